@@ -0,0 +1,658 @@
+#include "App/SnakeGame.hpp"
+#include "Core/AudioRing.hpp"
+#include "Core/EmulatorPool.hpp"
+#include "Core/Lockstep.hpp"
+#include "Core/NesCpu.hpp"
+#include "Core/Ppu.hpp"
+#include "Core/Rewind.hpp"
+#include "Core/System.hpp"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Instructions executed per benchmark iteration by the program benchmarks.
+static const uint64_t BATCH_INSTRUCTIONS = 4096;
+
+static const char *core_name(CpuCore core) {
+    switch (core) {
+    case CpuCore::Threaded:
+        return "threaded";
+    case CpuCore::Cached:
+        return "cached";
+    case CpuCore::Jit:
+        return "jit";
+    default:
+        return "switch";
+    }
+}
+
+static const char *mode_name(AddressingMode mode) {
+    switch (mode) {
+    case AddressingMode::Immediate:
+        return "Immediate";
+    case AddressingMode::ZeroPage:
+        return "ZeroPage";
+    case AddressingMode::ZeroPage_X:
+        return "ZeroPage_X";
+    case AddressingMode::ZeroPage_Y:
+        return "ZeroPage_Y";
+    case AddressingMode::Absolute:
+        return "Absolute";
+    case AddressingMode::Absolute_X:
+        return "Absolute_X";
+    case AddressingMode::Absolute_Y:
+        return "Absolute_Y";
+    case AddressingMode::Indirect_X:
+        return "Indirect_X";
+    case AddressingMode::Indirect_Y:
+        return "Indirect_Y";
+    default:
+        return "NoneAddressing";
+    }
+}
+
+static bool is_control_flow(Instruction instruction) {
+    switch (instruction) {
+    case Instruction::BCC:
+    case Instruction::BCS:
+    case Instruction::BEQ:
+    case Instruction::BMI:
+    case Instruction::BNE:
+    case Instruction::BPL:
+    case Instruction::BVC:
+    case Instruction::BVS:
+    case Instruction::BRK:
+    case Instruction::JMP:
+    case Instruction::JSR:
+    case Instruction::RTI:
+    case Instruction::RTS:
+    case Instruction::Illegal:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// A CPU with `program` loaded at $0600 and the zero page filled with $02,
+// so every indirect pointer resolves to $0202.
+static NesCpu make_cpu(const std::vector<uint8_t> &program, CpuCore core) {
+    NesCpu cpu;
+    cpu.core = core;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(program);
+    for (uint16_t addr = 0x00; addr < 0x100; addr++) {
+        cpu.mem_write(addr, 0x02);
+    }
+    cpu.program_counter = 0x0600;
+    return cpu;
+}
+
+// 256 copies of `op` followed by JMP $0600. Every operand byte is $02, so
+// writes land in the zero page, the stack or $0202-$0301 and never in the
+// program itself.
+static std::vector<uint8_t> repeat_instruction(const OpCode &op) {
+    std::vector<uint8_t> program;
+    for (int i = 0; i < 256; i++) {
+        program.push_back(op.code);
+        for (int j = 1; j < op.len; j++) {
+            program.push_back(0x02);
+        }
+    }
+    program.insert(program.end(), {0x4c, 0x00, 0x06});
+    return program;
+}
+
+static void run_batches(benchmark::State &state, NesCpu &cpu,
+                        uint64_t instructions) {
+    RunLimits limits;
+    limits.max_instructions = instructions;
+    for (auto _ : state) {
+        cpu.run_until(limits);
+    }
+    state.SetItemsProcessed(state.iterations() * instructions);
+}
+
+// Decode and dispatch cost of one opcode in a straight-line block.
+static void BM_Dispatch(benchmark::State &state, OpCode op, CpuCore core) {
+    NesCpu cpu = make_cpu(repeat_instruction(op), core);
+    run_batches(state, cpu, BATCH_INSTRUCTIONS);
+}
+
+// Effective address resolution alone, with X and Y varying per call.
+template <AddressingMode M>
+static void BM_OperandAddress(benchmark::State &state) {
+    NesCpu cpu = make_cpu({0xea, 0x02, 0x02}, CpuCore::Switch);
+    cpu.program_counter = 0x0601;
+    uint8_t index = 0;
+    for (auto _ : state) {
+        cpu.register_x = index;
+        cpu.register_y = index;
+        benchmark::DoNotOptimize(cpu.operand_address<M>());
+        index++;
+    }
+}
+
+// The same through the mode-dispatching get_operand_address.
+static void BM_GetOperandAddress(benchmark::State &state,
+                                 AddressingMode mode) {
+    NesCpu cpu = make_cpu({0xea, 0x02, 0x02}, CpuCore::Switch);
+    cpu.program_counter = 0x0601;
+    uint8_t index = 0;
+    for (auto _ : state) {
+        cpu.register_x = index;
+        cpu.register_y = index;
+        benchmark::DoNotOptimize(cpu.get_operand_address(mode));
+        index++;
+    }
+}
+
+static void start_snake(NesCpu &cpu, CpuCore core) {
+    cpu = NesCpu();
+    cpu.core = core;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(SNAKE_GAME_CODE);
+    cpu.reset();
+}
+
+// Plays snake headless for state.range(0) million instructions per
+// iteration. A fixed-seed generator feeds $FE and the snake turns every
+// 64K instructions; a finished game is reloaded.
+static void BM_Snake(benchmark::State &state, CpuCore core) {
+    const uint64_t total = state.range(0) * 1000000;
+    const char keys[] = {'w', 'd', 's', 'a'};
+    NesCpu cpu;
+    uint32_t seed = 1;
+    RunLimits limits;
+    limits.max_instructions = 1000;
+
+    for (auto _ : state) {
+        start_snake(cpu, core);
+        for (uint64_t done = 0; done < total;) {
+            seed = seed * 1103515245 + 12345;
+            cpu.mem_write(0xfe, (seed >> 16) % 15 + 1);
+            cpu.mem_write(0xff, keys[(done >> 16) & 3]);
+            RunResult result = cpu.run_until(limits);
+            done += result.instructions;
+            if (result.reason == StopReason::Break) {
+                start_snake(cpu, core);
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * total);
+}
+
+// LDX #0; loop: LDA $0200,X; STA $0300,X; INX; BNE loop; JMP $0600
+static const std::vector<uint8_t> COPY_PAGE = {
+    0xa2, 0x00, 0xbd, 0x00, 0x02, 0x9d, 0x00, 0x03,
+    0xe8, 0xd0, 0xf7, 0x4c, 0x00, 0x06};
+static const uint64_t COPY_PAGE_INSTRUCTIONS = 1 + 256 * 4 + 1;
+
+// Copies one page per pass with absolute indexed loads and stores.
+static void BM_CopyPage(benchmark::State &state, CpuCore core) {
+    NesCpu cpu = make_cpu(COPY_PAGE, core);
+    run_batches(state, cpu, COPY_PAGE_INSTRUCTIONS * 16);
+    state.SetBytesProcessed(state.iterations() * 256 * 16);
+}
+
+// The same copy in a cartridge's RAM layout, 2KB repeated across
+// $0000-$1FFF, so every store also sets the three mirrors.
+static void BM_CartridgeCopyPage(benchmark::State &state, CpuCore core) {
+    NesCpu cpu;
+    cpu.bus.map_memory(0x00, 0x20, 0x800);
+    cpu.core = core;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(COPY_PAGE);
+    cpu.program_counter = 0x0600;
+    run_batches(state, cpu, COPY_PAGE_INSTRUCTIONS * 16);
+    state.SetBytesProcessed(state.iterations() * 256 * 16);
+}
+
+// LDA #$02; STA $01; LDA #$00; STA $00; LDY #$00;
+// loop: STA ($00),Y; INY; BNE loop; INC $01; LDX $01; CPX #$06; BNE loop;
+// JMP $0600
+static const std::vector<uint8_t> FILL_SCREEN = {
+    0xa9, 0x02, 0x85, 0x01, 0xa9, 0x00, 0x85, 0x00, 0xa0, 0x00,
+    0x91, 0x00, 0xc8, 0xd0, 0xfb, 0xe6, 0x01, 0xa6, 0x01, 0xe0,
+    0x06, 0xd0, 0xf3, 0x4c, 0x00, 0x06};
+static const uint64_t FILL_SCREEN_INSTRUCTIONS = 5 + 4 * (256 * 3 + 4) + 1;
+
+// Fills the 1KB screen at $0200-$05FF through an indirect pointer.
+static void BM_FillScreen(benchmark::State &state, CpuCore core) {
+    NesCpu cpu = make_cpu(FILL_SCREEN, core);
+    run_batches(state, cpu, FILL_SCREEN_INSTRUCTIONS * 4);
+    state.SetBytesProcessed(state.iterations() * 1024 * 4);
+}
+
+// Host-side read-modify-write of the whole address space through the bus.
+static void BM_BusReadWrite(benchmark::State &state) {
+    NesCpu cpu;
+    for (auto _ : state) {
+        for (uint32_t addr = 0; addr < 0x10000; addr++) {
+            cpu.mem_write(addr, cpu.mem_read(addr) + 1);
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * 0x10000);
+}
+BENCHMARK(BM_BusReadWrite);
+
+// The same over $0000-$1FFF, mapped flat or as the console's 2KB of RAM
+// repeated four times.
+static void BM_BusReadWriteRam(benchmark::State &state, bool mirrored) {
+    NesCpu cpu;
+    if (mirrored) {
+        cpu.bus.map_memory(0x00, 0x20, 0x800);
+    }
+    for (auto _ : state) {
+        for (uint32_t addr = 0; addr < 0x2000; addr++) {
+            cpu.mem_write(addr, cpu.mem_read(addr) + 1);
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * 0x2000);
+}
+BENCHMARK_CAPTURE(BM_BusReadWriteRam, flat, false);
+BENCHMARK_CAPTURE(BM_BusReadWriteRam, mirrored, true);
+
+static NesCpu make_snake_cpu() {
+    NesCpu cpu;
+    start_snake(cpu, DEFAULT_CPU_CORE);
+    RunLimits limits;
+    limits.max_instructions = 10000;
+    cpu.run_until(limits);
+    return cpu;
+}
+
+// Snapshot after state.range(0) pages were written.
+static void BM_Snapshot(benchmark::State &state) {
+    NesCpu cpu = make_snake_cpu();
+    const int64_t pages = state.range(0);
+    uint8_t value = 0;
+    for (auto _ : state) {
+        for (int64_t page = 0; page < pages; page++) {
+            cpu.mem_write(0x0200 + page * BUS_PAGE_SIZE, value);
+        }
+        value++;
+        benchmark::DoNotOptimize(cpu.snapshot());
+    }
+}
+BENCHMARK(BM_Snapshot)->Arg(0)->Arg(1)->Arg(4)->Arg(16);
+
+// Restore after state.range(0) pages were written.
+static void BM_Restore(benchmark::State &state) {
+    NesCpu cpu = make_snake_cpu();
+    CpuSnapshot snapshot = cpu.snapshot();
+    const int64_t pages = state.range(0);
+    uint8_t value = 0;
+    for (auto _ : state) {
+        for (int64_t page = 0; page < pages; page++) {
+            cpu.mem_write(0x0200 + page * BUS_PAGE_SIZE, value);
+        }
+        value++;
+        cpu.restore(snapshot);
+    }
+}
+BENCHMARK(BM_Restore)->Arg(0)->Arg(1)->Arg(4)->Arg(16);
+
+static void BM_SaveState(benchmark::State &state) {
+    NesCpu cpu = make_snake_cpu();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cpu.save_state());
+    }
+}
+BENCHMARK(BM_SaveState);
+
+static void BM_LoadState(benchmark::State &state) {
+    NesCpu cpu = make_snake_cpu();
+    std::vector<uint8_t> saved = cpu.save_state();
+    for (auto _ : state) {
+        cpu.load_state(saved);
+    }
+    state.SetBytesProcessed(state.iterations() * saved.size());
+}
+BENCHMARK(BM_LoadState);
+
+static const uint64_t FRAME_CYCLES = 29781;
+static const uint64_t REWIND_FRAMES = 600;
+
+// Plays REWIND_FRAMES frames of snake, capturing each one after writing
+// its keys. A finished game starts over without moving the cycle count
+// back, so the history stays one timeline.
+static void play_rewind(NesCpu &cpu, RewindBuffer &rewind) {
+    start_snake(cpu, DEFAULT_CPU_CORE);
+    CpuSnapshot start = cpu.snapshot();
+    const char keys[] = {'w', 'd', 's', 'a'};
+    uint32_t seed = 1;
+    RunLimits limits;
+    limits.max_cycles = FRAME_CYCLES;
+    for (uint64_t frame = 0; frame < REWIND_FRAMES; frame++) {
+        seed = seed * 1103515245 + 12345;
+        cpu.mem_write(0xfe, (seed >> 16) % 15 + 1);
+        cpu.mem_write(0xff, keys[(frame / 32) & 3]);
+        rewind.capture(cpu);
+        if (cpu.run_until(limits).reason == StopReason::Break) {
+            start.cycles = cpu.cycles;
+            cpu.restore(start);
+        }
+    }
+}
+
+// Ten seconds of snake at 60 captures per second with a keyframe every
+// state.range(0) captures; reports the buffer size per emulated second.
+static void BM_RewindCapture(benchmark::State &state) {
+    NesCpu cpu;
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        RewindBuffer rewind(SIZE_MAX, state.range(0));
+        play_rewind(cpu, rewind);
+        bytes = rewind.stats().bytes;
+    }
+    state.counters["bytes_per_second"] = bytes * 60.0 / REWIND_FRAMES;
+}
+BENCHMARK(BM_RewindCapture)
+    ->Arg(1)
+    ->Arg(15)
+    ->Arg(60)
+    ->Unit(benchmark::kMillisecond);
+
+// Seeks to pseudo-random cycles of a ten second history with a keyframe
+// every state.range(0) captures.
+static void BM_RewindSeek(benchmark::State &state) {
+    NesCpu cpu;
+    RewindBuffer rewind(SIZE_MAX, state.range(0));
+    play_rewind(cpu, rewind);
+    RewindStats stats = rewind.stats();
+    uint64_t span = stats.last_cycle - stats.first_cycle;
+    uint32_t seed = 1;
+    for (auto _ : state) {
+        seed = seed * 1103515245 + 12345;
+        benchmark::DoNotOptimize(
+            rewind.seek(cpu, stats.first_cycle + seed % span));
+    }
+}
+BENCHMARK(BM_RewindSeek)
+    ->Arg(1)
+    ->Arg(15)
+    ->Arg(60)
+    ->Unit(benchmark::kMicrosecond);
+
+// A scrolled background and 64 sprites, with rendering on.
+static void build_ppu_scene(NesCpu &cpu, NesPpu &ppu) {
+    ppu.write(0x2006, 0x00);
+    ppu.write(0x2006, 0x00);
+    for (int i = 0; i < 0x2000; i++) {
+        ppu.write(0x2007, (i * 37) & 0xFF);
+    }
+    for (int i = 0; i < 0x800 + 0x20; i++) {
+        ppu.write(0x2007, (i * 7 + i / 29) & 0xFF);
+    }
+    for (int i = 0; i < 256; i++) {
+        cpu.mem_write(0x0300 + i, (i * 29) & 0xFF);
+    }
+    ppu.write(0x4014, 0x03);
+    ppu.write(0x2005, 13);
+    ppu.write(0x2005, 21);
+    ppu.write(0x2000, 0x10);
+    ppu.write(0x2001, 0x1E);
+}
+
+// An idle CPU under a PPU drawing build_ppu_scene, one frame per
+// iteration.
+static void BM_PpuFrame(benchmark::State &state, PpuMode mode) {
+    NesCpu cpu;
+    cpu.load({0x4c, 0x00, 0x06});
+    cpu.reset();
+    NesPpu ppu;
+    ppu.mode = mode;
+    ppu.attach(cpu);
+    build_ppu_scene(cpu, ppu);
+
+    for (auto _ : state) {
+        uint64_t frame = ppu.frame_count();
+        while (ppu.frame_count() == frame) {
+            RunLimits limits;
+            limits.max_cycles =
+                std::max<uint64_t>(ppu.next_vblank_cycle(), cpu.cycles + 1) -
+                cpu.cycles;
+            cpu.run_until(limits);
+            ppu.catch_up();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_PpuFrame, scanline, PpuMode::Scanline)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_PpuFrame, dot, PpuMode::Dot)
+    ->Unit(benchmark::kMicrosecond);
+
+// loop: INX; STX $00; LDA $00; ADC #$01; JMP loop
+static const std::vector<uint8_t> MAIN_LOOP = {0xe8, 0x86, 0x00, 0xa5, 0x00,
+                                               0x69, 0x01, 0x4c, 0x00, 0x06};
+
+// Frames of a CPU busy in RAM under build_ppu_scene, run through the event
+// scheduler or caught up after every instruction.
+static void BM_SystemFrame(benchmark::State &state, bool lockstep) {
+    NesSystem system;
+    system.load(MAIN_LOOP);
+    build_ppu_scene(system.cpu, system.ppu);
+    for (auto _ : state) {
+        if (lockstep) {
+            system.run_frame_lockstep();
+        } else {
+            system.run_frame();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_SystemFrame, scheduled, false)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_SystemFrame, lockstep, true)
+    ->Unit(benchmark::kMicrosecond);
+
+// BM_SystemFrame's scheduled frames with both pulses, the triangle and the
+// noise sounding, and the samples drained from a ring every frame.
+static void BM_ApuFrame(benchmark::State &state) {
+    NesSystem system;
+    AudioRing ring(4096);
+    system.apu.output = &ring;
+    system.load(MAIN_LOOP);
+    build_ppu_scene(system.cpu, system.ppu);
+    const uint8_t registers[][2] = {
+        {0x15, 0x0F}, {0x00, 0xBF}, {0x02, 0xFD}, {0x03, 0x08},
+        {0x04, 0x7A}, {0x06, 0x50}, {0x07, 0x09}, {0x08, 0xFF},
+        {0x0A, 0x80}, {0x0B, 0x08}, {0x0C, 0x3C}, {0x0E, 0x04},
+        {0x0F, 0x08}};
+    for (const auto &reg : registers) {
+        system.cpu.mem_write(0x4000 | reg[0], reg[1]);
+    }
+    std::vector<float> samples(ring.capacity());
+    for (auto _ : state) {
+        system.run_frame();
+        ring.pop(samples.data(), samples.size());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["dropped"] =
+        static_cast<double>(system.apu.samples_dropped());
+}
+BENCHMARK(BM_ApuFrame)->Unit(benchmark::kMicrosecond);
+
+// 16 independent copies of the page copy kernel, 1M cycles each, run on
+// state.range(0) threads in slices of state.range(1) cycles.
+static void BM_EmulatorPool(benchmark::State &state) {
+    uint64_t instructions = 0;
+    for (auto _ : state) {
+        EmulatorPool pool(state.range(0));
+        for (int i = 0; i < 16; i++) {
+            pool.add(make_cpu(COPY_PAGE, DEFAULT_CPU_CORE), 1000000);
+        }
+        pool.run(state.range(1));
+        instructions += pool.stats().instructions;
+    }
+    state.SetItemsProcessed(instructions);
+}
+BENCHMARK(BM_EmulatorPool)
+    ->Args({1, 10000})
+    ->Args({4, 10000})
+    ->Args({4, 1000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// state.range(0) copies of a looping kernel, in lockstep and as independent
+// CPUs. Items are instructions summed over all copies.
+static void BM_LockstepKernel(benchmark::State &state,
+                              const std::vector<uint8_t> *program) {
+    LockstepEngine engine(make_cpu(*program, DEFAULT_CPU_CORE),
+                          state.range(0));
+    uint64_t instructions = 0;
+    for (auto _ : state) {
+        instructions += engine.run(BATCH_INSTRUCTIONS).instructions;
+    }
+    state.SetItemsProcessed(instructions);
+}
+
+static void BM_IndependentKernel(benchmark::State &state,
+                                 const std::vector<uint8_t> *program) {
+    std::vector<NesCpu> cpus(state.range(0),
+                             make_cpu(*program, DEFAULT_CPU_CORE));
+    RunLimits limits;
+    limits.max_instructions = BATCH_INSTRUCTIONS;
+    uint64_t instructions = 0;
+    for (auto _ : state) {
+        for (NesCpu &cpu : cpus) {
+            instructions += cpu.run_until(limits).instructions;
+        }
+    }
+    state.SetItemsProcessed(instructions);
+}
+
+// state.range(0) games of snake played from the start for up to 20000
+// instructions each. Every game gets its own random stream at $FE and key
+// sequence at $FF, refreshed every 1000 instructions, so the copies diverge.
+static const uint64_t SNAKE_CHUNKS = 20;
+
+static void BM_LockstepSnake(benchmark::State &state) {
+    const std::size_t lanes = state.range(0);
+    const char keys[] = {'w', 'd', 's', 'a'};
+    NesCpu prototype;
+    start_snake(prototype, DEFAULT_CPU_CORE);
+    uint64_t instructions = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        LockstepEngine engine(prototype, lanes);
+        uint32_t seed = 1;
+        state.ResumeTiming();
+        for (uint64_t chunk = 0; chunk < SNAKE_CHUNKS; chunk++) {
+            for (std::size_t lane = 0; lane < lanes; lane++) {
+                seed = seed * 1103515245 + 12345;
+                engine.write(lane, 0xfe, (seed >> 16) % 15 + 1);
+                engine.write(lane, 0xff, keys[(chunk * 3 + lane) % 4]);
+            }
+            instructions += engine.run(1000).instructions;
+        }
+    }
+    state.SetItemsProcessed(instructions);
+}
+
+static void BM_IndependentSnake(benchmark::State &state) {
+    const std::size_t lanes = state.range(0);
+    const char keys[] = {'w', 'd', 's', 'a'};
+    NesCpu prototype;
+    start_snake(prototype, DEFAULT_CPU_CORE);
+    RunLimits limits;
+    limits.max_instructions = 1000;
+    uint64_t instructions = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<NesCpu> cpus(lanes, prototype);
+        std::vector<bool> halted(lanes, false);
+        uint32_t seed = 1;
+        state.ResumeTiming();
+        for (uint64_t chunk = 0; chunk < SNAKE_CHUNKS; chunk++) {
+            for (std::size_t lane = 0; lane < lanes; lane++) {
+                seed = seed * 1103515245 + 12345;
+                cpus[lane].mem_write(0xfe, (seed >> 16) % 15 + 1);
+                cpus[lane].mem_write(0xff, keys[(chunk * 3 + lane) % 4]);
+                if (!halted[lane]) {
+                    RunResult result = cpus[lane].run_until(limits);
+                    instructions += result.instructions;
+                    halted[lane] = result.reason == StopReason::Break;
+                }
+            }
+        }
+    }
+    state.SetItemsProcessed(instructions);
+}
+
+BENCHMARK_CAPTURE(BM_LockstepKernel, copy_page, &COPY_PAGE)
+    ->Arg(32)
+    ->Arg(1024);
+BENCHMARK_CAPTURE(BM_IndependentKernel, copy_page, &COPY_PAGE)
+    ->Arg(32)
+    ->Arg(1024);
+BENCHMARK_CAPTURE(BM_LockstepKernel, fill_screen, &FILL_SCREEN)
+    ->Arg(32)
+    ->Arg(1024);
+BENCHMARK_CAPTURE(BM_IndependentKernel, fill_screen, &FILL_SCREEN)
+    ->Arg(32)
+    ->Arg(1024);
+BENCHMARK(BM_LockstepSnake)->Arg(1024)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_IndependentSnake)->Arg(1024)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::Immediate);
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::ZeroPage);
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::ZeroPage_X);
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::ZeroPage_Y);
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::Absolute);
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::Absolute_X);
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::Absolute_Y);
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::Indirect_X);
+BENCHMARK_TEMPLATE(BM_OperandAddress, AddressingMode::Indirect_Y);
+
+// The per-core and per-opcode benchmarks are registered at startup.
+static void register_benchmarks() {
+    for (int mode = 0; mode < static_cast<int>(AddressingMode::NoneAddressing);
+         mode++) {
+        AddressingMode m = static_cast<AddressingMode>(mode);
+        std::string name = std::string("BM_GetOperandAddress/") + mode_name(m);
+        benchmark::RegisterBenchmark(name.c_str(), BM_GetOperandAddress, m);
+    }
+
+    for (CpuCore core : {CpuCore::Switch, CpuCore::Threaded, CpuCore::Cached,
+                         CpuCore::Jit}) {
+        std::string suffix = std::string("/") + core_name(core);
+        benchmark::RegisterBenchmark(("BM_Snake" + suffix).c_str(), BM_Snake,
+                                     core)
+            ->Arg(1)
+            ->Arg(10)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("BM_CopyPage" + suffix).c_str(),
+                                     BM_CopyPage, core);
+        benchmark::RegisterBenchmark(
+            ("BM_CartridgeCopyPage" + suffix).c_str(), BM_CartridgeCopyPage,
+            core);
+        benchmark::RegisterBenchmark(("BM_FillScreen" + suffix).c_str(),
+                                     BM_FillScreen, core);
+
+        for (const OpCode &op : CPU_OPS_CODES) {
+            if (is_control_flow(op.instruction)) {
+                continue;
+            }
+            char code[8];
+            std::snprintf(code, sizeof(code), "%02x", op.code);
+            std::string name = "BM_Dispatch" + suffix + "/" + code + "_" +
+                               op.mnemonic + "_" + mode_name(op.mode);
+            benchmark::RegisterBenchmark(name.c_str(), BM_Dispatch, op, core)
+                ->MinTime(0.05);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+  register_benchmarks();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "Core/AudioRing.hpp"
+#include "Core/Bus.hpp"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+class NesCpu;
+
+// NTSC CPU clock, which also drives the APU.
+const uint32_t APU_CPU_CLOCK = 1789773;
+const uint32_t APU_SAMPLE_RATE = 48000;
+// Frame counter steps, in CPU cycles from the start of its sequence. The
+// 4-step sequence raises its IRQ on the last one.
+const std::array<uint32_t, 4> APU_FOUR_STEP_CYCLES = {7457, 14913, 22371,
+                                                      29829};
+const uint32_t APU_FOUR_STEP_PERIOD = 29830;
+const std::array<uint32_t, 5> APU_FIVE_STEP_CYCLES = {7457, 14913, 22371,
+                                                      29829, 37281};
+const uint32_t APU_FIVE_STEP_PERIOD = 37282;
+
+// Band-limited step synthesis. The APU's output is a level that changes at
+// CPU cycles; every change adds a windowed-sinc impulse at its fractional
+// position in the 48kHz output, and reading integrates them. Edges that
+// fall between output samples are therefore rendered without aliasing, and
+// stretches where the level holds cost nothing.
+class StepSynth {
+public:
+  // Phases of the impulse per output sample, and its length in samples.
+  static const uint32_t PHASES = 32;
+  static const uint32_t TAPS = 16;
+
+  StepSynth();
+
+  // Drops pending output and starts the sample clock at `cycle`, with
+  // `cpu_clock` cycles to a second.
+  void reset(uint64_t cycle, uint32_t cpu_clock);
+  // The level changes by `delta` at `cycle`, which may not be earlier than
+  // the last cycle passed to read().
+  void add_delta(uint64_t cycle, float delta);
+  // Moves the samples before `cycle`, which no later change can affect,
+  // into `out` and returns how many there were. A DC-blocking high-pass
+  // is applied on the way out.
+  std::size_t read(uint64_t cycle, std::vector<float> &out);
+  // Samples waiting for read().
+  std::size_t pending(uint64_t cycle) const;
+
+private:
+  // Output sample position of `cycle`, in 1/PHASES of a sample.
+  uint64_t position(uint64_t cycle) const;
+
+  std::array<std::array<float, TAPS>, PHASES> kernel;
+  // Impulses of the samples from `base` on.
+  std::vector<float> impulses;
+  uint64_t base;
+  uint32_t cpu_clock;
+  float level;
+  float filter_in;
+  float filter_out;
+};
+
+// Length counter, envelope and sweep pieces shared by the channels.
+struct ApuEnvelope {
+  bool start;
+  bool loop;
+  bool constant;
+  uint8_t volume;
+  uint8_t divider;
+  uint8_t decay;
+
+  void clock();
+  uint8_t output() const { return this->constant ? this->volume : this->decay; }
+};
+
+struct ApuPulse {
+  // Pulse 1 negates its sweep in ones' complement.
+  bool ones_complement;
+  bool enabled;
+  bool halt;
+  uint8_t duty;
+  uint8_t step;
+  uint8_t length;
+  uint16_t period;
+  // CPU cycles until the sequencer steps.
+  uint32_t counter;
+  ApuEnvelope envelope;
+  bool sweep_enabled;
+  bool sweep_negate;
+  bool sweep_reload;
+  uint8_t sweep_period;
+  uint8_t sweep_shift;
+  uint8_t sweep_divider;
+
+  uint16_t sweep_target() const;
+  void clock_sweep();
+  uint8_t output() const;
+};
+
+struct ApuTriangle {
+  bool enabled;
+  bool control;
+  bool linear_reload;
+  uint8_t linear_load;
+  uint8_t linear;
+  uint8_t step;
+  uint8_t length;
+  uint16_t period;
+  uint32_t counter;
+
+  void clock_linear();
+  uint8_t output() const;
+};
+
+struct ApuNoise {
+  bool enabled;
+  bool halt;
+  bool short_mode;
+  uint8_t length;
+  uint16_t shift;
+  uint16_t period;
+  uint32_t counter;
+  ApuEnvelope envelope;
+
+  uint8_t output() const;
+};
+
+struct ApuDmc {
+  bool irq_enabled;
+  bool loop;
+  bool silence;
+  bool buffer_full;
+  uint8_t buffer;
+  uint8_t shift;
+  // Output clocks left in the current byte, 1-8.
+  uint8_t bits;
+  uint8_t level;
+  uint16_t period;
+  uint32_t counter;
+  uint16_t sample_address;
+  uint16_t sample_length;
+  uint16_t address;
+  uint16_t remaining;
+};
+
+// The 2A03's audio unit: two pulse channels, triangle, noise, DMC and the
+// frame counter, at $4000-$4017.
+//
+// Like the PPU it runs behind the CPU and catches up to NesCpu::cycles on
+// register accesses and when the host calls catch_up(). Catching up does
+// not step cycle by cycle: it jumps from one channel timer expiry or frame
+// counter step to the next, and only where the mixed level changes does it
+// add a step to a StepSynth. catch_up() then moves the finished 48kHz
+// samples to `output` as one block, so audio costs a few calls per frame
+// or scanline rather than one per CPU cycle.
+//
+// The frame counter and DMC IRQs drive the attached CPU's IRQ line. DMC
+// sample fetches read through the CPU bus but do not stall the CPU.
+//
+// APU state is not part of CPU snapshots or state hashes.
+class NesApu : public BusDevice {
+public:
+  // Receives the samples; nullptr discards them. Samples it has no room
+  // for are dropped, never waited on.
+  AudioRing *output;
+
+  NesApu();
+  NesApu(const NesApu &) = delete;
+  NesApu &operator=(const NesApu &) = delete;
+
+  // Maps the $40xx page on `cpu`'s bus. Addresses the APU does not decode,
+  // among them OAM DMA at $4014, go on to the device mapped there before,
+  // so attach the PPU first. The APU clock starts at cpu.cycles.
+  // `cpu_clock` is the CPU cycles the host runs per second. Samples are
+  // timed against it, so a host slower than the console still gets 48000
+  // of them a second, with every pitch scaled down along with the CPU.
+  void attach(NesCpu &cpu, uint32_t cpu_clock = APU_CPU_CLOCK);
+  // Runs the APU up to the attached CPU's cycle count and hands the
+  // finished samples to `output`.
+  void catch_up();
+  // First CPU cycle on which the frame counter or the DMC will raise IRQ
+  // if no register is written before; UINT64_MAX when neither will.
+  uint64_t next_irq_cycle() const;
+
+  uint64_t samples_written() const { return this->written; }
+  uint64_t samples_dropped() const { return this->dropped; }
+
+  uint8_t read(uint16_t addr) override;
+  void write(uint16_t addr, uint8_t data) override;
+  uint8_t peek(uint16_t addr) override;
+
+private:
+  void run_to(uint64_t cycle);
+  void flush();
+  void clock_frame_step();
+  void quarter_frame();
+  void half_frame();
+  void clock_dmc();
+  void fetch_dmc();
+  void restart_dmc();
+  void update_irq();
+  void update_output();
+  uint8_t status() const;
+
+  NesCpu *cpu;
+  // The device that had the $40xx page before attach().
+  BusDevice *next;
+  // CPU cycle the APU has run to.
+  uint64_t clock;
+  ApuPulse pulse[2];
+  ApuTriangle triangle;
+  ApuNoise noise;
+  ApuDmc dmc;
+  bool five_step;
+  bool irq_inhibit;
+  bool frame_irq;
+  bool dmc_irq;
+  // Next frame counter step and the cycle its sequence started on.
+  uint32_t frame_step;
+  uint64_t frame_start;
+  float mixed;
+  StepSynth synth;
+  std::vector<float> samples;
+  uint64_t written;
+  uint64_t dropped;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Core/Compiler.hpp"
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// A queue of audio samples between one producer thread (the emulator) and
+// one consumer thread (the audio callback). Neither side locks, waits or
+// allocates: each owns one index, publishes it with a release store and
+// reads the other's with an acquire load, so a sample is always written
+// before the consumer can see it. When the ring is full the producer's
+// samples are dropped; when it is empty the consumer gets fewer than it
+// asked for.
+class AudioRing {
+public:
+  // `capacity` is rounded up to a power of two.
+  explicit AudioRing(std::size_t capacity);
+  AudioRing(const AudioRing &) = delete;
+  AudioRing &operator=(const AudioRing &) = delete;
+
+  // Producer side: appends up to `count` samples, returning how many fit.
+  std::size_t push(const float *samples, std::size_t count);
+  // Consumer side: takes up to `count` samples, returning how many there
+  // were.
+  std::size_t pop(float *samples, std::size_t count);
+
+  // Samples queued; exact on either side only while the other is idle.
+  std::size_t size() const;
+  std::size_t capacity() const { return this->buffer.size(); }
+
+private:
+  std::vector<float> buffer;
+  std::size_t mask;
+  // Both indices only grow; they are reduced with `mask` on access.
+  alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> head;
+  alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> tail;
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Core/Bus.hpp"
+#include "Core/OpCodes.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Longest straight-line run decoded into one block.
+const std::size_t MAX_BLOCK_OPS = 64;
+
+// Instructions that can leave pc anywhere but the next instruction; a block
+// ends after the first of them.
+constexpr bool ends_block(Instruction instruction) {
+  switch (instruction) {
+  case Instruction::BCC:
+  case Instruction::BCS:
+  case Instruction::BEQ:
+  case Instruction::BMI:
+  case Instruction::BNE:
+  case Instruction::BPL:
+  case Instruction::BVC:
+  case Instruction::BVS:
+  case Instruction::BRK:
+  case Instruction::JMP:
+  case Instruction::JSR:
+  case Instruction::RTI:
+  case Instruction::RTS:
+  case Instruction::Illegal:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Whether the opcode can write memory, and so possibly its own block.
+constexpr bool writes_memory(const OpCode &op) {
+  switch (op.instruction) {
+  case Instruction::STA:
+  case Instruction::STX:
+  case Instruction::STY:
+  case Instruction::INC:
+  case Instruction::DEC:
+  case Instruction::PHA:
+  case Instruction::PHP:
+  case Instruction::JSR:
+    return true;
+  case Instruction::ASL:
+  case Instruction::LSR:
+  case Instruction::ROL:
+  case Instruction::ROR:
+    return op.mode != AddressingMode::NoneAddressing;
+  default:
+    return false;
+  }
+}
+
+// One pre-decoded instruction: the opcode selects the handler, and the
+// operand bytes were fetched when the block was decoded.
+struct DecodedOp {
+  uint16_t pc;
+  // Operand bytes, little-endian; the high byte is zero for one-byte
+  // operands and both are zero without an operand.
+  uint16_t operand;
+  uint8_t code;
+  uint8_t len;
+  uint8_t cycles;
+};
+
+// A straight-line run of instructions starting at `start`. It ends after the
+// first branch, jump, return, BRK or illegal opcode, before an instruction
+// that touches a device page, or after MAX_BLOCK_OPS instructions.
+struct DecodedBlock {
+  uint16_t start;
+  // One past the last byte of the last instruction.
+  uint32_t end;
+  std::vector<DecodedOp> ops;
+  // Slot in the cache, reused once the block is dropped, and a number no
+  // other decode shares, so per-block data kept elsewhere can tell the
+  // blocks in a reused slot apart.
+  uint32_t id;
+  uint64_t serial;
+};
+
+// Decoded blocks keyed by their start address. The cache relies on the
+// bus's code traps to learn about writes: every page a block spans is armed
+// when the block is decoded, and the owner passes the pages the bus reports
+// to invalidate_page() before running cached code again.
+class BlockCache {
+public:
+  BlockCache();
+
+  // The block starting at `pc`, or nullptr when none is cached.
+  const DecodedBlock *find(uint16_t pc) const {
+    const std::vector<uint32_t> &page = this->block_at[pc >> 8];
+    if (page.empty() || page[pc & 0xFF] == 0) {
+      return nullptr;
+    }
+    return &this->blocks[page[pc & 0xFF] - 1];
+  }
+
+  // Decodes and caches the block at `pc`. The block has no instructions
+  // when the one at `pc` touches a device page; such code is never cached.
+  // Invalidates pointers returned by earlier calls.
+  const DecodedBlock &decode(Bus &bus, uint16_t pc);
+
+  // Drops every block that spans `page`.
+  void invalidate_page(uint8_t page);
+  void clear();
+
+  // Live blocks.
+  std::size_t size() const;
+  // Blocks decoded since construction, including ones invalidated since.
+  uint64_t decoded() const { return this->decode_count; }
+
+private:
+  void release(uint32_t id);
+
+  // Per page, 0 when no block starts at the address, otherwise the block
+  // index + 1. A page's entries are allocated when its first block is
+  // decoded, which keeps a fresh cache (and a copied NesCpu) cheap.
+  std::array<std::vector<uint32_t>, BUS_PAGE_COUNT> block_at;
+  std::vector<DecodedBlock> blocks;
+  std::vector<uint32_t> free_blocks;
+  // Blocks spanning each page. Entries can go stale when a block spanning
+  // two pages is dropped through the other one; invalidate_page() checks.
+  std::array<std::vector<uint32_t>, BUS_PAGE_COUNT> page_blocks;
+  uint64_t decode_count;
+};
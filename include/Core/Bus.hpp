@@ -0,0 +1,244 @@
+#pragma once
+
+#include "Core/Compiler.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Memory-mapped I/O attached to the bus (PPU/APU registers, mappers). Devices
+// receive the full CPU address so one device can serve mirrored ranges.
+class BusDevice {
+public:
+  virtual ~BusDevice() = default;
+  virtual uint8_t read(uint16_t addr) = 0;
+  virtual void write(uint16_t addr, uint8_t data) = 0;
+  // Side-effect free read for debuggers and tracing.
+  virtual uint8_t peek(uint16_t /* addr */) { return 0; }
+};
+
+const std::size_t BUS_PAGE_SIZE = 0x100;
+const std::size_t BUS_PAGE_COUNT = 0x100;
+const std::size_t BUS_MEMORY_SIZE = 0x10000;
+
+// Multipliers of memory_byte_hash. Both fit a sign-extended 32-bit
+// immediate so generated code can multiply by them directly.
+const uint64_t MEMORY_HASH_K1 = 0x7FEB352D;
+const uint64_t MEMORY_HASH_K2 = 0xFFFFFFFF846CA68B;
+
+// Hash of `value` stored at `addr`. The hash of a memory image is the XOR
+// of this over every address except the mirror copies, which always hold
+// the same bytes as the range they mirror, so a write updates it with two
+// calls, one taking the old byte out and one putting the new byte in.
+EIZNESS_ALWAYS_INLINE uint64_t memory_byte_hash(uint16_t addr, uint8_t value) {
+  uint64_t key = addr | static_cast<uint64_t>(value) << 16;
+  return byte_swap64(key * MEMORY_HASH_K1) * MEMORY_HASH_K2;
+}
+
+enum class PageKind : uint8_t {
+  Unmapped,
+  Ram,
+  // RAM whose bytes repeat elsewhere in the address space.
+  Mirrored,
+  Rom,
+  Device,
+};
+
+// Copies of a byte the inline write path stores to on a mirrored page.
+const std::size_t BUS_MIRROR_COPIES = 4;
+
+// Where a write to a mirrored page goes, as offsets: `to_canonical` takes
+// an address on the page to its canonical copy and `copies` take that to
+// each of the others. A page with fewer copies repeats offset 0, which
+// just stores the canonical byte again. Entries are 8 bytes so generated
+// code can index the table.
+struct BusMirror {
+  int16_t to_canonical;
+  int16_t copies[BUS_MIRROR_COPIES - 1];
+};
+
+// CPU address decoding through a 256-entry page table.
+//
+// `memory` is the 64KB image the CPU sees. Pages without a device are read
+// straight out of it, so the page lookup is only a predicted branch and the
+// load itself does not wait on it; with a pointer per page the extra
+// dependent load cost the interpreter 10-15%. Everything that is not plain
+// RAM keeps the image coherent on the (rarer) write side instead: mirrored
+// RAM writes are copied to every mirror, ROM is copied into the image when
+// mapped and writes to it are dropped, and device pages forward both
+// directions to their BusDevice.
+//
+// The write fast path tests a single flags byte per page, so write traps
+// (the first write to a page after clear_dirty_pages()) cost nothing once
+// the page has been written. Mirrored pages with no trap armed are the
+// one other inline case: the byte goes to the fixed BUS_MIRROR_COPIES
+// stores of the page's BusMirror, with no loop or division, and only the
+// canonical copy is hashed. Traps on a mirrored page are armed on all of
+// its copies together, so the inline path never skips one. Mirrors with
+// more copies, or spread over more than 32KB, take write_slow().
+class Bus {
+public:
+  std::array<uint8_t, BUS_MEMORY_SIZE> memory;
+#ifdef EIZNESS_INCREMENTAL_HASH
+  // XOR of memory_byte_hash over `memory`, kept current by every change
+  // the bus makes. Writing `memory` directly needs rehash() afterwards.
+  uint64_t image_hash;
+#endif
+
+  Bus();
+
+  // Maps `page_count` pages starting at `first_page` as RAM. When `size` is
+  // smaller than the mapped range the bytes repeat every `size` bytes, which
+  // is how mirrors are expressed. `size` must be a multiple of BUS_PAGE_SIZE.
+  // Mapping anything over part of a mirrored range leaves the rest of it as
+  // plain RAM holding its current bytes.
+  void map_memory(uint8_t first_page, std::size_t page_count,
+                  std::size_t size);
+  // Copies `size` bytes of read-only data into the range, repeating them
+  // like map_memory when the range is larger. Bank switching remaps.
+  void map_rom(uint8_t first_page, std::size_t page_count, const uint8_t *data,
+               std::size_t size);
+  void map_device(uint8_t first_page, std::size_t page_count,
+                  BusDevice *device);
+  // Unmapped pages read as zero and ignore writes.
+  void unmap(uint8_t first_page, std::size_t page_count);
+
+  EIZNESS_ALWAYS_INLINE uint8_t read(uint16_t addr) {
+    if (EIZNESS_LIKELY(this->devices[addr >> 8] == nullptr)) {
+      return this->memory[addr];
+    }
+    return this->read_slow(addr);
+  }
+
+  EIZNESS_ALWAYS_INLINE void write(uint16_t addr, uint8_t data) {
+    uint8_t flags = this->write_flags[addr >> 8];
+    if (EIZNESS_LIKELY(flags == 0)) {
+#ifdef EIZNESS_INCREMENTAL_HASH
+      this->image_hash ^= memory_byte_hash(addr, this->memory[addr]) ^
+                          memory_byte_hash(addr, data);
+#endif
+      this->memory[addr] = data;
+      return;
+    }
+    if (EIZNESS_LIKELY(flags == WRITE_MIRROR)) {
+      // Copied out first: byte stores could alias the table.
+      BusMirror mirror = this->mirrors[addr >> 8];
+      uint16_t pos = static_cast<uint16_t>(addr + mirror.to_canonical);
+#ifdef EIZNESS_INCREMENTAL_HASH
+      this->image_hash ^= memory_byte_hash(pos, this->memory[pos]) ^
+                          memory_byte_hash(pos, data);
+#endif
+      uint8_t *canonical = &this->memory[pos];
+      canonical[0] = data;
+      for (std::size_t i = 0; i < BUS_MIRROR_COPIES - 1; i++) {
+        canonical[mirror.copies[i]] = data;
+      }
+      return;
+    }
+    this->write_slow(addr, data);
+  }
+
+  // Copies `size` bytes into the image at `start` as they are, without
+  // looking at page kinds or recording dirty pages.
+  void store_image(uint16_t start, const uint8_t *data, std::size_t size);
+
+  // The image hash: O(1) with EIZNESS_INCREMENTAL_HASH, otherwise the
+  // same value computed over all 64KB.
+  uint64_t memory_hash() const;
+  uint64_t compute_memory_hash() const;
+  // Recomputes image_hash after `memory` was written directly.
+  void rehash();
+
+  uint8_t peek(uint16_t addr) const;
+
+  // write_flags value of a mirrored page whose writes take the inline
+  // fan-out.
+  static constexpr uint8_t WRITE_MIRROR = 0x08;
+
+  // The tables read() and write() test, for generated code that inlines the
+  // same fast paths. A page may be read from `memory` when its device is
+  // null and written when its flags byte is zero, or through its entry in
+  // the mirror table when the flags byte is WRITE_MIRROR.
+  BusDevice *const *device_table() const { return this->devices.data(); }
+  const uint8_t *write_flag_table() const { return this->write_flags.data(); }
+  const BusMirror *mirror_table() const { return this->mirrors.data(); }
+
+  PageKind page_kind(uint16_t addr) const;
+  BusDevice *device_at(uint16_t addr) const;
+
+  // Pages whose bytes in `memory` changed since the last clear_dirty_pages(),
+  // through write() or by being remapped. Writing `memory` directly bypasses
+  // the tracking.
+  bool page_dirty(uint8_t page) const {
+    return (this->dirty[page / 64] >> (page % 64)) & 1;
+  }
+  void clear_dirty_pages();
+
+  // Write traps for pages that hold decoded code. Once armed, the next write
+  // that changes the page, directly, through a mirror or by remapping it,
+  // records the page and disarms its trap. Device pages are never armed.
+  void arm_code_trap(uint8_t page);
+  void disarm_code_traps();
+  bool code_written() const { return this->code_write_pending; }
+  // Calls visit(page) for each page recorded since the last call.
+  template <typename F> void drain_code_writes(F &&visit);
+
+private:
+  // write_flags bits besides WRITE_MIRROR; the fast path requires all of
+  // them clear.
+  static constexpr uint8_t WRITE_SLOW_KIND = 0x01;
+  static constexpr uint8_t WRITE_TRAP_DIRTY = 0x02;
+  static constexpr uint8_t WRITE_TRAP_CODE = 0x04;
+  // Range a page was mapped as part of, used to find its mirrors.
+  struct Mapping {
+    uint8_t first_page;
+    uint16_t page_count;
+    uint16_t span;
+  };
+
+  void set_pages(uint8_t first_page, std::size_t page_count, PageKind kind,
+                 std::size_t size, BusDevice *device);
+  // Turns what is left of any mirrored range the pages cut into into plain
+  // RAM holding its current bytes.
+  void split_mirrors(uint8_t first_page, std::size_t page_count);
+  // Whether the page's bytes count towards the image hash: every page but
+  // the mirror copies.
+  bool hashed(std::size_t page) const;
+
+  void mark_dirty(std::size_t page);
+  void note_code_write(std::size_t page);
+
+  // Sets one byte of the image, keeping image_hash.
+  void store_byte(std::size_t pos, uint8_t data);
+  // Takes the hashed bytes of [start, start + length) out of image_hash
+  // before the image changes there, or puts them back in after.
+  void toggle_hash(std::size_t start, std::size_t length);
+  // The same for a whole page whether or not it is hashed.
+  void toggle_page_hash(std::size_t page);
+  // Calls visit(page) for the page and every mirror of it.
+  template <typename F> void for_each_copy(std::size_t page, F &&visit);
+
+  EIZNESS_COLD uint8_t read_slow(uint16_t addr);
+  EIZNESS_COLD void write_slow(uint16_t addr, uint8_t data);
+
+  std::array<uint8_t, BUS_PAGE_COUNT> write_flags;
+  std::array<PageKind, BUS_PAGE_COUNT> kinds;
+  std::array<BusDevice *, BUS_PAGE_COUNT> devices;
+  std::array<Mapping, BUS_PAGE_COUNT> mappings;
+  std::array<BusMirror, BUS_PAGE_COUNT> mirrors;
+  std::array<uint64_t, BUS_PAGE_COUNT / 64> dirty;
+  std::array<uint64_t, BUS_PAGE_COUNT / 64> code_writes;
+  bool code_write_pending;
+};
+
+template <typename F> void Bus::drain_code_writes(F &&visit) {
+  this->code_write_pending = false;
+  for (std::size_t word = 0; word < this->code_writes.size(); word++) {
+    uint64_t bits = this->code_writes[word];
+    this->code_writes[word] = 0;
+    while (bits != 0) {
+      std::size_t page = word * 64 + count_trailing_zeros(bits);
+      bits &= bits - 1;
+      visit(static_cast<uint8_t>(page));
+    }
+  }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Core/Bus.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+const std::size_t INES_HEADER_SIZE = 16;
+const std::size_t INES_TRAINER_SIZE = 512;
+const uint16_t INES_TRAINER_ADDRESS = 0x7000;
+const std::size_t PRG_ROM_BANK_SIZE = 0x4000;
+const std::size_t CHR_ROM_BANK_SIZE = 0x2000;
+
+enum class Mirroring { Horizontal, Vertical, FourScreen };
+
+struct CartridgeHeader {
+  bool nes2;
+  uint16_t mapper;
+  uint8_t submapper;
+  std::size_t prg_rom_size;
+  std::size_t chr_rom_size;
+  std::size_t prg_ram_size;
+  Mirroring mirroring;
+  bool battery;
+  bool trainer;
+};
+
+// Parses the 16-byte iNES / NES 2.0 header. Throws std::runtime_error when
+// the magic is missing or the sizes do not fit in `size` bytes.
+CartridgeHeader parse_ines_header(const uint8_t *data, std::size_t size);
+
+class Cartridge;
+
+// Decides what the cartridge puts on the CPU bus. Mappers with bank
+// registers attach themselves as a BusDevice over $8000-$FFFF.
+class Mapper {
+public:
+  virtual ~Mapper() = default;
+  virtual void attach(const Cartridge &cartridge, Bus &bus) const = 0;
+};
+
+// An iNES / NES 2.0 image. Opening a file mmaps it read-only and PRG/CHR are
+// views into the mapping, so any number of CPUs can share one cartridge and
+// the file is only paged in as it is touched.
+class Cartridge {
+public:
+  explicit Cartridge(const std::string &path);
+  // For images already in memory (tests, embedded ROMs).
+  explicit Cartridge(std::vector<uint8_t> image);
+  ~Cartridge();
+
+  Cartridge(const Cartridge &) = delete;
+  Cartridge &operator=(const Cartridge &) = delete;
+  Cartridge(Cartridge &&other) noexcept;
+  Cartridge &operator=(Cartridge &&other) noexcept;
+
+  const CartridgeHeader &header() const;
+  // The 512-byte trainer, or nullptr when the image has none.
+  const uint8_t *trainer() const;
+  const uint8_t *prg_rom() const;
+  const uint8_t *chr_rom() const;
+
+  // Maps PRG-RAM, with the trainer loaded at $7000, and PRG-ROM into the CPU
+  // address space ($6000-$FFFF). The
+  // bus reads out of its own 64KB image, so the PRG banks visible to the CPU
+  // are copied into it; the cartridge itself is never copied.
+  void attach(Bus &bus) const;
+
+private:
+  void parse();
+  void release();
+
+  std::vector<uint8_t> owned;
+  void *mapping;
+  std::size_t mapping_size;
+  const uint8_t *data;
+  std::size_t size;
+  CartridgeHeader info;
+  std::unique_ptr<Mapper> mapper;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Padding that keeps data written by different threads on separate lines.
+const std::size_t CACHE_LINE_SIZE = 64;
+
+// The threaded core inlines every handler into one very large function, which
+// exhausts GCC's inlining budget long before the small memory accessors. The
+// accessors that sit on every instruction are forced inline, and the
+// uncommon bus paths are kept out of line so they do not count against it.
+#if defined(__GNUC__) || defined(__clang__)
+#define EIZNESS_ALWAYS_INLINE inline __attribute__((always_inline))
+#define EIZNESS_COLD __attribute__((cold, noinline))
+#define EIZNESS_LIKELY(x) __builtin_expect(!!(x), 1)
+#define EIZNESS_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define EIZNESS_ALWAYS_INLINE inline
+#define EIZNESS_COLD
+#define EIZNESS_LIKELY(x) (x)
+#define EIZNESS_UNLIKELY(x) (x)
+#endif
+
+// Index of the lowest set bit; `bits` must be non-zero.
+inline unsigned count_trailing_zeros(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<unsigned>(__builtin_ctzll(bits));
+#else
+  unsigned count = 0;
+  while ((bits & 1) == 0) {
+    bits >>= 1;
+    count++;
+  }
+  return count;
+#endif
+}
+
+inline unsigned count_ones(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<unsigned>(__builtin_popcountll(bits));
+#else
+  unsigned count = 0;
+  while (bits != 0) {
+    bits &= bits - 1;
+    count++;
+  }
+  return count;
+#endif
+}
+
+inline uint64_t byte_swap64(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_bswap64(value);
+#else
+  uint64_t swapped = 0;
+  for (int i = 0; i < 8; i++) {
+    swapped = swapped << 8 | (value & 0xFF);
+    value >>= 8;
+  }
+  return swapped;
+#endif
+}
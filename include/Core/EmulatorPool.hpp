@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Core/NesCpu.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Called on the worker thread that ran the last slice of an instance, once
+// it reached BRK or spent its cycle budget. `total` sums every slice.
+using PoolCompletion =
+    std::function<void(std::size_t index, NesCpu &cpu, const RunResult &total)>;
+
+struct PoolStats {
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t slices;
+  // Slices a worker took from another worker's queue.
+  uint64_t steals;
+  std::size_t completed;
+  double seconds;
+};
+
+// One instance and its bookkeeping. Each slot is a separate cache-line
+// aligned allocation, so no two instances (or their registers) ever share a
+// line while different workers run them.
+struct alignas(CACHE_LINE_SIZE) PoolInstance {
+  NesCpu cpu;
+  uint64_t cycle_budget;
+  RunResult total;
+  bool done;
+  PoolCompletion on_complete;
+  std::exception_ptr error;
+};
+
+// Owns independent NesCpu instances and runs them across threads in time
+// slices. Every worker has its own queue of instances; it runs a slice of
+// the oldest one it holds and queues it again at the back unless it
+// finished, so its instances take turns, and an idle worker steals the
+// newest instance from another worker's queue. An instance is only ever run
+// by one worker at a time.
+class EmulatorPool {
+public:
+  // `threads` == 0 uses std::thread::hardware_concurrency().
+  explicit EmulatorPool(std::size_t threads = 0);
+
+  // Takes ownership of `cpu`; it runs until BRK or until it has executed at
+  // least `cycle_budget` cycles. Returns the instance index.
+  std::size_t add(NesCpu cpu, uint64_t cycle_budget = UINT64_MAX,
+                  PoolCompletion on_complete = nullptr);
+
+  std::size_t size() const;
+  std::size_t threads() const;
+  NesCpu &cpu(std::size_t index);
+  const RunResult &result(std::size_t index) const;
+
+  // Runs every unfinished instance to completion in slices of
+  // `slice_cycles`, then joins the workers. If an instance throws, it is
+  // finished without its completion callback; that exception, or one thrown
+  // by a completion callback, is rethrown once every other instance is
+  // done, the first instance's first.
+  void run(uint64_t slice_cycles);
+
+  // Totals of the last run().
+  PoolStats stats() const;
+
+private:
+  struct alignas(CACHE_LINE_SIZE) Worker {
+    std::mutex lock;
+    std::deque<std::size_t> queue;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t slices;
+    uint64_t steals;
+  };
+
+  void work(std::size_t id, uint64_t slice_cycles);
+  bool take(std::size_t id, std::size_t &index);
+  // Runs one slice; returns true when the instance finished.
+  bool run_slice(Worker &worker, PoolInstance &instance, std::size_t index,
+                 uint64_t slice_cycles);
+
+  std::vector<std::unique_ptr<PoolInstance>> instances;
+  std::vector<std::unique_ptr<Worker>> workers;
+  // Instances not finished yet; workers exit once it reaches zero.
+  std::atomic<std::size_t> remaining;
+  PoolStats last_stats;
+};
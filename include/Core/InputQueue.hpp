@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Core/Compiler.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Input bytes, such as key codes for the $FF register, from one producer
+// thread (the frontend's event loop) to one consumer thread (the
+// emulator). Built like AudioRing, one byte at a time: neither side locks,
+// and a full queue drops the new byte rather than blocking the producer.
+class InputQueue {
+public:
+  static const std::size_t CAPACITY = 64;
+
+  InputQueue();
+  InputQueue(const InputQueue &) = delete;
+  InputQueue &operator=(const InputQueue &) = delete;
+
+  // Producer side; returns false when the queue is full.
+  bool push(uint8_t value);
+  // Consumer side; returns false when the queue is empty.
+  bool pop(uint8_t &value);
+
+private:
+  std::array<uint8_t, CAPACITY> buffer;
+  alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> head;
+  alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> tail;
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Core/BlockCache.hpp"
+#include "Core/Bus.hpp"
+#include "Core/Compiler.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Runs a block has to reach before it is compiled.
+const uint32_t JIT_HOT_RUNS = 16;
+// Executable memory per CPU; when it fills up every compiled block is
+// dropped and compilation starts over.
+const std::size_t JIT_ARENA_SIZE = 1 << 20;
+
+// Guest state handed to compiled code. The flags are split the way the
+// generated code keeps them, which is also how NesCpu keeps them with
+// EIZNESS_LAZY_FLAGS: `carry` and `overflow` are 0 or 1, and
+// `zero_negative` holds the last result, with Z set when its low byte is
+// zero and N set when any bit of 0x8080 is. Only the bits of `status`
+// other than N, Z, C and V are read.
+struct JitState {
+  uint8_t *memory;
+  BusDevice *const *devices;
+  const uint8_t *write_flags;
+  const BusMirror *mirrors;
+  uint64_t *dirty_lines;
+  uint64_t cycles;
+  // A block that ends by jumping back to its start repeats without
+  // returning while cycles + its max_cycles stays below `cycle_limit` and
+  // `loop_budget` covers another pass; `passes` counts the repeats.
+  uint64_t cycle_limit;
+  uint64_t loop_budget;
+  uint64_t passes;
+  // Bus::image_hash, updated on every store with EIZNESS_INCREMENTAL_HASH.
+  uint64_t memory_hash;
+  uint32_t write_watch;
+  uint16_t program_counter;
+  uint16_t zero_negative;
+  uint8_t register_a;
+  uint8_t register_x;
+  uint8_t register_y;
+  uint8_t stack_pointer;
+  uint8_t status;
+  uint8_t carry;
+  uint8_t overflow;
+};
+
+// Runs the first `length` instructions of a block and returns how many of
+// them completed on the last pass, leaving program_counter on the next one. It returns
+// early, before the instruction it stops at has any effect, when that
+// instruction touches a device page, writes a page whose writes are not
+// plain (code pages, ROM, snapshot traps) or writes the watched address;
+// the interpreter runs it instead. Stores to mirrored RAM set every copy
+// inline, as Bus::write does.
+using JitBlockFn = uint32_t (*)(JitState *state);
+
+struct JitBlock {
+  JitBlockFn code;
+  // Instructions compiled; the rest of the block is interpreted.
+  uint32_t length;
+  // Upper bound on the cycles the compiled instructions can take.
+  uint32_t max_cycles;
+};
+
+// Translates hot decoded blocks to x86-64. Guest registers live in host
+// registers for the whole block and N/Z are only computed when something
+// reads them. On other hosts nothing is ever compiled and the owner keeps
+// interpreting.
+//
+// Copies start empty: compiled code is tied to the arena of the CPU that
+// compiled it, and CPUs copied into worker threads must not share one.
+class Jit {
+public:
+  Jit();
+  Jit(const Jit &other);
+  Jit &operator=(const Jit &other);
+  ~Jit();
+
+  // Whether this build can generate code for the host.
+  static bool available();
+
+  // Counts a run of `block` and returns its compiled form, compiling it on
+  // the run that makes it hot; nullptr while cold or when its first
+  // instruction cannot be compiled.
+  EIZNESS_ALWAYS_INLINE const JitBlock *lookup(const DecodedBlock &block) {
+    if (EIZNESS_LIKELY(block.id < this->entries.size())) {
+      const Entry &entry = this->entries[block.id];
+      if (entry.serial == block.serial && entry.block.code != nullptr) {
+        return &entry.block;
+      }
+    }
+    return this->lookup_cold(block);
+  }
+  // Drops all compiled code and counters.
+  void clear();
+  // Blocks compiled since construction.
+  uint64_t compiled() const { return this->compile_count; }
+
+  uint32_t hot_runs;
+
+private:
+  struct Entry {
+    uint64_t serial;
+    uint32_t runs;
+    bool failed;
+    JitBlock block;
+  };
+
+  const JitBlock *lookup_cold(const DecodedBlock &block);
+  Entry &entry_for(const DecodedBlock &block);
+  bool compile(const DecodedBlock &block, JitBlock &compiled);
+  bool map_arena();
+  void release_arena();
+
+  // Indexed by block id; an entry belongs to the block whose serial it
+  // holds and is reset when the id is reused.
+  std::vector<Entry> entries;
+  // The arena is never writable and executable through the same mapping.
+  // Where the host allows it `arena_writable` is a second view of the same
+  // pages; otherwise it equals `arena`, which is made writable only while
+  // code is copied in.
+  uint8_t *arena;
+  uint8_t *arena_writable;
+  std::size_t arena_used;
+  uint64_t compile_count;
+};
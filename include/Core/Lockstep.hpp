@@ -0,0 +1,153 @@
+#pragma once
+
+#include "Core/NesCpu.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Lane counts are padded to a multiple of this so every vector kernel works
+// on whole 32-byte blocks.
+const std::size_t LOCKSTEP_LANE_ALIGN = 32;
+
+struct LockstepStats {
+  // Instructions executed, summed over every lane.
+  uint64_t instructions;
+  // Times a group of lanes sharing a PC was stepped.
+  uint64_t steps;
+  // Steps that ran through the vector kernels.
+  uint64_t vector_steps;
+  // Lane instructions that fell back to the one-lane-at-a-time path.
+  uint64_t scalar_instructions;
+};
+
+// Runs many copies of one program in lockstep. Registers are stored as
+// structure-of-arrays (one array per register, one byte per lane) and each
+// lane has its own 64KB of RAM, interleaved so that the bytes of all lanes
+// for one address are contiguous: byte `addr` of lane `l` is at
+// memory[addr * stride() + l].
+//
+// Lanes that share a PC form a group and execute each instruction together.
+// When the operand address is the same for every lane in the group (no
+// index register or pointer differs), the loads, stores and ALU operations
+// run on whole vectors of lanes with SSE2 or AVX2; otherwise, and for the
+// rarer instructions, each lane is stepped on its own. After a branch the
+// lanes that took it form a new group, and groups merge again as soon as
+// their PCs coincide. The group with the lowest PC always runs next, which
+// lets lanes that skipped ahead in a loop wait for the others.
+//
+// Each lane behaves exactly like a NesCpu with flat RAM in BreakMode::Exit:
+// same registers, cycle counts and memory after the same instructions.
+// Mirrors, ROM, devices and interrupts are not modelled.
+class LockstepEngine {
+public:
+  // Every lane starts as a copy of `prototype`'s registers and memory.
+  // Throws std::invalid_argument when a page of its bus is not plain RAM or
+  // when it is not in BreakMode::Exit.
+  LockstepEngine(const NesCpu &prototype, std::size_t lanes);
+
+  std::size_t lanes() const;
+  // lanes() rounded up to LOCKSTEP_LANE_ALIGN.
+  std::size_t stride() const;
+
+  uint8_t read(std::size_t lane, uint16_t addr) const;
+  void write(std::size_t lane, uint16_t addr, uint8_t value);
+
+  // Executes up to `max_instructions` instructions on every lane that has
+  // not reached BRK yet. Like NesCpu, a lane that reaches BRK stops with
+  // its PC past the BRK, and stays halted. Throws std::runtime_error on an
+  // illegal opcode, after which the engine state is unspecified.
+  LockstepStats run(uint64_t max_instructions);
+
+  bool halted(std::size_t lane) const;
+  // Copies a lane's registers and memory into `cpu` through its bus.
+  void extract(std::size_t lane, NesCpu &cpu) const;
+
+  // Per-lane registers, stride() entries each. Valid between run() calls.
+  std::vector<uint8_t> register_a;
+  std::vector<uint8_t> register_x;
+  std::vector<uint8_t> register_y;
+  std::vector<uint8_t> status;
+  std::vector<uint8_t> stack_pointer;
+  std::vector<uint16_t> program_counter;
+  std::vector<uint64_t> cycles;
+
+private:
+  // Lanes at the same PC. Cycles and instructions that every member
+  // executed are accumulated here and only added to the per-lane counters
+  // when the group is flushed.
+  struct LaneGroup {
+    uint16_t pc;
+    // One byte per lane: 0xFF for members, 0x00 otherwise.
+    std::vector<uint8_t> mask;
+    std::size_t count;
+    std::size_t leader;
+    // Members all lie in [first, last), both multiples of the vector size.
+    std::size_t first;
+    std::size_t last;
+    uint64_t pending_cycles;
+    uint64_t pending_instructions;
+    // Instructions the group can run before its first member is out of
+    // budget.
+    uint64_t budget;
+  };
+
+  // Set of the PCs that currently have a group, with a fast minimum.
+  class PcSet {
+  public:
+    PcSet();
+    void insert(uint16_t pc);
+    void erase(uint16_t pc);
+    bool empty() const;
+    uint16_t first() const;
+
+  private:
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> summary;
+  };
+
+  uint8_t *row(uint16_t addr) {
+    return this->memory.data() + static_cast<std::size_t>(addr) * this->width;
+  }
+
+  std::size_t new_group(uint16_t pc);
+  void free_group(std::size_t index);
+  void add_lane(LaneGroup &group, std::size_t lane);
+  void detach_lane(LaneGroup &group, std::size_t lane);
+  void find_leader(LaneGroup &group);
+  // Moves the group to `pc`, merging it into a group already there.
+  void place(std::size_t index, uint16_t pc);
+  void flush(LaneGroup &group);
+  void merge(std::size_t from, std::size_t into);
+  // Once the group's budget is spent, flushes it and stops the members
+  // that have no instructions left.
+  void retire(std::size_t index);
+
+  void step(std::size_t index, LockstepStats &stats);
+  bool step_vector(std::size_t index, const OpCode &op);
+  void step_scalar(std::size_t index, LockstepStats &stats);
+  // Executes one instruction on one lane, returning its next PC.
+  uint16_t step_lane(std::size_t lane, uint16_t pc);
+
+  bool code_uniform(const LaneGroup &group, uint16_t pc, std::size_t len);
+  bool lanes_equal(const LaneGroup &group, const uint8_t *values,
+                   uint8_t expected) const;
+  bool operand_address(const LaneGroup &group, const OpCode &op,
+                       uint16_t &addr, bool &page_crossed);
+
+  std::size_t count;
+  std::size_t width;
+  std::vector<uint8_t> memory;
+  std::vector<uint8_t> halt;
+  std::vector<uint64_t> remaining;
+  // Pages written since construction. Code fetched from a page that no
+  // lane wrote is the same for every lane and is not compared.
+  std::vector<bool> page_written;
+
+  // A deque, so references to a group survive new_group().
+  std::deque<LaneGroup> groups;
+  std::vector<std::size_t> free_groups;
+  std::vector<int32_t> group_at_pc;
+  PcSet active;
+  std::vector<uint16_t> next_pc;
+};
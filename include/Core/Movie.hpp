@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Core/NesCpu.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+const uint32_t MOVIE_MAGIC = 0x564D5A45; // "EZMV" little-endian
+const uint16_t MOVIE_VERSION = 1;
+// Cycles between state hashes while recording, about one second of NTSC
+// CPU time.
+const uint64_t MOVIE_CHECKPOINT_CYCLES = 1789773;
+
+// A write from outside the CPU (input, the host's random numbers) made
+// between two instructions, when the cycle counter read `cycle`.
+struct MovieEvent {
+  uint64_t cycle;
+  uint16_t address;
+  uint8_t value;
+};
+
+// state_hash() when the cycle counter read `cycle`, before the events of
+// that cycle were applied.
+struct MovieCheckpoint {
+  uint64_t cycle;
+  uint64_t hash;
+};
+
+// A recorded session: the state it started from, every external write in
+// order and hashes to check a re-run against. Like save states it does not
+// hold the bus layout, so it is replayed onto a CPU with the same image
+// loaded.
+struct Movie {
+  std::vector<uint8_t> start_state;
+  uint64_t start_cycle;
+  uint64_t end_cycle;
+  // Whether the last run stopped on a BRK, which leaves the program counter
+  // past it; the final checkpoints are taken after that.
+  bool break_at_end;
+  std::vector<MovieEvent> events;
+  std::vector<MovieCheckpoint> checkpoints;
+};
+
+// File format, little-endian, with unsigned LEB128 varints (v):
+//   u32 magic, u16 version, u64 start cycle, v state size, save state,
+//   v event count, per event v (cycle delta << 1 | new address),
+//   [u16 address], u8 value,
+//   v checkpoint count, per checkpoint v cycle delta, u64 hash,
+//   v (end cycle delta << 1 | break at end).
+// Cycle deltas are from the previous entry of the same list, the first one
+// from the start cycle; the address is only stored when it changes.
+std::vector<uint8_t> serialize_movie(const Movie &movie);
+// Throws std::runtime_error on a bad magic, an unknown version or a
+// truncated buffer.
+Movie deserialize_movie(const std::vector<uint8_t> &data);
+
+// Records a session on `cpu` from its current state. External writes must
+// go through write() and runs through run_until() for the movie to replay;
+// only the last run may stop on BRK.
+class MovieRecorder {
+public:
+  explicit MovieRecorder(NesCpu &cpu,
+                         uint64_t checkpoint_cycles = MOVIE_CHECKPOINT_CYCLES);
+
+  void write(uint16_t address, uint8_t value);
+  // cpu.run_until(limits), hashing the state afterwards when a checkpoint
+  // is due.
+  RunResult run_until(const RunLimits &limits);
+  // Ends the movie at the current cycle with a last checkpoint.
+  Movie finish();
+
+private:
+  NesCpu &cpu;
+  Movie movie;
+  uint64_t checkpoint_cycles;
+  uint64_t next_checkpoint;
+};
+
+struct ReplayResult {
+  uint64_t instructions;
+  uint64_t cycles;
+  std::size_t checkpoints;
+  // Why the last run stopped; Break when the movie ended on a BRK.
+  StopReason reason;
+};
+
+// Restores the movie's start state and re-runs it as fast as the core
+// goes, applying each event at its cycle and checking every checkpoint.
+// Throws std::runtime_error at the first hash that differs, or when the
+// run reaches a BRK or misses a recorded cycle before the end.
+ReplayResult replay_movie(NesCpu &cpu, const Movie &movie);
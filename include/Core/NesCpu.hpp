@@ -1,29 +1,21 @@
 #pragma once
 
+#include "Core/BlockCache.hpp"
+#include "Core/Bus.hpp"
+#include "Core/Jit.hpp"
+#include "Core/OpCodes.hpp"
+#include "Core/Snapshot.hpp"
+#include "Core/Trace.hpp"
 #include <array>
-#include <bitset>
 #include <cstdint>
 #include <cstring>
 #include <functional>
-#include <iostream>
 #include <stdexcept>
+#include <type_traits>
 #include <unistd.h>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
-enum class AddressingMode {
-  Immediate,
-  ZeroPage,
-  ZeroPage_X,
-  ZeroPage_Y,
-  Absolute,
-  Absolute_X,
-  Absolute_Y,
-  Indirect_X,
-  Indirect_Y,
-  NoneAddressing,
-};
-
 enum CpuFlags : uint8_t {
   CARRY = 0b00000001,
   ZERO = 0b00000010,
@@ -60,289 +52,178 @@ constexpr void operator&=(CpuFlags &a, CpuFlags b) {
   a = static_cast<CpuFlags>(static_cast<uint8_t>(a) & static_cast<uint8_t>(b));
 }
 
-const uint16_t STACK = 0x0100;
-const uint8_t STACK_RESET = 0xfd;
+// Interpreter core used by run_with_callback. All cores share the same
+// instruction handlers and produce identical register and memory results.
+enum class CpuCore {
+  Switch,
+  Threaded,
+  // Runs straight-line blocks decoded once into a BlockCache.
+  Cached,
+  // Like Cached, but hot blocks are compiled to x86-64 for runs without a
+  // per-instruction callback or predicate (run, run_for_cycles and
+  // run_until without `stop`). Other runs, and other hosts, interpret.
+  Jit,
+};
 
-struct OpCode {
-  uint8_t code;
-  const char *mnemonic;
-  uint8_t len;
-  uint8_t cycles;
-  AddressingMode mode;
+#ifdef EIZNESS_THREADED_CORE
+constexpr CpuCore DEFAULT_CPU_CORE = CpuCore::Threaded;
+#else
+constexpr CpuCore DEFAULT_CPU_CORE = CpuCore::Switch;
+#endif
+
+// What opcode $00 does.
+enum class BreakMode {
+  // BRK pushes the address past its padding byte and the status with B
+  // set, and jumps through the IRQ vector at $FFFE.
+  Interrupt,
+  // BRK stops the run before executing, leaving the PC past it. Lets tests
+  // and tools run raw programs that end in BRK on flat RAM, which has no
+  // vectors.
+  Exit,
 };
 
-OpCode createOpCode(uint8_t code, const char *mnemonic, uint8_t len,
-                    uint8_t cycles, AddressingMode mode);
-
-const std::vector<OpCode> CPU_OPS_CODES = {
-    createOpCode(0x00, "BRK", 1, 7, AddressingMode::NoneAddressing),
-    createOpCode(0xea, "NOP", 1, 2, AddressingMode::NoneAddressing),
-
-    /* Arithmetic */
-    createOpCode(0x69, "ADC", 2, 2, AddressingMode::Immediate),
-    createOpCode(0x65, "ADC", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0x75, "ADC", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0x6d, "ADC", 3, 4, AddressingMode::Absolute),
-    createOpCode(0x7d, "ADC", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_X),
-    createOpCode(0x79, "ADC", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_Y),
-    createOpCode(0x61, "ADC", 2, 6, AddressingMode::Indirect_X),
-    createOpCode(0x71, "ADC", 2, 5 /*+1 if page crossed*/,
-                 AddressingMode::Indirect_Y),
-
-    createOpCode(0xe9, "SBC", 2, 2, AddressingMode::Immediate),
-    createOpCode(0xe5, "SBC", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0xf5, "SBC", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0xed, "SBC", 3, 4, AddressingMode::Absolute),
-    createOpCode(0xfd, "SBC", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_X),
-    createOpCode(0xf9, "SBC", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_Y),
-    createOpCode(0xe1, "SBC", 2, 6, AddressingMode::Indirect_X),
-    createOpCode(0xf1, "SBC", 2, 5 /*+1 if page crossed*/,
-                 AddressingMode::Indirect_Y),
-
-    createOpCode(0x29, "AND", 2, 2, AddressingMode::Immediate),
-    createOpCode(0x25, "AND", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0x35, "AND", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0x2d, "AND", 3, 4, AddressingMode::Absolute),
-    createOpCode(0x3d, "AND", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_X),
-    createOpCode(0x39, "AND", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_Y),
-    createOpCode(0x21, "AND", 2, 6, AddressingMode::Indirect_X),
-    createOpCode(0x31, "AND", 2, 5 /*+1 if page crossed*/,
-                 AddressingMode::Indirect_Y),
-
-    createOpCode(0x49, "EOR", 2, 2, AddressingMode::Immediate),
-    createOpCode(0x45, "EOR", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0x55, "EOR", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0x4d, "EOR", 3, 4, AddressingMode::Absolute),
-    createOpCode(0x5d, "EOR", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_X),
-    createOpCode(0x59, "EOR", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_Y),
-    createOpCode(0x41, "EOR", 2, 6, AddressingMode::Indirect_X),
-    createOpCode(0x51, "EOR", 2, 5 /*+1 if page crossed*/,
-                 AddressingMode::Indirect_Y),
-
-    createOpCode(0x09, "ORA", 2, 2, AddressingMode::Immediate),
-    createOpCode(0x05, "ORA", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0x15, "ORA", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0x0d, "ORA", 3, 4, AddressingMode::Absolute),
-    createOpCode(0x1d, "ORA", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_X),
-    createOpCode(0x19, "ORA", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_Y),
-    createOpCode(0x01, "ORA", 2, 6, AddressingMode::Indirect_X),
-    createOpCode(0x11, "ORA", 2, 5 /*+1 if page crossed*/,
-                 AddressingMode::Indirect_Y),
-
-    /* Shifts */
-    createOpCode(0x0a, "ASL", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x06, "ASL", 2, 5, AddressingMode::ZeroPage),
-    createOpCode(0x16, "ASL", 2, 6, AddressingMode::ZeroPage_X),
-    createOpCode(0x0e, "ASL", 3, 6, AddressingMode::Absolute),
-    createOpCode(0x1e, "ASL", 3, 7, AddressingMode::Absolute_X),
-
-    createOpCode(0x4a, "LSR", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x46, "LSR", 2, 5, AddressingMode::ZeroPage),
-    createOpCode(0x56, "LSR", 2, 6, AddressingMode::ZeroPage_X),
-    createOpCode(0x4e, "LSR", 3, 6, AddressingMode::Absolute),
-    createOpCode(0x5e, "LSR", 3, 7, AddressingMode::Absolute_X),
-
-    createOpCode(0x2a, "ROL", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x26, "ROL", 2, 5, AddressingMode::ZeroPage),
-    createOpCode(0x36, "ROL", 2, 6, AddressingMode::ZeroPage_X),
-    createOpCode(0x2e, "ROL", 3, 6, AddressingMode::Absolute),
-    createOpCode(0x3e, "ROL", 3, 7, AddressingMode::Absolute_X),
-
-    createOpCode(0x6a, "ROR", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x66, "ROR", 2, 5, AddressingMode::ZeroPage),
-    createOpCode(0x76, "ROR", 2, 6, AddressingMode::ZeroPage_X),
-    createOpCode(0x6e, "ROR", 3, 6, AddressingMode::Absolute),
-    createOpCode(0x7e, "ROR", 3, 7, AddressingMode::Absolute_X),
-
-    createOpCode(0xe6, "INC", 2, 5, AddressingMode::ZeroPage),
-    createOpCode(0xf6, "INC", 2, 6, AddressingMode::ZeroPage_X),
-    createOpCode(0xee, "INC", 3, 6, AddressingMode::Absolute),
-    createOpCode(0xfe, "INC", 3, 7, AddressingMode::Absolute_X),
-
-    createOpCode(0xe8, "INX", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0xc8, "INY", 1, 2, AddressingMode::NoneAddressing),
-
-    createOpCode(0xc6, "DEC", 2, 5, AddressingMode::ZeroPage),
-    createOpCode(0xd6, "DEC", 2, 6, AddressingMode::ZeroPage_X),
-    createOpCode(0xce, "DEC", 3, 6, AddressingMode::Absolute),
-    createOpCode(0xde, "DEC", 3, 7, AddressingMode::Absolute_X),
-
-    createOpCode(0xca, "DEX", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x88, "DEY", 1, 2, AddressingMode::NoneAddressing),
-
-    createOpCode(0xc9, "CMP", 2, 2, AddressingMode::Immediate),
-    createOpCode(0xc5, "CMP", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0xd5, "CMP", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0xcd, "CMP", 3, 4, AddressingMode::Absolute),
-    createOpCode(0xdd, "CMP", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_X),
-    createOpCode(0xd9, "CMP", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_Y),
-    createOpCode(0xc1, "CMP", 2, 6, AddressingMode::Indirect_X),
-    createOpCode(0xd1, "CMP", 2, 5 /*+1 if page crossed*/,
-                 AddressingMode::Indirect_Y),
-
-    createOpCode(0xc0, "CPY", 2, 2, AddressingMode::Immediate),
-    createOpCode(0xc4, "CPY", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0xcc, "CPY", 3, 4, AddressingMode::Absolute),
-
-    createOpCode(0xe0, "CPX", 2, 2, AddressingMode::Immediate),
-    createOpCode(0xe4, "CPX", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0xec, "CPX", 3, 4, AddressingMode::Absolute),
-
-    /* Branching */
-
-    createOpCode(0x4c, "JMP", 3, 3,
-                 AddressingMode::NoneAddressing), // AddressingMode that acts as
-                                                  // Immidiate
-    createOpCode(0x6c, "JMP", 3, 5,
-                 AddressingMode::NoneAddressing), // AddressingMode:Indirect
-                                                  // with 6502 bug
-
-    createOpCode(0x20, "JSR", 3, 6, AddressingMode::NoneAddressing),
-    createOpCode(0x60, "RTS", 1, 6, AddressingMode::NoneAddressing),
-
-    createOpCode(0x40, "RTI", 1, 6, AddressingMode::NoneAddressing),
-
-    createOpCode(0xd0, "BNE", 2,
-                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
-                 AddressingMode::NoneAddressing),
-    createOpCode(0x70, "BVS", 2,
-                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
-                 AddressingMode::NoneAddressing),
-    createOpCode(0x50, "BVC", 2,
-                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
-                 AddressingMode::NoneAddressing),
-    createOpCode(0x30, "BMI", 2,
-                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
-                 AddressingMode::NoneAddressing),
-    createOpCode(0xf0, "BEQ", 2,
-                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
-                 AddressingMode::NoneAddressing),
-    createOpCode(0xb0, "BCS", 2,
-                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
-                 AddressingMode::NoneAddressing),
-    createOpCode(0x90, "BCC", 2,
-                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
-                 AddressingMode::NoneAddressing),
-    createOpCode(0x10, "BPL", 2,
-                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
-                 AddressingMode::NoneAddressing),
-
-    createOpCode(0x24, "BIT", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0x2c, "BIT", 3, 4, AddressingMode::Absolute),
-
-    /* Stores, Loads */
-    createOpCode(0xa9, "LDA", 2, 2, AddressingMode::Immediate),
-    createOpCode(0xa5, "LDA", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0xb5, "LDA", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0xad, "LDA", 3, 4, AddressingMode::Absolute),
-    createOpCode(0xbd, "LDA", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_X),
-    createOpCode(0xb9, "LDA", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_Y),
-    createOpCode(0xa1, "LDA", 2, 6, AddressingMode::Indirect_X),
-    createOpCode(0xb1, "LDA", 2, 5 /*+1 if page crossed*/,
-                 AddressingMode::Indirect_Y),
-
-    createOpCode(0xa2, "LDX", 2, 2, AddressingMode::Immediate),
-    createOpCode(0xa6, "LDX", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0xb6, "LDX", 2, 4, AddressingMode::ZeroPage_Y),
-    createOpCode(0xae, "LDX", 3, 4, AddressingMode::Absolute),
-    createOpCode(0xbe, "LDX", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_Y),
-
-    createOpCode(0xa0, "LDY", 2, 2, AddressingMode::Immediate),
-    createOpCode(0xa4, "LDY", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0xb4, "LDY", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0xac, "LDY", 3, 4, AddressingMode::Absolute),
-    createOpCode(0xbc, "LDY", 3, 4 /*+1 if page crossed*/,
-                 AddressingMode::Absolute_X),
-
-    createOpCode(0x85, "STA", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0x95, "STA", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0x8d, "STA", 3, 4, AddressingMode::Absolute),
-    createOpCode(0x9d, "STA", 3, 5, AddressingMode::Absolute_X),
-    createOpCode(0x99, "STA", 3, 5, AddressingMode::Absolute_Y),
-    createOpCode(0x81, "STA", 2, 6, AddressingMode::Indirect_X),
-    createOpCode(0x91, "STA", 2, 6, AddressingMode::Indirect_Y),
-
-    createOpCode(0x86, "STX", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0x96, "STX", 2, 4, AddressingMode::ZeroPage_Y),
-    createOpCode(0x8e, "STX", 3, 4, AddressingMode::Absolute),
-
-    createOpCode(0x84, "STY", 2, 3, AddressingMode::ZeroPage),
-    createOpCode(0x94, "STY", 2, 4, AddressingMode::ZeroPage_X),
-    createOpCode(0x8c, "STY", 3, 4, AddressingMode::Absolute),
-
-    /* Flags clear */
-
-    createOpCode(0xD8, "CLD", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x58, "CLI", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0xb8, "CLV", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x18, "CLC", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x38, "SEC", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x78, "SEI", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0xf8, "SED", 1, 2, AddressingMode::NoneAddressing),
-
-    createOpCode(0xaa, "TAX", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0xa8, "TAY", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0xba, "TSX", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x8a, "TXA", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x9a, "TXS", 1, 2, AddressingMode::NoneAddressing),
-    createOpCode(0x98, "TYA", 1, 2, AddressingMode::NoneAddressing),
-
-    /* Stack */
-    createOpCode(0x48, "PHA", 1, 3, AddressingMode::NoneAddressing),
-    createOpCode(0x68, "PLA", 1, 4, AddressingMode::NoneAddressing),
-    createOpCode(0x08, "PHP", 1, 3, AddressingMode::NoneAddressing),
-    createOpCode(0x28, "PLP", 1, 4, AddressingMode::NoneAddressing),
+// Why a bounded run returned.
+enum class StopReason {
+  // A BRK in BreakMode::Exit.
+  Break,
+  InstructionLimit,
+  CycleLimit,
+  Breakpoint,
+  WriteWatch,
+  Predicate,
+};
 
+// Bounds for NesCpu::run_until. Every limit is optional; a run with no
+// limits only stops on BRK in BreakMode::Exit.
+struct RunLimits {
+  uint64_t max_instructions = UINT64_MAX;
+  uint64_t max_cycles = UINT64_MAX;
+  // Stop before executing the instruction at this address.
+  int32_t break_at = -1;
+  // Stop after the instruction that writes to this address.
+  int32_t watch_write = -1;
 };
 
-const std::unordered_map<uint8_t, const OpCode *> OPCODES_MAP = []() {
-  std::unordered_map<uint8_t, const OpCode *> map;
-  for (const OpCode &cpuop : CPU_OPS_CODES) {
-    map[cpuop.code] = &cpuop;
-  }
-  return map;
-}();
+struct RunResult {
+  StopReason reason;
+  uint64_t instructions;
+  uint64_t cycles;
+};
+
+const uint32_t NO_WRITE_WATCH = 0x10000;
+
+// mem_write marks the 64-byte line it lands in.
+const std::size_t DIRTY_LINE_SHIFT = 6;
+const std::size_t DIRTY_LINE_SIZE = 1 << DIRTY_LINE_SHIFT;
+const std::size_t DIRTY_LINE_COUNT = 0x10000 >> DIRTY_LINE_SHIFT;
+
+class Cartridge;
+class NesCpu;
+
+// The predicate of run_until(limits); runs with it may use compiled code.
+struct NeverStop {
+  bool operator()(NesCpu &) const { return false; }
+};
+
+// run_cached's block entry hook when no compiled code may run.
+struct InterpretOnly {
+  bool operator()(const DecodedBlock &, uint32_t &) const { return true; }
+};
+
+const uint16_t STACK = 0x0100;
+const uint8_t STACK_RESET = 0xfd;
+
+const uint16_t NMI_VECTOR = 0xFFFA;
+const uint16_t RESET_VECTOR = 0xFFFC;
+const uint16_t IRQ_VECTOR = 0xFFFE;
+
+// Bits of NesCpu::interrupt_lines.
+const uint8_t NMI_LINE = 0b01;
+const uint8_t IRQ_LINE = 0b10;
 
 class NesCpu {
 public:
   uint8_t register_a;
   uint8_t register_x;
   uint8_t register_y;
-  CpuFlags status;
+  // Raw processor status. With EIZNESS_LAZY_FLAGS only I, D and the B bits
+  // are kept here and N, Z, C and V live in the flag_* fields below, so
+  // read and write the register through get_status() and set_status().
+  CpuFlags status_bits;
+#ifdef EIZNESS_LAZY_FLAGS
+  // Last result that set N and Z: Z is set when its low byte is zero and N
+  // when any bit of 0x8080 is, which lets set_flag() give N without a
+  // result. C and V are 0 or 1.
+  uint16_t flag_result;
+  uint8_t flag_carry;
+  uint8_t flag_overflow;
+#endif
   uint16_t program_counter;
   uint8_t stack_pointer;
-  std::array<uint8_t, 0xFFFF> memory;
+  uint64_t cycles;
+  // Maps the whole address space flat onto bus.memory by default; frontends
+  // remap pages to mirror RAM, expose ROM or attach devices.
+  Bus bus;
+  // Address armed by run_until's watch_write; NO_WRITE_WATCH when idle.
+  uint32_t write_watch;
+  bool write_watch_hit;
+  CpuCore core;
+  BreakMode break_mode;
+  // NMI_LINE while an NMI is latched, IRQ_LINE while a device holds IRQ
+  // low. The run loops test the whole byte once before every instruction,
+  // so without an interrupt that costs one branch that is never taken.
+  // Part of snapshots and state hashes.
+  uint8_t interrupt_lines;
+  // Pages of the last snapshot taken or restored. Bus pages that are not
+  // dirty still hold exactly these bytes.
+  std::array<std::shared_ptr<const MemoryPage>, BUS_PAGE_COUNT> snapshot_pages;
+  // One bit per 64-byte line written through mem_write since it was last
+  // cleared. Unlike the bus's page traps this is set on every write, so any
+  // number of consumers can read and clear their own ranges. Only the
+  // address written is marked, not its mirrors.
+  std::array<uint64_t, DIRTY_LINE_COUNT / 64> dirty_lines;
+  // Blocks decoded by the cached core. Writes through the bus invalidate
+  // them; code changed behind its back (writing bus.memory directly) needs
+  // invalidate_blocks(), which also rehashes the bus image.
+  BlockCache blocks;
+  // Operand bytes of the instruction the cached core is executing.
+  uint16_t decoded_operand;
+  // Native code for the jit core's hot blocks. Copies of a NesCpu start
+  // without any.
+  Jit jit;
+#ifdef EIZNESS_TRACE
+  // Receives a record for every instruction executed while set.
+  TraceBuffer *tracer;
+#endif
 
   NesCpu();
 
-  void ldy(AddressingMode mode);
-  void ldx(AddressingMode mode);
-  void lda(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> void ldy();
+  template <AddressingMode M, bool Decoded = false> void ldx();
+  template <AddressingMode M, bool Decoded = false> void lda();
   void set_register_a(uint8_t value);
-  void andd(AddressingMode mode);
-  void eor(AddressingMode mode);
-  void ora(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> void andd();
+  template <AddressingMode M, bool Decoded = false> void eor();
+  template <AddressingMode M, bool Decoded = false> void ora();
   void tax();
+  void tay();
+  void tsx();
+  void txa();
+  void txs();
+  void tya();
   void inx();
   void iny();
-  void sta(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> void sta();
+  template <AddressingMode M, bool Decoded = false> void stx();
+  template <AddressingMode M, bool Decoded = false> void sty();
   void update_zero_and_negative_flags(uint8_t result);
   void update_negative_flags(uint8_t result);
+  bool flag(CpuFlags flag) const;
+  void set_flag(CpuFlags flag, bool value);
+  // The status register with every flag materialized, as PHP pushes it
+  // without the B bits.
+  CpuFlags get_status() const;
+  void set_status(CpuFlags status);
 
   // Memory
   uint8_t mem_read(uint16_t addr);
@@ -351,500 +232,1174 @@ public:
   void mem_write(uint16_t addr, uint8_t data);
   void mem_write_u16(uint16_t pos, uint16_t data);
 
-  void load(std::vector<uint8_t> program);
+  bool line_dirty(uint16_t addr) const;
+  // Calls visit(line_start) for each dirty line overlapping [first, last]
+  // and clears it.
+  template <typename F>
+  void drain_dirty_lines(uint16_t first, uint16_t last, F &&visit);
+  void mark_all_lines_dirty();
+  void clear_dirty_lines();
+
+  void invalidate_blocks();
+
+  void load(const std::vector<uint8_t> &program);
+  // Lays out the NES memory map (2KB of RAM mirrored to $1FFF, cartridge
+  // from $6000) and resets through the cartridge's vector at $FFFC.
+  void insert_cartridge(const Cartridge &cartridge);
   void reset();
+
+  // Copies only the pages written since the previous snapshot or restore;
+  // the rest are shared with it.
+  CpuSnapshot snapshot();
+  // Copies back only pages that were written since, or that differ from the
+  // last snapshot taken or restored.
+  void restore(const CpuSnapshot &snapshot);
+  std::vector<uint8_t> save_state();
+  void load_state(const std::vector<uint8_t> &data);
+  // 64-bit FNV-1a over the registers, the cycle count and the bus image's
+  // hash. Device registers are not part of the image and do not
+  // contribute. O(1) with EIZNESS_INCREMENTAL_HASH; debug builds then check
+  // it against full_state_hash() and throw std::logic_error on a mismatch.
+  uint64_t state_hash() const;
+  // state_hash() with the image hashed from scratch.
+  uint64_t full_state_hash() const;
   void run();
-  void load_and_run(std::vector<uint8_t> program);
+  void load_and_run(const std::vector<uint8_t> &program);
+  // Runs whole instructions until at least `budget` cycles have elapsed or a
+  // BRK is reached; returns the number of cycles actually executed.
+  uint64_t run_for_cycles(uint64_t budget);
   void set_carry_flag();
   void clear_carry_flag();
   void add_to_register_a(uint8_t data);
-  void sbc(AddressingMode mode);
-  void adc(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> void sbc();
+  template <AddressingMode M, bool Decoded = false> void adc();
 
   uint8_t stack_pop();
   void stack_push(uint8_t data);
   uint16_t stack_pop_u16();
   void stack_push_u16(uint16_t data);
 
+  // Shift and rotate a value through the carry flag, returning the result.
+  uint8_t shift_left(uint8_t data);
+  uint8_t shift_right(uint8_t data);
+  uint8_t rotate_left(uint8_t data);
+  uint8_t rotate_right(uint8_t data);
+
   void asl_accumulator();
-  uint8_t asl(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> uint8_t asl();
 
   void lsr_accumulator();
-  uint8_t lsr(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> uint8_t lsr();
 
   void rol_accumulator();
-  uint8_t rol(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> uint8_t rol();
 
   void ror_accumulator();
-  uint8_t ror(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> uint8_t ror();
 
-  uint8_t inc(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> uint8_t inc();
 
   void dey();
   void dex();
-  uint8_t dec(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> uint8_t dec();
 
+  void pha();
   void pla();
   void plp();
   void php();
 
-  void bit(AddressingMode mode);
+  template <AddressingMode M, bool Decoded = false> void bit();
+
+  template <AddressingMode M, bool Decoded = false> void compare(uint8_t compare_with);
+  template <bool Decoded = false> void branch(bool condition);
+
+  void brk();
+
+  // Latches an NMI, taken before the next instruction whatever the I flag.
+  void nmi();
+  // Asserts or releases the IRQ line. While it is asserted an IRQ is taken
+  // before every instruction that starts with I clear.
+  void set_irq(bool asserted);
+  // Takes a pending NMI, or an IRQ when I is clear; returns whether it did.
+  bool poll_interrupts();
+  // Pushes the PC and the status without B, sets I and jumps through
+  // `vector`, charging the 7 cycles of the sequence.
+  void interrupt(uint16_t vector);
+
+  void jmp_absolute();
+  void jmp_indirect();
+  void jsr();
+  // JSR with its target already fetched.
+  void jsr_to(uint16_t target_address);
+  void rts();
+  void rti();
+
+  // Resolves the effective address of the current operand. The templated
+  // form is what the handlers use, so the mode is fixed per opcode and the
+  // resolution inlines without branching on the mode. With `Decoded` the
+  // operand bytes come from decoded_operand instead of memory.
+  template <AddressingMode M, bool Decoded = false> uint16_t operand_address();
+  template <bool Decoded> uint8_t operand_u8();
+  template <bool Decoded> uint16_t operand_u16();
+  uint16_t get_operand_address(AddressingMode mode);
+  // Reads the operand of a read instruction, charging the extra cycle taken
+  // when an indexed address crosses a page boundary.
+  template <AddressingMode M, bool Decoded = false> uint8_t read_operand();
+
+  // Captures the instruction about to be fetched into tracer. Compiles to
+  // nothing unless EIZNESS_TRACE is defined.
+  void trace_instruction();
+
+  // Executes a single decoded instruction; the opcode byte has already been
+  // consumed and program_counter points at its first operand byte. With
+  // `Decoded` the operand bytes are taken from decoded_operand.
+  template <uint8_t Code, bool Decoded = false> void execute();
+
+  // Calls `callback` after every `stride` instructions.
+  template <typename T>
+  void run_with_callback(T &&callback, uint32_t stride = 1) {
+    if (stride <= 1) {
+      this->run_while([&callback](NesCpu &cpu) {
+        callback(cpu);
+        return true;
+      });
+      return;
+    }
+    uint32_t countdown = stride;
+    this->run_while([&callback, &countdown, stride](NesCpu &cpu) {
+      if (--countdown == 0) {
+        countdown = stride;
+        callback(cpu);
+      }
+      return true;
+    });
+  }
 
-  void compare(AddressingMode mode, uint8_t compare_with);
-  void branch(bool condition);
+  // Runs a bounded batch without any per-instruction callback. The templated
+  // form additionally stops once `stop(*this)` returns true.
+  RunResult run_until(const RunLimits &limits);
+  template <typename P>
+  RunResult run_until(const RunLimits &limits, P &&stop);
+
+  // Executes instructions until BRK or until `keep_running(*this)`, checked
+  // after every instruction, returns false. The jit core interprets here:
+  // compiled blocks cannot call back after each instruction.
+  template <typename F> void run_while(F &&keep_running) {
+    if (this->core == CpuCore::Threaded) {
+      this->run_threaded(keep_running);
+    } else if (this->core == CpuCore::Cached ||
+               this->core == CpuCore::Jit) {
+      this->run_cached(keep_running);
+    } else {
+      this->run_switch(keep_running);
+    }
+  }
 
-  uint16_t get_operand_address(AddressingMode mode);
+  template <typename F> void run_threaded(F &&keep_running);
+  template <typename F> void run_switch(F &&keep_running);
+  // `enter_native(block, done)` is called on entering each cached block;
+  // it may run the first `done` instructions itself and returns false when
+  // the run has to stop.
+  template <typename F, typename N = InterpretOnly>
+  void run_cached(F &&keep_running, N &&enter_native = N());
+  // run_until's loop for the jit core: run_cached, entering compiled code
+  // for hot blocks when no limit can fall inside them. `keep_running` is
+  // then called once, for their last instruction, after `instructions` is
+  // advanced past the others.
+  template <typename F>
+  void run_jit(F &&keep_running, const RunLimits &limits,
+               uint64_t cycle_target, uint64_t &instructions);
+
+private:
+  // Drops the blocks on pages the bus saw written since the last call.
+  void drop_written_blocks();
+  bool can_run_native(const JitBlock &native, const DecodedBlock &block,
+                      const RunLimits &limits, uint64_t cycle_target,
+                      uint64_t instructions) const;
+  // Runs compiled code and returns how many instructions of its last pass
+  // completed. Earlier whole passes of a self-looping block, which stay
+  // within `loop_budget` instructions and below `cycle_limit`, are added to
+  // `instructions`.
+  uint32_t run_native(const JitBlock &native, uint64_t loop_budget,
+                      uint64_t cycle_limit, uint64_t &instructions);
+};
 
-  /* template <typename T> void run_with_callback(T callback); */
-  template <typename T> void run_with_callback(T &&callback) {
-    const std::unordered_map<uint8_t, const OpCode *> &opcodes = OPCODES_MAP;
-    while (true) {
-
-      /* std::cout << "before program_counter: " << std::hex */
-      /*           << this->program_counter << "\n" */
-      /*           << std::endl; */
-
-      uint8_t code = this->mem_read(this->program_counter);
-      this->program_counter += 1;
-      uint16_t program_counter_state = this->program_counter;
-      /* std::cout << "CODE ERROR: " << std::bitset<8>(code) << "\n"; */
-      auto opcode = opcodes.at(code);
-
-      std::cout << "=================\n";
-      std::cout << "code: " << std::bitset<8>(code) << "\n"
-                << "program_counter: " << std::hex << this->program_counter
-                << "\n"
-                << "program_counter_state: " << std::hex
-                << program_counter_state << "\n"
-                << "opcode: " << opcode->mnemonic
-                << "\n=================" << std::endl;
-
-      switch (code) {
-      case 0xa9:
-      case 0xa5:
-      case 0xb5:
-      case 0xad:
-      case 0xbd:
-      case 0xb9:
-      case 0xa1:
-      case 0xb1: {
-        this->lda(opcode->mode);
-        break;
-      }
+// The helpers below run on every instruction; they live in the header so
+// the templated handlers can inline them.
 
-      case 0xaa: {
-        this->tax();
-        break;
-      }
+EIZNESS_ALWAYS_INLINE uint8_t NesCpu::mem_read(uint16_t addr) {
+  return this->bus.read(addr);
+}
 
-      case 0xe8: {
-        this->inx();
-        break;
-      }
+EIZNESS_ALWAYS_INLINE uint16_t NesCpu::mem_read_u16(uint16_t pos) {
+  uint8_t lo = this->mem_read(pos);
+  uint8_t hi = this->mem_read(pos + 1);
+  return (hi << 8) | lo;
+}
 
-      case 0x00: {
-        return;
-      }
+EIZNESS_ALWAYS_INLINE void NesCpu::mem_write(uint16_t addr, uint8_t data) {
+  this->bus.write(addr, data);
+  this->dirty_lines[addr >> 12] |= static_cast<uint64_t>(1)
+                                   << ((addr >> DIRTY_LINE_SHIFT) & 63);
+  if (addr == this->write_watch) {
+    this->write_watch_hit = true;
+  }
+}
 
-      case 0xd8: {
-        this->status &= ~CpuFlags::DECIMAL_MODE;
-        break;
-      }
-      case 0x58: {
-        this->status &= ~CpuFlags::INTERRUPT_DISABLE;
-        break;
-      }
-      case 0xb8: {
-        this->status &= ~CpuFlags::OVERFLOW;
-        break;
-      }
-      case 0x18: {
-        this->clear_carry_flag();
-        break;
-      }
-      case 0x38: {
-        this->set_carry_flag();
-        break;
-      }
-      case 0x78: {
-        this->status |= CpuFlags::INTERRUPT_DISABLE;
-        break;
-      }
-      case 0xf8: {
-        this->status |= CpuFlags::DECIMAL_MODE;
-        break;
-      }
-      case 0x48: {
-        this->stack_push(this->register_a);
-        break;
-      }
+inline void NesCpu::mem_write_u16(uint16_t pos, uint16_t data) {
+  uint8_t hi = (data >> 8) & 0xff;
+  uint8_t lo = data & 0xff;
+  this->mem_write(pos, lo);
+  this->mem_write(pos + 1, hi);
+}
 
-      case 0x68: {
-        this->pla();
-        break;
-      }
+inline void NesCpu::set_register_a(uint8_t value) {
+  this->register_a = value;
+  this->update_zero_and_negative_flags(this->register_a);
+}
 
-      case 0x08: {
-        this->php();
-        break;
-      }
+inline void NesCpu::update_zero_and_negative_flags(uint8_t result) {
+#ifdef EIZNESS_LAZY_FLAGS
+  this->flag_result = result;
+#else
+  if (result == 0) {
+    this->status_bits |= CpuFlags::ZERO;
+  } else {
+    this->status_bits &= ~CpuFlags::ZERO;
+  }
 
-      case 0x28: {
-        this->plp();
-        break;
-      }
+  if ((result >> 7) == 1) {
+    this->status_bits |= CpuFlags::NEGATIV;
+  } else {
+    this->status_bits &= ~CpuFlags::NEGATIV;
+  }
+#endif
+}
 
-      case 0x69:
-      case 0x65:
-      case 0x75:
-      case 0x6d:
-      case 0x7d:
-      case 0x79:
-      case 0x61:
-      case 0x71: {
-        this->adc(opcode->mode);
-        break;
-      }
+// With a constant `flag` both of these fold to a single field access.
+EIZNESS_ALWAYS_INLINE bool NesCpu::flag(CpuFlags flag) const {
+#ifdef EIZNESS_LAZY_FLAGS
+  switch (flag) {
+  case CpuFlags::CARRY:
+    return this->flag_carry != 0;
+  case CpuFlags::OVERFLOW:
+    return this->flag_overflow != 0;
+  case CpuFlags::ZERO:
+    return (this->flag_result & 0xFF) == 0;
+  case CpuFlags::NEGATIV:
+    return (this->flag_result & 0x8080) != 0;
+  default:
+    break;
+  }
+#endif
+  return (this->status_bits & flag) != 0;
+}
 
-      case 0xe9:
-      case 0xe5:
-      case 0xf5:
-      case 0xed:
-      case 0xfd:
-      case 0xf9:
-      case 0xe1:
-      case 0xf1: {
-        this->sbc(opcode->mode);
-        break;
-      }
+EIZNESS_ALWAYS_INLINE void NesCpu::set_flag(CpuFlags flag, bool value) {
+#ifdef EIZNESS_LAZY_FLAGS
+  switch (flag) {
+  case CpuFlags::CARRY:
+    this->flag_carry = value;
+    return;
+  case CpuFlags::OVERFLOW:
+    this->flag_overflow = value;
+    return;
+  case CpuFlags::ZERO:
+    this->flag_result = (this->flag(CpuFlags::NEGATIV) ? 0x8000 : 0) |
+                        (value ? 0 : 1);
+    return;
+  case CpuFlags::NEGATIV:
+    this->flag_result = (this->flag(CpuFlags::ZERO) ? 0 : 1) |
+                        (value ? 0x8000 : 0);
+    return;
+  default:
+    break;
+  }
+#endif
+  this->status_bits =
+      (this->status_bits & ~flag) | (value ? flag : static_cast<CpuFlags>(0));
+}
 
-      case 0x29:
-      case 0x25:
-      case 0x35:
-      case 0x2d:
-      case 0x3d:
-      case 0x39:
-      case 0x21:
-      case 0x31: {
-        this->andd(opcode->mode);
-        break;
-      }
+inline void NesCpu::set_carry_flag() { this->set_flag(CpuFlags::CARRY, true); }
 
-      case 0x49:
-      case 0x45:
-      case 0x55:
-      case 0x4d:
-      case 0x5d:
-      case 0x59:
-      case 0x41:
-      case 0x51: {
-        this->eor(opcode->mode);
-        break;
-      }
+inline void NesCpu::clear_carry_flag() {
+  this->set_flag(CpuFlags::CARRY, false);
+}
 
-      case 0x09:
-      case 0x05:
-      case 0x15:
-      case 0x0d:
-      case 0x1d:
-      case 0x19:
-      case 0x01:
-      case 0x11: {
-        this->ora(opcode->mode);
-        break;
-      }
+inline void NesCpu::add_to_register_a(uint8_t data) {
+  uint16_t sum = this->register_a + data + this->flag(CpuFlags::CARRY);
+  uint8_t result = static_cast<uint8_t>(sum & 0xFF);
 
-      case 0x46:
-      case 0x56:
-      case 0x4e:
-      case 0x5e: {
-        this->lsr(opcode->mode);
-        break;
-      }
+  this->set_flag(CpuFlags::CARRY, sum > 0xFF);
+  this->set_flag(CpuFlags::OVERFLOW,
+                 ((data ^ result) & (result ^ this->register_a) & 0x80) != 0);
+  this->set_register_a(result);
+}
 
-      case 0x4a: {
-        this->lsr_accumulator();
-        break;
-      }
+inline uint8_t NesCpu::stack_pop() {
+  this->stack_pointer = uint8_t(stack_pointer + 1);
+  return this->mem_read(static_cast<uint16_t>(STACK) +
+                        static_cast<uint16_t>(this->stack_pointer));
+}
 
-      case 0x06:
-      case 0x16:
-      case 0x0e:
-      case 0x1e: {
-        this->asl(opcode->mode);
-        break;
-      }
+inline void NesCpu::stack_push(uint8_t data) {
+  this->mem_write(static_cast<uint16_t>(STACK) +
+                      static_cast<uint16_t>(this->stack_pointer),
+                  data);
+  this->stack_pointer = uint8_t(stack_pointer - 1);
+}
 
-      case 0x0a: {
-        this->asl_accumulator();
-      }
+inline uint16_t NesCpu::stack_pop_u16() {
+  uint16_t lo = static_cast<uint16_t>(this->stack_pop());
+  uint16_t hi = static_cast<uint16_t>(this->stack_pop());
 
-      case 0x2a: {
-        this->rol_accumulator();
-        break;
-      }
+  return hi << 8 | lo;
+}
 
-      case 0x26:
-      case 0x36:
-      case 0x2e:
-      case 0x3e: {
-        this->rol(opcode->mode);
-        break;
-      }
+inline void NesCpu::stack_push_u16(uint16_t data) {
+  uint8_t hi = (data >> 8) & 0xFF;
+  uint8_t lo = data & 0xFF;
+  this->stack_push(hi);
+  this->stack_push(lo);
+}
 
-      case 0x6a: {
-        this->ror_accumulator();
-        break;
-      }
+inline uint8_t NesCpu::shift_left(uint8_t data) {
+  this->set_flag(CpuFlags::CARRY, (data >> 7) == 1);
+  return data << 1;
+}
 
-      case 0x66:
-      case 0x76:
-      case 0x6e:
-      case 0x7e: {
-        this->ror(opcode->mode);
-        break;
-      }
+inline uint8_t NesCpu::shift_right(uint8_t data) {
+  this->set_flag(CpuFlags::CARRY, (data & 1) == 1);
+  return data >> 1;
+}
 
-      case 0xe6:
-      case 0xf6:
-      case 0xee:
-      case 0xfe: {
-        this->inc(opcode->mode);
-        break;
-      }
+inline uint8_t NesCpu::rotate_left(uint8_t data) {
+  bool old_carry = this->flag(CpuFlags::CARRY);
+  data = this->shift_left(data);
+  if (old_carry) {
+    data = data | 1;
+  }
+  return data;
+}
 
-      case 0xc8: {
-        this->iny();
-      }
+inline uint8_t NesCpu::rotate_right(uint8_t data) {
+  bool old_carry = this->flag(CpuFlags::CARRY);
+  data = this->shift_right(data);
+  if (old_carry) {
+    data = data | 0b10000000;
+  }
+  return data;
+}
 
-      case 0xc6:
-      case 0xd6:
-      case 0xce:
-      case 0xde: {
-        this->dec(opcode->mode);
-        break;
-      }
+inline void NesCpu::inx() {
+  this->register_x = static_cast<uint8_t>(this->register_x + 1);
+  update_zero_and_negative_flags(this->register_x);
+}
 
-      case 0xca: {
-        this->dex();
-        break;
-      }
+inline void NesCpu::iny() {
+  this->register_y = static_cast<uint8_t>(this->register_y + 1);
+  update_zero_and_negative_flags(this->register_y);
+}
 
-      case 0x88: {
-        this->dey();
-        break;
-      }
+inline void NesCpu::dey() {
+  this->register_y = uint8_t(this->register_y - 1);
+  this->update_zero_and_negative_flags(this->register_y);
+}
 
-      case 0xc9:
-      case 0xc5:
-      case 0xd5:
-      case 0xcd:
-      case 0xdd:
-      case 0xd9:
-      case 0xc1:
-      case 0xd1: {
-        this->compare(opcode->mode, this->register_a);
-        break;
-      }
+inline void NesCpu::dex() {
+  this->register_x = uint8_t(this->register_x - 1);
+  this->update_zero_and_negative_flags(this->register_x);
+}
 
-      case 0xc0:
-      case 0xc4:
-      case 0xcc: {
-        this->compare(opcode->mode, this->register_y);
-        break;
-      }
+template <bool Decoded> inline void NesCpu::branch(bool condition) {
+  if (condition) {
+    int8_t jump = static_cast<int8_t>(this->operand_u8<Decoded>());
+    uint16_t next = uint16_t(this->program_counter + 1);
+    uint16_t jump_addr = uint16_t(next + jump);
+    this->cycles += 1 + ((next & 0xFF00) != (jump_addr & 0xFF00));
+    this->program_counter = jump_addr;
+  }
+}
 
-      case 0xe0:
-      case 0xe4:
-      case 0xec: {
-        this->compare(opcode->mode, this->register_x);
-        break;
-      }
+inline void NesCpu::trace_instruction() {
+#ifdef EIZNESS_TRACE
+  if (this->tracer != nullptr) {
+    TraceRecord record;
+    record.cycle = this->cycles;
+    record.program_counter = this->program_counter;
+    record.opcode = this->bus.peek(this->program_counter);
+    record.operand[0] = this->bus.peek(this->program_counter + 1);
+    record.operand[1] = this->bus.peek(this->program_counter + 2);
+    record.register_a = this->register_a;
+    record.register_x = this->register_x;
+    record.register_y = this->register_y;
+    record.status = this->get_status();
+    record.stack_pointer = this->stack_pointer;
+    this->tracer->record(record);
+  }
+#endif
+}
 
-      case 0x4c: {
-        uint16_t mem_address = this->mem_read_u16(this->program_counter);
-        this->program_counter = mem_address;
-        break;
-      }
+template <bool Decoded> EIZNESS_ALWAYS_INLINE uint8_t NesCpu::operand_u8() {
+  if constexpr (Decoded) {
+    return static_cast<uint8_t>(this->decoded_operand);
+  } else {
+    return this->mem_read(this->program_counter);
+  }
+}
 
-      case 0x6c: {
-        uint16_t mem_address = this->mem_read_u16(this->program_counter);
-        uint16_t indirect_ref;
-        if ((mem_address & 0x00FF) == 0x00FF) {
-          uint8_t lo = this->mem_read(mem_address);
-          uint8_t hi = this->mem_read(mem_address & 0xFF00);
-          indirect_ref = (static_cast<uint16_t>(hi) << 8) | lo;
-        } else {
-          indirect_ref = this->mem_read_u16(mem_address);
-        }
-        this->program_counter = indirect_ref;
-        break;
-      }
+template <bool Decoded> EIZNESS_ALWAYS_INLINE uint16_t NesCpu::operand_u16() {
+  if constexpr (Decoded) {
+    return this->decoded_operand;
+  } else {
+    return this->mem_read_u16(this->program_counter);
+  }
+}
 
-      case 0x20: {
-        this->stack_push_u16(this->program_counter + 2 - 1);
-        uint16_t target_address = this->mem_read_u16(this->program_counter);
-        this->program_counter = target_address;
-        break;
-      }
+template <AddressingMode M, bool Decoded>
+EIZNESS_ALWAYS_INLINE uint16_t NesCpu::operand_address() {
+  if constexpr (M == AddressingMode::Immediate) {
+    return this->program_counter;
+  } else if constexpr (M == AddressingMode::ZeroPage) {
+    uint8_t pos = this->operand_u8<Decoded>();
+    return static_cast<uint16_t>(pos);
+  } else if constexpr (M == AddressingMode::Absolute) {
+    return this->operand_u16<Decoded>();
+  } else if constexpr (M == AddressingMode::ZeroPage_X) {
+    uint8_t pos = this->operand_u8<Decoded>();
+    return static_cast<uint8_t>(pos + this->register_x);
+  } else if constexpr (M == AddressingMode::ZeroPage_Y) {
+    uint8_t pos = this->operand_u8<Decoded>();
+    return static_cast<uint8_t>(pos + this->register_y);
+  } else if constexpr (M == AddressingMode::Absolute_X) {
+    uint16_t base = this->operand_u16<Decoded>();
+    return static_cast<uint16_t>(base + this->register_x);
+  } else if constexpr (M == AddressingMode::Absolute_Y) {
+    uint16_t base = this->operand_u16<Decoded>();
+    return static_cast<uint16_t>(base + this->register_y);
+  } else if constexpr (M == AddressingMode::Indirect_X) {
+    uint8_t base = this->operand_u8<Decoded>();
+    uint8_t ptr = static_cast<uint8_t>(base + this->register_x);
+    uint8_t lo = this->mem_read(ptr);
+    uint8_t hi = this->mem_read(static_cast<uint8_t>(ptr + 1));
+    return (static_cast<uint16_t>(hi) << 8) | static_cast<uint16_t>(lo);
+  } else if constexpr (M == AddressingMode::Indirect_Y) {
+    uint8_t base = this->operand_u8<Decoded>();
+    uint8_t lo = this->mem_read(base);
+    uint8_t hi = this->mem_read(static_cast<uint8_t>(base + 1));
+    uint16_t deref_base =
+        (static_cast<uint16_t>(hi) << 8) | static_cast<uint16_t>(lo);
+    return static_cast<uint16_t>(deref_base + this->register_y);
+  } else {
+    static_assert(M != AddressingMode::NoneAddressing,
+                  "NoneAddressing has no operand address");
+  }
+}
 
-      case 0x60: {
-        this->program_counter = this->stack_pop_u16() + 1;
-        break;
-      }
+template <AddressingMode M, bool Decoded>
+EIZNESS_ALWAYS_INLINE uint8_t NesCpu::read_operand() {
+  if constexpr (M == AddressingMode::Immediate && Decoded) {
+    return this->operand_u8<Decoded>();
+  }
+  uint16_t addr = this->operand_address<M, Decoded>();
+  if constexpr (M == AddressingMode::Absolute_X) {
+    this->cycles += (addr & 0xFF) < this->register_x;
+  } else if constexpr (M == AddressingMode::Absolute_Y ||
+                       M == AddressingMode::Indirect_Y) {
+    this->cycles += (addr & 0xFF) < this->register_y;
+  }
+  return this->mem_read(addr);
+}
 
-      case 0x40: {
-        this->status = static_cast<CpuFlags>(this->stack_pop());
-        this->status &= ~CpuFlags::BREAK;
-        this->status |= CpuFlags::BREAK2;
+template <AddressingMode M, bool Decoded> void NesCpu::lda() {
+  uint8_t value = this->read_operand<M, Decoded>();
+  this->set_register_a(value);
+}
 
-        this->program_counter = stack_pop_u16();
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::ldy() {
+  uint8_t value = this->read_operand<M, Decoded>();
 
-      case 0xd0: {
-        this->branch(
-            !static_cast<bool>(status & static_cast<uint8_t>(CpuFlags::ZERO)));
-        break;
-      }
+  this->register_y = value;
+  this->update_zero_and_negative_flags(register_y);
+}
 
-      case 0x70: {
-        this->branch(static_cast<bool>(
-            status & static_cast<uint8_t>(CpuFlags::OVERFLOW)));
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::ldx() {
+  uint8_t value = this->read_operand<M, Decoded>();
 
-      case 0x50: {
-        this->branch(!static_cast<bool>(
-            status & static_cast<uint8_t>(CpuFlags::OVERFLOW)));
-        break;
-      }
+  this->register_x = value;
+  this->update_zero_and_negative_flags(register_x);
+}
 
-      case 0x10: {
-        this->branch(!static_cast<bool>(
-            status & static_cast<uint8_t>(CpuFlags::NEGATIV)));
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::sta() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  this->mem_write(addr, this->register_a);
+}
 
-      case 0x30: {
-        this->branch(static_cast<bool>(
-            status & static_cast<uint8_t>(CpuFlags::NEGATIV)));
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::stx() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  this->mem_write(addr, this->register_x);
+}
 
-      case 0xf0: {
-        this->branch(
-            static_cast<bool>(status & static_cast<uint8_t>(CpuFlags::ZERO)));
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::sty() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  this->mem_write(addr, this->register_y);
+}
 
-      case 0xb0: {
-        this->branch(
-            static_cast<bool>(status & static_cast<uint8_t>(CpuFlags::CARRY)));
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::andd() {
+  uint8_t data = this->read_operand<M, Decoded>();
+  this->set_register_a(data & this->register_a);
+}
 
-      case 0x90: {
-        this->branch(
-            !static_cast<bool>(status & static_cast<uint8_t>(CpuFlags::CARRY)));
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::eor() {
+  uint8_t data = this->read_operand<M, Decoded>();
+  this->set_register_a(data ^ this->register_a);
+}
 
-      case 0x24:
-      case 0x2c: {
-        this->bit(opcode->mode);
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::ora() {
+  uint8_t data = this->read_operand<M, Decoded>();
+  this->set_register_a(data | this->register_a);
+}
 
-      case 0x85:
-      case 0x95:
-      case 0x8d:
-      case 0x9d:
-      case 0x99:
-      case 0x81:
-      case 0x91: {
-        this->sta(opcode->mode);
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::sbc() {
+  uint8_t data = this->read_operand<M, Decoded>();
+  this->add_to_register_a(static_cast<uint8_t>(~data));
+}
 
-      case 0x86:
-      case 0x96:
-      case 0x8e: {
-        uint16_t addr = this->get_operand_address(opcode->mode);
-        this->mem_write(addr, this->register_x);
-        break;
-      }
+template <AddressingMode M, bool Decoded> void NesCpu::adc() {
+  uint8_t value = this->read_operand<M, Decoded>();
+  this->add_to_register_a(value);
+}
 
-      case 0x84:
-      case 0x94:
-      case 0x8c: {
-        uint16_t addr = this->get_operand_address(opcode->mode);
-        this->mem_write(addr, this->register_y);
-        break;
-      }
+template <AddressingMode M, bool Decoded> uint8_t NesCpu::asl() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  uint8_t data = this->shift_left(this->mem_read(addr));
+  this->mem_write(addr, data);
+  this->update_zero_and_negative_flags(data);
 
-      case 0xa2:
-      case 0xa6:
-      case 0xb6:
-      case 0xae:
-      case 0xbe: {
-        this->ldx(opcode->mode);
-        break;
-      }
+  return data;
+}
 
-      case 0xa0:
-      case 0xa4:
-      case 0xb4:
-      case 0xac:
-      case 0xbc: {
-        this->ldy(opcode->mode);
-        break;
-      }
+template <AddressingMode M, bool Decoded> uint8_t NesCpu::lsr() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  uint8_t data = this->shift_right(this->mem_read(addr));
+  this->mem_write(addr, data);
+  this->update_zero_and_negative_flags(data);
 
-      case 0xea: {
+  return data;
+}
 
-        break;
-      }
+template <AddressingMode M, bool Decoded> uint8_t NesCpu::rol() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  uint8_t data = this->rotate_left(this->mem_read(addr));
+  this->mem_write(addr, data);
+  this->update_zero_and_negative_flags(data);
 
-      case 0xa8: {
-        this->register_y = this->register_a;
-        this->update_zero_and_negative_flags(this->register_y);
-        break;
-      }
+  return data;
+}
 
-      case 0xba: {
-        this->register_x = this->stack_pointer;
-        this->update_zero_and_negative_flags(this->register_x);
-        break;
-      }
+template <AddressingMode M, bool Decoded> uint8_t NesCpu::ror() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  uint8_t data = this->rotate_right(this->mem_read(addr));
+  this->mem_write(addr, data);
+  this->update_zero_and_negative_flags(data);
 
-      case 0x8a: {
-        this->register_a = this->register_x;
-        this->update_zero_and_negative_flags(this->register_a);
-        break;
-      }
+  return data;
+}
 
-      case 0x9a: {
-        this->stack_pointer = this->register_x;
-        break;
-      }
+template <AddressingMode M, bool Decoded> uint8_t NesCpu::inc() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  uint8_t data = uint8_t(this->mem_read(addr) + 1);
 
-      case 0x98: {
-        this->register_a = this->register_y;
-        this->update_zero_and_negative_flags(this->register_a);
-        break;
-      }
+  this->mem_write(addr, data);
+  this->update_zero_and_negative_flags(data);
 
-      default: {
-        break;
-      }
-      }
+  return data;
+}
 
-      if (program_counter_state == this->program_counter) {
-        this->program_counter += static_cast<uint16_t>(opcode->len - 1);
-      }
+template <AddressingMode M, bool Decoded> uint8_t NesCpu::dec() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  uint8_t data = uint8_t(this->mem_read(addr) - 1);
+
+  this->mem_write(addr, data);
+  this->update_zero_and_negative_flags(data);
+
+  return data;
+}
+
+// Culpable de los errores
+template <AddressingMode M, bool Decoded> void NesCpu::bit() {
+  uint16_t addr = this->operand_address<M, Decoded>();
+  uint8_t data = this->mem_read(addr);
+  uint8_t andd = this->register_a & data;
+
+#ifdef EIZNESS_LAZY_FLAGS
+  this->flag_result = (andd != 0) | ((data & 0b10000000) << 8);
+#else
+  this->set_flag(CpuFlags::ZERO, andd == 0);
+  this->set_flag(CpuFlags::NEGATIV, (data & 0b10000000) > 0);
+#endif
+  this->set_flag(CpuFlags::OVERFLOW, (data & 0b01000000) > 0);
+}
 
-      callback(*this);
-    };
+template <AddressingMode M, bool Decoded> void NesCpu::compare(uint8_t compare_with) {
+  uint8_t data = this->read_operand<M, Decoded>();
+  this->set_flag(CpuFlags::CARRY, data <= compare_with);
+  this->update_zero_and_negative_flags(compare_with - data);
+}
+
+template <uint8_t Code, bool Decoded> void NesCpu::execute() {
+  constexpr OpCode op = OPCODES_TABLE[Code];
+  constexpr Instruction ins = op.instruction;
+  uint16_t program_counter_state = this->program_counter;
+
+  if constexpr (ins == Instruction::ADC) {
+    this->adc<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::AND) {
+    this->andd<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::ASL) {
+    if constexpr (op.mode == AddressingMode::NoneAddressing) {
+      this->asl_accumulator();
+    } else {
+      this->asl<op.mode, Decoded>();
+    }
+  } else if constexpr (ins == Instruction::BCC) {
+    this->branch<Decoded>(!this->flag(CpuFlags::CARRY));
+  } else if constexpr (ins == Instruction::BCS) {
+    this->branch<Decoded>(this->flag(CpuFlags::CARRY));
+  } else if constexpr (ins == Instruction::BEQ) {
+    this->branch<Decoded>(this->flag(CpuFlags::ZERO));
+  } else if constexpr (ins == Instruction::BIT) {
+    this->bit<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::BMI) {
+    this->branch<Decoded>(this->flag(CpuFlags::NEGATIV));
+  } else if constexpr (ins == Instruction::BNE) {
+    this->branch<Decoded>(!this->flag(CpuFlags::ZERO));
+  } else if constexpr (ins == Instruction::BPL) {
+    this->branch<Decoded>(!this->flag(CpuFlags::NEGATIV));
+  } else if constexpr (ins == Instruction::BRK) {
+    // In BreakMode::Exit the run loops stop before getting here.
+    this->brk();
+  } else if constexpr (ins == Instruction::BVC) {
+    this->branch<Decoded>(!this->flag(CpuFlags::OVERFLOW));
+  } else if constexpr (ins == Instruction::BVS) {
+    this->branch<Decoded>(this->flag(CpuFlags::OVERFLOW));
+  } else if constexpr (ins == Instruction::CLC) {
+    this->clear_carry_flag();
+  } else if constexpr (ins == Instruction::CLD) {
+    this->set_flag(CpuFlags::DECIMAL_MODE, false);
+  } else if constexpr (ins == Instruction::CLI) {
+    this->set_flag(CpuFlags::INTERRUPT_DISABLE, false);
+  } else if constexpr (ins == Instruction::CLV) {
+    this->set_flag(CpuFlags::OVERFLOW, false);
+  } else if constexpr (ins == Instruction::CMP) {
+    this->compare<op.mode, Decoded>(this->register_a);
+  } else if constexpr (ins == Instruction::CPX) {
+    this->compare<op.mode, Decoded>(this->register_x);
+  } else if constexpr (ins == Instruction::CPY) {
+    this->compare<op.mode, Decoded>(this->register_y);
+  } else if constexpr (ins == Instruction::DEC) {
+    this->dec<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::DEX) {
+    this->dex();
+  } else if constexpr (ins == Instruction::DEY) {
+    this->dey();
+  } else if constexpr (ins == Instruction::EOR) {
+    this->eor<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::INC) {
+    this->inc<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::INX) {
+    this->inx();
+  } else if constexpr (ins == Instruction::INY) {
+    this->iny();
+  } else if constexpr (ins == Instruction::JMP) {
+    if constexpr (Code == 0x6c) {
+      this->jmp_indirect();
+    } else {
+      if constexpr (Decoded) {
+        this->program_counter = this->decoded_operand;
+      } else {
+        this->jmp_absolute();
+      }
+    }
+  } else if constexpr (ins == Instruction::JSR) {
+    if constexpr (Decoded) {
+      this->jsr_to(this->decoded_operand);
+    } else {
+      this->jsr();
+    }
+  } else if constexpr (ins == Instruction::LDA) {
+    this->lda<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::LDX) {
+    this->ldx<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::LDY) {
+    this->ldy<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::LSR) {
+    if constexpr (op.mode == AddressingMode::NoneAddressing) {
+      this->lsr_accumulator();
+    } else {
+      this->lsr<op.mode, Decoded>();
+    }
+  } else if constexpr (ins == Instruction::NOP) {
+  } else if constexpr (ins == Instruction::ORA) {
+    this->ora<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::PHA) {
+    this->pha();
+  } else if constexpr (ins == Instruction::PHP) {
+    this->php();
+  } else if constexpr (ins == Instruction::PLA) {
+    this->pla();
+  } else if constexpr (ins == Instruction::PLP) {
+    this->plp();
+  } else if constexpr (ins == Instruction::ROL) {
+    if constexpr (op.mode == AddressingMode::NoneAddressing) {
+      this->rol_accumulator();
+    } else {
+      this->rol<op.mode, Decoded>();
+    }
+  } else if constexpr (ins == Instruction::ROR) {
+    if constexpr (op.mode == AddressingMode::NoneAddressing) {
+      this->ror_accumulator();
+    } else {
+      this->ror<op.mode, Decoded>();
+    }
+  } else if constexpr (ins == Instruction::RTI) {
+    this->rti();
+  } else if constexpr (ins == Instruction::RTS) {
+    this->rts();
+  } else if constexpr (ins == Instruction::SBC) {
+    this->sbc<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::SEC) {
+    this->set_carry_flag();
+  } else if constexpr (ins == Instruction::SED) {
+    this->set_flag(CpuFlags::DECIMAL_MODE, true);
+  } else if constexpr (ins == Instruction::SEI) {
+    this->set_flag(CpuFlags::INTERRUPT_DISABLE, true);
+  } else if constexpr (ins == Instruction::STA) {
+    this->sta<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::STX) {
+    this->stx<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::STY) {
+    this->sty<op.mode, Decoded>();
+  } else if constexpr (ins == Instruction::TAX) {
+    this->tax();
+  } else if constexpr (ins == Instruction::TAY) {
+    this->tay();
+  } else if constexpr (ins == Instruction::TSX) {
+    this->tsx();
+  } else if constexpr (ins == Instruction::TXA) {
+    this->txa();
+  } else if constexpr (ins == Instruction::TXS) {
+    this->txs();
+  } else if constexpr (ins == Instruction::TYA) {
+    this->tya();
+  } else {
+    throw std::runtime_error("opcode no soportado");
+  }
+
+  if (program_counter_state == this->program_counter) {
+    this->program_counter += static_cast<uint16_t>(op.len - 1);
+  }
+  this->cycles += op.cycles;
+}
+
+inline bool NesCpu::line_dirty(uint16_t addr) const {
+  return (this->dirty_lines[addr >> 12] >> ((addr >> DIRTY_LINE_SHIFT) & 63)) &
+         1;
+}
+
+template <typename F>
+void NesCpu::drain_dirty_lines(uint16_t first, uint16_t last, F &&visit) {
+  std::size_t first_line = first >> DIRTY_LINE_SHIFT;
+  std::size_t last_line = last >> DIRTY_LINE_SHIFT;
+  for (std::size_t word = first_line / 64; word <= last_line / 64; word++) {
+    uint64_t bits = this->dirty_lines[word];
+    if (word == first_line / 64) {
+      bits &= ~static_cast<uint64_t>(0) << (first_line % 64);
+    }
+    if (word == last_line / 64 && last_line % 64 != 63) {
+      bits &= (static_cast<uint64_t>(1) << (last_line % 64 + 1)) - 1;
+    }
+    this->dirty_lines[word] &= ~bits;
+    while (bits != 0) {
+      std::size_t line = word * 64 + count_trailing_zeros(bits);
+      bits &= bits - 1;
+      visit(static_cast<uint16_t>(line << DIRTY_LINE_SHIFT));
+    }
+  }
+}
+
+template <typename P>
+RunResult NesCpu::run_until(const RunLimits &limits, P &&stop) {
+  RunResult result = {StopReason::Break, 0, 0};
+  uint64_t start_cycles = this->cycles;
+  uint64_t cycle_target = limits.max_cycles == UINT64_MAX
+                              ? UINT64_MAX
+                              : start_cycles + limits.max_cycles;
+
+  if (limits.max_instructions == 0) {
+    result.reason = StopReason::InstructionLimit;
+    return result;
+  }
+  if (limits.max_cycles == 0) {
+    result.reason = StopReason::CycleLimit;
+    return result;
+  }
+  if (limits.break_at == this->program_counter) {
+    result.reason = StopReason::Breakpoint;
+    return result;
+  }
+
+  this->write_watch = limits.watch_write < 0
+                          ? NO_WRITE_WATCH
+                          : static_cast<uint32_t>(limits.watch_write);
+  this->write_watch_hit = false;
+
+  auto keep_running = [&](NesCpu &cpu) {
+    result.instructions += 1;
+    if (cpu.write_watch_hit) {
+      result.reason = StopReason::WriteWatch;
+      return false;
+    }
+    if (result.instructions >= limits.max_instructions) {
+      result.reason = StopReason::InstructionLimit;
+      return false;
+    }
+    if (cpu.cycles >= cycle_target) {
+      result.reason = StopReason::CycleLimit;
+      return false;
+    }
+    if (cpu.program_counter == limits.break_at) {
+      result.reason = StopReason::Breakpoint;
+      return false;
+    }
+    if (stop(cpu)) {
+      result.reason = StopReason::Predicate;
+      return false;
+    }
+    return true;
   };
-};
+  if (this->core == CpuCore::Jit &&
+      std::is_same<std::decay_t<P>, NeverStop>::value) {
+    this->run_jit(keep_running, limits, cycle_target, result.instructions);
+  } else {
+    this->run_while(keep_running);
+  }
+
+  this->write_watch = NO_WRITE_WATCH;
+  result.cycles = this->cycles - start_cycles;
+  return result;
+}
+
+using OpHandler = void (*)(NesCpu &);
+
+template <uint8_t Code> void execute_opcode(NesCpu &cpu) {
+  cpu.execute<Code>();
+}
+
+template <std::size_t... Codes>
+constexpr std::array<OpHandler, sizeof...(Codes)>
+make_opcode_handlers(std::index_sequence<Codes...>) {
+  return {&execute_opcode<static_cast<uint8_t>(Codes)>...};
+}
+
+// One handler per opcode byte, instantiated from OPCODES_TABLE. It sits
+// beside that table instead of in it because every handler is compiled
+// from its descriptor, so a descriptor cannot also point at it.
+inline constexpr std::array<OpHandler, 256> OPCODE_HANDLERS =
+    make_opcode_handlers(std::make_index_sequence<256>{});
+
+// clang-format off
+#define EIZNESS_OPCODE_ROW(X, h)                                               \
+  X(h##0) X(h##1) X(h##2) X(h##3) X(h##4) X(h##5) X(h##6) X(h##7)              \
+  X(h##8) X(h##9) X(h##a) X(h##b) X(h##c) X(h##d) X(h##e) X(h##f)
+#define EIZNESS_OPCODES(X)                                                     \
+  EIZNESS_OPCODE_ROW(X, 0) EIZNESS_OPCODE_ROW(X, 1) EIZNESS_OPCODE_ROW(X, 2)   \
+  EIZNESS_OPCODE_ROW(X, 3) EIZNESS_OPCODE_ROW(X, 4) EIZNESS_OPCODE_ROW(X, 5)   \
+  EIZNESS_OPCODE_ROW(X, 6) EIZNESS_OPCODE_ROW(X, 7) EIZNESS_OPCODE_ROW(X, 8)   \
+  EIZNESS_OPCODE_ROW(X, 9) EIZNESS_OPCODE_ROW(X, a) EIZNESS_OPCODE_ROW(X, b)   \
+  EIZNESS_OPCODE_ROW(X, c) EIZNESS_OPCODE_ROW(X, d) EIZNESS_OPCODE_ROW(X, e)   \
+  EIZNESS_OPCODE_ROW(X, f)
+// clang-format on
+
+// Reference core: one switch over every opcode byte, each case running the
+// same execute<Code>() handler the threaded core uses.
+template <typename F> void NesCpu::run_switch(F &&keep_running) {
+#define EIZNESS_SWITCH_CASE(n)                                                 \
+  case 0x##n: {                                                                \
+    this->execute<0x##n>();                                                    \
+    break;                                                                     \
+  }
+
+  while (true) {
+    if (EIZNESS_UNLIKELY(this->interrupt_lines != 0)) {
+      this->poll_interrupts();
+    }
+    this->trace_instruction();
+    uint8_t code = this->mem_read(this->program_counter);
+    this->program_counter += 1;
+
+    if (code == 0x00 && this->break_mode == BreakMode::Exit) {
+      return;
+    }
+
+    switch (code) { EIZNESS_OPCODES(EIZNESS_SWITCH_CASE) }
+
+    if (!keep_running(*this)) {
+      return;
+    }
+  }
+
+#undef EIZNESS_SWITCH_CASE
+}
+
+// Direct-threaded interpreter: every opcode gets its own copy of the dispatch
+// sequence, so the indirect jump at the end of each handler is predicted per
+// opcode instead of funnelling through a single switch. Compilers without
+// labels-as-values fall back to calling through OPCODE_HANDLERS.
+template <typename F> void NesCpu::run_threaded(F &&keep_running) {
+#if defined(__GNUC__) || defined(__clang__)
+#define EIZNESS_LABEL_ADDRESS(n) &&op_##n,
+#define EIZNESS_DISPATCH()                                                     \
+  if (EIZNESS_UNLIKELY(this->interrupt_lines != 0)) {                          \
+    this->poll_interrupts();                                                   \
+  }                                                                            \
+  this->trace_instruction();                                                   \
+  goto *dispatch_table[this->mem_read(this->program_counter++)]
+#define EIZNESS_THREADED_OP(n)                                                 \
+  op_##n : if (0x##n == 0x00 && this->break_mode == BreakMode::Exit) {         \
+    return;                                                                    \
+  }                                                                            \
+  this->execute<0x##n>();                                                      \
+  if (!keep_running(*this)) {                                                  \
+    return;                                                                    \
+  }                                                                            \
+  EIZNESS_DISPATCH();
+
+  static void *const dispatch_table[256] = {
+      EIZNESS_OPCODES(EIZNESS_LABEL_ADDRESS)};
+
+  EIZNESS_DISPATCH();
+  EIZNESS_OPCODES(EIZNESS_THREADED_OP)
+
+#undef EIZNESS_THREADED_OP
+#undef EIZNESS_DISPATCH
+#undef EIZNESS_LABEL_ADDRESS
+#else
+  while (true) {
+    if (EIZNESS_UNLIKELY(this->interrupt_lines != 0)) {
+      this->poll_interrupts();
+    }
+    this->trace_instruction();
+    uint8_t code = this->mem_read(this->program_counter);
+    this->program_counter += 1;
+    if (code == 0x00 && this->break_mode == BreakMode::Exit) {
+      return;
+    }
+    OPCODE_HANDLERS[code](*this);
+    if (!keep_running(*this)) {
+      return;
+    }
+  }
+#endif
+}
+
+// Block-cached core: looks up the decoded block at the PC, decoding it on a
+// miss, and runs its instructions with the operand bytes fetched at decode
+// time. A block is left early when an instruction jumps or when a write hit
+// a page holding decoded code, which covers code that modifies itself.
+// Within a block the instructions are dispatched like the threaded core,
+// from a jump at the end of every handler.
+template <typename F, typename N>
+void NesCpu::run_cached(F &&keep_running, N &&enter_native) {
+  const DecodedBlock *block = nullptr;
+  const DecodedOp *op;
+  const DecodedOp *end;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define EIZNESS_LABEL_ADDRESS(n) &&cached_##n,
+#define EIZNESS_DISPATCH()                                                     \
+  if (op == end) {                                                             \
+    goto next_block;                                                           \
+  }                                                                            \
+  if (EIZNESS_UNLIKELY(this->interrupt_lines != 0) &&                          \
+      this->poll_interrupts()) {                                               \
+    goto next_block;                                                           \
+  }                                                                            \
+  this->trace_instruction();                                                   \
+  this->program_counter = op->pc + 1;                                          \
+  this->decoded_operand = op->operand;                                         \
+  goto *dispatch_table[op->code]
+#define EIZNESS_CACHED_OP(n)                                                   \
+  cached_##n : if (0x##n == 0x00 && this->break_mode == BreakMode::Exit) {     \
+    return;                                                                    \
+  }                                                                            \
+  this->execute<0x##n, true>();                                                \
+  if (!keep_running(*this)) {                                                  \
+    return;                                                                    \
+  }                                                                            \
+  if constexpr (ends_block(OPCODES_TABLE[0x##n].instruction)) {                \
+    goto next_block;                                                           \
+  }                                                                            \
+  if constexpr (writes_memory(OPCODES_TABLE[0x##n])) {                         \
+    if (EIZNESS_UNLIKELY(this->bus.code_written())) {                          \
+      goto next_block;                                                         \
+    }                                                                          \
+  }                                                                            \
+  op++;                                                                        \
+  EIZNESS_DISPATCH();
+
+  static void *const dispatch_table[256] = {
+      EIZNESS_OPCODES(EIZNESS_LABEL_ADDRESS)};
+#else
+#define EIZNESS_CACHED_CASE(n)                                                 \
+  case 0x##n: {                                                                \
+    this->execute<0x##n, true>();                                              \
+    break;                                                                     \
+  }
+#endif
+
+next_block:
+  // Taken here, an interrupt leads straight to the handler's block.
+  if (EIZNESS_UNLIKELY(this->interrupt_lines != 0)) {
+    this->poll_interrupts();
+  }
+  if (EIZNESS_UNLIKELY(this->bus.code_written())) {
+    this->drop_written_blocks();
+    block = nullptr;
+  }
+  // Tight loops branch back to the start of the block they are in; those
+  // skip the lookup.
+  if (block == nullptr || this->program_counter != block->start) {
+    block = this->blocks.find(this->program_counter);
+    if (block == nullptr) {
+      block = &this->blocks.decode(this->bus, this->program_counter);
+    }
+  }
+  op = block->ops.data();
+  end = op + block->ops.size();
+
+  if (op == end) {
+    // Code on a device page runs uncached, one instruction at a time.
+    this->trace_instruction();
+    uint8_t code = this->mem_read(this->program_counter);
+    this->program_counter += 1;
+    if (code == 0x00 && this->break_mode == BreakMode::Exit) {
+      return;
+    }
+    OPCODE_HANDLERS[code](*this);
+    if (!keep_running(*this)) {
+      return;
+    }
+    goto next_block;
+  }
+  {
+    uint32_t done = 0;
+    if (!enter_native(*block, done)) {
+      return;
+    }
+    op += done;
+  }
+
+#if defined(__GNUC__) || defined(__clang__)
+  EIZNESS_DISPATCH();
+  EIZNESS_OPCODES(EIZNESS_CACHED_OP)
+
+#undef EIZNESS_CACHED_OP
+#undef EIZNESS_DISPATCH
+#undef EIZNESS_LABEL_ADDRESS
+#else
+  for (; op != end; op++) {
+    if (EIZNESS_UNLIKELY(this->interrupt_lines != 0) &&
+        this->poll_interrupts()) {
+      break;
+    }
+    this->trace_instruction();
+    this->program_counter = op->pc + 1;
+    if (op->code == 0x00 && this->break_mode == BreakMode::Exit) {
+      return;
+    }
+    this->decoded_operand = op->operand;
+    switch (op->code) { EIZNESS_OPCODES(EIZNESS_CACHED_CASE) }
+
+    if (!keep_running(*this)) {
+      return;
+    }
+    if (this->program_counter != static_cast<uint16_t>(op->pc + op->len) ||
+        EIZNESS_UNLIKELY(this->bus.code_written())) {
+      break;
+    }
+  }
+  goto next_block;
+
+#undef EIZNESS_CACHED_CASE
+#endif
+}
+
+inline bool NesCpu::can_run_native(const JitBlock &native,
+                                   const DecodedBlock &block,
+                                   const RunLimits &limits,
+                                   uint64_t cycle_target,
+                                   uint64_t instructions) const {
+#ifdef EIZNESS_TRACE
+  if (this->tracer != nullptr) {
+    return false;
+  }
+#endif
+  // Compiled code does not poll interrupts. A masked IRQ can wait out the
+  // block, unless the block clears I with CLI or PLP.
+  if (this->interrupt_lines != 0) {
+    if (this->interrupt_lines != IRQ_LINE ||
+        !this->flag(CpuFlags::INTERRUPT_DISABLE)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < native.length; i++) {
+      if (block.ops[i].code == 0x58 || block.ops[i].code == 0x28) {
+        return false;
+      }
+    }
+  }
+  // Every instruction but the last must leave all limits untouched.
+  if (limits.max_instructions - instructions < native.length ||
+      cycle_target - this->cycles <= native.max_cycles) {
+    return false;
+  }
+  if (limits.break_at >= 0) {
+    for (uint32_t i = 1; i < native.length; i++) {
+      if (block.ops[i].pc == limits.break_at) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename F>
+void NesCpu::run_jit(F &&keep_running, const RunLimits &limits,
+                     uint64_t cycle_target, uint64_t &instructions) {
+  // Compiled code stops early before anything it cannot do itself; the
+  // interpreter picks up from there to the end of the block.
+  this->run_cached(keep_running, [&](const DecodedBlock &block,
+                                     uint32_t &done) {
+    const JitBlock *native = this->jit.lookup(block);
+    if (native == nullptr ||
+        !this->can_run_native(*native, block, limits, cycle_target,
+                              instructions)) {
+      return true;
+    }
+    // Further passes of a self-looping block must stay within the
+    // instruction limit and may not reach break_at at its start.
+    uint64_t loop_budget =
+        this->program_counter == limits.break_at
+            ? 0
+            : limits.max_instructions - instructions - native->length;
+    done = this->run_native(*native, loop_budget, cycle_target, instructions);
+    if (done == 0) {
+      return true;
+    }
+    instructions += done - 1;
+    return keep_running(*this);
+  });
+}
+
+#undef EIZNESS_OPCODES
+#undef EIZNESS_OPCODE_ROW
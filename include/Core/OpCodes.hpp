@@ -0,0 +1,333 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+enum class AddressingMode {
+  Immediate,
+  ZeroPage,
+  ZeroPage_X,
+  ZeroPage_Y,
+  Absolute,
+  Absolute_X,
+  Absolute_Y,
+  Indirect_X,
+  Indirect_Y,
+  NoneAddressing,
+};
+
+enum class Instruction : uint8_t {
+  // clang-format off
+  ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC,
+  CLD, CLI, CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP,
+  JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTI,
+  RTS, SBC, SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA,
+  // clang-format on
+  Illegal,
+};
+
+inline constexpr std::array<const char *, 57> INSTRUCTION_MNEMONICS = {
+    // clang-format off
+    "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL",
+    "BRK", "BVC", "BVS", "CLC", "CLD", "CLI", "CLV", "CMP", "CPX", "CPY",
+    "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA",
+    "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL",
+    "ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY",
+    "TAX", "TAY", "TSX", "TXA", "TXS", "TYA", "???",
+    // clang-format on
+};
+
+constexpr bool mnemonic_equals(const char *lhs, const char *rhs) {
+  while (*lhs != '\0' && *lhs == *rhs) {
+    lhs++;
+    rhs++;
+  }
+  return *lhs == *rhs;
+}
+
+// Resolved at compile time, an unknown mnemonic maps to Instruction::Illegal.
+constexpr Instruction instruction_from_mnemonic(const char *mnemonic) {
+  for (std::size_t i = 0; i < INSTRUCTION_MNEMONICS.size(); i++) {
+    if (mnemonic_equals(INSTRUCTION_MNEMONICS[i], mnemonic)) {
+      return static_cast<Instruction>(i);
+    }
+  }
+  return Instruction::Illegal;
+}
+
+struct OpCode {
+  uint8_t code;
+  const char *mnemonic;
+  uint8_t len;
+  uint8_t cycles;
+  AddressingMode mode;
+  Instruction instruction;
+};
+
+constexpr OpCode createOpCode(uint8_t code, const char *mnemonic, uint8_t len,
+                              uint8_t cycles, AddressingMode mode) {
+  return {code, mnemonic, len, cycles, mode,
+          instruction_from_mnemonic(mnemonic)};
+}
+
+inline constexpr std::array CPU_OPS_CODES = {
+    createOpCode(0x00, "BRK", 1, 7, AddressingMode::NoneAddressing),
+    createOpCode(0xea, "NOP", 1, 2, AddressingMode::NoneAddressing),
+
+    /* Arithmetic */
+    createOpCode(0x69, "ADC", 2, 2, AddressingMode::Immediate),
+    createOpCode(0x65, "ADC", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0x75, "ADC", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0x6d, "ADC", 3, 4, AddressingMode::Absolute),
+    createOpCode(0x7d, "ADC", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_X),
+    createOpCode(0x79, "ADC", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_Y),
+    createOpCode(0x61, "ADC", 2, 6, AddressingMode::Indirect_X),
+    createOpCode(0x71, "ADC", 2, 5 /*+1 if page crossed*/,
+                 AddressingMode::Indirect_Y),
+
+    createOpCode(0xe9, "SBC", 2, 2, AddressingMode::Immediate),
+    createOpCode(0xe5, "SBC", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0xf5, "SBC", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0xed, "SBC", 3, 4, AddressingMode::Absolute),
+    createOpCode(0xfd, "SBC", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_X),
+    createOpCode(0xf9, "SBC", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_Y),
+    createOpCode(0xe1, "SBC", 2, 6, AddressingMode::Indirect_X),
+    createOpCode(0xf1, "SBC", 2, 5 /*+1 if page crossed*/,
+                 AddressingMode::Indirect_Y),
+
+    createOpCode(0x29, "AND", 2, 2, AddressingMode::Immediate),
+    createOpCode(0x25, "AND", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0x35, "AND", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0x2d, "AND", 3, 4, AddressingMode::Absolute),
+    createOpCode(0x3d, "AND", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_X),
+    createOpCode(0x39, "AND", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_Y),
+    createOpCode(0x21, "AND", 2, 6, AddressingMode::Indirect_X),
+    createOpCode(0x31, "AND", 2, 5 /*+1 if page crossed*/,
+                 AddressingMode::Indirect_Y),
+
+    createOpCode(0x49, "EOR", 2, 2, AddressingMode::Immediate),
+    createOpCode(0x45, "EOR", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0x55, "EOR", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0x4d, "EOR", 3, 4, AddressingMode::Absolute),
+    createOpCode(0x5d, "EOR", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_X),
+    createOpCode(0x59, "EOR", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_Y),
+    createOpCode(0x41, "EOR", 2, 6, AddressingMode::Indirect_X),
+    createOpCode(0x51, "EOR", 2, 5 /*+1 if page crossed*/,
+                 AddressingMode::Indirect_Y),
+
+    createOpCode(0x09, "ORA", 2, 2, AddressingMode::Immediate),
+    createOpCode(0x05, "ORA", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0x15, "ORA", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0x0d, "ORA", 3, 4, AddressingMode::Absolute),
+    createOpCode(0x1d, "ORA", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_X),
+    createOpCode(0x19, "ORA", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_Y),
+    createOpCode(0x01, "ORA", 2, 6, AddressingMode::Indirect_X),
+    createOpCode(0x11, "ORA", 2, 5 /*+1 if page crossed*/,
+                 AddressingMode::Indirect_Y),
+
+    /* Shifts */
+    createOpCode(0x0a, "ASL", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x06, "ASL", 2, 5, AddressingMode::ZeroPage),
+    createOpCode(0x16, "ASL", 2, 6, AddressingMode::ZeroPage_X),
+    createOpCode(0x0e, "ASL", 3, 6, AddressingMode::Absolute),
+    createOpCode(0x1e, "ASL", 3, 7, AddressingMode::Absolute_X),
+
+    createOpCode(0x4a, "LSR", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x46, "LSR", 2, 5, AddressingMode::ZeroPage),
+    createOpCode(0x56, "LSR", 2, 6, AddressingMode::ZeroPage_X),
+    createOpCode(0x4e, "LSR", 3, 6, AddressingMode::Absolute),
+    createOpCode(0x5e, "LSR", 3, 7, AddressingMode::Absolute_X),
+
+    createOpCode(0x2a, "ROL", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x26, "ROL", 2, 5, AddressingMode::ZeroPage),
+    createOpCode(0x36, "ROL", 2, 6, AddressingMode::ZeroPage_X),
+    createOpCode(0x2e, "ROL", 3, 6, AddressingMode::Absolute),
+    createOpCode(0x3e, "ROL", 3, 7, AddressingMode::Absolute_X),
+
+    createOpCode(0x6a, "ROR", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x66, "ROR", 2, 5, AddressingMode::ZeroPage),
+    createOpCode(0x76, "ROR", 2, 6, AddressingMode::ZeroPage_X),
+    createOpCode(0x6e, "ROR", 3, 6, AddressingMode::Absolute),
+    createOpCode(0x7e, "ROR", 3, 7, AddressingMode::Absolute_X),
+
+    createOpCode(0xe6, "INC", 2, 5, AddressingMode::ZeroPage),
+    createOpCode(0xf6, "INC", 2, 6, AddressingMode::ZeroPage_X),
+    createOpCode(0xee, "INC", 3, 6, AddressingMode::Absolute),
+    createOpCode(0xfe, "INC", 3, 7, AddressingMode::Absolute_X),
+
+    createOpCode(0xe8, "INX", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0xc8, "INY", 1, 2, AddressingMode::NoneAddressing),
+
+    createOpCode(0xc6, "DEC", 2, 5, AddressingMode::ZeroPage),
+    createOpCode(0xd6, "DEC", 2, 6, AddressingMode::ZeroPage_X),
+    createOpCode(0xce, "DEC", 3, 6, AddressingMode::Absolute),
+    createOpCode(0xde, "DEC", 3, 7, AddressingMode::Absolute_X),
+
+    createOpCode(0xca, "DEX", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x88, "DEY", 1, 2, AddressingMode::NoneAddressing),
+
+    createOpCode(0xc9, "CMP", 2, 2, AddressingMode::Immediate),
+    createOpCode(0xc5, "CMP", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0xd5, "CMP", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0xcd, "CMP", 3, 4, AddressingMode::Absolute),
+    createOpCode(0xdd, "CMP", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_X),
+    createOpCode(0xd9, "CMP", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_Y),
+    createOpCode(0xc1, "CMP", 2, 6, AddressingMode::Indirect_X),
+    createOpCode(0xd1, "CMP", 2, 5 /*+1 if page crossed*/,
+                 AddressingMode::Indirect_Y),
+
+    createOpCode(0xc0, "CPY", 2, 2, AddressingMode::Immediate),
+    createOpCode(0xc4, "CPY", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0xcc, "CPY", 3, 4, AddressingMode::Absolute),
+
+    createOpCode(0xe0, "CPX", 2, 2, AddressingMode::Immediate),
+    createOpCode(0xe4, "CPX", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0xec, "CPX", 3, 4, AddressingMode::Absolute),
+
+    /* Branching */
+
+    createOpCode(0x4c, "JMP", 3, 3,
+                 AddressingMode::NoneAddressing), // AddressingMode that acts as
+                                                  // Immidiate
+    createOpCode(0x6c, "JMP", 3, 5,
+                 AddressingMode::NoneAddressing), // AddressingMode:Indirect
+                                                  // with 6502 bug
+
+    createOpCode(0x20, "JSR", 3, 6, AddressingMode::NoneAddressing),
+    createOpCode(0x60, "RTS", 1, 6, AddressingMode::NoneAddressing),
+
+    createOpCode(0x40, "RTI", 1, 6, AddressingMode::NoneAddressing),
+
+    createOpCode(0xd0, "BNE", 2,
+                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
+                 AddressingMode::NoneAddressing),
+    createOpCode(0x70, "BVS", 2,
+                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
+                 AddressingMode::NoneAddressing),
+    createOpCode(0x50, "BVC", 2,
+                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
+                 AddressingMode::NoneAddressing),
+    createOpCode(0x30, "BMI", 2,
+                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
+                 AddressingMode::NoneAddressing),
+    createOpCode(0xf0, "BEQ", 2,
+                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
+                 AddressingMode::NoneAddressing),
+    createOpCode(0xb0, "BCS", 2,
+                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
+                 AddressingMode::NoneAddressing),
+    createOpCode(0x90, "BCC", 2,
+                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
+                 AddressingMode::NoneAddressing),
+    createOpCode(0x10, "BPL", 2,
+                 2 /*(+1 if branch succeeds +2 if to a new page)*/,
+                 AddressingMode::NoneAddressing),
+
+    createOpCode(0x24, "BIT", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0x2c, "BIT", 3, 4, AddressingMode::Absolute),
+
+    /* Stores, Loads */
+    createOpCode(0xa9, "LDA", 2, 2, AddressingMode::Immediate),
+    createOpCode(0xa5, "LDA", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0xb5, "LDA", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0xad, "LDA", 3, 4, AddressingMode::Absolute),
+    createOpCode(0xbd, "LDA", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_X),
+    createOpCode(0xb9, "LDA", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_Y),
+    createOpCode(0xa1, "LDA", 2, 6, AddressingMode::Indirect_X),
+    createOpCode(0xb1, "LDA", 2, 5 /*+1 if page crossed*/,
+                 AddressingMode::Indirect_Y),
+
+    createOpCode(0xa2, "LDX", 2, 2, AddressingMode::Immediate),
+    createOpCode(0xa6, "LDX", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0xb6, "LDX", 2, 4, AddressingMode::ZeroPage_Y),
+    createOpCode(0xae, "LDX", 3, 4, AddressingMode::Absolute),
+    createOpCode(0xbe, "LDX", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_Y),
+
+    createOpCode(0xa0, "LDY", 2, 2, AddressingMode::Immediate),
+    createOpCode(0xa4, "LDY", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0xb4, "LDY", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0xac, "LDY", 3, 4, AddressingMode::Absolute),
+    createOpCode(0xbc, "LDY", 3, 4 /*+1 if page crossed*/,
+                 AddressingMode::Absolute_X),
+
+    createOpCode(0x85, "STA", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0x95, "STA", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0x8d, "STA", 3, 4, AddressingMode::Absolute),
+    createOpCode(0x9d, "STA", 3, 5, AddressingMode::Absolute_X),
+    createOpCode(0x99, "STA", 3, 5, AddressingMode::Absolute_Y),
+    createOpCode(0x81, "STA", 2, 6, AddressingMode::Indirect_X),
+    createOpCode(0x91, "STA", 2, 6, AddressingMode::Indirect_Y),
+
+    createOpCode(0x86, "STX", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0x96, "STX", 2, 4, AddressingMode::ZeroPage_Y),
+    createOpCode(0x8e, "STX", 3, 4, AddressingMode::Absolute),
+
+    createOpCode(0x84, "STY", 2, 3, AddressingMode::ZeroPage),
+    createOpCode(0x94, "STY", 2, 4, AddressingMode::ZeroPage_X),
+    createOpCode(0x8c, "STY", 3, 4, AddressingMode::Absolute),
+
+    /* Flags clear */
+
+    createOpCode(0xD8, "CLD", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x58, "CLI", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0xb8, "CLV", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x18, "CLC", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x38, "SEC", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x78, "SEI", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0xf8, "SED", 1, 2, AddressingMode::NoneAddressing),
+
+    createOpCode(0xaa, "TAX", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0xa8, "TAY", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0xba, "TSX", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x8a, "TXA", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x9a, "TXS", 1, 2, AddressingMode::NoneAddressing),
+    createOpCode(0x98, "TYA", 1, 2, AddressingMode::NoneAddressing),
+
+    /* Stack */
+    createOpCode(0x48, "PHA", 1, 3, AddressingMode::NoneAddressing),
+    createOpCode(0x68, "PLA", 1, 4, AddressingMode::NoneAddressing),
+    createOpCode(0x08, "PHP", 1, 3, AddressingMode::NoneAddressing),
+    createOpCode(0x28, "PLP", 1, 4, AddressingMode::NoneAddressing),
+
+};
+
+// Dense decode table indexed directly by the fetched byte. Every slot not
+// listed in CPU_OPS_CODES is filled with an explicit illegal descriptor, so
+// decoding never misses and the whole table is built at compile time.
+// A descriptor names its Instruction rather than holding a handler: the
+// handlers are compiled from these descriptors, one per byte, into
+// OPCODE_HANDLERS in NesCpu.hpp, which is indexed the same way.
+constexpr std::array<OpCode, 256> build_opcodes_table() {
+  std::array<OpCode, 256> table{};
+  for (std::size_t i = 0; i < table.size(); i++) {
+    table[i] = createOpCode(static_cast<uint8_t>(i), "???", 1, 2,
+                            AddressingMode::NoneAddressing);
+  }
+  for (const OpCode &cpuop : CPU_OPS_CODES) {
+    table[cpuop.code] = cpuop;
+  }
+  return table;
+}
+
+inline constexpr std::array<OpCode, 256> OPCODES_TABLE = build_opcodes_table();
+
+static_assert(OPCODES_TABLE[0xa9].instruction == Instruction::LDA,
+              "LDA #imm must decode through the dense table");
+static_assert(OPCODES_TABLE[0x02].instruction == Instruction::Illegal,
+              "unassigned slots must be marked illegal");
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "Core/Bus.hpp"
+#include "Core/Cartridge.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class NesCpu;
+
+const std::size_t PPU_SCREEN_WIDTH = 256;
+const std::size_t PPU_SCREEN_HEIGHT = 240;
+const uint32_t PPU_DOTS_PER_SCANLINE = 341;
+const uint32_t PPU_SCANLINES_PER_FRAME = 262;
+const uint32_t PPU_VBLANK_SCANLINE = 241;
+const uint32_t PPU_PRERENDER_SCANLINE = 261;
+const uint64_t PPU_DOTS_PER_CPU_CYCLE = 3;
+// CPU cycles an OAM DMA takes, plus one when it starts on an odd cycle.
+const uint64_t OAM_DMA_CYCLES = 513;
+
+enum class PpuMode {
+  // Draws each visible scanline in one pass at its first dot, from tile
+  // rows decoded once per CHR byte. Scroll, palette and OAM changes made
+  // while a scanline is drawn show from the next one.
+  Scanline,
+  // Steps every dot through the background fetches and shift registers
+  // like the 2C02 does. Several times slower; meant for tests.
+  Dot,
+};
+
+// Packed 0xRRGGBB of each of the 64 colours the PPU outputs.
+uint32_t ppu_color_rgb(uint8_t color);
+
+// The 2C02 picture processing unit. It sees the CPU's registers at
+// $2000-$3FFF (eight, mirrored) and OAM DMA at $4014, and renders into a
+// 256x240 frame of colour indices.
+//
+// The PPU runs three dots per CPU cycle but does not step along with the
+// CPU: every register access first catches it up to NesCpu::cycles (the
+// cycle the accessing instruction started on), and hosts call catch_up()
+// at their frame or batch boundaries, or schedule next_vblank_cycle() so
+// that the vblank NMI reaches the attached CPU on time.
+//
+// PPU state is not part of CPU snapshots or state hashes.
+class NesPpu : public BusDevice {
+public:
+  PpuMode mode;
+
+  NesPpu();
+  NesPpu(const NesPpu &) = delete;
+  NesPpu &operator=(const NesPpu &) = delete;
+
+  // Takes CHR-ROM and nametable mirroring from `cartridge`, which has to
+  // outlive the PPU. Without it, or for a cartridge without CHR-ROM, the
+  // pattern tables are 8KB of CHR-RAM.
+  void insert_cartridge(const Cartridge &cartridge);
+  // Maps the registers on `cpu`'s bus: $2000-$3FFF and the $40xx page,
+  // where only $4014 is implemented. The PPU clock starts at cpu.cycles.
+  void attach(NesCpu &cpu);
+  // Runs the PPU up to the attached CPU's cycle count.
+  void catch_up();
+  // First CPU cycle by which the PPU has entered the next vblank, counted
+  // from where the last catch_up() left it.
+  uint64_t next_vblank_cycle() const;
+  // True once for every NMI raised since the last call. Each one has also
+  // been latched on the attached CPU.
+  bool take_nmi();
+
+  uint8_t read(uint16_t addr) override;
+  void write(uint16_t addr, uint8_t data) override;
+  uint8_t peek(uint16_t addr) override;
+
+  // The PPU address space: pattern tables, nametables and palette.
+  uint8_t ppu_read(uint16_t addr) const;
+  void ppu_write(uint16_t addr, uint8_t data);
+
+  // Colour indices (0-63) of the frame being drawn; complete once
+  // frame_count() advanced.
+  const std::array<uint8_t, PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT> &
+  frame() const {
+    return this->pixels;
+  }
+  // Vblanks entered so far.
+  uint64_t frame_count() const { return this->frames; }
+  uint32_t scanline() const { return this->line; }
+  uint32_t dot() const { return this->line_dot; }
+
+private:
+  // A sprite picked for the scanline being drawn, its pattern row already
+  // flipped.
+  struct LineSprite {
+    uint8_t x;
+    uint8_t attributes;
+    uint8_t low;
+    uint8_t high;
+    bool zero;
+  };
+
+  uint32_t line_length() const;
+  bool rendering() const { return (this->mask & 0x18) != 0; }
+  void run_to(uint64_t target);
+  void advance(uint32_t dots);
+  void start_vblank();
+  void raise_nmi();
+
+  uint32_t next_event() const;
+  void scanline_event();
+  void render_line(uint32_t line);
+  void step_dot();
+  void load_shifters();
+
+  void evaluate_sprites(uint32_t line);
+  // Mixes the background pixel `background` (palette << 2 | pixel, 0 when
+  // transparent) with the sprites at `x` into a colour index. Sets `hit`
+  // on a sprite 0 hit.
+  uint8_t compose(uint32_t x, uint8_t background, bool &hit) const;
+  uint8_t backdrop() const;
+
+  void increment_x();
+  void increment_y();
+  void copy_x();
+  void copy_y();
+
+  std::size_t nametable_index(uint16_t addr) const;
+  void decode_tile_row(std::size_t tile, std::size_t row);
+
+  NesCpu *cpu;
+  const uint8_t *chr;
+  std::vector<uint8_t> chr_ram;
+  Mirroring mirroring;
+  std::array<uint8_t, 0x1000> vram;
+  std::array<uint8_t, 0x20> palette;
+  std::array<uint8_t, 0x100> oam;
+  // Pixel values (0-3) of every pattern table row, one byte per pixel in
+  // memory order, indexed by tile * 8 + row with tiles 0-511 across both
+  // tables.
+  std::array<uint64_t, 512 * 8> tile_rows;
+
+  uint8_t ctrl;
+  uint8_t mask;
+  uint8_t status;
+  uint8_t oam_addr;
+  uint8_t read_buffer;
+  // Last value written to any register; unused status bits read it back.
+  uint8_t io_latch;
+  // Loopy's current and temporary VRAM addresses, fine X and the shared
+  // $2005/$2006 write toggle.
+  uint16_t v;
+  uint16_t t;
+  uint8_t fine_x;
+  bool w;
+
+  uint32_t line;
+  uint32_t line_dot;
+  // Dots run since power-on, counting from the CPU cycle at attach().
+  uint64_t clock;
+  uint64_t frames;
+  bool odd_frame;
+  bool nmi;
+
+  std::array<LineSprite, 8> sprites;
+  uint8_t sprite_count;
+  // Scanline mode: dot of the current scanline at which sprite 0 hits, or
+  // PPU_DOTS_PER_SCANLINE.
+  uint32_t sprite_zero_dot;
+  // Dot mode: the background pipeline.
+  uint16_t pattern_low;
+  uint16_t pattern_high;
+  uint16_t attribute_low;
+  uint16_t attribute_high;
+  uint8_t next_tile;
+  uint8_t next_attribute;
+  uint8_t next_low;
+  uint8_t next_high;
+
+  std::array<uint8_t, PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT> pixels;
+};
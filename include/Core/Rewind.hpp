@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Core/NesCpu.hpp"
+#include "Core/Snapshot.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Captures between two keyframes, one second of frames at 60 per second.
+const uint32_t REWIND_KEYFRAME_INTERVAL = 60;
+const std::size_t REWIND_DEFAULT_CAPACITY = 16 << 20;
+
+// One captured point. The registers are kept as they are; `data` is the
+// bus image as XOR runs against the previous capture, or against an
+// all-zero image for a keyframe:
+//   per page that differs, u8 page, then tokens covering its 256 bytes:
+//   t < 0x80 is t + 1 unchanged bytes, t >= 0x80 is t - 0x7F XOR bytes
+//   that follow it.
+struct RewindFrame {
+  uint64_t cycles;
+  uint8_t register_a;
+  uint8_t register_x;
+  uint8_t register_y;
+  uint8_t status;
+  uint8_t stack_pointer;
+  uint8_t interrupt_lines;
+  uint16_t program_counter;
+  bool keyframe;
+  std::vector<uint8_t> data;
+};
+
+struct RewindStats {
+  std::size_t frames;
+  std::size_t keyframes;
+  // Encoded frames plus their bookkeeping.
+  std::size_t bytes;
+  uint64_t first_cycle;
+  uint64_t last_cycle;
+};
+
+// A bounded history of a CPU for stepping backwards. Every capture stores
+// only the pages written since the previous one, as XOR deltas, with a
+// full keyframe every `keyframe_interval` captures; when the buffer goes
+// over `capacity` bytes the oldest keyframe and its deltas are dropped.
+// Seeking restores the nearest capture at or before the target and
+// re-executes from there, so it costs at most one keyframe interval of
+// decoding plus the emulation between two captures.
+//
+// Captures use cpu.snapshot(), whose shared pages tell which ones changed,
+// and the bus layout is not recorded, as with snapshots.
+class RewindBuffer {
+public:
+  explicit RewindBuffer(std::size_t capacity = REWIND_DEFAULT_CAPACITY,
+                        uint32_t keyframe_interval = REWIND_KEYFRAME_INTERVAL);
+
+  // Records the state of `cpu`. Hosts capture at the points where they
+  // apply external input, after applying it, so that re-running from one
+  // capture reproduces everything up to the next. A capture at or before
+  // the newest one (after a seek) first drops the history after it.
+  void capture(NesCpu &cpu);
+  // Puts `cpu` at the first instruction boundary at or after `cycle`, or
+  // at a BRK before it. Returns false and leaves `cpu` alone when `cycle`
+  // is older than the oldest capture kept.
+  bool seek(NesCpu &cpu, uint64_t cycle);
+  // The state of capture `index`, 0 being the oldest kept.
+  CpuSnapshot frame(std::size_t index) const;
+
+  RewindStats stats() const;
+  void clear();
+
+private:
+  // Rebuilds capture `index` into `snapshot`, keeping its pages that
+  // already match.
+  void decode(std::size_t index, CpuSnapshot &snapshot) const;
+  void drop_after(uint64_t cycle);
+  void evict();
+
+  std::deque<RewindFrame> frames;
+  std::size_t bytes;
+  std::size_t capacity;
+  uint32_t keyframe_interval;
+  uint32_t since_keyframe;
+  // Pages of the newest capture, the base of the next delta; empty when
+  // the next capture has to be a keyframe.
+  std::array<std::shared_ptr<const MemoryPage>, BUS_PAGE_COUNT> last_pages;
+  bool has_last;
+};
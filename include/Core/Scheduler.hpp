@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Things a device needs the CPU to stop for.
+enum class SystemEvent : uint8_t {
+  // The PPU enters vblank: the frame is done and an NMI may be raised.
+  PpuVblank,
+  // The APU's frame counter or DMC raises IRQ.
+  ApuIrq,
+  Count,
+};
+
+const uint64_t NO_EVENT = UINT64_MAX;
+
+// Pending events keyed by the CPU cycle they fall on. Each event is
+// pending at most once, so scheduling it again moves it; the entries live
+// in a binary min-heap that remembers where each event sits, which makes
+// rescheduling and cancelling O(log n) and next_cycle() O(1).
+class EventScheduler {
+public:
+  EventScheduler();
+
+  void schedule(SystemEvent event, uint64_t cycle);
+  void cancel(SystemEvent event);
+  bool pending(SystemEvent event) const;
+  // Cycle of the earliest pending event, NO_EVENT when there is none.
+  uint64_t next_cycle() const;
+  // Takes the earliest event due at or before `cycle` into `event`;
+  // returns false when none is.
+  bool pop_due(uint64_t cycle, SystemEvent &event);
+
+private:
+  struct Entry {
+    uint64_t cycle;
+    SystemEvent event;
+  };
+
+  void place(std::size_t index, const Entry &entry);
+  void sift_up(std::size_t index);
+  void sift_down(std::size_t index);
+  void remove_at(std::size_t index);
+
+  std::vector<Entry> heap;
+  // Heap index of each event, or -1.
+  std::vector<int32_t> positions;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Core/Bus.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+const uint32_t SNAPSHOT_MAGIC = 0x534E5A45; // "EZNS" little-endian
+const uint16_t SNAPSHOT_VERSION = 2;
+
+using MemoryPage = std::array<uint8_t, BUS_PAGE_SIZE>;
+
+// CPU registers plus the 64KB bus image, held as immutable shared pages.
+// Snapshots taken from the same CPU share every page that did not change in
+// between, and restoring one only copies the pages that differ. The bus
+// layout (mappings and devices) is not part of a snapshot.
+struct CpuSnapshot {
+  uint8_t register_a;
+  uint8_t register_x;
+  uint8_t register_y;
+  uint8_t status;
+  uint8_t stack_pointer;
+  // NesCpu::interrupt_lines, so a latched NMI or a held IRQ survives.
+  uint8_t interrupt_lines;
+  uint16_t program_counter;
+  uint64_t cycles;
+  std::array<std::shared_ptr<const MemoryPage>, BUS_PAGE_COUNT> pages;
+};
+
+// Portable save-state format, all fields little-endian:
+//   u32 magic, u16 version, u8 a, x, y, status, sp, interrupt lines,
+//   u16 pc, u64 cycles,
+//   then per page a u8 tag: 0 for an all-zero page, 1 followed by 256 bytes.
+std::vector<uint8_t> serialize_snapshot(const CpuSnapshot &snapshot);
+// Throws std::runtime_error on a bad magic, an unknown version or a
+// truncated buffer.
+CpuSnapshot deserialize_snapshot(const std::vector<uint8_t> &data);
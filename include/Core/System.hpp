@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Core/Apu.hpp"
+#include "Core/Cartridge.hpp"
+#include "Core/NesCpu.hpp"
+#include "Core/Ppu.hpp"
+#include "Core/Scheduler.hpp"
+#include <cstdint>
+#include <vector>
+
+// A CPU and the devices around it on one clock, the CPU's cycle counter.
+//
+// The devices run behind the CPU instead of stepping along with it: they
+// catch up when the CPU touches one of their registers, and the CPU runs
+// uninterrupted up to the next cycle in `events`, where the device that
+// scheduled it is caught up and handled; interrupts it raises are taken
+// before the CPU's next instruction. A sprite 0 hit needs no event, since
+// the CPU can only see it through $2002, which catches up; neither does
+// audio, which the APU renders in one block per run.
+class NesSystem {
+public:
+  NesCpu cpu;
+  NesPpu ppu;
+  NesApu apu;
+  EventScheduler events;
+
+  NesSystem() = default;
+  NesSystem(const NesSystem &) = delete;
+  NesSystem &operator=(const NesSystem &) = delete;
+
+  // The NES memory map with the PPU and APU attached. `cartridge` has to
+  // outlive the system.
+  void insert_cartridge(const Cartridge &cartridge);
+  // A raw program at $0600 on flat RAM, with the PPU over $2000-$3FFF and
+  // CHR-RAM and the APU at $4000-$4017.
+  void load(const std::vector<uint8_t> &program);
+
+  // NesCpu::run_until with the devices kept on schedule. `limits` bound
+  // the whole run, however many events it stops for.
+  RunResult run(const RunLimits &limits);
+  // Runs until the CPU reaches `cycle` or a BRK.
+  RunResult run_until_cycle(uint64_t cycle);
+  // Runs until the PPU has finished the next frame or the CPU reaches a
+  // BRK.
+  RunResult run_frame();
+  // run_frame catching the PPU and APU up after every instruction instead;
+  // the baseline the scheduler is measured against.
+  RunResult run_frame_lockstep();
+
+private:
+  void schedule_devices();
+  void dispatch();
+};
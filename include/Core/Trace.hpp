@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// One executed instruction, captured before it runs. Records are fixed size
+// and hold only raw bytes; all formatting happens offline in dump().
+struct TraceRecord {
+  uint64_t cycle;
+  uint16_t program_counter;
+  uint8_t opcode;
+  uint8_t operand[2];
+  uint8_t register_a;
+  uint8_t register_x;
+  uint8_t register_y;
+  uint8_t status;
+  uint8_t stack_pointer;
+};
+
+// Formats a record the way nestest.log does:
+// "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD
+// CYC:7". Memory contents are not captured, so the "= XX" annotations that
+// nestest prints after memory operands are omitted.
+std::string format_trace_record(const TraceRecord &record);
+
+// Preallocated ring buffer of trace records. The capacity is rounded up to a
+// power of two so recording is a store and a masked increment; once full the
+// oldest records are overwritten.
+class TraceBuffer {
+public:
+  explicit TraceBuffer(std::size_t capacity = 1 << 16);
+
+  void record(const TraceRecord &record) {
+    this->records[this->next & this->mask] = record;
+    this->next += 1;
+  }
+
+  std::size_t capacity() const;
+  std::size_t size() const;
+  void clear();
+
+  // Oldest first.
+  const TraceRecord &at(std::size_t index) const;
+
+  void dump(std::ostream &out) const;
+
+private:
+  std::vector<TraceRecord> records;
+  std::size_t mask;
+  uint64_t next;
+};
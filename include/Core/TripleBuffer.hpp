@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Core/Compiler.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hands whole frames from one producer thread (the emulator) to one
+// consumer thread (the renderer) without either waiting on the other. Of
+// the three buffers the producer owns one, the consumer owns one and the
+// third is the last frame published; publish() and acquire() swap their
+// own buffer with that one in a single atomic exchange. The producer never
+// stalls on a slow consumer, which just skips the frames it missed, and
+// the consumer always gets the latest complete frame.
+class TripleBuffer {
+public:
+  explicit TripleBuffer(std::size_t frame_size);
+  TripleBuffer(const TripleBuffer &) = delete;
+  TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+  // Producer side: the frame being built, then handing it over.
+  uint8_t *back() { return this->frames[this->back_index].data(); }
+  void publish();
+  // Consumer side: takes the latest published frame if there is one newer
+  // than front(); returns whether there was.
+  bool acquire();
+  const uint8_t *front() const {
+    return this->frames[this->front_index].data();
+  }
+
+  std::size_t frame_size() const { return this->frames[0].size(); }
+
+private:
+  std::vector<uint8_t> frames[3];
+  // Index of the shared buffer, with FRESH set while the consumer has not
+  // taken it.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint8_t> middle;
+  alignas(CACHE_LINE_SIZE) uint8_t back_index;
+  alignas(CACHE_LINE_SIZE) uint8_t front_index;
+};
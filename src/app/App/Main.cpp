@@ -1,13 +1,32 @@
+#include "App/SnakeGame.hpp"
+#include "Core/Apu.hpp"
+#include "Core/AudioRing.hpp"
+#include "Core/InputQueue.hpp"
+#include "Core/Movie.hpp"
 #include "Core/NesCpu.hpp"
+#include "Core/TripleBuffer.hpp"
 #include <SDL.h>
 #include <SDL_keycode.h>
 #include <SDL_pixels.h>
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <array>
+#include <atomic>
 #include <random>
 #include <thread>
 
+// The game draws a 32x32 screen at $0200-$05FF, converted to RGB24.
+const std::size_t SCREEN_BYTES = 32 * 3 * 32;
+
+// Emulated cycles per second. The snake was written for a slow simulator;
+// this keeps it at the pace of the old 70us sleep per instruction.
+const uint64_t CYCLES_PER_SECOND = 35000;
+const uint64_t FRAMES_PER_SECOND = 60;
+
 SDL_Color color(uint8_t byte) {
   SDL_Color result;
   switch (byte) {
@@ -48,54 +67,164 @@ SDL_Color color(uint8_t byte) {
   return result;
 }
 
-bool read_screen_state(NesCpu *cpu, uint8_t frame[32 * 3 * 32]) {
-  int frame_idx = 0;
+// Converts only the 64-byte lines of $0200-$05FF written since the last call.
+bool read_screen_state(NesCpu *cpu, uint8_t frame[SCREEN_BYTES]) {
   bool update = false;
-  for (int i = 0x0200; i < 0x600; i++) {
-    uint8_t color_idx = cpu->mem_read(i);
-    SDL_Color c = color(color_idx);
-    if (frame[frame_idx] != c.r || frame[frame_idx + 1] != c.g ||
-        frame[frame_idx + 2] != c.b) {
-      frame[frame_idx] = c.r;
-      frame[frame_idx + 1] = c.g;
-      frame[frame_idx + 2] = c.b;
-      update = true;
+  cpu->drain_dirty_lines(0x0200, 0x05FF, [&](uint16_t line) {
+    int frame_idx = (line - 0x0200) * 3;
+    for (int i = line; i < line + static_cast<int>(DIRTY_LINE_SIZE); i++) {
+      uint8_t color_idx = cpu->mem_read(i);
+      SDL_Color c = color(color_idx);
+      if (frame[frame_idx] != c.r || frame[frame_idx + 1] != c.g ||
+          frame[frame_idx + 2] != c.b) {
+        frame[frame_idx] = c.r;
+        frame[frame_idx + 1] = c.g;
+        frame[frame_idx + 2] = c.b;
+        update = true;
+      }
+      frame_idx += 3;
     }
-    frame_idx += 3;
-  }
+  });
   return update;
 }
 
-void handle_user_input(NesCpu &cpu, SDL_Event &event) {
+// SDL's audio thread drains the ring the emulation fills; whatever it has
+// not produced yet plays as silence rather than blocking either side.
+void fill_audio(void *userdata, Uint8 *stream, int len) {
+  AudioRing *ring = static_cast<AudioRing *>(userdata);
+  float *out = reinterpret_cast<float *>(stream);
+  std::size_t count = len / sizeof(float);
+  std::size_t got = ring->pop(out, count);
+  std::fill(out + got, out + count, 0.0f);
+}
+
+// Opens the default device for the APU's 48kHz mono float samples, which
+// fill_audio drains from `ring`. With no changes allowed SDL converts to
+// whatever the hardware takes, so the obtained spec should match; if the
+// device cannot be opened or does not, the game runs silent and says why.
+SDL_AudioDeviceID open_audio(AudioRing &ring) {
+  SDL_AudioSpec want;
+  SDL_zero(want);
+  want.freq = APU_SAMPLE_RATE;
+  want.format = AUDIO_F32SYS;
+  want.channels = 1;
+  want.samples = 512;
+  want.callback = fill_audio;
+  want.userdata = &ring;
+  SDL_AudioSpec have;
+  SDL_zero(have);
+  SDL_AudioDeviceID audio = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+  if (audio == 0) {
+    std::cerr << "sin audio: " << SDL_GetError() << std::endl;
+    return 0;
+  }
+  if (have.freq != want.freq || have.format != want.format ||
+      have.channels != want.channels) {
+    std::cerr << "sin audio: el dispositivo no acepta " << APU_SAMPLE_RATE
+              << "Hz mono float" << std::endl;
+    SDL_CloseAudioDevice(audio);
+    return 0;
+  }
+  SDL_PauseAudioDevice(audio, 0);
+  return audio;
+}
+
+// Queues key presses for the emulation thread; returns false once the
+// player asked to quit.
+bool handle_user_input(InputQueue &keys, SDL_Event &event) {
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
     case SDL_QUIT:
+      return false;
     case SDL_KEYDOWN:
       if (event.key.keysym.sym == SDLK_ESCAPE) {
-        std::exit(0);
+        return false;
       } else if (event.key.keysym.sym == SDLK_w) {
-        cpu.mem_write(0xff, 0x77);
+        keys.push(0x77);
       } else if (event.key.keysym.sym == SDLK_s) {
-        cpu.mem_write(0xff, 0x73);
+        keys.push(0x73);
       } else if (event.key.keysym.sym == SDLK_a) {
-        cpu.mem_write(0xff, 0x61);
+        keys.push(0x61);
       } else if (event.key.keysym.sym == SDLK_d) {
-        cpu.mem_write(0xff, 0x64);
+        keys.push(0x64);
       }
       break;
     default:
       break;
     }
   }
+  return true;
+}
+
+// The emulation thread. It runs the game a frame's worth of cycles at a
+// time and publishes the screen when it changed, then sleeps until the
+// steady clock reaches the emulated time, so neither vsync nor a slow
+// renderer holds the CPU back. Key presses and random bytes are the only
+// inputs that are not reproducible, so they all go through the recorder.
+void run_emulation(NesCpu &cpu, NesApu &apu, MovieRecorder &recorder,
+                   InputQueue &keys, TripleBuffer &frames,
+                   std::atomic<bool> &running) {
+  using Clock = std::chrono::steady_clock;
+  std::mt19937 rng(std::random_device{}());
+  uint8_t screen_state[SCREEN_BYTES] = {};
+  RunLimits limits;
+  limits.max_cycles = CYCLES_PER_SECOND / FRAMES_PER_SECOND;
+  Clock::time_point start = Clock::now();
+  uint64_t start_cycle = cpu.cycles;
+
+  while (running.load(std::memory_order_relaxed)) {
+    uint8_t key;
+    while (keys.pop(key)) {
+      recorder.write(0xff, key);
+    }
+    recorder.write(0xfe, rng() % 15 + 1);
+
+    RunResult result = recorder.run_until(limits);
+    apu.catch_up();
+
+    // The dirty lines only update screen_state, so the whole screen is
+    // copied into whichever buffer the producer holds.
+    if (read_screen_state(&cpu, screen_state)) {
+      std::memcpy(frames.back(), screen_state, SCREEN_BYTES);
+      frames.publish();
+    }
+
+    if (result.reason == StopReason::Break) {
+      break;
+    }
+
+    Clock::time_point due =
+        start + std::chrono::microseconds((cpu.cycles - start_cycle) *
+                                          1000000 / CYCLES_PER_SECOND);
+    Clock::time_point now = Clock::now();
+    if (now - due > std::chrono::milliseconds(100)) {
+      // Far behind, e.g. after the process was suspended: carry on from
+      // here instead of racing through the backlog.
+      start = now;
+      start_cycle = cpu.cycles;
+    } else {
+      std::this_thread::sleep_until(due);
+    }
+  }
+  running.store(false, std::memory_order_relaxed);
 }
 
 int main(int argc, char *argv[]) {
-  SDL_Init(SDL_INIT_VIDEO);
+  // --record FILE saves the session as a movie for eizness_headless --replay.
+  const char *record_path = nullptr;
+  if (argc == 3 && std::strcmp(argv[1], "--record") == 0) {
+    record_path = argv[2];
+  }
+
+  SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
   SDL_Window *window =
       SDL_CreateWindow("Snake game", SDL_WINDOWPOS_CENTERED,
                        SDL_WINDOWPOS_CENTERED, 320, 320, SDL_WINDOW_SHOWN);
   SDL_Renderer *renderer = SDL_CreateRenderer(
       window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  SDL_RendererInfo info;
+  bool vsync = SDL_GetRendererInfo(renderer, &info) == 0 &&
+               (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
 
   SDL_RenderSetScale(renderer, 10.0, 10.0);
 
@@ -105,54 +234,63 @@ int main(int argc, char *argv[]) {
   SDL_Event event;
   SDL_zero(event);
 
-
-  std::vector<uint8_t> game_code = {
-      0x20, 0x06, 0x06, 0x20, 0x38, 0x06, 0x20, 0x0d, 0x06, 0x20, 0x2a, 0x06,
-      0x60, 0xa9, 0x02, 0x85, 0x02, 0xa9, 0x04, 0x85, 0x03, 0xa9, 0x11, 0x85,
-      0x10, 0xa9, 0x10, 0x85, 0x12, 0xa9, 0x0f, 0x85, 0x14, 0xa9, 0x04, 0x85,
-      0x11, 0x85, 0x13, 0x85, 0x15, 0x60, 0xa5, 0xfe, 0x85, 0x00, 0xa5, 0xfe,
-      0x29, 0x03, 0x18, 0x69, 0x02, 0x85, 0x01, 0x60, 0x20, 0x4d, 0x06, 0x20,
-      0x8d, 0x06, 0x20, 0xc3, 0x06, 0x20, 0x19, 0x07, 0x20, 0x20, 0x07, 0x20,
-      0x2d, 0x07, 0x4c, 0x38, 0x06, 0xa5, 0xff, 0xc9, 0x77, 0xf0, 0x0d, 0xc9,
-      0x64, 0xf0, 0x14, 0xc9, 0x73, 0xf0, 0x1b, 0xc9, 0x61, 0xf0, 0x22, 0x60,
-      0xa9, 0x04, 0x24, 0x02, 0xd0, 0x26, 0xa9, 0x01, 0x85, 0x02, 0x60, 0xa9,
-      0x08, 0x24, 0x02, 0xd0, 0x1b, 0xa9, 0x02, 0x85, 0x02, 0x60, 0xa9, 0x01,
-      0x24, 0x02, 0xd0, 0x10, 0xa9, 0x04, 0x85, 0x02, 0x60, 0xa9, 0x02, 0x24,
-      0x02, 0xd0, 0x05, 0xa9, 0x08, 0x85, 0x02, 0x60, 0x60, 0x20, 0x94, 0x06,
-      0x20, 0xa8, 0x06, 0x60, 0xa5, 0x00, 0xc5, 0x10, 0xd0, 0x0d, 0xa5, 0x01,
-      0xc5, 0x11, 0xd0, 0x07, 0xe6, 0x03, 0xe6, 0x03, 0x20, 0x2a, 0x06, 0x60,
-      0xa2, 0x02, 0xb5, 0x10, 0xc5, 0x10, 0xd0, 0x06, 0xb5, 0x11, 0xc5, 0x11,
-      0xf0, 0x09, 0xe8, 0xe8, 0xe4, 0x03, 0xf0, 0x06, 0x4c, 0xaa, 0x06, 0x4c,
-      0x35, 0x07, 0x60, 0xa6, 0x03, 0xca, 0x8a, 0xb5, 0x10, 0x95, 0x12, 0xca,
-      0x10, 0xf9, 0xa5, 0x02, 0x4a, 0xb0, 0x09, 0x4a, 0xb0, 0x19, 0x4a, 0xb0,
-      0x1f, 0x4a, 0xb0, 0x2f, 0xa5, 0x10, 0x38, 0xe9, 0x20, 0x85, 0x10, 0x90,
-      0x01, 0x60, 0xc6, 0x11, 0xa9, 0x01, 0xc5, 0x11, 0xf0, 0x28, 0x60, 0xe6,
-      0x10, 0xa9, 0x1f, 0x24, 0x10, 0xf0, 0x1f, 0x60, 0xa5, 0x10, 0x18, 0x69,
-      0x20, 0x85, 0x10, 0xb0, 0x01, 0x60, 0xe6, 0x11, 0xa9, 0x06, 0xc5, 0x11,
-      0xf0, 0x0c, 0x60, 0xc6, 0x10, 0xa5, 0x10, 0x29, 0x1f, 0xc9, 0x1f, 0xf0,
-      0x01, 0x60, 0x4c, 0x35, 0x07, 0xa0, 0x00, 0xa5, 0xfe, 0x91, 0x00, 0x60,
-      0xa6, 0x03, 0xa9, 0x00, 0x81, 0x10, 0xa2, 0x00, 0xa9, 0x01, 0x81, 0x10,
-      0x60, 0xa6, 0xff, 0xea, 0xea, 0xca, 0xd0, 0xfb, 0x60,
-  };
-
   NesCpu *cpu = new NesCpu();
-  cpu->load(game_code);
+  // The game ends on a BRK.
+  cpu->break_mode = BreakMode::Exit;
+  cpu->load(SNAKE_GAME_CODE);
   cpu->reset();
 
-  uint8_t screen_state[32 * 3 * 32];
-  std::mt19937 rng(std::random_device{}());
+  // About 85ms of audio between the emulation and the device. The game
+  // runs far slower than the console, so the APU times its samples
+  // against CYCLES_PER_SECOND to keep the ring filled at the device's rate.
+  AudioRing ring(4096);
+  NesApu apu;
+  apu.output = &ring;
+  apu.attach(*cpu, CYCLES_PER_SECOND);
+  // The game has no IRQ handler.
+  cpu->mem_write(0x4017, 0x40);
+  SDL_AudioDeviceID audio = open_audio(ring);
 
-  cpu->run_with_callback([&event, &rng, &screen_state, &texture, &renderer](NesCpu& cpu) {
-    handle_user_input(cpu, event);
-    cpu.mem_write(0xfe, rng() % 15 + 1);
+  MovieRecorder recorder(*cpu);
+  InputQueue keys;
+  TripleBuffer frames(SCREEN_BYTES);
+  std::atomic<bool> running(true);
+  std::thread emulation(run_emulation, std::ref(*cpu), std::ref(apu),
+                        std::ref(recorder), std::ref(keys), std::ref(frames),
+                        std::ref(running));
 
-    if(read_screen_state(&cpu, screen_state)) {
-      SDL_UpdateTexture(texture, nullptr, screen_state, 32 * 3);
-      SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-      SDL_RenderPresent(renderer);
+  // SDL wants events and rendering on the main thread, which presents the
+  // latest finished frame at the display's rate.
+  SDL_UpdateTexture(texture, nullptr, frames.front(), 32 * 3);
+  while (running.load(std::memory_order_relaxed)) {
+    if (!handle_user_input(keys, event)) {
+      running.store(false, std::memory_order_relaxed);
+      break;
+    }
+    if (frames.acquire()) {
+      SDL_UpdateTexture(texture, nullptr, frames.front(), 32 * 3);
+    }
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+    if (!vsync) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1000) /
+                                  FRAMES_PER_SECOND);
     }
+  }
+  emulation.join();
 
-    std::this_thread::sleep_for(std::chrono::microseconds(70));
-  });
+  if (audio != 0) {
+    SDL_CloseAudioDevice(audio);
+  }
+
+  if (record_path != nullptr) {
+    std::vector<uint8_t> movie = serialize_movie(recorder.finish());
+    std::ofstream file(record_path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(movie.data()), movie.size());
+    if (!file) {
+      std::cerr << "no se pudo escribir " << record_path << std::endl;
+      return 1;
+    }
+  }
   return 0;
 }
@@ -0,0 +1,624 @@
+#include "Core/Apu.hpp"
+#include "Core/NesCpu.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const uint8_t LENGTH_TABLE[32] = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+
+static const uint8_t DUTY_TABLE[4][8] = {{0, 1, 0, 0, 0, 0, 0, 0},
+                                         {0, 1, 1, 0, 0, 0, 0, 0},
+                                         {0, 1, 1, 1, 1, 0, 0, 0},
+                                         {1, 0, 0, 1, 1, 1, 1, 1}};
+
+// Periods in CPU cycles.
+static const uint16_t NOISE_PERIODS[16] = {4,   8,   16,  32,  64,  96,
+                                           128, 160, 202, 254, 380, 508,
+                                           762, 1016, 2034, 4068};
+static const uint16_t DMC_PERIODS[16] = {428, 380, 340, 320, 286, 254,
+                                         226, 214, 190, 160, 142, 128,
+                                         106, 84,  72,  54};
+
+// Samples the synth may hold before run_to hands them over without waiting
+// for catch_up().
+static const std::size_t MAX_PENDING_SAMPLES = 4096;
+
+// Cutoff of the band-limiting kernel as a fraction of the sample rate, and
+// the pole of the DC blocker.
+static const double KERNEL_CUTOFF = 0.45;
+static const float HIGH_PASS_POLE = 0.996f;
+
+static const double PI = 3.14159265358979323846;
+
+StepSynth::StepSynth() {
+  for (uint32_t phase = 0; phase < PHASES; phase++) {
+    double sum = 0.0;
+    std::array<double, TAPS> taps;
+    for (uint32_t tap = 0; tap < TAPS; tap++) {
+      // Distance from the impulse centre, which lies `phase` into the
+      // sample after tap TAPS/2 - 1.
+      double x = static_cast<double>(tap) - (TAPS / 2 - 1) -
+                 static_cast<double>(phase) / PHASES;
+      double sinc = x == 0.0
+                        ? 2.0 * KERNEL_CUTOFF
+                        : std::sin(2.0 * PI * KERNEL_CUTOFF * x) / (PI * x);
+      double window = 0.42 + 0.5 * std::cos(2.0 * PI * x / TAPS) +
+                      0.08 * std::cos(4.0 * PI * x / TAPS);
+      taps[tap] = sinc * window;
+      sum += taps[tap];
+    }
+    // Every phase adds exactly the step, whatever its rounding.
+    for (uint32_t tap = 0; tap < TAPS; tap++) {
+      this->kernel[phase][tap] = static_cast<float>(taps[tap] / sum);
+    }
+  }
+  this->reset(0, APU_CPU_CLOCK);
+}
+
+uint64_t StepSynth::position(uint64_t cycle) const {
+  return cycle * (APU_SAMPLE_RATE * PHASES) / this->cpu_clock;
+}
+
+void StepSynth::reset(uint64_t cycle, uint32_t cpu_clock) {
+  this->impulses.clear();
+  this->cpu_clock = cpu_clock;
+  this->base = this->position(cycle) / PHASES;
+  this->level = 0.0f;
+  this->filter_in = 0.0f;
+  this->filter_out = 0.0f;
+}
+
+void StepSynth::add_delta(uint64_t cycle, float delta) {
+  uint64_t at = this->position(cycle);
+  std::size_t sample = static_cast<std::size_t>(at / PHASES - this->base);
+  const std::array<float, TAPS> &taps = this->kernel[at % PHASES];
+  if (this->impulses.size() < sample + TAPS) {
+    this->impulses.resize(sample + TAPS, 0.0f);
+  }
+  float *out = &this->impulses[sample];
+  for (uint32_t tap = 0; tap < TAPS; tap++) {
+    out[tap] += taps[tap] * delta;
+  }
+}
+
+std::size_t StepSynth::read(uint64_t cycle, std::vector<float> &out) {
+  std::size_t count = this->pending(cycle);
+  if (count == 0) {
+    return 0;
+  }
+  if (this->impulses.size() < count) {
+    this->impulses.resize(count, 0.0f);
+  }
+  std::size_t start = out.size();
+  out.resize(start + count);
+  float level = this->level;
+  float filter_in = this->filter_in;
+  float filter_out = this->filter_out;
+  for (std::size_t i = 0; i < count; i++) {
+    level += this->impulses[i];
+    filter_out = level - filter_in + HIGH_PASS_POLE * filter_out;
+    filter_in = level;
+    out[start + i] = filter_out;
+  }
+  this->level = level;
+  this->filter_in = filter_in;
+  this->filter_out = filter_out;
+  this->impulses.erase(this->impulses.begin(),
+                       this->impulses.begin() + count);
+  this->base += count;
+  return count;
+}
+
+std::size_t StepSynth::pending(uint64_t cycle) const {
+  uint64_t end = this->position(cycle) / PHASES;
+  return end > this->base ? static_cast<std::size_t>(end - this->base) : 0;
+}
+
+void ApuEnvelope::clock() {
+  if (this->start) {
+    this->start = false;
+    this->decay = 15;
+    this->divider = this->volume;
+  } else if (this->divider == 0) {
+    this->divider = this->volume;
+    if (this->decay > 0) {
+      this->decay--;
+    } else if (this->loop) {
+      this->decay = 15;
+    }
+  } else {
+    this->divider--;
+  }
+}
+
+uint16_t ApuPulse::sweep_target() const {
+  int32_t change = this->period >> this->sweep_shift;
+  if (!this->sweep_negate) {
+    return static_cast<uint16_t>(this->period + change);
+  }
+  int32_t target = this->period - change - (this->ones_complement ? 1 : 0);
+  return static_cast<uint16_t>(std::max(target, 0));
+}
+
+void ApuPulse::clock_sweep() {
+  uint16_t target = this->sweep_target();
+  if (this->sweep_divider == 0 && this->sweep_enabled &&
+      this->sweep_shift > 0 && this->period >= 8 && target <= 0x7FF) {
+    this->period = target;
+  }
+  if (this->sweep_divider == 0 || this->sweep_reload) {
+    this->sweep_divider = this->sweep_period;
+    this->sweep_reload = false;
+  } else {
+    this->sweep_divider--;
+  }
+}
+
+uint8_t ApuPulse::output() const {
+  // Periods under 8 and sweep targets past $7FF mute the channel.
+  if (this->length == 0 || this->period < 8 || this->sweep_target() > 0x7FF ||
+      DUTY_TABLE[this->duty][this->step] == 0) {
+    return 0;
+  }
+  return this->envelope.output();
+}
+
+void ApuTriangle::clock_linear() {
+  if (this->linear_reload) {
+    this->linear = this->linear_load;
+  } else if (this->linear > 0) {
+    this->linear--;
+  }
+  if (!this->control) {
+    this->linear_reload = false;
+  }
+}
+
+uint8_t ApuTriangle::output() const {
+  // 15 down to 0, then 0 up to 15. A halted sequencer holds its value.
+  return this->step < 16 ? 15 - this->step : this->step - 16;
+}
+
+uint8_t ApuNoise::output() const {
+  if (this->length == 0 || (this->shift & 1) != 0) {
+    return 0;
+  }
+  return this->envelope.output();
+}
+
+NesApu::NesApu() {
+  this->output = nullptr;
+  this->cpu = nullptr;
+  this->next = nullptr;
+  this->clock = 0;
+  for (ApuPulse &pulse : this->pulse) {
+    pulse = ApuPulse();
+    pulse.counter = 2;
+  }
+  this->pulse[0].ones_complement = true;
+  this->triangle = ApuTriangle();
+  this->triangle.counter = 1;
+  this->noise = ApuNoise();
+  this->noise.shift = 1;
+  this->noise.period = NOISE_PERIODS[0];
+  this->noise.counter = this->noise.period;
+  this->dmc = ApuDmc();
+  this->dmc.silence = true;
+  this->dmc.bits = 8;
+  this->dmc.period = DMC_PERIODS[0];
+  this->dmc.counter = this->dmc.period;
+  this->dmc.sample_address = 0xC000;
+  this->dmc.sample_length = 1;
+  this->five_step = false;
+  this->irq_inhibit = false;
+  this->frame_irq = false;
+  this->dmc_irq = false;
+  this->frame_step = 0;
+  this->frame_start = 0;
+  this->mixed = 0.0f;
+  this->written = 0;
+  this->dropped = 0;
+}
+
+void NesApu::attach(NesCpu &cpu, uint32_t cpu_clock) {
+  this->cpu = &cpu;
+  BusDevice *previous = cpu.bus.device_at(0x4000);
+  if (previous != this) {
+    this->next = previous;
+  }
+  this->clock = cpu.cycles;
+  this->frame_start = cpu.cycles;
+  this->frame_step = 0;
+  this->synth.reset(cpu.cycles, cpu_clock);
+  this->mixed = 0.0f;
+  this->update_output();
+  cpu.bus.map_device(0x40, 1, this);
+}
+
+void NesApu::catch_up() {
+  if (this->cpu != nullptr) {
+    this->run_to(this->cpu->cycles);
+  }
+  this->flush();
+}
+
+uint64_t NesApu::next_irq_cycle() const {
+  uint64_t next = UINT64_MAX;
+  if (!this->five_step && !this->irq_inhibit && !this->frame_irq) {
+    next = this->frame_start + APU_FOUR_STEP_CYCLES[3];
+  }
+  const ApuDmc &dmc = this->dmc;
+  if (dmc.irq_enabled && !dmc.loop && dmc.remaining > 0 && !this->dmc_irq) {
+    // Fetches are eager, so the buffer holds a byte and every remaining
+    // one is fetched as the previous byte runs out; the IRQ comes with
+    // the last fetch.
+    uint64_t last = this->clock + dmc.counter +
+                    static_cast<uint64_t>(dmc.bits - 1) * dmc.period +
+                    static_cast<uint64_t>(dmc.remaining - 1) * 8 * dmc.period;
+    next = std::min(next, last);
+  }
+  return next;
+}
+
+void NesApu::run_to(uint64_t cycle) {
+  while (this->clock < cycle) {
+    uint64_t step_cycle =
+        this->frame_start + (this->five_step
+                                 ? APU_FIVE_STEP_CYCLES[this->frame_step]
+                                 : APU_FOUR_STEP_CYCLES[this->frame_step]);
+    // Timers of silent channels are left alone: nothing they clock is
+    // heard, and skipping them keeps a 4-cycle noise period from costing
+    // an event every 4 cycles.
+    bool pulse_active[2];
+    for (int i = 0; i < 2; i++) {
+      pulse_active[i] = this->pulse[i].length > 0 && this->pulse[i].period >= 8;
+    }
+    bool triangle_active = this->triangle.length > 0 &&
+                           this->triangle.linear > 0 &&
+                           this->triangle.period >= 2;
+    bool noise_active = this->noise.length > 0;
+
+    uint64_t next = std::min(cycle, step_cycle);
+    for (int i = 0; i < 2; i++) {
+      if (pulse_active[i]) {
+        next = std::min(next, this->clock + this->pulse[i].counter);
+      }
+    }
+    if (triangle_active) {
+      next = std::min(next, this->clock + this->triangle.counter);
+    }
+    if (noise_active) {
+      next = std::min(next, this->clock + this->noise.counter);
+    }
+    next = std::min(next, this->clock + this->dmc.counter);
+
+    uint32_t elapsed = static_cast<uint32_t>(next - this->clock);
+    for (int i = 0; i < 2; i++) {
+      ApuPulse &pulse = this->pulse[i];
+      if (pulse_active[i] && (pulse.counter -= elapsed) == 0) {
+        pulse.counter = (pulse.period + 1) * 2;
+        pulse.step = (pulse.step + 1) & 7;
+      }
+    }
+    if (triangle_active && (this->triangle.counter -= elapsed) == 0) {
+      this->triangle.counter = this->triangle.period + 1;
+      this->triangle.step = (this->triangle.step + 1) & 31;
+    }
+    if (noise_active && (this->noise.counter -= elapsed) == 0) {
+      ApuNoise &noise = this->noise;
+      noise.counter = noise.period;
+      uint16_t feedback =
+          (noise.shift ^ (noise.shift >> (noise.short_mode ? 6 : 1))) & 1;
+      noise.shift = (noise.shift >> 1) | (feedback << 14);
+    }
+    if ((this->dmc.counter -= elapsed) == 0) {
+      this->dmc.counter = this->dmc.period;
+      this->clock_dmc();
+    }
+    this->clock = next;
+    if (next == step_cycle) {
+      this->clock_frame_step();
+    }
+    this->update_output();
+  }
+  this->update_irq();
+  if (this->synth.pending(this->clock) >= MAX_PENDING_SAMPLES) {
+    this->flush();
+  }
+}
+
+void NesApu::flush() {
+  this->synth.read(this->clock, this->samples);
+  if (this->samples.empty()) {
+    return;
+  }
+  std::size_t pushed = 0;
+  if (this->output != nullptr) {
+    pushed = this->output->push(this->samples.data(), this->samples.size());
+  }
+  this->written += pushed;
+  this->dropped += this->samples.size() - pushed;
+  this->samples.clear();
+}
+
+void NesApu::clock_frame_step() {
+  if (this->five_step) {
+    // Quarter, quarter and half, quarter, nothing, quarter and half.
+    if (this->frame_step != 3) {
+      this->quarter_frame();
+    }
+    if (this->frame_step == 1 || this->frame_step == 4) {
+      this->half_frame();
+    }
+    if (++this->frame_step == APU_FIVE_STEP_CYCLES.size()) {
+      this->frame_step = 0;
+      this->frame_start += APU_FIVE_STEP_PERIOD;
+    }
+    return;
+  }
+  this->quarter_frame();
+  if (this->frame_step == 1 || this->frame_step == 3) {
+    this->half_frame();
+  }
+  if (this->frame_step == 3 && !this->irq_inhibit) {
+    this->frame_irq = true;
+  }
+  if (++this->frame_step == APU_FOUR_STEP_CYCLES.size()) {
+    this->frame_step = 0;
+    this->frame_start += APU_FOUR_STEP_PERIOD;
+  }
+}
+
+void NesApu::quarter_frame() {
+  this->pulse[0].envelope.clock();
+  this->pulse[1].envelope.clock();
+  this->noise.envelope.clock();
+  this->triangle.clock_linear();
+}
+
+void NesApu::half_frame() {
+  for (ApuPulse &pulse : this->pulse) {
+    if (!pulse.halt && pulse.length > 0) {
+      pulse.length--;
+    }
+    pulse.clock_sweep();
+  }
+  if (!this->triangle.control && this->triangle.length > 0) {
+    this->triangle.length--;
+  }
+  if (!this->noise.halt && this->noise.length > 0) {
+    this->noise.length--;
+  }
+}
+
+void NesApu::clock_dmc() {
+  ApuDmc &dmc = this->dmc;
+  if (!dmc.silence) {
+    if ((dmc.shift & 1) != 0) {
+      if (dmc.level <= 125) {
+        dmc.level += 2;
+      }
+    } else if (dmc.level >= 2) {
+      dmc.level -= 2;
+    }
+  }
+  dmc.shift >>= 1;
+  if (--dmc.bits == 0) {
+    dmc.bits = 8;
+    dmc.silence = !dmc.buffer_full;
+    if (dmc.buffer_full) {
+      dmc.shift = dmc.buffer;
+      dmc.buffer_full = false;
+      this->fetch_dmc();
+    }
+  }
+}
+
+void NesApu::fetch_dmc() {
+  ApuDmc &dmc = this->dmc;
+  if (dmc.buffer_full || dmc.remaining == 0) {
+    return;
+  }
+  // peek keeps a fetch from re-entering a device that is catching up.
+  dmc.buffer = this->cpu != nullptr ? this->cpu->bus.peek(dmc.address) : 0;
+  dmc.buffer_full = true;
+  dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+  if (--dmc.remaining == 0) {
+    if (dmc.loop) {
+      this->restart_dmc();
+    } else if (dmc.irq_enabled) {
+      this->dmc_irq = true;
+    }
+  }
+}
+
+void NesApu::restart_dmc() {
+  this->dmc.address = this->dmc.sample_address;
+  this->dmc.remaining = this->dmc.sample_length;
+}
+
+void NesApu::update_irq() {
+  if (this->cpu != nullptr) {
+    this->cpu->set_irq(this->frame_irq || this->dmc_irq);
+  }
+}
+
+void NesApu::update_output() {
+  uint32_t pulses = this->pulse[0].output() + this->pulse[1].output();
+  float pulse_out = pulses == 0 ? 0.0f : 95.88f / (8128.0f / pulses + 100.0f);
+  float tnd = this->triangle.output() / 8227.0f +
+              this->noise.output() / 12241.0f + this->dmc.level / 22638.0f;
+  float tnd_out = tnd == 0.0f ? 0.0f : 159.79f / (1.0f / tnd + 100.0f);
+  float mixed = pulse_out + tnd_out;
+  if (mixed != this->mixed) {
+    this->synth.add_delta(this->clock, mixed - this->mixed);
+    this->mixed = mixed;
+  }
+}
+
+uint8_t NesApu::status() const {
+  return (this->pulse[0].length > 0 ? 0x01 : 0) |
+         (this->pulse[1].length > 0 ? 0x02 : 0) |
+         (this->triangle.length > 0 ? 0x04 : 0) |
+         (this->noise.length > 0 ? 0x08 : 0) |
+         (this->dmc.remaining > 0 ? 0x10 : 0) |
+         (this->frame_irq ? 0x40 : 0) | (this->dmc_irq ? 0x80 : 0);
+}
+
+uint8_t NesApu::read(uint16_t addr) {
+  if (addr != 0x4015) {
+    return this->next != nullptr ? this->next->read(addr) : 0;
+  }
+  if (this->cpu != nullptr) {
+    this->run_to(this->cpu->cycles);
+  }
+  uint8_t value = this->status();
+  this->frame_irq = false;
+  this->update_irq();
+  return value;
+}
+
+void NesApu::write(uint16_t addr, uint8_t data) {
+  if (addr > 0x4017 || addr == 0x4014 || addr == 0x4016) {
+    if (this->next != nullptr) {
+      this->next->write(addr, data);
+    }
+    return;
+  }
+  if (this->cpu != nullptr) {
+    this->run_to(this->cpu->cycles);
+  }
+  switch (addr) {
+  case 0x4000:
+  case 0x4004: {
+    ApuPulse &pulse = this->pulse[(addr >> 2) & 1];
+    pulse.duty = data >> 6;
+    pulse.halt = pulse.envelope.loop = (data & 0x20) != 0;
+    pulse.envelope.constant = (data & 0x10) != 0;
+    pulse.envelope.volume = data & 0x0F;
+    break;
+  }
+  case 0x4001:
+  case 0x4005: {
+    ApuPulse &pulse = this->pulse[(addr >> 2) & 1];
+    pulse.sweep_enabled = (data & 0x80) != 0;
+    pulse.sweep_period = (data >> 4) & 7;
+    pulse.sweep_negate = (data & 0x08) != 0;
+    pulse.sweep_shift = data & 7;
+    pulse.sweep_reload = true;
+    break;
+  }
+  case 0x4002:
+  case 0x4006: {
+    ApuPulse &pulse = this->pulse[(addr >> 2) & 1];
+    pulse.period = (pulse.period & 0x700) | data;
+    break;
+  }
+  case 0x4003:
+  case 0x4007: {
+    ApuPulse &pulse = this->pulse[(addr >> 2) & 1];
+    pulse.period = (pulse.period & 0xFF) | ((data & 7) << 8);
+    if (pulse.enabled) {
+      pulse.length = LENGTH_TABLE[data >> 3];
+    }
+    pulse.step = 0;
+    pulse.envelope.start = true;
+    break;
+  }
+  case 0x4008:
+    this->triangle.control = (data & 0x80) != 0;
+    this->triangle.linear_load = data & 0x7F;
+    break;
+  case 0x400A:
+    this->triangle.period = (this->triangle.period & 0x700) | data;
+    break;
+  case 0x400B:
+    this->triangle.period = (this->triangle.period & 0xFF) | ((data & 7) << 8);
+    if (this->triangle.enabled) {
+      this->triangle.length = LENGTH_TABLE[data >> 3];
+    }
+    this->triangle.linear_reload = true;
+    break;
+  case 0x400C:
+    this->noise.halt = this->noise.envelope.loop = (data & 0x20) != 0;
+    this->noise.envelope.constant = (data & 0x10) != 0;
+    this->noise.envelope.volume = data & 0x0F;
+    break;
+  case 0x400E:
+    this->noise.short_mode = (data & 0x80) != 0;
+    this->noise.period = NOISE_PERIODS[data & 0x0F];
+    break;
+  case 0x400F:
+    if (this->noise.enabled) {
+      this->noise.length = LENGTH_TABLE[data >> 3];
+    }
+    this->noise.envelope.start = true;
+    break;
+  case 0x4010:
+    this->dmc.irq_enabled = (data & 0x80) != 0;
+    this->dmc.loop = (data & 0x40) != 0;
+    this->dmc.period = DMC_PERIODS[data & 0x0F];
+    if (!this->dmc.irq_enabled) {
+      this->dmc_irq = false;
+    }
+    break;
+  case 0x4011:
+    this->dmc.level = data & 0x7F;
+    break;
+  case 0x4012:
+    this->dmc.sample_address = 0xC000 + data * 64;
+    break;
+  case 0x4013:
+    this->dmc.sample_length = data * 16 + 1;
+    break;
+  case 0x4015:
+    for (int i = 0; i < 2; i++) {
+      this->pulse[i].enabled = (data & (1 << i)) != 0;
+      if (!this->pulse[i].enabled) {
+        this->pulse[i].length = 0;
+      }
+    }
+    this->triangle.enabled = (data & 0x04) != 0;
+    if (!this->triangle.enabled) {
+      this->triangle.length = 0;
+    }
+    this->noise.enabled = (data & 0x08) != 0;
+    if (!this->noise.enabled) {
+      this->noise.length = 0;
+    }
+    this->dmc_irq = false;
+    if ((data & 0x10) == 0) {
+      this->dmc.remaining = 0;
+    } else if (this->dmc.remaining == 0) {
+      this->restart_dmc();
+      this->fetch_dmc();
+    }
+    break;
+  case 0x4017:
+    // Takes effect at once rather than 3-4 cycles after the write.
+    this->five_step = (data & 0x80) != 0;
+    this->irq_inhibit = (data & 0x40) != 0;
+    if (this->irq_inhibit) {
+      this->frame_irq = false;
+    }
+    this->frame_start = this->clock;
+    this->frame_step = 0;
+    if (this->five_step) {
+      this->quarter_frame();
+      this->half_frame();
+    }
+    break;
+  default:
+    break;
+  }
+  this->update_irq();
+  this->update_output();
+}
+
+uint8_t NesApu::peek(uint16_t addr) {
+  if (addr != 0x4015) {
+    return this->next != nullptr ? this->next->peek(addr) : 0;
+  }
+  return this->status();
+}
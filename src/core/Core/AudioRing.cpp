@@ -0,0 +1,45 @@
+#include "Core/AudioRing.hpp"
+#include <algorithm>
+#include <cstring>
+
+AudioRing::AudioRing(std::size_t capacity) : head(0), tail(0) {
+  std::size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  this->buffer.assign(size, 0.0f);
+  this->mask = size - 1;
+}
+
+std::size_t AudioRing::push(const float *samples, std::size_t count) {
+  std::size_t head = this->head.load(std::memory_order_relaxed);
+  std::size_t tail = this->tail.load(std::memory_order_acquire);
+  count = std::min(count, this->buffer.size() - (head - tail));
+  // At most two copies: up to the end of the buffer, then from its start.
+  std::size_t start = head & this->mask;
+  std::size_t first = std::min(count, this->buffer.size() - start);
+  std::memcpy(&this->buffer[start], samples, first * sizeof(float));
+  std::memcpy(&this->buffer[0], samples + first,
+              (count - first) * sizeof(float));
+  this->head.store(head + count, std::memory_order_release);
+  return count;
+}
+
+std::size_t AudioRing::pop(float *samples, std::size_t count) {
+  std::size_t tail = this->tail.load(std::memory_order_relaxed);
+  std::size_t head = this->head.load(std::memory_order_acquire);
+  count = std::min(count, head - tail);
+  std::size_t start = tail & this->mask;
+  std::size_t first = std::min(count, this->buffer.size() - start);
+  std::memcpy(samples, &this->buffer[start], first * sizeof(float));
+  std::memcpy(samples + first, &this->buffer[0],
+              (count - first) * sizeof(float));
+  this->tail.store(tail + count, std::memory_order_release);
+  return count;
+}
+
+std::size_t AudioRing::size() const {
+  std::size_t tail = this->tail.load(std::memory_order_acquire);
+  std::size_t head = this->head.load(std::memory_order_acquire);
+  return head - tail;
+}
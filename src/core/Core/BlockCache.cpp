@@ -0,0 +1,106 @@
+#include "Core/BlockCache.hpp"
+
+BlockCache::BlockCache() { this->decode_count = 0; }
+
+const DecodedBlock &BlockCache::decode(Bus &bus, uint16_t pc) {
+  DecodedBlock block;
+  block.start = pc;
+  block.id = 0;
+  block.serial = 0;
+  uint32_t addr = pc;
+  while (block.ops.size() < MAX_BLOCK_OPS) {
+    const OpCode &op = OPCODES_TABLE[bus.peek(static_cast<uint16_t>(addr))];
+    // Stop before the end of the address space and before device pages,
+    // whose reads can have side effects.
+    if (addr + op.len > BUS_MEMORY_SIZE) {
+      break;
+    }
+    bool on_device = false;
+    for (uint32_t i = addr; i < addr + op.len; i++) {
+      on_device |= bus.page_kind(static_cast<uint16_t>(i)) == PageKind::Device;
+    }
+    if (on_device) {
+      break;
+    }
+
+    DecodedOp decoded;
+    decoded.pc = static_cast<uint16_t>(addr);
+    decoded.operand = 0;
+    for (uint32_t i = 1; i < op.len; i++) {
+      decoded.operand |= bus.peek(static_cast<uint16_t>(addr + i))
+                         << (8 * (i - 1));
+    }
+    decoded.code = op.code;
+    decoded.len = op.len;
+    decoded.cycles = op.cycles;
+    block.ops.push_back(decoded);
+    addr += op.len;
+    if (ends_block(op.instruction)) {
+      break;
+    }
+  }
+  block.end = addr;
+
+  if (block.ops.empty()) {
+    static const DecodedBlock uncached = {0, 0, {}, 0, 0};
+    return uncached;
+  }
+
+  std::vector<uint32_t> &starts = this->block_at[pc >> 8];
+  if (starts.empty()) {
+    starts.assign(BUS_PAGE_SIZE, 0);
+  }
+  uint32_t id;
+  if (!this->free_blocks.empty()) {
+    id = this->free_blocks.back();
+    this->free_blocks.pop_back();
+    this->blocks[id] = std::move(block);
+  } else {
+    id = static_cast<uint32_t>(this->blocks.size());
+    this->blocks.push_back(std::move(block));
+  }
+  DecodedBlock &cached = this->blocks[id];
+  cached.id = id;
+  cached.serial = this->decode_count;
+  starts[pc & 0xFF] = id + 1;
+  for (uint32_t page = cached.start >> 8; page <= (cached.end - 1) >> 8;
+       page++) {
+    this->page_blocks[page].push_back(id);
+    bus.arm_code_trap(static_cast<uint8_t>(page));
+  }
+  this->decode_count++;
+  return cached;
+}
+
+void BlockCache::invalidate_page(uint8_t page) {
+  for (uint32_t id : this->page_blocks[page]) {
+    const DecodedBlock &block = this->blocks[id];
+    if (!block.ops.empty() && block.start >> 8 <= page &&
+        page <= (block.end - 1) >> 8) {
+      this->release(id);
+    }
+  }
+  this->page_blocks[page].clear();
+}
+
+void BlockCache::clear() {
+  for (uint32_t id = 0; id < this->blocks.size(); id++) {
+    if (!this->blocks[id].ops.empty()) {
+      this->release(id);
+    }
+  }
+  for (std::vector<uint32_t> &ids : this->page_blocks) {
+    ids.clear();
+  }
+}
+
+std::size_t BlockCache::size() const {
+  return this->blocks.size() - this->free_blocks.size();
+}
+
+void BlockCache::release(uint32_t id) {
+  DecodedBlock &block = this->blocks[id];
+  this->block_at[block.start >> 8][block.start & 0xFF] = 0;
+  block.ops.clear();
+  this->free_blocks.push_back(id);
+}
@@ -0,0 +1,357 @@
+#include "Core/Bus.hpp"
+#include <cstring>
+#include <stdexcept>
+
+#ifdef EIZNESS_INCREMENTAL_HASH
+// Hash of an all-zero image, computed once.
+static uint64_t zero_image_hash() {
+  static const uint64_t hash = [] {
+    uint64_t value = 0;
+    for (std::size_t addr = 0; addr < BUS_MEMORY_SIZE; addr++) {
+      value ^= memory_byte_hash(static_cast<uint16_t>(addr), 0);
+    }
+    return value;
+  }();
+  return hash;
+}
+#endif
+
+Bus::Bus() {
+  this->memory.fill(0);
+#ifdef EIZNESS_INCREMENTAL_HASH
+  this->image_hash = zero_image_hash();
+#endif
+  this->write_flags.fill(WRITE_SLOW_KIND);
+  this->kinds.fill(PageKind::Unmapped);
+  this->devices.fill(nullptr);
+  this->mappings.fill(Mapping{0, 0, 0});
+  this->mirrors.fill(BusMirror{0, {0, 0, 0}});
+  this->dirty.fill(~static_cast<uint64_t>(0));
+  this->code_writes.fill(0);
+  this->code_write_pending = false;
+}
+
+static void check_range(uint8_t first_page, std::size_t page_count) {
+  if (page_count == 0 || first_page + page_count > BUS_PAGE_COUNT) {
+    throw std::out_of_range("rango de paginas fuera del bus");
+  }
+}
+
+static void check_size(std::size_t size) {
+  if (size == 0 || size % BUS_PAGE_SIZE != 0) {
+    throw std::invalid_argument("tamaño de memoria no alineado a pagina");
+  }
+}
+
+// Whether writes to a range mirrored every `size` bytes fit the inline
+// path: no more than BUS_MIRROR_COPIES copies, all within reach of an
+// int16_t offset.
+static bool inline_mirrors(std::size_t length, std::size_t size) {
+  return length <= 0x8000 && length <= size * BUS_MIRROR_COPIES;
+}
+
+void Bus::split_mirrors(uint8_t first_page, std::size_t page_count) {
+  std::size_t end = first_page + page_count;
+  for (std::size_t i = first_page; i < end; i++) {
+    if (this->kinds[i] != PageKind::Mirrored) {
+      continue;
+    }
+    Mapping old = this->mappings[i];
+    for (std::size_t page = old.first_page;
+         page < old.first_page + old.page_count; page++) {
+      if ((page >= first_page && page < end) ||
+          this->kinds[page] != PageKind::Mirrored ||
+          this->mappings[page].first_page != old.first_page) {
+        continue;
+      }
+      bool was_hashed = this->hashed(page);
+      this->write_flags[page] &= ~(WRITE_MIRROR | WRITE_SLOW_KIND);
+      this->kinds[page] = PageKind::Ram;
+      this->mappings[page] = Mapping{static_cast<uint8_t>(page), 1, 1};
+      this->mirrors[page] = BusMirror{0, {0, 0, 0}};
+      if (!was_hashed) {
+        this->toggle_page_hash(page);
+      }
+    }
+  }
+}
+
+void Bus::set_pages(uint8_t first_page, std::size_t page_count, PageKind kind,
+                    std::size_t size, BusDevice *device) {
+  this->split_mirrors(first_page, page_count);
+  Mapping mapping;
+  mapping.first_page = first_page;
+  mapping.page_count = static_cast<uint16_t>(page_count);
+  mapping.span = static_cast<uint16_t>(size / BUS_PAGE_SIZE);
+  std::size_t length = page_count * BUS_PAGE_SIZE;
+  uint8_t flags = WRITE_SLOW_KIND;
+  if (kind == PageKind::Ram) {
+    flags = 0;
+  } else if (kind == PageKind::Mirrored && inline_mirrors(length, size)) {
+    flags = WRITE_MIRROR;
+  }
+  for (std::size_t i = first_page; i < first_page + page_count; i++) {
+    this->note_code_write(i);
+    bool was_hashed = this->hashed(i);
+    this->write_flags[i] = flags;
+    this->kinds[i] = kind;
+    this->devices[i] = device;
+    this->mappings[i] = mapping;
+    BusMirror mirror = {0, {0, 0, 0}};
+    if (flags == WRITE_MIRROR) {
+      std::size_t offset = (i - first_page) * BUS_PAGE_SIZE % size;
+      mirror.to_canonical = static_cast<int16_t>(
+          static_cast<int>(offset) - static_cast<int>(i - first_page) *
+                                         static_cast<int>(BUS_PAGE_SIZE));
+      std::size_t copy = 0;
+      for (std::size_t pos = offset + size; pos < length; pos += size) {
+        mirror.copies[copy++] = static_cast<int16_t>(pos - offset);
+      }
+    }
+    this->mirrors[i] = mirror;
+    // Pages that become or stop being mirror copies leave or join the
+    // hash as they are.
+    if (this->hashed(i) != was_hashed) {
+      this->toggle_page_hash(i);
+    }
+    this->mark_dirty(i);
+  }
+}
+
+bool Bus::hashed(std::size_t page) const {
+  const Mapping &mapping = this->mappings[page];
+  return this->kinds[page] != PageKind::Mirrored ||
+         page - mapping.first_page < mapping.span;
+}
+
+template <typename F> void Bus::for_each_copy(std::size_t page, F &&visit) {
+  if (this->kinds[page] != PageKind::Mirrored) {
+    visit(page);
+    return;
+  }
+  const Mapping &mapping = this->mappings[page];
+  std::size_t end = mapping.first_page + mapping.page_count;
+  for (std::size_t copy =
+           mapping.first_page + (page - mapping.first_page) % mapping.span;
+       copy < end; copy += mapping.span) {
+    visit(copy);
+  }
+}
+
+void Bus::map_memory(uint8_t first_page, std::size_t page_count,
+                     std::size_t size) {
+  check_range(first_page, page_count);
+  check_size(size);
+  std::size_t start = first_page * BUS_PAGE_SIZE;
+  std::size_t length = page_count * BUS_PAGE_SIZE;
+  if (size >= length) {
+    this->set_pages(first_page, page_count, PageKind::Ram, length, nullptr);
+    return;
+  }
+  // Mirrors start out as copies of the first `size` bytes.
+  this->toggle_hash(start + size, length - size);
+  for (std::size_t pos = size; pos < length; pos += size) {
+    std::memcpy(&this->memory[start + pos], &this->memory[start], size);
+  }
+  this->toggle_hash(start + size, length - size);
+  this->set_pages(first_page, page_count, PageKind::Mirrored, size, nullptr);
+}
+
+void Bus::map_rom(uint8_t first_page, std::size_t page_count,
+                  const uint8_t *data, std::size_t size) {
+  check_range(first_page, page_count);
+  check_size(size);
+  std::size_t start = first_page * BUS_PAGE_SIZE;
+  std::size_t length = page_count * BUS_PAGE_SIZE;
+  this->toggle_hash(start, length);
+  for (std::size_t pos = 0; pos < length; pos += size) {
+    std::size_t chunk = size < length - pos ? size : length - pos;
+    std::memcpy(&this->memory[start + pos], data, chunk);
+  }
+  this->toggle_hash(start, length);
+  this->set_pages(first_page, page_count, PageKind::Rom, size, nullptr);
+}
+
+void Bus::map_device(uint8_t first_page, std::size_t page_count,
+                     BusDevice *device) {
+  check_range(first_page, page_count);
+  if (device == nullptr) {
+    throw std::invalid_argument("dispositivo nulo");
+  }
+  this->set_pages(first_page, page_count, PageKind::Device,
+                  page_count * BUS_PAGE_SIZE, device);
+}
+
+void Bus::unmap(uint8_t first_page, std::size_t page_count) {
+  check_range(first_page, page_count);
+  std::size_t start = first_page * BUS_PAGE_SIZE;
+  std::size_t length = page_count * BUS_PAGE_SIZE;
+  this->toggle_hash(start, length);
+  std::memset(&this->memory[start], 0, length);
+  this->toggle_hash(start, length);
+  this->set_pages(first_page, page_count, PageKind::Unmapped,
+                  page_count * BUS_PAGE_SIZE, nullptr);
+}
+
+void Bus::store_image(uint16_t start, const uint8_t *data, std::size_t size) {
+  if (start + size > BUS_MEMORY_SIZE) {
+    throw std::out_of_range("rango de memoria fuera del bus");
+  }
+  this->toggle_hash(start, size);
+  std::memcpy(&this->memory[start], data, size);
+  this->toggle_hash(start, size);
+}
+
+uint64_t Bus::memory_hash() const {
+#ifdef EIZNESS_INCREMENTAL_HASH
+  return this->image_hash;
+#else
+  return this->compute_memory_hash();
+#endif
+}
+
+uint64_t Bus::compute_memory_hash() const {
+  uint64_t hash = 0;
+  for (std::size_t addr = 0; addr < BUS_MEMORY_SIZE; addr++) {
+    if (this->hashed(addr >> 8)) {
+      hash ^=
+          memory_byte_hash(static_cast<uint16_t>(addr), this->memory[addr]);
+    }
+  }
+  return hash;
+}
+
+void Bus::rehash() {
+#ifdef EIZNESS_INCREMENTAL_HASH
+  this->image_hash = this->compute_memory_hash();
+#endif
+}
+
+void Bus::store_byte(std::size_t pos, uint8_t data) {
+#ifdef EIZNESS_INCREMENTAL_HASH
+  uint16_t addr = static_cast<uint16_t>(pos);
+  this->image_hash ^= memory_byte_hash(addr, this->memory[pos]) ^
+                      memory_byte_hash(addr, data);
+#endif
+  this->memory[pos] = data;
+}
+
+void Bus::toggle_hash(std::size_t start, std::size_t length) {
+#ifdef EIZNESS_INCREMENTAL_HASH
+  for (std::size_t pos = start; pos < start + length; pos++) {
+    if (this->hashed(pos >> 8)) {
+      this->image_hash ^=
+          memory_byte_hash(static_cast<uint16_t>(pos), this->memory[pos]);
+    }
+  }
+#else
+  (void)start;
+  (void)length;
+#endif
+}
+
+void Bus::toggle_page_hash(std::size_t page) {
+#ifdef EIZNESS_INCREMENTAL_HASH
+  std::size_t start = page * BUS_PAGE_SIZE;
+  for (std::size_t pos = start; pos < start + BUS_PAGE_SIZE; pos++) {
+    this->image_hash ^=
+        memory_byte_hash(static_cast<uint16_t>(pos), this->memory[pos]);
+  }
+#else
+  (void)page;
+#endif
+}
+
+uint8_t Bus::peek(uint16_t addr) const {
+  BusDevice *device = this->devices[addr >> 8];
+  return device != nullptr ? device->peek(addr) : this->memory[addr];
+}
+
+PageKind Bus::page_kind(uint16_t addr) const { return this->kinds[addr >> 8]; }
+
+BusDevice *Bus::device_at(uint16_t addr) const {
+  return this->devices[addr >> 8];
+}
+
+void Bus::clear_dirty_pages() {
+  // Clean pages still have their trap armed, so only dirty ones need it.
+  for (std::size_t word = 0; word < this->dirty.size(); word++) {
+    uint64_t bits = this->dirty[word];
+    while (bits != 0) {
+      std::size_t page = word * 64 + count_trailing_zeros(bits);
+      bits &= bits - 1;
+      if (this->kinds[page] == PageKind::Ram ||
+          this->kinds[page] == PageKind::Mirrored) {
+        this->write_flags[page] |= WRITE_TRAP_DIRTY;
+      }
+    }
+    this->dirty[word] = 0;
+  }
+}
+
+void Bus::mark_dirty(std::size_t page) {
+  this->dirty[page / 64] |= static_cast<uint64_t>(1) << (page % 64);
+  this->write_flags[page] &= ~WRITE_TRAP_DIRTY;
+}
+
+void Bus::arm_code_trap(uint8_t page) {
+  // Every copy of a mirrored page, so none of them writes inline.
+  this->for_each_copy(page, [this](std::size_t copy) {
+    if (this->kinds[copy] != PageKind::Device) {
+      this->write_flags[copy] |= WRITE_TRAP_CODE;
+    }
+  });
+}
+
+void Bus::disarm_code_traps() {
+  for (uint8_t &flags : this->write_flags) {
+    flags &= ~WRITE_TRAP_CODE;
+  }
+  this->code_writes.fill(0);
+  this->code_write_pending = false;
+}
+
+void Bus::note_code_write(std::size_t page) {
+  if (this->write_flags[page] & WRITE_TRAP_CODE) {
+    this->write_flags[page] &= ~WRITE_TRAP_CODE;
+    this->code_writes[page / 64] |= static_cast<uint64_t>(1) << (page % 64);
+    this->code_write_pending = true;
+  }
+}
+
+uint8_t Bus::read_slow(uint16_t addr) {
+  return this->devices[addr >> 8]->read(addr);
+}
+
+void Bus::write_slow(uint16_t addr, uint8_t data) {
+  switch (this->kinds[addr >> 8]) {
+  case PageKind::Mirrored: {
+    // Only the first copy, the canonical one, is hashed.
+    bool canonical = true;
+    this->for_each_copy(addr >> 8, [&](std::size_t copy) {
+      std::size_t pos = copy * BUS_PAGE_SIZE | (addr & 0xFF);
+      this->mark_dirty(copy);
+      this->note_code_write(copy);
+      if (canonical) {
+        this->store_byte(pos, data);
+        canonical = false;
+      } else {
+        this->memory[pos] = data;
+      }
+    });
+    break;
+  }
+  case PageKind::Device:
+    this->devices[addr >> 8]->write(addr, data);
+    break;
+  case PageKind::Ram:
+    this->mark_dirty(addr >> 8);
+    this->note_code_write(addr >> 8);
+    this->store_byte(addr, data);
+    break;
+  case PageKind::Rom:
+  case PageKind::Unmapped:
+    // Dropped.
+    break;
+  }
+}
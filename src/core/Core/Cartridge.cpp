@@ -0,0 +1,211 @@
+#include "Core/Cartridge.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+// NES 2.0 sizes are either a 12-bit bank count or, when the high nibble is
+// $F, an exponent-multiplier pair packed into the low byte.
+static std::size_t nes2_rom_size(uint8_t lsb, uint8_t msb, std::size_t unit) {
+  if (msb == 0x0F) {
+    unsigned exponent = lsb >> 2;
+    unsigned multiplier = (lsb & 0x03) * 2 + 1;
+    if (exponent > 32) {
+      throw std::runtime_error("tamaño de ROM NES 2.0 invalido");
+    }
+    return (static_cast<std::size_t>(1) << exponent) * multiplier;
+  }
+  return ((static_cast<std::size_t>(msb) << 8) | lsb) * unit;
+}
+
+static std::size_t nes2_ram_size(uint8_t shift) {
+  return shift == 0 ? 0 : static_cast<std::size_t>(64) << shift;
+}
+
+CartridgeHeader parse_ines_header(const uint8_t *data, std::size_t size) {
+  if (size < INES_HEADER_SIZE || std::memcmp(data, "NES\x1A", 4) != 0) {
+    throw std::runtime_error("cabecera iNES invalida");
+  }
+
+  CartridgeHeader header;
+  uint8_t flags6 = data[6];
+  uint8_t flags7 = data[7];
+  header.nes2 = (flags7 & 0x0C) == 0x08;
+  header.battery = flags6 & 0x02;
+  header.trainer = flags6 & 0x04;
+  if (flags6 & 0x08) {
+    header.mirroring = Mirroring::FourScreen;
+  } else if (flags6 & 0x01) {
+    header.mirroring = Mirroring::Vertical;
+  } else {
+    header.mirroring = Mirroring::Horizontal;
+  }
+
+  if (header.nes2) {
+    header.mapper = (flags6 >> 4) | (flags7 & 0xF0) | ((data[8] & 0x0F) << 8);
+    header.submapper = data[8] >> 4;
+    header.prg_rom_size =
+        nes2_rom_size(data[4], data[9] & 0x0F, PRG_ROM_BANK_SIZE);
+    header.chr_rom_size = nes2_rom_size(data[5], data[9] >> 4,
+                                        CHR_ROM_BANK_SIZE);
+    header.prg_ram_size =
+        nes2_ram_size(data[10] & 0x0F) + nes2_ram_size(data[10] >> 4);
+  } else {
+    // Old dumps tagged "DiskDude!" in bytes 7-15 have garbage in the upper
+    // mapper nibble; only trust it when the padding is clean.
+    bool clean = data[12] == 0 && data[13] == 0 && data[14] == 0 &&
+                 data[15] == 0;
+    header.mapper = (flags6 >> 4) | (clean ? (flags7 & 0xF0) : 0);
+    header.submapper = 0;
+    header.prg_rom_size = data[4] * PRG_ROM_BANK_SIZE;
+    header.chr_rom_size = data[5] * CHR_ROM_BANK_SIZE;
+    header.prg_ram_size = (data[8] == 0 ? 1 : data[8]) * 0x2000;
+  }
+
+  std::size_t needed = INES_HEADER_SIZE +
+                       (header.trainer ? INES_TRAINER_SIZE : 0) +
+                       header.prg_rom_size + header.chr_rom_size;
+  if (header.prg_rom_size == 0 || needed > size) {
+    throw std::runtime_error("ROM truncada");
+  }
+  return header;
+}
+
+// Mapper 0: 16KB or 32KB of PRG-ROM at $8000, a 16KB bank mirrored into
+// $C000, and optional PRG-RAM at $6000. A trainer is loaded into PRG-RAM at
+// $7000.
+class NromMapper : public Mapper {
+public:
+  void attach(const Cartridge &cartridge, Bus &bus) const override {
+    const CartridgeHeader &header = cartridge.header();
+    if (header.prg_rom_size != PRG_ROM_BANK_SIZE &&
+        header.prg_rom_size != 2 * PRG_ROM_BANK_SIZE) {
+      throw std::runtime_error("tamaño de PRG no valido para NROM");
+    }
+    std::size_t ram = header.prg_ram_size < 0x2000 ? header.prg_ram_size
+                                                   : 0x2000;
+    // $7000 must not be a mirror of $6000.
+    if (header.trainer) {
+      ram = 0x2000;
+    }
+    if (ram > 0) {
+      ram = (ram + BUS_PAGE_SIZE - 1) / BUS_PAGE_SIZE * BUS_PAGE_SIZE;
+      bus.map_memory(0x60, 0x20, ram);
+    }
+    if (header.trainer) {
+      const uint8_t *trainer = cartridge.trainer();
+      for (std::size_t i = 0; i < INES_TRAINER_SIZE; i++) {
+        bus.write(static_cast<uint16_t>(INES_TRAINER_ADDRESS + i), trainer[i]);
+      }
+    }
+    bus.map_rom(0x80, 0x80, cartridge.prg_rom(), header.prg_rom_size);
+  }
+};
+
+static std::unique_ptr<Mapper> make_mapper(const CartridgeHeader &header) {
+  switch (header.mapper) {
+  case 0:
+    return std::make_unique<NromMapper>();
+  default:
+    throw std::runtime_error("mapper no soportado: " +
+                             std::to_string(header.mapper));
+  }
+}
+
+Cartridge::Cartridge(const std::string &path) {
+  this->mapping = nullptr;
+  this->mapping_size = 0;
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("no se pudo abrir la ROM: " + path);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    throw std::runtime_error("ROM vacia: " + path);
+  }
+  void *mapped = ::mmap(nullptr, static_cast<std::size_t>(st.st_size),
+                        PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("no se pudo mapear la ROM: " + path);
+  }
+
+  this->mapping = mapped;
+  this->mapping_size = static_cast<std::size_t>(st.st_size);
+  this->data = static_cast<const uint8_t *>(mapped);
+  this->size = this->mapping_size;
+  try {
+    this->parse();
+  } catch (...) {
+    this->release();
+    throw;
+  }
+}
+
+Cartridge::Cartridge(std::vector<uint8_t> image) : owned(std::move(image)) {
+  this->mapping = nullptr;
+  this->mapping_size = 0;
+  this->data = this->owned.data();
+  this->size = this->owned.size();
+  this->parse();
+}
+
+Cartridge::~Cartridge() { this->release(); }
+
+Cartridge::Cartridge(Cartridge &&other) noexcept
+    : owned(std::move(other.owned)), mapping(other.mapping),
+      mapping_size(other.mapping_size), data(other.data), size(other.size),
+      info(other.info), mapper(std::move(other.mapper)) {
+  other.mapping = nullptr;
+  other.mapping_size = 0;
+}
+
+Cartridge &Cartridge::operator=(Cartridge &&other) noexcept {
+  if (this != &other) {
+    this->release();
+    this->owned = std::move(other.owned);
+    this->mapping = other.mapping;
+    this->mapping_size = other.mapping_size;
+    this->data = other.data;
+    this->size = other.size;
+    this->info = other.info;
+    this->mapper = std::move(other.mapper);
+    other.mapping = nullptr;
+    other.mapping_size = 0;
+  }
+  return *this;
+}
+
+void Cartridge::parse() {
+  this->info = parse_ines_header(this->data, this->size);
+  this->mapper = make_mapper(this->info);
+}
+
+void Cartridge::release() {
+  if (this->mapping != nullptr) {
+    ::munmap(this->mapping, this->mapping_size);
+    this->mapping = nullptr;
+  }
+}
+
+const CartridgeHeader &Cartridge::header() const { return this->info; }
+
+const uint8_t *Cartridge::trainer() const {
+  return this->info.trainer ? this->data + INES_HEADER_SIZE : nullptr;
+}
+
+const uint8_t *Cartridge::prg_rom() const {
+  return this->data + INES_HEADER_SIZE +
+         (this->info.trainer ? INES_TRAINER_SIZE : 0);
+}
+
+const uint8_t *Cartridge::chr_rom() const {
+  return this->prg_rom() + this->info.prg_rom_size;
+}
+
+void Cartridge::attach(Bus &bus) const { this->mapper->attach(*this, bus); }
@@ -0,0 +1,176 @@
+#include "Core/EmulatorPool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+EmulatorPool::EmulatorPool(std::size_t threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (std::size_t i = 0; i < threads; i++) {
+    this->workers.push_back(std::make_unique<Worker>());
+  }
+  this->remaining = 0;
+  this->last_stats = PoolStats{0, 0, 0, 0, 0, 0.0};
+}
+
+std::size_t EmulatorPool::add(NesCpu cpu, uint64_t cycle_budget,
+                              PoolCompletion on_complete) {
+  std::unique_ptr<PoolInstance> instance = std::make_unique<PoolInstance>();
+  instance->cpu = std::move(cpu);
+  instance->cycle_budget = cycle_budget;
+  instance->total = RunResult{StopReason::CycleLimit, 0, 0};
+  instance->done = false;
+  instance->on_complete = std::move(on_complete);
+  this->instances.push_back(std::move(instance));
+  return this->instances.size() - 1;
+}
+
+std::size_t EmulatorPool::size() const { return this->instances.size(); }
+
+std::size_t EmulatorPool::threads() const { return this->workers.size(); }
+
+NesCpu &EmulatorPool::cpu(std::size_t index) {
+  return this->instances.at(index)->cpu;
+}
+
+const RunResult &EmulatorPool::result(std::size_t index) const {
+  return this->instances.at(index)->total;
+}
+
+PoolStats EmulatorPool::stats() const { return this->last_stats; }
+
+void EmulatorPool::run(uint64_t slice_cycles) {
+  if (slice_cycles == 0) {
+    throw std::invalid_argument("el intervalo de ciclos no puede ser cero");
+  }
+
+  // Deal the unfinished instances out round-robin.
+  std::size_t pending = 0;
+  for (std::size_t i = 0; i < this->instances.size(); i++) {
+    if (this->instances[i]->done) {
+      continue;
+    }
+    Worker &worker = *this->workers[pending % this->workers.size()];
+    worker.queue.push_back(i);
+    pending++;
+  }
+  for (std::unique_ptr<Worker> &worker : this->workers) {
+    worker->instructions = 0;
+    worker->cycles = 0;
+    worker->slices = 0;
+    worker->steals = 0;
+  }
+  this->remaining = pending;
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (std::size_t id = 1; id < this->workers.size(); id++) {
+    threads.emplace_back(&EmulatorPool::work, this, id, slice_cycles);
+  }
+  this->work(0, slice_cycles);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  PoolStats stats = {0, 0, 0, 0, pending, 0.0};
+  for (const std::unique_ptr<Worker> &worker : this->workers) {
+    stats.instructions += worker->instructions;
+    stats.cycles += worker->cycles;
+    stats.slices += worker->slices;
+    stats.steals += worker->steals;
+  }
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  this->last_stats = stats;
+
+  for (std::unique_ptr<PoolInstance> &instance : this->instances) {
+    if (instance->error) {
+      std::exception_ptr error = instance->error;
+      instance->error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+void EmulatorPool::work(std::size_t id, uint64_t slice_cycles) {
+  Worker &worker = *this->workers[id];
+  std::size_t index;
+  while (this->remaining.load(std::memory_order_acquire) > 0) {
+    if (!this->take(id, index)) {
+      // Every queued instance is being run by another worker right now.
+      std::this_thread::yield();
+      continue;
+    }
+    PoolInstance &instance = *this->instances[index];
+    if (this->run_slice(worker, instance, index, slice_cycles)) {
+      this->remaining.fetch_sub(1, std::memory_order_acq_rel);
+    } else {
+      std::lock_guard<std::mutex> guard(worker.lock);
+      worker.queue.push_back(index);
+    }
+  }
+}
+
+bool EmulatorPool::take(std::size_t id, std::size_t &index) {
+  Worker &own = *this->workers[id];
+  {
+    std::lock_guard<std::mutex> guard(own.lock);
+    // The oldest first: sliced instances go to the back, so the ones a
+    // worker holds take turns.
+    if (!own.queue.empty()) {
+      index = own.queue.front();
+      own.queue.pop_front();
+      return true;
+    }
+  }
+  for (std::size_t i = 1; i < this->workers.size(); i++) {
+    Worker &victim = *this->workers[(id + i) % this->workers.size()];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.queue.empty()) {
+      index = victim.queue.back();
+      victim.queue.pop_back();
+      own.steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool EmulatorPool::run_slice(Worker &worker, PoolInstance &instance,
+                             std::size_t index, uint64_t slice_cycles) {
+  RunLimits limits;
+  limits.max_cycles =
+      std::min(slice_cycles, instance.cycle_budget - instance.total.cycles);
+  try {
+    RunResult result = instance.cpu.run_until(limits);
+    instance.total.instructions += result.instructions;
+    instance.total.cycles += result.cycles;
+    instance.total.reason = result.reason;
+    worker.instructions += result.instructions;
+    worker.cycles += result.cycles;
+    worker.slices++;
+  } catch (...) {
+    instance.error = std::current_exception();
+    instance.done = true;
+    return true;
+  }
+
+  if (instance.total.reason != StopReason::Break &&
+      instance.total.cycles < instance.cycle_budget) {
+    return false;
+  }
+  instance.done = true;
+  if (instance.on_complete) {
+    // Rethrown by run() like the instance's own errors, rather than
+    // escaping the worker thread.
+    try {
+      instance.on_complete(index, instance.cpu, instance.total);
+    } catch (...) {
+      instance.error = std::current_exception();
+    }
+  }
+  return true;
+}
@@ -0,0 +1,23 @@
+#include "Core/InputQueue.hpp"
+
+InputQueue::InputQueue() : head(0), tail(0) { this->buffer.fill(0); }
+
+bool InputQueue::push(uint8_t value) {
+  std::size_t head = this->head.load(std::memory_order_relaxed);
+  if (head - this->tail.load(std::memory_order_acquire) == CAPACITY) {
+    return false;
+  }
+  this->buffer[head % CAPACITY] = value;
+  this->head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+bool InputQueue::pop(uint8_t &value) {
+  std::size_t tail = this->tail.load(std::memory_order_relaxed);
+  if (tail == this->head.load(std::memory_order_acquire)) {
+    return false;
+  }
+  value = this->buffer[tail % CAPACITY];
+  this->tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
@@ -0,0 +1,1341 @@
+#include "Core/Jit.hpp"
+#include "Core/NesCpu.hpp"
+#include "Core/OpCodes.hpp"
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define EIZNESS_JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef EIZNESS_JIT_X86_64
+
+// Host registers, numbered as in their encoding.
+enum Host : uint8_t {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+// Where compiled code keeps the guest state. Everything is caller-saved
+// except the flags and tables, which are pushed once per block. RAX holds
+// computed addresses and RCX is scratch; both are free between
+// instructions. The guest registers are always zero-extended bytes.
+const Host HOST_STATE = RDI;
+const Host HOST_MEMORY = RSI;
+const Host HOST_A = R8;
+const Host HOST_X = R9;
+const Host HOST_Y = R10;
+const Host HOST_SP = R11;
+const Host HOST_ZN = RDX;
+const Host HOST_CARRY = RBX;
+const Host HOST_OVERFLOW = RBP;
+const Host HOST_DEVICES = R12;
+const Host HOST_WRITE_FLAGS = R13;
+const Host HOST_DIRTY = R14;
+const Host HOST_VALUE = R15;
+
+#ifdef EIZNESS_INCREMENTAL_HASH
+// SSE registers are otherwise unused, so the image hash stays in one for
+// the whole block and two more hold the halves of each store's update.
+enum Xmm : uint8_t {
+  XMM0,
+  XMM1,
+  XMM2,
+};
+
+const Xmm HOST_HASH = XMM0;
+const Xmm HOST_HASH_OLD = XMM1;
+const Xmm HOST_HASH_NEW = XMM2;
+#endif
+
+enum class Width {
+  // Every register operand is a byte register.
+  Byte,
+  // Only the r/m operand is a byte register (movzx).
+  ByteSource,
+  Word,
+  Dword,
+  Qword,
+};
+
+enum Condition : uint8_t {
+  CC_O = 0x0,
+  CC_B = 0x2,
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+};
+
+// The r/m side of an instruction: a register or [base + index * 2^scale +
+// disp].
+struct Operand {
+  bool is_register;
+  uint8_t reg;
+  uint8_t base;
+  int8_t index;
+  uint8_t scale;
+  int32_t disp;
+};
+
+static Operand reg(Host r) { return {true, r, 0, -1, 0, 0}; }
+
+#ifdef EIZNESS_INCREMENTAL_HASH
+static Operand xmm_reg(Xmm r) { return {true, r, 0, -1, 0, 0}; }
+#endif
+
+static Operand mem(Host base, int32_t disp = 0) {
+  return {false, 0, base, -1, 0, disp};
+}
+
+static Operand mem(Host base, Host index, uint8_t scale, int32_t disp = 0) {
+  return {false, 0, base, static_cast<int8_t>(index), scale, disp};
+}
+
+static Operand state_field(std::size_t offset) {
+  return mem(HOST_STATE, static_cast<int32_t>(offset));
+}
+
+// Just enough of an x86-64 encoder for the instructions below.
+class X86Assembler {
+public:
+  std::vector<uint8_t> code;
+
+  void byte(uint8_t value) { this->code.push_back(value); }
+
+  void dword(uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      this->byte(static_cast<uint8_t>(value >> shift));
+    }
+  }
+
+  // [66] [REX] opcode ModRM [SIB] [disp]. `reg` is a register or an opcode
+  // extension.
+  void instr(std::initializer_list<uint8_t> opcode, uint8_t reg,
+             const Operand &rm, Width width) {
+    if (width == Width::Word) {
+      this->byte(0x66);
+    }
+    uint8_t rex = 0;
+    if (width == Width::Qword) {
+      rex |= 0x48;
+    }
+    if (reg >= 8) {
+      rex |= 0x44;
+    }
+    if (rm.is_register) {
+      if (rm.reg >= 8) {
+        rex |= 0x41;
+      }
+    } else {
+      if (rm.index >= 8) {
+        rex |= 0x42;
+      }
+      if (rm.base >= 8) {
+        rex |= 0x41;
+      }
+    }
+    // SPL..DIL need a REX prefix to not mean AH..BH.
+    bool byte_rm = width == Width::Byte || width == Width::ByteSource;
+    if ((width == Width::Byte && reg >= 4 && reg < 8) ||
+        (byte_rm && rm.is_register && rm.reg >= 4 && rm.reg < 8)) {
+      rex |= 0x40;
+    }
+    if (rex != 0) {
+      this->byte(rex);
+    }
+    for (uint8_t op : opcode) {
+      this->byte(op);
+    }
+    this->modrm(reg & 7, rm);
+  }
+
+  int new_label() {
+    this->labels.push_back(-1);
+    return static_cast<int>(this->labels.size() - 1);
+  }
+
+  void bind(int label) {
+    this->labels[label] = static_cast<int32_t>(this->code.size());
+  }
+
+  void jcc(Condition cc, int label) {
+    this->byte(0x0F);
+    this->byte(0x80 | cc);
+    this->rel32(label);
+  }
+
+  void jmp(int label) {
+    this->byte(0xE9);
+    this->rel32(label);
+  }
+
+  bool referenced(int label) const {
+    for (const Fixup &fixup : this->fixups) {
+      if (fixup.label == label) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Patches every jump once all labels are bound.
+  void resolve() {
+    for (const Fixup &fixup : this->fixups) {
+      int32_t rel = this->labels[fixup.label] - (fixup.at + 4);
+      std::memcpy(&this->code[fixup.at], &rel, sizeof(rel));
+    }
+  }
+
+private:
+  struct Fixup {
+    int32_t at;
+    int label;
+  };
+
+  void modrm(uint8_t reg, const Operand &rm) {
+    if (rm.is_register) {
+      this->byte(0xC0 | reg << 3 | (rm.reg & 7));
+      return;
+    }
+    uint8_t base = rm.base & 7;
+    bool sib = rm.index >= 0 || base == RSP;
+    uint8_t mod;
+    if (rm.disp == 0 && base != RBP) {
+      mod = 0;
+    } else if (rm.disp >= -128 && rm.disp <= 127) {
+      mod = 1;
+    } else {
+      mod = 2;
+    }
+    this->byte(mod << 6 | reg << 3 | (sib ? static_cast<uint8_t>(RSP) : base));
+    if (sib) {
+      uint8_t index = rm.index >= 0 ? rm.index & 7 : RSP;
+      this->byte(rm.scale << 6 | index << 3 | base);
+    }
+    if (mod == 1) {
+      this->byte(static_cast<uint8_t>(rm.disp));
+    } else if (mod == 2) {
+      this->dword(static_cast<uint32_t>(rm.disp));
+    }
+  }
+
+  void rel32(int label) {
+    this->fixups.push_back({static_cast<int32_t>(this->code.size()), label});
+    this->dword(0);
+  }
+
+  std::vector<int32_t> labels;
+  std::vector<Fixup> fixups;
+};
+
+// An effective address, either known when compiling or computed into RAX.
+struct Address {
+  bool constant;
+  uint16_t value;
+};
+
+// The byte a store writes: a register or a constant.
+struct StoreValue {
+  bool constant;
+  Host reg;
+  uint8_t value;
+};
+
+// A store whose page turned out to be mirrored, finished out of line from
+// `label` before jumping back to `resume`.
+struct MirroredStore {
+  int label;
+  int resume;
+  Address addr;
+  StoreValue value;
+};
+
+static bool compilable(const OpCode &op) {
+  switch (op.instruction) {
+  case Instruction::BRK:
+  case Instruction::RTI:
+  case Instruction::Illegal:
+    return false;
+  case Instruction::JMP:
+    // JMP ($nnnn) is left to the interpreter.
+    return op.code == 0x4c;
+  default:
+    return true;
+  }
+}
+
+// Instructions that go through read_operand and pay for page crossings.
+static bool pays_page_cross(const OpCode &op) {
+  switch (op.instruction) {
+  case Instruction::LDA:
+  case Instruction::LDX:
+  case Instruction::LDY:
+  case Instruction::ADC:
+  case Instruction::SBC:
+  case Instruction::AND:
+  case Instruction::ORA:
+  case Instruction::EOR:
+  case Instruction::CMP:
+  case Instruction::CPX:
+  case Instruction::CPY:
+    return op.mode == AddressingMode::Absolute_X ||
+           op.mode == AddressingMode::Absolute_Y ||
+           op.mode == AddressingMode::Indirect_Y;
+  default:
+    return false;
+  }
+}
+
+static bool is_branch(Instruction instruction) {
+  switch (instruction) {
+  case Instruction::BCC:
+  case Instruction::BCS:
+  case Instruction::BEQ:
+  case Instruction::BMI:
+  case Instruction::BNE:
+  case Instruction::BPL:
+  case Instruction::BVC:
+  case Instruction::BVS:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Upper bound on the cycles of the first `length` instructions, counting
+// every page-crossing and taken-branch penalty.
+static uint32_t max_cycles(const DecodedBlock &block, uint32_t length) {
+  uint32_t cycles = 0;
+  for (uint32_t i = 0; i < length; i++) {
+    const OpCode &op = OPCODES_TABLE[block.ops[i].code];
+    cycles += op.cycles + pays_page_cross(op) +
+              (is_branch(op.instruction) ? 2 : 0);
+  }
+  return cycles;
+}
+
+// Translates the first `length` instructions of a block. Each instruction
+// first runs every check that can send it back to the interpreter and only
+// then changes guest state, so an early exit leaves the state exactly as
+// it was before the instruction.
+class BlockCompiler {
+public:
+  BlockCompiler(const DecodedBlock &block, uint32_t length)
+      : block(block), length(length), exits(length + 1, -1),
+        prefix_cycles(length + 1, 0) {
+    for (uint32_t i = 0; i < length; i++) {
+      this->prefix_cycles[i + 1] =
+          this->prefix_cycles[i] + OPCODES_TABLE[block.ops[i].code].cycles;
+    }
+  }
+
+  std::vector<uint8_t> compile() {
+    this->epilogue = this->as.new_label();
+    this->prologue();
+    this->top = this->as.new_label();
+    this->as.bind(this->top);
+    bool ended = false;
+    for (uint32_t i = 0; i < this->length && !ended; i++) {
+      ended = this->instruction(i);
+    }
+    if (!ended) {
+      const DecodedOp &last = this->block.ops[this->length - 1];
+      this->finish(this->prefix_cycles[this->length],
+                   static_cast<uint16_t>(last.pc + last.len), this->length);
+    }
+    for (const MirroredStore &store : this->mirrored_stores) {
+      this->mirrored_store(store);
+    }
+    for (uint32_t i = 0; i < this->length; i++) {
+      if (this->exits[i] >= 0 && this->as.referenced(this->exits[i])) {
+        this->as.bind(this->exits[i]);
+        this->finish(this->prefix_cycles[i], this->block.ops[i].pc, i);
+      }
+    }
+    this->emit_epilogue();
+    this->as.resolve();
+    return this->as.code;
+  }
+
+private:
+  void prologue() {
+    for (Host r : {RBX, RBP, R12, R13, R14, R15}) {
+      this->push(r);
+    }
+    this->load64(HOST_MEMORY, state_field(offsetof(JitState, memory)));
+    this->load64(HOST_DEVICES, state_field(offsetof(JitState, devices)));
+    this->load64(HOST_WRITE_FLAGS,
+                 state_field(offsetof(JitState, write_flags)));
+    this->load64(HOST_DIRTY, state_field(offsetof(JitState, dirty_lines)));
+    this->movzx8(HOST_A, state_field(offsetof(JitState, register_a)));
+    this->movzx8(HOST_X, state_field(offsetof(JitState, register_x)));
+    this->movzx8(HOST_Y, state_field(offsetof(JitState, register_y)));
+    this->movzx8(HOST_SP, state_field(offsetof(JitState, stack_pointer)));
+    this->as.instr({0x0F, 0xB7}, HOST_ZN,
+                   state_field(offsetof(JitState, zero_negative)),
+                   Width::Dword);
+    this->movzx8(HOST_CARRY, state_field(offsetof(JitState, carry)));
+    this->movzx8(HOST_OVERFLOW, state_field(offsetof(JitState, overflow)));
+#ifdef EIZNESS_INCREMENTAL_HASH
+    this->movq(HOST_HASH, state_field(offsetof(JitState, memory_hash)),
+               false);
+#endif
+  }
+
+  void emit_epilogue() {
+    this->as.bind(this->epilogue);
+    this->store8(state_field(offsetof(JitState, register_a)), HOST_A);
+    this->store8(state_field(offsetof(JitState, register_x)), HOST_X);
+    this->store8(state_field(offsetof(JitState, register_y)), HOST_Y);
+    this->store8(state_field(offsetof(JitState, stack_pointer)), HOST_SP);
+    this->as.instr({0x89}, HOST_ZN,
+                   state_field(offsetof(JitState, zero_negative)),
+                   Width::Word);
+    this->store8(state_field(offsetof(JitState, carry)), HOST_CARRY);
+    this->store8(state_field(offsetof(JitState, overflow)), HOST_OVERFLOW);
+#ifdef EIZNESS_INCREMENTAL_HASH
+    this->movq(HOST_HASH, state_field(offsetof(JitState, memory_hash)), true);
+#endif
+    for (Host r : {R15, R14, R13, R12, RBP, RBX}) {
+      this->pop(r);
+    }
+    this->as.byte(0xC3);
+  }
+
+  // Leaves the block with `count` instructions done and pc at `pc`, or at
+  // AX when `pc` is not known.
+  void finish(uint32_t cycles, uint16_t pc, uint32_t count,
+              bool pc_in_ax = false) {
+    if (cycles > 0) {
+      this->as.instr({0x81}, 0, state_field(offsetof(JitState, cycles)),
+                     Width::Qword);
+      this->as.dword(cycles);
+    }
+    Operand pc_field = state_field(offsetof(JitState, program_counter));
+    if (pc_in_ax) {
+      this->as.instr({0x89}, RAX, pc_field, Width::Word);
+    } else {
+      this->as.instr({0xC7}, 0, pc_field, Width::Word);
+      this->as.byte(static_cast<uint8_t>(pc));
+      this->as.byte(static_cast<uint8_t>(pc >> 8));
+    }
+    this->mov_imm(RAX, count);
+    this->as.jmp(this->epilogue);
+  }
+
+  // Label that leaves the block before instruction `i` runs.
+  int exit(uint32_t i) {
+    if (this->exits[i] < 0) {
+      this->exits[i] = this->as.new_label();
+    }
+    return this->exits[i];
+  }
+
+  // Emits instruction `i`; returns true when it ends the block.
+  bool instruction(uint32_t i) {
+    const DecodedOp &op = this->block.ops[i];
+    const OpCode &info = OPCODES_TABLE[op.code];
+    AddressingMode mode = info.mode;
+    int out = this->exit(i);
+    uint32_t done = this->prefix_cycles[i + 1];
+
+    switch (info.instruction) {
+    case Instruction::LDA:
+      this->read(op, info, HOST_A, out);
+      this->mov(HOST_ZN, HOST_A);
+      return false;
+    case Instruction::LDX:
+      this->read(op, info, HOST_X, out);
+      this->mov(HOST_ZN, HOST_X);
+      return false;
+    case Instruction::LDY:
+      this->read(op, info, HOST_Y, out);
+      this->mov(HOST_ZN, HOST_Y);
+      return false;
+    case Instruction::STA:
+      this->write(this->address(op, mode, out), HOST_A, out);
+      return false;
+    case Instruction::STX:
+      this->write(this->address(op, mode, out), HOST_X, out);
+      return false;
+    case Instruction::STY:
+      this->write(this->address(op, mode, out), HOST_Y, out);
+      return false;
+
+    case Instruction::AND:
+    case Instruction::ORA:
+    case Instruction::EOR: {
+      uint8_t alu = info.instruction == Instruction::AND   ? 0x20
+                    : info.instruction == Instruction::ORA ? 0x08
+                                                           : 0x30;
+      this->read(op, info, RCX, out);
+      this->as.instr({alu}, RCX, reg(HOST_A), Width::Byte);
+      this->mov(HOST_ZN, HOST_A);
+      return false;
+    }
+    case Instruction::ADC:
+    case Instruction::SBC:
+      this->read(op, info, RCX, out);
+      if (info.instruction == Instruction::SBC) {
+        // A - M - !C is A + ~M + C, with the same carry and overflow.
+        this->as.instr({0xF6}, 2, reg(RCX), Width::Byte);
+      }
+      this->carry_to_host();
+      this->as.instr({0x10}, RCX, reg(HOST_A), Width::Byte);
+      this->setcc(CC_B, HOST_CARRY);
+      this->setcc(CC_O, HOST_OVERFLOW);
+      this->mov(HOST_ZN, HOST_A);
+      return false;
+    case Instruction::CMP:
+    case Instruction::CPX:
+    case Instruction::CPY: {
+      Host target = info.instruction == Instruction::CMP   ? HOST_A
+                    : info.instruction == Instruction::CPX ? HOST_X
+                                                           : HOST_Y;
+      this->read(op, info, RCX, out);
+      this->mov(HOST_ZN, target);
+      this->as.instr({0x28}, RCX, reg(HOST_ZN), Width::Byte);
+      this->setcc(CC_AE, HOST_CARRY);
+      this->as.instr({0x0F, 0xB6}, HOST_ZN, reg(HOST_ZN), Width::ByteSource);
+      return false;
+    }
+    case Instruction::BIT:
+      this->read(op, info, RCX, out);
+      this->mov(HOST_OVERFLOW, RCX);
+      this->shift(5, HOST_OVERFLOW, 6);
+      this->alu_imm(4, HOST_OVERFLOW, 1);
+      this->mov(HOST_ZN, RCX);
+      this->as.instr({0x21}, HOST_A, reg(HOST_ZN), Width::Dword);
+      this->alu_imm(4, RCX, 0x80);
+      this->shift(4, RCX, 8);
+      this->as.instr({0x09}, RCX, reg(HOST_ZN), Width::Dword);
+      return false;
+
+    case Instruction::ASL:
+    case Instruction::LSR:
+    case Instruction::ROL:
+    case Instruction::ROR:
+    case Instruction::INC:
+    case Instruction::DEC:
+      this->read_modify_write(op, info, out);
+      return false;
+
+    case Instruction::INX:
+    case Instruction::DEX:
+    case Instruction::INY:
+    case Instruction::DEY: {
+      bool x = info.instruction == Instruction::INX ||
+               info.instruction == Instruction::DEX;
+      bool up = info.instruction == Instruction::INX ||
+                info.instruction == Instruction::INY;
+      Host target = x ? HOST_X : HOST_Y;
+      this->as.instr({0xFE}, up ? 0 : 1, reg(target), Width::Byte);
+      this->mov(HOST_ZN, target);
+      return false;
+    }
+    case Instruction::TAX:
+      this->transfer(HOST_X, HOST_A, true);
+      return false;
+    case Instruction::TAY:
+      this->transfer(HOST_Y, HOST_A, true);
+      return false;
+    case Instruction::TXA:
+      this->transfer(HOST_A, HOST_X, true);
+      return false;
+    case Instruction::TYA:
+      this->transfer(HOST_A, HOST_Y, true);
+      return false;
+    case Instruction::TSX:
+      this->transfer(HOST_X, HOST_SP, true);
+      return false;
+    case Instruction::TXS:
+      this->transfer(HOST_SP, HOST_X, false);
+      return false;
+
+    case Instruction::CLC:
+      this->as.instr({0x31}, HOST_CARRY, reg(HOST_CARRY), Width::Dword);
+      return false;
+    case Instruction::SEC:
+      this->mov_imm(HOST_CARRY, 1);
+      return false;
+    case Instruction::CLV:
+      this->as.instr({0x31}, HOST_OVERFLOW, reg(HOST_OVERFLOW), Width::Dword);
+      return false;
+    case Instruction::CLI:
+    case Instruction::SEI:
+    case Instruction::CLD:
+    case Instruction::SED: {
+      uint8_t bit = info.instruction == Instruction::CLI ||
+                            info.instruction == Instruction::SEI
+                        ? INTERRUPT_DISABLE
+                        : DECIMAL_MODE;
+      bool set = info.instruction == Instruction::SEI ||
+                 info.instruction == Instruction::SED;
+      this->as.instr({0x80}, set ? 1 : 4,
+                     state_field(offsetof(JitState, status)), Width::Byte);
+      this->as.byte(set ? bit : static_cast<uint8_t>(~bit));
+      return false;
+    }
+    case Instruction::NOP:
+      return false;
+
+    case Instruction::PHA:
+    case Instruction::PHP:
+      this->stack_address(0);
+      this->check_write({false, 0}, out, 0x01);
+      if (info.instruction == Instruction::PHP) {
+        this->status_to(HOST_VALUE);
+        this->alu_imm(1, HOST_VALUE, BREAK | BREAK2);
+        this->store({false, 0}, HOST_VALUE, 0x01);
+      } else {
+        this->store({false, 0}, HOST_A, 0x01);
+      }
+      this->as.instr({0xFE}, 1, reg(HOST_SP), Width::Byte);
+      return false;
+    case Instruction::PLA:
+      this->check_read_page(0x01, out);
+      this->pop_to(HOST_A);
+      this->mov(HOST_ZN, HOST_A);
+      return false;
+    case Instruction::PLP:
+      this->check_read_page(0x01, out);
+      this->pop_to(RCX);
+      this->alu_imm(4, RCX, static_cast<uint8_t>(~BREAK));
+      this->alu_imm(1, RCX, BREAK2);
+      this->store8(state_field(offsetof(JitState, status)), RCX);
+      this->status_from(RCX);
+      return false;
+
+    case Instruction::JMP:
+      this->jump(done, op.operand, i + 1);
+      return true;
+    case Instruction::JSR: {
+      // Both bytes are checked before either is pushed.
+      uint16_t ret = static_cast<uint16_t>(op.pc + 2);
+      this->stack_address(0);
+      this->mov(RCX, HOST_SP);
+      this->as.instr({0xFE}, 1, reg(RCX), Width::Byte);
+      this->alu_imm(0, RCX, 0x100);
+      this->check_write({false, 0}, out, 0x01);
+      this->as.instr({0x3B}, RCX,
+                     state_field(offsetof(JitState, write_watch)),
+                     Width::Dword);
+      this->as.jcc(CC_E, out);
+      this->store_constant({false, 0}, static_cast<uint8_t>(ret >> 8), 0x01);
+      this->as.instr({0xFE}, 1, reg(HOST_SP), Width::Byte);
+      this->stack_address(0);
+      this->store_constant({false, 0}, static_cast<uint8_t>(ret), 0x01);
+      this->as.instr({0xFE}, 1, reg(HOST_SP), Width::Byte);
+      this->finish(done, op.operand, i + 1);
+      return true;
+    }
+    case Instruction::RTS:
+      this->check_read_page(0x01, out);
+      this->pop_to(RAX);
+      this->pop_to(RCX);
+      this->shift(4, RCX, 8);
+      this->as.instr({0x09}, RCX, reg(RAX), Width::Dword);
+      this->alu_imm(0, RAX, 1);
+      this->as.instr({0x0F, 0xB7}, RAX, reg(RAX), Width::Dword);
+      this->finish(done, 0, i + 1, true);
+      return true;
+
+    default:
+      if (is_branch(info.instruction)) {
+        this->branch(op, info.instruction, i);
+        return true;
+      }
+      throw std::logic_error("instruccion no compilable");
+    }
+  }
+
+  void branch(const DecodedOp &op, Instruction instruction, uint32_t i) {
+    Condition taken_if = CC_NE;
+    switch (instruction) {
+    case Instruction::BEQ:
+    case Instruction::BNE:
+      this->as.instr({0x84}, HOST_ZN, reg(HOST_ZN), Width::Byte);
+      taken_if = instruction == Instruction::BEQ ? CC_E : CC_NE;
+      break;
+    case Instruction::BMI:
+    case Instruction::BPL:
+      this->as.instr({0xF7}, 0, reg(HOST_ZN), Width::Dword);
+      this->as.dword(0x8080);
+      taken_if = instruction == Instruction::BMI ? CC_NE : CC_E;
+      break;
+    case Instruction::BCS:
+    case Instruction::BCC:
+      this->as.instr({0x85}, HOST_CARRY, reg(HOST_CARRY), Width::Dword);
+      taken_if = instruction == Instruction::BCS ? CC_NE : CC_E;
+      break;
+    default:
+      this->as.instr({0x85}, HOST_OVERFLOW, reg(HOST_OVERFLOW), Width::Dword);
+      taken_if = instruction == Instruction::BVS ? CC_NE : CC_E;
+      break;
+    }
+    int taken = this->as.new_label();
+    this->as.jcc(taken_if, taken);
+
+    uint32_t done = this->prefix_cycles[i + 1];
+    uint16_t next = static_cast<uint16_t>(op.pc + 2);
+    uint16_t target =
+        static_cast<uint16_t>(next + static_cast<int8_t>(op.operand));
+    this->finish(done, next, i + 1);
+    this->as.bind(taken);
+    this->jump(done + 1 + ((next & 0xFF00) != (target & 0xFF00)), target,
+               i + 1);
+  }
+
+  // Leaves the block for `target` after `count` instructions. A jump from
+  // the end of the block back to its start runs the block again without
+  // leaving while the budgets in JitState allow another whole pass.
+  void jump(uint32_t cycles, uint16_t target, uint32_t count) {
+    if (target != this->block.start || count != this->block.ops.size()) {
+      this->finish(cycles, target, count);
+      return;
+    }
+    int leave = this->as.new_label();
+    Operand cycles_field = state_field(offsetof(JitState, cycles));
+    Operand budget_field = state_field(offsetof(JitState, loop_budget));
+    this->as.instr({0x81}, 0, cycles_field, Width::Qword);
+    this->as.dword(cycles);
+    this->load64(RAX, cycles_field);
+    this->as.instr({0x81}, 0, reg(RAX), Width::Qword);
+    this->as.dword(max_cycles(this->block, count));
+    this->as.instr({0x3B}, RAX, state_field(offsetof(JitState, cycle_limit)),
+                   Width::Qword);
+    this->as.jcc(CC_AE, leave);
+    this->as.instr({0x81}, 5, budget_field, Width::Qword);
+    this->as.dword(count);
+    this->as.jcc(CC_B, leave);
+    this->as.instr({0xFF}, 0, state_field(offsetof(JitState, passes)),
+                   Width::Qword);
+    this->as.jmp(this->top);
+    this->as.bind(leave);
+    this->finish(0, target, count);
+  }
+
+  // Loads the operand of a read instruction into `dst`.
+  void read(const DecodedOp &op, const OpCode &info, Host dst, int out) {
+    if (info.mode == AddressingMode::Immediate) {
+      this->mov_imm(dst, op.operand & 0xFF);
+      return;
+    }
+    Address addr = this->address(op, info.mode, out);
+    this->check_read(addr, out);
+    if (pays_page_cross(info)) {
+      // One more cycle when (addr & 0xFF) < index, as in read_operand.
+      Host index =
+          info.mode == AddressingMode::Absolute_X ? HOST_X : HOST_Y;
+      this->as.instr({0x38}, index, reg(RAX), Width::Byte);
+      this->as.instr({0x83}, 2, state_field(offsetof(JitState, cycles)),
+                     Width::Qword);
+      this->as.byte(0);
+    }
+    this->as.instr({0x0F, 0xB6}, dst, this->at(addr), Width::ByteSource);
+  }
+
+  void read_modify_write(const DecodedOp &op, const OpCode &info, int out) {
+    Instruction instruction = info.instruction;
+    // The accumulator forms.
+    if (info.mode == AddressingMode::NoneAddressing) {
+      this->shift_or_rotate(instruction, reg(HOST_A));
+      this->mov(HOST_ZN, HOST_A);
+      return;
+    }
+    Address addr = this->address(op, info.mode, out);
+    // A page that takes plain or mirrored writes has no device, so one
+    // check covers the read as well.
+    this->check_write(addr, out);
+    this->as.instr({0x0F, 0xB6}, HOST_VALUE, this->at(addr),
+                   Width::ByteSource);
+    if (instruction == Instruction::INC || instruction == Instruction::DEC) {
+      this->as.instr({0xFE}, instruction == Instruction::INC ? 0 : 1,
+                     reg(HOST_VALUE), Width::Byte);
+    } else {
+      this->shift_or_rotate(instruction, reg(HOST_VALUE));
+    }
+    this->store(addr, HOST_VALUE);
+    this->mov(HOST_ZN, HOST_VALUE);
+  }
+
+  // x86 shifts and rotates through CF behave exactly like the 6502 ones.
+  void shift_or_rotate(Instruction instruction, const Operand &target) {
+    uint8_t ext = 4;
+    if (instruction == Instruction::LSR) {
+      ext = 5;
+    } else if (instruction == Instruction::ROL) {
+      ext = 2;
+    } else if (instruction == Instruction::ROR) {
+      ext = 3;
+    }
+    if (ext == 2 || ext == 3) {
+      this->carry_to_host();
+    }
+    this->as.instr({0xD0}, ext, target, Width::Byte);
+    this->setcc(CC_B, HOST_CARRY);
+  }
+
+  void transfer(Host dst, Host src, bool flags) {
+    this->mov(dst, src);
+    if (flags) {
+      this->mov(HOST_ZN, dst);
+    }
+  }
+
+  // Computes the effective address of `op`; pointer reads in the indirect
+  // modes leave through `out` when page zero is a device page.
+  Address address(const DecodedOp &op, AddressingMode mode, int out) {
+    uint8_t lo = static_cast<uint8_t>(op.operand);
+    switch (mode) {
+    case AddressingMode::ZeroPage:
+      return {true, lo};
+    case AddressingMode::Absolute:
+      return {true, op.operand};
+    case AddressingMode::ZeroPage_X:
+    case AddressingMode::ZeroPage_Y:
+      this->mov(RAX, mode == AddressingMode::ZeroPage_X ? HOST_X : HOST_Y);
+      this->as.instr({0x80}, 0, reg(RAX), Width::Byte);
+      this->as.byte(lo);
+      return {false, 0};
+    case AddressingMode::Absolute_X:
+    case AddressingMode::Absolute_Y:
+      this->mov(RAX, mode == AddressingMode::Absolute_X ? HOST_X : HOST_Y);
+      this->alu_imm(0, RAX, op.operand);
+      this->as.instr({0x0F, 0xB7}, RAX, reg(RAX), Width::Dword);
+      return {false, 0};
+    case AddressingMode::Indirect_X:
+      this->check_read_page(0x00, out);
+      this->mov(RCX, HOST_X);
+      this->as.instr({0x80}, 0, reg(RCX), Width::Byte);
+      this->as.byte(lo);
+      this->as.instr({0x0F, 0xB6}, RAX, mem(HOST_MEMORY, RCX, 0),
+                     Width::ByteSource);
+      this->as.instr({0xFE}, 0, reg(RCX), Width::Byte);
+      this->as.instr({0x0F, 0xB6}, RCX, mem(HOST_MEMORY, RCX, 0),
+                     Width::ByteSource);
+      this->shift(4, RCX, 8);
+      this->as.instr({0x09}, RCX, reg(RAX), Width::Dword);
+      return {false, 0};
+    case AddressingMode::Indirect_Y:
+      this->check_read_page(0x00, out);
+      this->as.instr({0x0F, 0xB6}, RAX, mem(HOST_MEMORY, lo),
+                     Width::ByteSource);
+      this->as.instr({0x0F, 0xB6}, RCX,
+                     mem(HOST_MEMORY, static_cast<uint8_t>(lo + 1)),
+                     Width::ByteSource);
+      this->shift(4, RCX, 8);
+      this->as.instr({0x09}, RCX, reg(RAX), Width::Dword);
+      this->as.instr({0x03}, RAX, reg(HOST_Y), Width::Dword);
+      this->as.instr({0x0F, 0xB7}, RAX, reg(RAX), Width::Dword);
+      return {false, 0};
+    default:
+      throw std::logic_error("modo sin direccion");
+    }
+  }
+
+  Operand at(Address addr) const {
+    return addr.constant ? mem(HOST_MEMORY, addr.value)
+                         : mem(HOST_MEMORY, RAX, 0);
+  }
+
+  // Leaves through `out` when the address is on a device page.
+  void check_read(Address addr, int out) {
+    if (addr.constant) {
+      this->check_read_page(addr.value >> 8, out);
+      return;
+    }
+    this->mov(RCX, RAX);
+    this->shift(5, RCX, 8);
+    this->as.instr({0x83}, 7, mem(HOST_DEVICES, RCX, 3), Width::Qword);
+    this->as.byte(0);
+    this->as.jcc(CC_NE, out);
+  }
+
+  void check_read_page(uint8_t page, int out) {
+    this->as.instr({0x83}, 7, mem(HOST_DEVICES, page * 8), Width::Qword);
+    this->as.byte(0);
+    this->as.jcc(CC_NE, out);
+  }
+
+  // The write_flags byte of the page `addr` is on. `page` is used for a
+  // computed address whose page is known; otherwise the page goes in RCX.
+  Operand write_flags_of(Address addr, int page) {
+    if (addr.constant) {
+      return mem(HOST_WRITE_FLAGS, addr.value >> 8);
+    }
+    if (page >= 0) {
+      return mem(HOST_WRITE_FLAGS, page);
+    }
+    this->mov(RCX, RAX);
+    this->shift(5, RCX, 8);
+    return mem(HOST_WRITE_FLAGS, RCX, 0);
+  }
+
+  // Leaves through `out` unless the address takes plain or mirrored writes
+  // and is not watched.
+  void check_write(Address addr, int out, int page = -1) {
+    this->as.instr({0xF6}, 0, this->write_flags_of(addr, page), Width::Byte);
+    this->as.byte(static_cast<uint8_t>(~Bus::WRITE_MIRROR));
+    this->as.jcc(CC_NE, out);
+    Operand watch = state_field(offsetof(JitState, write_watch));
+    if (addr.constant) {
+      this->as.instr({0x81}, 7, watch, Width::Dword);
+      this->as.dword(addr.value);
+    } else {
+      this->as.instr({0x3B}, RAX, watch, Width::Dword);
+    }
+    this->as.jcc(CC_E, out);
+  }
+
+  void write(Address addr, Host value, int out) {
+    this->check_write(addr, out);
+    this->store(addr, value);
+  }
+
+  // Writes `value` and marks the line dirty, like NesCpu::mem_write, once
+  // check_write has passed. Clobbers RAX.
+  void store(Address addr, Host value, int page = -1) {
+    this->store_value(addr, {false, value, 0}, page);
+  }
+
+  void store_constant(Address addr, uint8_t value, int page = -1) {
+    this->store_value(addr, {true, RAX, value}, page);
+  }
+
+  void store_value(Address addr, StoreValue value, int page) {
+    this->mark_dirty(addr);
+    int mirrored = this->as.new_label();
+    int resume = this->as.new_label();
+    this->as.instr({0xF6}, 0, this->write_flags_of(addr, page), Width::Byte);
+    this->as.byte(Bus::WRITE_MIRROR);
+    this->as.jcc(CC_NE, mirrored);
+    this->store_byte(addr, value);
+    this->as.bind(resume);
+    this->mirrored_stores.push_back({mirrored, resume, addr, value});
+  }
+
+  // Sets the byte at `addr`, keeping the image hash.
+  void store_byte(Address addr, StoreValue value) {
+#ifdef EIZNESS_INCREMENTAL_HASH
+    this->movzx8(RCX, this->at(addr));
+    this->hash_byte(addr, HOST_HASH_OLD);
+    if (value.constant) {
+      this->mov_imm(RCX, value.value);
+    } else {
+      this->as.instr({0x0F, 0xB6}, RCX, reg(value.reg), Width::ByteSource);
+    }
+    this->hash_byte(addr, HOST_HASH_NEW);
+    this->update_hash();
+#endif
+    this->store_to(this->at(addr), value);
+  }
+
+  void store_to(const Operand &dst, StoreValue value) {
+    if (value.constant) {
+      this->as.instr({0xC6}, 0, dst, Width::Byte);
+      this->as.byte(value.value);
+    } else {
+      this->store8(dst, value.reg);
+    }
+  }
+
+  // The out-of-line half of a store to a mirrored page, as in Bus::write:
+  // the canonical copy is set and hashed, then the others are set through
+  // the page's BusMirror. R12 holds the entry and is reloaded after.
+  void mirrored_store(const MirroredStore &store) {
+    this->as.bind(store.label);
+    this->load64(HOST_DEVICES, state_field(offsetof(JitState, mirrors)));
+    if (store.addr.constant) {
+      this->mov_imm(RAX, store.addr.value);
+      this->as.instr({0x8D}, HOST_DEVICES,
+                     mem(HOST_DEVICES, (store.addr.value >> 8) * 8),
+                     Width::Qword);
+    } else {
+      this->mov(RCX, RAX);
+      this->shift(5, RCX, 8);
+      this->as.instr({0x8D}, HOST_DEVICES, mem(HOST_DEVICES, RCX, 3),
+                     Width::Qword);
+    }
+    // movsx rcx, word [entry].
+    this->as.instr({0x0F, 0xBF}, RCX,
+                   mem(HOST_DEVICES, offsetof(BusMirror, to_canonical)),
+                   Width::Qword);
+    this->as.instr({0x01}, RCX, reg(RAX), Width::Dword);
+    this->store_byte({false, 0}, store.value);
+    for (std::size_t i = 0; i < BUS_MIRROR_COPIES - 1; i++) {
+      this->as.instr({0x0F, 0xBF}, RCX,
+                     mem(HOST_DEVICES, static_cast<int32_t>(
+                                           offsetof(BusMirror, copies) +
+                                           i * sizeof(int16_t))),
+                     Width::Qword);
+      this->as.instr({0x01}, RAX, reg(RCX), Width::Qword);
+      this->store_to(mem(HOST_MEMORY, RCX, 0), store.value);
+    }
+    this->load64(HOST_DEVICES, state_field(offsetof(JitState, devices)));
+    this->as.jmp(store.resume);
+  }
+
+#ifdef EIZNESS_INCREMENTAL_HASH
+  // dst = memory_byte_hash(addr, CL), with CL zero-extended; clobbers RCX.
+  void hash_byte(Address addr, Xmm dst) {
+    this->shift(4, RCX, 16);
+    if (addr.constant) {
+      this->alu_imm(1, RCX, addr.value);
+    } else {
+      this->as.instr({0x09}, RAX, reg(RCX), Width::Dword);
+    }
+    // imul rcx, rcx, imm32; bswap rcx; imul rcx, rcx, imm32.
+    this->as.instr({0x69}, RCX, reg(RCX), Width::Qword);
+    this->as.dword(static_cast<uint32_t>(MEMORY_HASH_K1));
+    this->as.byte(0x48);
+    this->as.byte(0x0F);
+    this->as.byte(0xC8 | RCX);
+    this->as.instr({0x69}, RCX, reg(RCX), Width::Qword);
+    this->as.dword(static_cast<uint32_t>(MEMORY_HASH_K2));
+    this->movq(dst, reg(RCX), false);
+  }
+
+  // The running hash takes the old byte out and the new one in, one xor
+  // on its dependency chain per store.
+  void update_hash() {
+    this->pxor(HOST_HASH_OLD, HOST_HASH_NEW);
+    this->pxor(HOST_HASH, HOST_HASH_OLD);
+  }
+
+  // movq xmm, r/m64 or, with `to_rm`, movq r/m64, xmm.
+  void movq(Xmm xmm, const Operand &rm, bool to_rm) {
+    this->as.byte(0x66);
+    this->as.instr({0x0F, static_cast<uint8_t>(to_rm ? 0x7E : 0x6E)}, xmm,
+                   rm, Width::Qword);
+  }
+
+  void pxor(Xmm dst, Xmm src) {
+    this->as.byte(0x66);
+    this->as.instr({0x0F, 0xEF}, dst, xmm_reg(src), Width::Dword);
+  }
+#endif
+
+  void mark_dirty(Address addr) {
+    if (addr.constant) {
+      this->as.instr({0x80}, 1, mem(HOST_DIRTY, addr.value >> 9), Width::Byte);
+      this->as.byte(static_cast<uint8_t>(1 << ((addr.value >> 6) & 7)));
+      return;
+    }
+    this->mov(RCX, RAX);
+    this->shift(5, RCX, static_cast<uint8_t>(DIRTY_LINE_SHIFT));
+    this->as.instr({0x0F, 0xAB}, RCX, mem(HOST_DIRTY), Width::Qword);
+  }
+
+  // EAX = $0100 + SP + delta.
+  void stack_address(int32_t delta) {
+    this->as.instr({0x8D}, RAX, mem(HOST_SP, 0x100 + delta), Width::Dword);
+  }
+
+  // Pops the byte above SP into `dst`.
+  void pop_to(Host dst) {
+    this->as.instr({0xFE}, 0, reg(HOST_SP), Width::Byte);
+    this->as.instr({0x0F, 0xB6}, dst, mem(HOST_MEMORY, HOST_SP, 0, 0x100),
+                   Width::ByteSource);
+  }
+
+  // Builds the status byte into `dst`; clobbers RCX.
+  void status_to(Host dst) {
+    this->movzx8(dst, state_field(offsetof(JitState, status)));
+    this->alu_imm(4, dst,
+                  INTERRUPT_DISABLE | DECIMAL_MODE | BREAK | BREAK2);
+    this->as.instr({0x09}, HOST_CARRY, reg(dst), Width::Dword);
+    this->mov(RCX, HOST_OVERFLOW);
+    this->shift(4, RCX, 6);
+    this->as.instr({0x09}, RCX, reg(dst), Width::Dword);
+    this->as.instr({0x31}, RCX, reg(RCX), Width::Dword);
+    this->as.instr({0x84}, HOST_ZN, reg(HOST_ZN), Width::Byte);
+    this->setcc(CC_E, RCX);
+    this->shift(4, RCX, 1);
+    this->as.instr({0x09}, RCX, reg(dst), Width::Dword);
+    this->as.instr({0x31}, RCX, reg(RCX), Width::Dword);
+    this->as.instr({0xF7}, 0, reg(HOST_ZN), Width::Dword);
+    this->as.dword(0x8080);
+    this->setcc(CC_NE, RCX);
+    this->shift(4, RCX, 7);
+    this->as.instr({0x09}, RCX, reg(dst), Width::Dword);
+  }
+
+  // Splits the status byte in `src` into the flag registers; clobbers it.
+  void status_from(Host src) {
+    this->mov(HOST_CARRY, src);
+    this->alu_imm(4, HOST_CARRY, 1);
+    this->mov(HOST_OVERFLOW, src);
+    this->shift(5, HOST_OVERFLOW, 6);
+    this->alu_imm(4, HOST_OVERFLOW, 1);
+    this->mov(HOST_ZN, src);
+    this->shift(5, HOST_ZN, 1);
+    this->alu_imm(4, HOST_ZN, 1);
+    this->alu_imm(6, HOST_ZN, 1);
+    this->alu_imm(4, src, 0x80);
+    this->shift(4, src, 8);
+    this->as.instr({0x09}, src, reg(HOST_ZN), Width::Dword);
+  }
+
+  // CF = the guest carry.
+  void carry_to_host() {
+    this->as.instr({0x0F, 0xBA}, 4, reg(HOST_CARRY), Width::Dword);
+    this->as.byte(0);
+  }
+
+  void setcc(Condition cc, Host dst) {
+    this->as.instr({0x0F, static_cast<uint8_t>(0x90 | cc)}, 0, reg(dst),
+                   Width::Byte);
+  }
+
+  void mov(Host dst, Host src) {
+    this->as.instr({0x8B}, dst, reg(src), Width::Dword);
+  }
+
+  void mov_imm(Host dst, uint32_t value) {
+    if (dst >= 8) {
+      this->as.byte(0x41);
+    }
+    this->as.byte(0xB8 | (dst & 7));
+    this->as.dword(value);
+  }
+
+  void movzx8(Host dst, const Operand &src) {
+    this->as.instr({0x0F, 0xB6}, dst, src, Width::ByteSource);
+  }
+
+  void store8(const Operand &dst, Host src) {
+    this->as.instr({0x88}, src, dst, Width::Byte);
+  }
+
+  void load64(Host dst, const Operand &src) {
+    this->as.instr({0x8B}, dst, src, Width::Qword);
+  }
+
+  // 32-bit ALU op with an immediate; `ext` selects add (0), or (1), and
+  // (4) or xor (6).
+  void alu_imm(uint8_t ext, Host dst, uint32_t value) {
+    if (value < 0x80) {
+      this->as.instr({0x83}, ext, reg(dst), Width::Dword);
+      this->as.byte(static_cast<uint8_t>(value));
+    } else {
+      this->as.instr({0x81}, ext, reg(dst), Width::Dword);
+      this->as.dword(value);
+    }
+  }
+
+  // shl (4) or shr (5) by a constant.
+  void shift(uint8_t ext, Host dst, uint8_t count) {
+    this->as.instr({0xC1}, ext, reg(dst), Width::Dword);
+    this->as.byte(count);
+  }
+
+  void push(Host r) {
+    if (r >= 8) {
+      this->as.byte(0x41);
+    }
+    this->as.byte(0x50 | (r & 7));
+  }
+
+  void pop(Host r) {
+    if (r >= 8) {
+      this->as.byte(0x41);
+    }
+    this->as.byte(0x58 | (r & 7));
+  }
+
+  const DecodedBlock &block;
+  uint32_t length;
+  X86Assembler as;
+  int epilogue;
+  int top;
+  std::vector<int> exits;
+  std::vector<uint32_t> prefix_cycles;
+  std::vector<MirroredStore> mirrored_stores;
+};
+
+#endif
+
+Jit::Jit() {
+  this->hot_runs = JIT_HOT_RUNS;
+  this->arena = nullptr;
+  this->arena_writable = nullptr;
+  this->arena_used = 0;
+  this->compile_count = 0;
+}
+
+Jit::Jit(const Jit &other) : Jit() { this->hot_runs = other.hot_runs; }
+
+Jit &Jit::operator=(const Jit &other) {
+  if (this != &other) {
+    this->clear();
+    this->hot_runs = other.hot_runs;
+  }
+  return *this;
+}
+
+Jit::~Jit() { this->release_arena(); }
+
+bool Jit::available() {
+#ifdef EIZNESS_JIT_X86_64
+  return true;
+#else
+  return false;
+#endif
+}
+
+const JitBlock *Jit::lookup_cold(const DecodedBlock &block) {
+  Entry &entry = this->entry_for(block);
+  if (entry.block.code != nullptr) {
+    return &entry.block;
+  }
+  if (entry.failed || ++entry.runs < this->hot_runs) {
+    return nullptr;
+  }
+  JitBlock compiled;
+  bool ok = this->compile(block, compiled);
+  // Compiling can start the arena over, which drops every entry.
+  Entry &compiled_entry = this->entry_for(block);
+  if (!ok) {
+    compiled_entry.failed = true;
+    return nullptr;
+  }
+  compiled_entry.block = compiled;
+  return &compiled_entry.block;
+}
+
+Jit::Entry &Jit::entry_for(const DecodedBlock &block) {
+  if (block.id >= this->entries.size()) {
+    this->entries.resize(block.id + 1, Entry{UINT64_MAX, 0, false, {}});
+  }
+  Entry &entry = this->entries[block.id];
+  if (entry.serial != block.serial) {
+    entry = Entry{block.serial, 0, false, {nullptr, 0, 0}};
+  }
+  return entry;
+}
+
+void Jit::clear() {
+  this->entries.clear();
+  this->arena_used = 0;
+}
+
+#ifdef EIZNESS_JIT_X86_64
+
+bool Jit::compile(const DecodedBlock &block, JitBlock &compiled) {
+  uint32_t length = 0;
+  while (length < block.ops.size() &&
+         compilable(OPCODES_TABLE[block.ops[length].code])) {
+    length++;
+  }
+  if (length == 0) {
+    return false;
+  }
+  std::vector<uint8_t> code = BlockCompiler(block, length).compile();
+
+  if (this->arena == nullptr && !this->map_arena()) {
+    return false;
+  }
+  if (code.size() > JIT_ARENA_SIZE) {
+    return false;
+  }
+  if (this->arena_used + code.size() > JIT_ARENA_SIZE) {
+    this->clear();
+  }
+
+  uint8_t *start = this->arena + this->arena_used;
+  if (this->arena_writable != this->arena) {
+    std::memcpy(this->arena_writable + this->arena_used, code.data(),
+                code.size());
+  } else {
+    if (mprotect(this->arena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE) != 0) {
+      return false;
+    }
+    std::memcpy(start, code.data(), code.size());
+    mprotect(this->arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC);
+  }
+  // Keep blocks 16-byte aligned.
+  this->arena_used += (code.size() + 15) & ~static_cast<std::size_t>(15);
+
+  compiled.code = reinterpret_cast<JitBlockFn>(start);
+  compiled.length = length;
+  compiled.max_cycles = max_cycles(block, length);
+  this->compile_count++;
+  return true;
+}
+
+bool Jit::map_arena() {
+#ifdef __linux__
+  // Two views of one memory file, so adding code costs no system calls.
+  int fd = memfd_create("eizness-jit", MFD_CLOEXEC);
+  if (fd >= 0) {
+    void *writable = MAP_FAILED;
+    void *executable = MAP_FAILED;
+    if (ftruncate(fd, JIT_ARENA_SIZE) == 0) {
+      writable = mmap(nullptr, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+      executable = mmap(nullptr, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC,
+                        MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (writable != MAP_FAILED && executable != MAP_FAILED) {
+      this->arena = static_cast<uint8_t *>(executable);
+      this->arena_writable = static_cast<uint8_t *>(writable);
+      return true;
+    }
+    if (writable != MAP_FAILED) {
+      munmap(writable, JIT_ARENA_SIZE);
+    }
+    if (executable != MAP_FAILED) {
+      munmap(executable, JIT_ARENA_SIZE);
+    }
+  }
+#endif
+  void *memory = mmap(nullptr, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  this->arena = static_cast<uint8_t *>(memory);
+  this->arena_writable = this->arena;
+  return true;
+}
+
+void Jit::release_arena() {
+  if (this->arena_writable != this->arena) {
+    munmap(this->arena_writable, JIT_ARENA_SIZE);
+  }
+  if (this->arena != nullptr) {
+    munmap(this->arena, JIT_ARENA_SIZE);
+  }
+  this->arena = nullptr;
+  this->arena_writable = nullptr;
+}
+
+#else
+
+bool Jit::compile(const DecodedBlock &, JitBlock &) { return false; }
+
+bool Jit::map_arena() { return false; }
+
+void Jit::release_arena() {}
+
+#endif
@@ -0,0 +1,1429 @@
+#include "Core/Lockstep.hpp"
+#include "Core/Compiler.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Byte-lane vector helpers. Masks hold 0xFF for selected lanes and 0x00
+// elsewhere; vblend(m, a, b) picks `a` where the mask is set.
+#if defined(__AVX2__)
+using LaneVector = __m256i;
+const std::size_t VECTOR_LANES = 32;
+
+static inline LaneVector vload(const uint8_t *src) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+}
+static inline void vstore(uint8_t *dst, LaneVector v) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), v);
+}
+static inline LaneVector vsplat(uint8_t byte) {
+  return _mm256_set1_epi8(static_cast<char>(byte));
+}
+static inline LaneVector vand(LaneVector a, LaneVector b) {
+  return _mm256_and_si256(a, b);
+}
+static inline LaneVector vor(LaneVector a, LaneVector b) {
+  return _mm256_or_si256(a, b);
+}
+static inline LaneVector vxor(LaneVector a, LaneVector b) {
+  return _mm256_xor_si256(a, b);
+}
+// a & ~b
+static inline LaneVector vandnot(LaneVector a, LaneVector b) {
+  return _mm256_andnot_si256(b, a);
+}
+static inline LaneVector vadd(LaneVector a, LaneVector b) {
+  return _mm256_add_epi8(a, b);
+}
+static inline LaneVector vsub(LaneVector a, LaneVector b) {
+  return _mm256_sub_epi8(a, b);
+}
+static inline LaneVector veq(LaneVector a, LaneVector b) {
+  return _mm256_cmpeq_epi8(a, b);
+}
+static inline LaneVector vmin(LaneVector a, LaneVector b) {
+  return _mm256_min_epu8(a, b);
+}
+// 0xFF where bit 7 is set.
+static inline LaneVector vsign(LaneVector v) {
+  return _mm256_cmpgt_epi8(_mm256_setzero_si256(), v);
+}
+static inline LaneVector vshr1(LaneVector v) {
+  return _mm256_and_si256(_mm256_srli_epi16(v, 1), vsplat(0x7F));
+}
+// One bit per lane, taken from bit 7.
+static inline uint64_t vbits(LaneVector v) {
+  return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+using LaneVector = __m128i;
+const std::size_t VECTOR_LANES = 16;
+
+static inline LaneVector vload(const uint8_t *src) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+}
+static inline void vstore(uint8_t *dst, LaneVector v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), v);
+}
+static inline LaneVector vsplat(uint8_t byte) {
+  return _mm_set1_epi8(static_cast<char>(byte));
+}
+static inline LaneVector vand(LaneVector a, LaneVector b) {
+  return _mm_and_si128(a, b);
+}
+static inline LaneVector vor(LaneVector a, LaneVector b) {
+  return _mm_or_si128(a, b);
+}
+static inline LaneVector vxor(LaneVector a, LaneVector b) {
+  return _mm_xor_si128(a, b);
+}
+static inline LaneVector vandnot(LaneVector a, LaneVector b) {
+  return _mm_andnot_si128(b, a);
+}
+static inline LaneVector vadd(LaneVector a, LaneVector b) {
+  return _mm_add_epi8(a, b);
+}
+static inline LaneVector vsub(LaneVector a, LaneVector b) {
+  return _mm_sub_epi8(a, b);
+}
+static inline LaneVector veq(LaneVector a, LaneVector b) {
+  return _mm_cmpeq_epi8(a, b);
+}
+static inline LaneVector vmin(LaneVector a, LaneVector b) {
+  return _mm_min_epu8(a, b);
+}
+static inline LaneVector vsign(LaneVector v) {
+  return _mm_cmpgt_epi8(_mm_setzero_si128(), v);
+}
+static inline LaneVector vshr1(LaneVector v) {
+  return _mm_and_si128(_mm_srli_epi16(v, 1), vsplat(0x7F));
+}
+static inline uint64_t vbits(LaneVector v) {
+  return static_cast<uint32_t>(_mm_movemask_epi8(v));
+}
+#else
+using LaneVector = uint8_t;
+const std::size_t VECTOR_LANES = 1;
+
+static inline LaneVector vload(const uint8_t *src) { return *src; }
+static inline void vstore(uint8_t *dst, LaneVector v) { *dst = v; }
+static inline LaneVector vsplat(uint8_t byte) { return byte; }
+static inline LaneVector vand(LaneVector a, LaneVector b) { return a & b; }
+static inline LaneVector vor(LaneVector a, LaneVector b) { return a | b; }
+static inline LaneVector vxor(LaneVector a, LaneVector b) { return a ^ b; }
+static inline LaneVector vandnot(LaneVector a, LaneVector b) {
+  return a & ~b;
+}
+static inline LaneVector vadd(LaneVector a, LaneVector b) { return a + b; }
+static inline LaneVector vsub(LaneVector a, LaneVector b) { return a - b; }
+static inline LaneVector veq(LaneVector a, LaneVector b) {
+  return a == b ? 0xFF : 0x00;
+}
+static inline LaneVector vmin(LaneVector a, LaneVector b) {
+  return std::min(a, b);
+}
+static inline LaneVector vsign(LaneVector v) { return v & 0x80 ? 0xFF : 0; }
+static inline LaneVector vshr1(LaneVector v) { return v >> 1; }
+static inline uint64_t vbits(LaneVector v) { return v >> 7; }
+#endif
+
+static_assert(LOCKSTEP_LANE_ALIGN % VECTOR_LANES == 0,
+              "lane padding must hold whole vectors");
+
+static inline LaneVector vblend(LaneVector mask, LaneVector a, LaneVector b) {
+  return vor(vand(mask, a), vandnot(b, mask));
+}
+
+// Status with N and Z recomputed from `result`.
+static inline LaneVector vflags_nz(LaneVector status, LaneVector result) {
+  LaneVector zero = vand(veq(result, vsplat(0)), vsplat(CpuFlags::ZERO));
+  LaneVector negative = vand(result, vsplat(CpuFlags::NEGATIV));
+  return vor(vandnot(status, vsplat(CpuFlags::ZERO | CpuFlags::NEGATIV)),
+             vor(zero, negative));
+}
+
+// Status with C set from the top bit of `carry` and N, Z from `result`.
+static inline LaneVector vflags_cnz(LaneVector status, LaneVector carry,
+                                    LaneVector result) {
+  status = vandnot(status, vsplat(CpuFlags::CARRY));
+  status = vor(status, vand(vsign(carry), vsplat(CpuFlags::CARRY)));
+  return vflags_nz(status, result);
+}
+
+// Calls f(offset, mask) for every vector of lanes in [first, last).
+template <typename F>
+static inline void for_each_vector(const std::vector<uint8_t> &mask,
+                                   std::size_t first, std::size_t last,
+                                   F &&f) {
+  for (std::size_t i = first; i < last; i += VECTOR_LANES) {
+    f(i, vload(mask.data() + i));
+  }
+}
+
+static inline void set_flags_nz(uint8_t &status, uint8_t result) {
+  status = (status & ~(CpuFlags::ZERO | CpuFlags::NEGATIV)) |
+           (result & CpuFlags::NEGATIV) | (result == 0 ? CpuFlags::ZERO : 0);
+}
+
+static inline void set_carry(uint8_t &status, bool carry) {
+  status = (status & ~CpuFlags::CARRY) | (carry ? CpuFlags::CARRY : 0);
+}
+
+static bool reads_with_penalty(Instruction instruction) {
+  switch (instruction) {
+  case Instruction::ADC:
+  case Instruction::AND:
+  case Instruction::CMP:
+  case Instruction::CPX:
+  case Instruction::CPY:
+  case Instruction::EOR:
+  case Instruction::LDA:
+  case Instruction::LDX:
+  case Instruction::LDY:
+  case Instruction::ORA:
+  case Instruction::SBC:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Branch condition as (flag, taken when set).
+static bool branch_condition(Instruction instruction, uint8_t &flag,
+                             bool &when_set) {
+  switch (instruction) {
+  case Instruction::BCC:
+    flag = CpuFlags::CARRY;
+    when_set = false;
+    return true;
+  case Instruction::BCS:
+    flag = CpuFlags::CARRY;
+    when_set = true;
+    return true;
+  case Instruction::BEQ:
+    flag = CpuFlags::ZERO;
+    when_set = true;
+    return true;
+  case Instruction::BNE:
+    flag = CpuFlags::ZERO;
+    when_set = false;
+    return true;
+  case Instruction::BMI:
+    flag = CpuFlags::NEGATIV;
+    when_set = true;
+    return true;
+  case Instruction::BPL:
+    flag = CpuFlags::NEGATIV;
+    when_set = false;
+    return true;
+  case Instruction::BVS:
+    flag = CpuFlags::OVERFLOW;
+    when_set = true;
+    return true;
+  case Instruction::BVC:
+    flag = CpuFlags::OVERFLOW;
+    when_set = false;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// NesCpu only advances past the operand when a handler leaves the PC where
+// it was, so a jump to the operand address itself also skips the operand.
+static inline uint16_t jump_target(uint16_t pc, uint16_t target,
+                                   uint8_t len) {
+  return target == static_cast<uint16_t>(pc + 1)
+             ? static_cast<uint16_t>(pc + len)
+             : target;
+}
+
+LockstepEngine::PcSet::PcSet() : words(1024, 0), summary(16, 0) {}
+
+void LockstepEngine::PcSet::insert(uint16_t pc) {
+  this->words[pc >> 6] |= static_cast<uint64_t>(1) << (pc & 63);
+  this->summary[pc >> 12] |= static_cast<uint64_t>(1) << ((pc >> 6) & 63);
+}
+
+void LockstepEngine::PcSet::erase(uint16_t pc) {
+  uint64_t &word = this->words[pc >> 6];
+  word &= ~(static_cast<uint64_t>(1) << (pc & 63));
+  if (word == 0) {
+    this->summary[pc >> 12] &=
+        ~(static_cast<uint64_t>(1) << ((pc >> 6) & 63));
+  }
+}
+
+bool LockstepEngine::PcSet::empty() const {
+  for (uint64_t bits : this->summary) {
+    if (bits != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint16_t LockstepEngine::PcSet::first() const {
+  for (std::size_t i = 0; i < this->summary.size(); i++) {
+    if (this->summary[i] != 0) {
+      std::size_t word = i * 64 + count_trailing_zeros(this->summary[i]);
+      return static_cast<uint16_t>(word * 64 +
+                                   count_trailing_zeros(this->words[word]));
+    }
+  }
+  return 0;
+}
+
+LockstepEngine::LockstepEngine(const NesCpu &prototype, std::size_t lanes) {
+  if (lanes == 0) {
+    throw std::invalid_argument("el motor necesita al menos un carril");
+  }
+  if (prototype.break_mode != BreakMode::Exit) {
+    throw std::invalid_argument("el motor en paralelo solo admite BRK como "
+                                "salida");
+  }
+  for (std::size_t page = 0; page < BUS_PAGE_COUNT; page++) {
+    if (prototype.bus.page_kind(page * BUS_PAGE_SIZE) != PageKind::Ram) {
+      throw std::invalid_argument(
+          "el motor en paralelo solo admite memoria RAM plana");
+    }
+  }
+
+  this->count = lanes;
+  this->width = (lanes + LOCKSTEP_LANE_ALIGN - 1) / LOCKSTEP_LANE_ALIGN *
+                LOCKSTEP_LANE_ALIGN;
+  this->register_a.assign(this->width, prototype.register_a);
+  this->register_x.assign(this->width, prototype.register_x);
+  this->register_y.assign(this->width, prototype.register_y);
+  this->status.assign(this->width, prototype.get_status());
+  this->stack_pointer.assign(this->width, prototype.stack_pointer);
+  this->program_counter.assign(this->width, prototype.program_counter);
+  this->cycles.assign(this->width, prototype.cycles);
+  this->halt.assign(this->width, 0);
+  std::fill(this->halt.begin() + lanes, this->halt.end(), 1);
+  this->remaining.assign(this->width, 0);
+  this->next_pc.assign(this->width, 0);
+  this->page_written.assign(BUS_PAGE_COUNT, false);
+  this->group_at_pc.assign(BUS_MEMORY_SIZE, -1);
+
+  this->memory.resize(BUS_MEMORY_SIZE * this->width);
+  for (std::size_t addr = 0; addr < BUS_MEMORY_SIZE; addr++) {
+    std::fill_n(this->memory.begin() + addr * this->width, this->width,
+                prototype.bus.memory[addr]);
+  }
+}
+
+std::size_t LockstepEngine::lanes() const { return this->count; }
+
+std::size_t LockstepEngine::stride() const { return this->width; }
+
+uint8_t LockstepEngine::read(std::size_t lane, uint16_t addr) const {
+  return this->memory[static_cast<std::size_t>(addr) * this->width + lane];
+}
+
+void LockstepEngine::write(std::size_t lane, uint16_t addr, uint8_t value) {
+  this->memory[static_cast<std::size_t>(addr) * this->width + lane] = value;
+  this->page_written[addr >> 8] = true;
+}
+
+bool LockstepEngine::halted(std::size_t lane) const {
+  return this->halt[lane] != 0;
+}
+
+void LockstepEngine::extract(std::size_t lane, NesCpu &cpu) const {
+  cpu.register_a = this->register_a[lane];
+  cpu.register_x = this->register_x[lane];
+  cpu.register_y = this->register_y[lane];
+  cpu.set_status(static_cast<CpuFlags>(this->status[lane]));
+  cpu.stack_pointer = this->stack_pointer[lane];
+  cpu.program_counter = this->program_counter[lane];
+  cpu.cycles = this->cycles[lane];
+  for (std::size_t addr = 0; addr < BUS_MEMORY_SIZE; addr++) {
+    cpu.mem_write(addr, this->read(lane, addr));
+  }
+}
+
+LockstepStats LockstepEngine::run(uint64_t max_instructions) {
+  LockstepStats stats = {0, 0, 0, 0};
+  if (max_instructions == 0) {
+    return stats;
+  }
+
+  for (std::size_t lane = 0; lane < this->count; lane++) {
+    if (this->halt[lane]) {
+      continue;
+    }
+    this->remaining[lane] = max_instructions;
+    uint16_t pc = this->program_counter[lane];
+    if (this->group_at_pc[pc] < 0) {
+      std::size_t index = this->new_group(pc);
+      this->groups[index].budget = max_instructions;
+      this->group_at_pc[pc] = static_cast<int32_t>(index);
+      this->active.insert(pc);
+    }
+    this->add_lane(this->groups[this->group_at_pc[pc]], lane);
+  }
+
+  while (!this->active.empty()) {
+    uint16_t pc = this->active.first();
+    this->step(static_cast<std::size_t>(this->group_at_pc[pc]), stats);
+  }
+  return stats;
+}
+
+std::size_t LockstepEngine::new_group(uint16_t pc) {
+  std::size_t index;
+  if (!this->free_groups.empty()) {
+    index = this->free_groups.back();
+    this->free_groups.pop_back();
+  } else {
+    index = this->groups.size();
+    this->groups.emplace_back();
+    this->groups.back().mask.assign(this->width, 0);
+  }
+  LaneGroup &group = this->groups[index];
+  group.pc = pc;
+  group.count = 0;
+  group.leader = 0;
+  group.first = this->width;
+  group.last = 0;
+  group.pending_cycles = 0;
+  group.pending_instructions = 0;
+  group.budget = 0;
+  return index;
+}
+
+void LockstepEngine::free_group(std::size_t index) {
+  LaneGroup &group = this->groups[index];
+  if (group.first < group.last) {
+    std::fill(group.mask.begin() + group.first,
+              group.mask.begin() + group.last, 0);
+  }
+  group.count = 0;
+  this->free_groups.push_back(index);
+}
+
+void LockstepEngine::add_lane(LaneGroup &group, std::size_t lane) {
+  group.mask[lane] = 0xFF;
+  if (group.count == 0 || lane < group.leader) {
+    group.leader = lane;
+  }
+  group.count++;
+  group.first = std::min(group.first, lane / VECTOR_LANES * VECTOR_LANES);
+  group.last = std::max(group.last, (lane / VECTOR_LANES + 1) * VECTOR_LANES);
+}
+
+void LockstepEngine::detach_lane(LaneGroup &group, std::size_t lane) {
+  this->cycles[lane] += group.pending_cycles;
+  this->remaining[lane] -= group.pending_instructions;
+  group.mask[lane] = 0;
+  group.count--;
+}
+
+void LockstepEngine::find_leader(LaneGroup &group) {
+  for (std::size_t i = group.first; i < group.last; i += VECTOR_LANES) {
+    uint64_t bits = vbits(vload(group.mask.data() + i));
+    if (bits != 0) {
+      group.leader = i + count_trailing_zeros(bits);
+      return;
+    }
+  }
+}
+
+void LockstepEngine::flush(LaneGroup &group) {
+  uint64_t budget = UINT64_MAX;
+  for (std::size_t lane = group.first; lane < group.last; lane++) {
+    if (group.mask[lane]) {
+      this->cycles[lane] += group.pending_cycles;
+      this->remaining[lane] -= group.pending_instructions;
+      budget = std::min(budget, this->remaining[lane]);
+    }
+  }
+  group.pending_cycles = 0;
+  group.pending_instructions = 0;
+  group.budget = budget;
+}
+
+void LockstepEngine::merge(std::size_t from, std::size_t into) {
+  LaneGroup &source = this->groups[from];
+  LaneGroup &target = this->groups[into];
+  if (source.pending_cycles != target.pending_cycles ||
+      source.pending_instructions != target.pending_instructions) {
+    this->flush(source);
+    this->flush(target);
+  }
+  std::size_t first = std::min(source.first, target.first);
+  std::size_t last = std::max(source.last, target.last);
+  for (std::size_t i = source.first; i < source.last; i += VECTOR_LANES) {
+    LaneVector merged =
+        vor(vload(source.mask.data() + i), vload(target.mask.data() + i));
+    vstore(target.mask.data() + i, merged);
+  }
+  target.count += source.count;
+  target.leader = std::min(target.leader, source.leader);
+  target.first = first;
+  target.last = last;
+  target.budget = std::min(target.budget, source.budget);
+  this->free_group(from);
+}
+
+void LockstepEngine::place(std::size_t index, uint16_t pc) {
+  this->groups[index].pc = pc;
+  int32_t other = this->group_at_pc[pc];
+  if (other >= 0) {
+    this->merge(index, static_cast<std::size_t>(other));
+    index = static_cast<std::size_t>(other);
+  } else {
+    this->group_at_pc[pc] = static_cast<int32_t>(index);
+    this->active.insert(pc);
+  }
+  this->retire(index);
+}
+
+void LockstepEngine::retire(std::size_t index) {
+  LaneGroup &group = this->groups[index];
+  if (group.budget > 0) {
+    return;
+  }
+  this->flush(group);
+  uint64_t budget = UINT64_MAX;
+  for (std::size_t lane = group.first; lane < group.last; lane++) {
+    if (!group.mask[lane]) {
+      continue;
+    }
+    if (this->remaining[lane] == 0) {
+      this->program_counter[lane] = group.pc;
+      group.mask[lane] = 0;
+      group.count--;
+    } else {
+      budget = std::min(budget, this->remaining[lane]);
+    }
+  }
+  group.budget = budget;
+  if (group.count == 0) {
+    this->group_at_pc[group.pc] = -1;
+    this->active.erase(group.pc);
+    this->free_group(index);
+  } else {
+    this->find_leader(group);
+  }
+}
+
+bool LockstepEngine::lanes_equal(const LaneGroup &group,
+                                 const uint8_t *values,
+                                 uint8_t expected) const {
+  LaneVector want = vsplat(expected);
+  bool equal = true;
+  for_each_vector(group.mask, group.first, group.last,
+                  [&](std::size_t i, LaneVector m) {
+                    LaneVector differ =
+                        vandnot(m, veq(vload(values + i), want));
+                    equal = equal && vbits(differ) == 0;
+                  });
+  return equal;
+}
+
+bool LockstepEngine::code_uniform(const LaneGroup &group, uint16_t pc,
+                                  std::size_t len) {
+  for (std::size_t i = 0; i < len; i++) {
+    uint16_t addr = static_cast<uint16_t>(pc + i);
+    if (this->page_written[addr >> 8]) {
+      const uint8_t *values = this->row(addr);
+      if (!this->lanes_equal(group, values, values[group.leader])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool LockstepEngine::operand_address(const LaneGroup &group,
+                                     const OpCode &op, uint16_t &addr,
+                                     bool &page_crossed) {
+  std::size_t leader = group.leader;
+  uint16_t operand = static_cast<uint16_t>(group.pc + 1);
+  uint8_t lo = this->row(operand)[leader];
+  uint8_t hi = this->row(static_cast<uint16_t>(operand + 1))[leader];
+  uint8_t x = this->register_x[leader];
+  uint8_t y = this->register_y[leader];
+  page_crossed = false;
+
+  switch (op.mode) {
+  case AddressingMode::Immediate:
+    addr = operand;
+    return true;
+  case AddressingMode::ZeroPage:
+    addr = lo;
+    return true;
+  case AddressingMode::Absolute:
+    addr = static_cast<uint16_t>(hi << 8 | lo);
+    return true;
+  case AddressingMode::ZeroPage_X:
+    addr = static_cast<uint8_t>(lo + x);
+    return this->lanes_equal(group, this->register_x.data(), x);
+  case AddressingMode::ZeroPage_Y:
+    addr = static_cast<uint8_t>(lo + y);
+    return this->lanes_equal(group, this->register_y.data(), y);
+  case AddressingMode::Absolute_X:
+    addr = static_cast<uint16_t>((hi << 8 | lo) + x);
+    page_crossed = (addr & 0xFF) < x;
+    return this->lanes_equal(group, this->register_x.data(), x);
+  case AddressingMode::Absolute_Y:
+    addr = static_cast<uint16_t>((hi << 8 | lo) + y);
+    page_crossed = (addr & 0xFF) < y;
+    return this->lanes_equal(group, this->register_y.data(), y);
+  case AddressingMode::Indirect_X: {
+    if (!this->lanes_equal(group, this->register_x.data(), x)) {
+      return false;
+    }
+    uint8_t ptr = static_cast<uint8_t>(lo + x);
+    const uint8_t *ptr_lo = this->row(ptr);
+    const uint8_t *ptr_hi = this->row(static_cast<uint8_t>(ptr + 1));
+    addr = static_cast<uint16_t>(ptr_hi[leader] << 8 | ptr_lo[leader]);
+    return this->lanes_equal(group, ptr_lo, ptr_lo[leader]) &&
+           this->lanes_equal(group, ptr_hi, ptr_hi[leader]);
+  }
+  case AddressingMode::Indirect_Y: {
+    const uint8_t *ptr_lo = this->row(lo);
+    const uint8_t *ptr_hi = this->row(static_cast<uint8_t>(lo + 1));
+    addr = static_cast<uint16_t>((ptr_hi[leader] << 8 | ptr_lo[leader]) + y);
+    page_crossed = (addr & 0xFF) < y;
+    return this->lanes_equal(group, this->register_y.data(), y) &&
+           this->lanes_equal(group, ptr_lo, ptr_lo[leader]) &&
+           this->lanes_equal(group, ptr_hi, ptr_hi[leader]);
+  }
+  default:
+    return false;
+  }
+}
+
+void LockstepEngine::step(std::size_t index, LockstepStats &stats) {
+  LaneGroup &group = this->groups[index];
+  uint16_t pc = group.pc;
+  this->group_at_pc[pc] = -1;
+  this->active.erase(pc);
+  stats.steps++;
+
+  const OpCode &op = OPCODES_TABLE[this->row(pc)[group.leader]];
+  if (!this->code_uniform(group, pc, op.len)) {
+    this->step_scalar(index, stats);
+    return;
+  }
+
+  if (op.code == 0x00) {
+    // BRK halts every member, as NesCpu does in BreakMode::Exit.
+    for (std::size_t lane = group.first; lane < group.last; lane++) {
+      if (group.mask[lane]) {
+        this->detach_lane(group, lane);
+        this->program_counter[lane] = static_cast<uint16_t>(pc + 1);
+        this->halt[lane] = 1;
+      }
+    }
+    this->free_group(index);
+    return;
+  }
+  if (op.instruction == Instruction::Illegal) {
+    throw std::runtime_error("opcode no soportado");
+  }
+
+  // Sparse groups are cheaper to step one lane at a time than to sweep
+  // their whole lane range.
+  std::size_t members = group.count;
+  bool dense = members * 16 >= group.last - group.first;
+  if (dense && this->step_vector(index, op)) {
+    stats.vector_steps++;
+    stats.instructions += members;
+    return;
+  }
+  this->step_scalar(index, stats);
+}
+
+bool LockstepEngine::step_vector(std::size_t index, const OpCode &op) {
+  LaneGroup &group = this->groups[index];
+  const uint16_t pc = group.pc;
+  const std::size_t leader = group.leader;
+  const Instruction ins = op.instruction;
+
+  uint16_t addr = 0;
+  bool page_crossed = false;
+  if (op.mode != AddressingMode::NoneAddressing &&
+      !this->operand_address(group, op, addr, page_crossed)) {
+    return false;
+  }
+
+  uint8_t *a = this->register_a.data();
+  uint8_t *x = this->register_x.data();
+  uint8_t *y = this->register_y.data();
+  uint8_t *p = this->status.data();
+  uint8_t *sp = this->stack_pointer.data();
+  uint8_t *mem = this->row(addr);
+  uint16_t next = static_cast<uint16_t>(pc + op.len);
+  // JMP and JSR take their target without an addressing mode.
+  uint16_t absolute =
+      static_cast<uint16_t>(this->row(pc + 2)[leader] << 8 |
+                            this->row(pc + 1)[leader]);
+  uint64_t extra_cycles =
+      page_crossed && reads_with_penalty(ins) ? 1 : 0;
+
+  bool sets_memory = op.mode != AddressingMode::NoneAddressing;
+  uint8_t *rmw_target = sets_memory ? mem : a;
+
+  auto each = [&](auto &&f) {
+    for_each_vector(group.mask, group.first, group.last, f);
+  };
+  // dst = value with N and Z updated, on the group's lanes.
+  auto load = [&](uint8_t *dst, const uint8_t *src) {
+    each([&](std::size_t i, LaneVector m) {
+      LaneVector v = vload(src + i);
+      vstore(dst + i, vblend(m, v, vload(dst + i)));
+      vstore(p + i, vblend(m, vflags_nz(vload(p + i), v), vload(p + i)));
+    });
+  };
+  auto store = [&](const uint8_t *src) {
+    each([&](std::size_t i, LaneVector m) {
+      vstore(mem + i, vblend(m, vload(src + i), vload(mem + i)));
+    });
+    this->page_written[addr >> 8] = true;
+  };
+  auto add_to_a = [&](bool invert) {
+    each([&](std::size_t i, LaneVector m) {
+      LaneVector va = vload(a + i);
+      LaneVector vp = vload(p + i);
+      LaneVector v = vload(mem + i);
+      if (invert) {
+        v = vxor(v, vsplat(0xFF));
+      }
+      LaneVector carry_in = vand(vp, vsplat(CpuFlags::CARRY));
+      LaneVector sum = vadd(vadd(va, v), carry_in);
+      // Carry out of bit 7 of a full adder.
+      LaneVector carry = vor(vand(va, v), vandnot(vor(va, v), sum));
+      LaneVector overflow = vand(vxor(v, sum), vxor(sum, va));
+      LaneVector flags = vandnot(vflags_cnz(vp, carry, sum),
+                                 vsplat(CpuFlags::OVERFLOW));
+      flags = vor(flags, vand(vsign(overflow), vsplat(CpuFlags::OVERFLOW)));
+      vstore(a + i, vblend(m, sum, va));
+      vstore(p + i, vblend(m, flags, vp));
+    });
+  };
+  auto logic = [&](auto &&combine) {
+    each([&](std::size_t i, LaneVector m) {
+      LaneVector va = vload(a + i);
+      LaneVector vp = vload(p + i);
+      LaneVector result = combine(va, vload(mem + i));
+      vstore(a + i, vblend(m, result, va));
+      vstore(p + i, vblend(m, vflags_nz(vp, result), vp));
+    });
+  };
+  auto compare = [&](const uint8_t *reg) {
+    each([&](std::size_t i, LaneVector m) {
+      LaneVector vr = vload(reg + i);
+      LaneVector v = vload(mem + i);
+      LaneVector vp = vload(p + i);
+      // reg >= v, as a mask.
+      LaneVector carry = veq(vmin(vr, v), v);
+      vstore(p + i, vblend(m, vflags_cnz(vp, carry, vsub(vr, v)), vp));
+    });
+  };
+  // Read-modify-write of `target`; `shift` returns the result and the carry
+  // (bit 7 set when carry out), or a zero carry for INC and DEC.
+  auto modify = [&](uint8_t *target, bool sets_carry, auto &&shift) {
+    each([&](std::size_t i, LaneVector m) {
+      LaneVector v = vload(target + i);
+      LaneVector vp = vload(p + i);
+      LaneVector carry;
+      LaneVector result = shift(v, vp, carry);
+      LaneVector flags = sets_carry ? vflags_cnz(vp, carry, result)
+                                    : vflags_nz(vp, result);
+      vstore(target + i, vblend(m, result, v));
+      vstore(p + i, vblend(m, flags, vp));
+    });
+    if (target == mem && sets_memory) {
+      this->page_written[addr >> 8] = true;
+    }
+  };
+  auto carry_in = [](LaneVector vp) {
+    return veq(vand(vp, vsplat(CpuFlags::CARRY)), vsplat(CpuFlags::CARRY));
+  };
+  auto step_register = [&](uint8_t *reg, uint8_t delta) {
+    modify(reg, false, [&](LaneVector v, LaneVector, LaneVector &) {
+      return vadd(v, vsplat(delta));
+    });
+  };
+  auto set_status = [&](uint8_t set, uint8_t clear) {
+    each([&](std::size_t i, LaneVector m) {
+      LaneVector vp = vload(p + i);
+      LaneVector flags = vor(vandnot(vp, vsplat(clear)), vsplat(set));
+      vstore(p + i, vblend(m, flags, vp));
+    });
+  };
+  auto fill = [&](uint8_t *dst, uint8_t value) {
+    each([&](std::size_t i, LaneVector m) {
+      vstore(dst + i, vblend(m, vsplat(value), vload(dst + i)));
+    });
+  };
+  auto adjust_sp = [&](int delta) {
+    each([&](std::size_t i, LaneVector m) {
+      LaneVector v = vload(sp + i);
+      vstore(sp + i, vblend(m, vadd(v, vsplat(static_cast<uint8_t>(delta))),
+                            v));
+    });
+  };
+
+  uint8_t flag;
+  bool when_set;
+  switch (ins) {
+  case Instruction::LDA:
+    load(a, mem);
+    break;
+  case Instruction::LDX:
+    load(x, mem);
+    break;
+  case Instruction::LDY:
+    load(y, mem);
+    break;
+  case Instruction::STA:
+    store(a);
+    break;
+  case Instruction::STX:
+    store(x);
+    break;
+  case Instruction::STY:
+    store(y);
+    break;
+  case Instruction::ADC:
+    add_to_a(false);
+    break;
+  case Instruction::SBC:
+    add_to_a(true);
+    break;
+  case Instruction::AND:
+    logic([](LaneVector l, LaneVector r) { return vand(l, r); });
+    break;
+  case Instruction::ORA:
+    logic([](LaneVector l, LaneVector r) { return vor(l, r); });
+    break;
+  case Instruction::EOR:
+    logic([](LaneVector l, LaneVector r) { return vxor(l, r); });
+    break;
+  case Instruction::CMP:
+    compare(a);
+    break;
+  case Instruction::CPX:
+    compare(x);
+    break;
+  case Instruction::CPY:
+    compare(y);
+    break;
+  case Instruction::BIT:
+    each([&](std::size_t i, LaneVector m) {
+      LaneVector v = vload(mem + i);
+      LaneVector vp = vload(p + i);
+      LaneVector zero = vand(veq(vand(vload(a + i), v), vsplat(0)),
+                             vsplat(CpuFlags::ZERO));
+      LaneVector top = vand(v, vsplat(CpuFlags::NEGATIV | CpuFlags::OVERFLOW));
+      LaneVector flags = vandnot(
+          vp, vsplat(CpuFlags::ZERO | CpuFlags::NEGATIV | CpuFlags::OVERFLOW));
+      vstore(p + i, vblend(m, vor(flags, vor(zero, top)), vp));
+    });
+    break;
+  case Instruction::ASL:
+    modify(rmw_target, true, [](LaneVector v, LaneVector, LaneVector &c) {
+      c = v;
+      return vadd(v, v);
+    });
+    break;
+  case Instruction::LSR:
+    modify(rmw_target, true, [](LaneVector v, LaneVector, LaneVector &c) {
+      c = veq(vand(v, vsplat(0x01)), vsplat(0x01));
+      return vshr1(v);
+    });
+    break;
+  case Instruction::ROL:
+    modify(rmw_target, true,
+           [&](LaneVector v, LaneVector vp, LaneVector &c) {
+             c = v;
+             return vor(vadd(v, v), vand(carry_in(vp), vsplat(0x01)));
+           });
+    break;
+  case Instruction::ROR:
+    modify(rmw_target, true,
+           [&](LaneVector v, LaneVector vp, LaneVector &c) {
+             c = veq(vand(v, vsplat(0x01)), vsplat(0x01));
+             return vor(vshr1(v), vand(carry_in(vp), vsplat(0x80)));
+           });
+    break;
+  case Instruction::INC:
+    step_register(mem, 1);
+    break;
+  case Instruction::DEC:
+    step_register(mem, 0xFF);
+    break;
+  case Instruction::INX:
+    step_register(x, 1);
+    break;
+  case Instruction::INY:
+    step_register(y, 1);
+    break;
+  case Instruction::DEX:
+    step_register(x, 0xFF);
+    break;
+  case Instruction::DEY:
+    step_register(y, 0xFF);
+    break;
+  case Instruction::TAX:
+    load(x, a);
+    break;
+  case Instruction::TAY:
+    load(y, a);
+    break;
+  case Instruction::TXA:
+    load(a, x);
+    break;
+  case Instruction::TYA:
+    load(a, y);
+    break;
+  case Instruction::TSX:
+    load(x, sp);
+    break;
+  case Instruction::TXS:
+    each([&](std::size_t i, LaneVector m) {
+      vstore(sp + i, vblend(m, vload(x + i), vload(sp + i)));
+    });
+    break;
+  case Instruction::CLC:
+    set_status(0, CpuFlags::CARRY);
+    break;
+  case Instruction::SEC:
+    set_status(CpuFlags::CARRY, 0);
+    break;
+  case Instruction::CLD:
+    set_status(0, CpuFlags::DECIMAL_MODE);
+    break;
+  case Instruction::SED:
+    set_status(CpuFlags::DECIMAL_MODE, 0);
+    break;
+  case Instruction::CLI:
+    set_status(0, CpuFlags::INTERRUPT_DISABLE);
+    break;
+  case Instruction::SEI:
+    set_status(CpuFlags::INTERRUPT_DISABLE, 0);
+    break;
+  case Instruction::CLV:
+    set_status(0, CpuFlags::OVERFLOW);
+    break;
+  case Instruction::NOP:
+    break;
+  case Instruction::JMP:
+    if (op.code != 0x4c) {
+      return false;
+    }
+    next = jump_target(pc, absolute, op.len);
+    break;
+  case Instruction::PHA:
+  case Instruction::PHP:
+  case Instruction::PLA:
+  case Instruction::PLP:
+  case Instruction::JSR:
+  case Instruction::RTS: {
+    uint8_t top = sp[leader];
+    if (!this->lanes_equal(group, sp, top)) {
+      return false;
+    }
+    if (ins == Instruction::PHA) {
+      addr = STACK + top;
+      mem = this->row(addr);
+      store(a);
+      adjust_sp(-1);
+    } else if (ins == Instruction::PHP) {
+      mem = this->row(STACK + top);
+      each([&](std::size_t i, LaneVector m) {
+        LaneVector pushed =
+            vor(vload(p + i), vsplat(CpuFlags::BREAK | CpuFlags::BREAK2));
+        vstore(mem + i, vblend(m, pushed, vload(mem + i)));
+      });
+      this->page_written[STACK >> 8] = true;
+      adjust_sp(-1);
+    } else if (ins == Instruction::PLA) {
+      load(a, this->row(STACK + static_cast<uint8_t>(top + 1)));
+      adjust_sp(1);
+    } else if (ins == Instruction::PLP) {
+      const uint8_t *pulled = this->row(STACK + static_cast<uint8_t>(top + 1));
+      each([&](std::size_t i, LaneVector m) {
+        LaneVector flags = vor(vandnot(vload(pulled + i),
+                                       vsplat(CpuFlags::BREAK)),
+                               vsplat(CpuFlags::BREAK2));
+        vstore(p + i, vblend(m, flags, vload(p + i)));
+      });
+      adjust_sp(1);
+    } else if (ins == Instruction::JSR) {
+      uint16_t ret = static_cast<uint16_t>(pc + 2);
+      fill(this->row(STACK + top), ret >> 8);
+      fill(this->row(STACK + static_cast<uint8_t>(top - 1)), ret & 0xFF);
+      this->page_written[STACK >> 8] = true;
+      adjust_sp(-2);
+      next = jump_target(pc, absolute, op.len);
+    } else {
+      const uint8_t *ret_lo = this->row(STACK + static_cast<uint8_t>(top + 1));
+      const uint8_t *ret_hi = this->row(STACK + static_cast<uint8_t>(top + 2));
+      if (!this->lanes_equal(group, ret_lo, ret_lo[leader]) ||
+          !this->lanes_equal(group, ret_hi, ret_hi[leader])) {
+        return false;
+      }
+      adjust_sp(2);
+      uint16_t ret = static_cast<uint16_t>(ret_hi[leader] << 8 | ret_lo[leader]);
+      next = jump_target(pc, static_cast<uint16_t>(ret + 1), op.len);
+    }
+    break;
+  }
+  default:
+    if (!branch_condition(ins, flag, when_set)) {
+      // RTI and JMP ($nnnn) are rare enough to always run per lane.
+      return false;
+    }
+    {
+      int8_t offset = static_cast<int8_t>(this->row(pc + 1)[leader]);
+      uint16_t fallthrough = static_cast<uint16_t>(pc + 2);
+      uint16_t jump = static_cast<uint16_t>(fallthrough + offset);
+      uint64_t taken_cycles =
+          1 + ((fallthrough & 0xFF00) != (jump & 0xFF00));
+      uint16_t taken_pc = jump_target(pc, jump, op.len);
+
+      group.pending_cycles += op.cycles;
+      group.pending_instructions++;
+      group.budget--;
+
+      // Split the lanes that take the branch off into their own group.
+      std::size_t child = this->new_group(taken_pc);
+      LaneGroup &taken = this->groups[child];
+      std::size_t taken_count = 0;
+      LaneVector test = vsplat(flag);
+      each([&](std::size_t i, LaneVector m) {
+        LaneVector set = veq(vand(vload(p + i), test), test);
+        LaneVector t = when_set ? vand(m, set) : vandnot(m, set);
+        uint64_t bits = vbits(t);
+        if (bits != 0) {
+          if (taken_count == 0) {
+            taken.leader = i + count_trailing_zeros(bits);
+          }
+          taken_count += count_ones(bits);
+          vstore(taken.mask.data() + i, t);
+          vstore(group.mask.data() + i, vandnot(m, t));
+        }
+      });
+
+      if (taken_count == 0) {
+        this->free_group(child);
+        this->place(index, fallthrough);
+        return true;
+      }
+      taken.count = taken_count;
+      taken.first = group.first;
+      taken.last = group.last;
+      taken.pending_cycles = group.pending_cycles + taken_cycles;
+      taken.pending_instructions = group.pending_instructions;
+      taken.budget = group.budget;
+      group.count -= taken_count;
+      if (group.count == 0) {
+        this->free_group(index);
+      } else {
+        this->find_leader(group);
+        this->place(index, fallthrough);
+      }
+      this->place(child, taken_pc);
+      return true;
+    }
+  }
+
+  group.pending_cycles += op.cycles + extra_cycles;
+  group.pending_instructions++;
+  group.budget--;
+  this->place(index, next);
+  return true;
+}
+
+void LockstepEngine::step_scalar(std::size_t index, LockstepStats &stats) {
+  LaneGroup &group = this->groups[index];
+  const uint16_t pc = group.pc;
+  for (std::size_t lane = group.first; lane < group.last; lane++) {
+    if (group.mask[lane]) {
+      this->next_pc[lane] = this->step_lane(lane, pc);
+    }
+  }
+
+  // Lanes that reached BRK leave before the step is charged to the group.
+  for (std::size_t lane = group.first; lane < group.last; lane++) {
+    if (group.mask[lane] && this->halt[lane]) {
+      this->detach_lane(group, lane);
+      this->program_counter[lane] = this->next_pc[lane];
+    }
+  }
+  if (group.count == 0) {
+    this->free_group(index);
+    return;
+  }
+  this->find_leader(group);
+  stats.instructions += group.count;
+  stats.scalar_instructions += group.count;
+  group.pending_instructions++;
+  group.budget--;
+
+  // Regroup by next PC; the leader's lanes stay in this group.
+  uint16_t lead_pc = this->next_pc[group.leader];
+  std::vector<std::pair<uint16_t, std::size_t>> children;
+  for (std::size_t lane = group.first; lane < group.last; lane++) {
+    if (!group.mask[lane] || this->next_pc[lane] == lead_pc) {
+      continue;
+    }
+    uint16_t lane_pc = this->next_pc[lane];
+    std::size_t child = 0;
+    bool found = false;
+    for (const std::pair<uint16_t, std::size_t> &entry : children) {
+      if (entry.first == lane_pc) {
+        child = entry.second;
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      child = this->new_group(lane_pc);
+      LaneGroup &split = this->groups[child];
+      split.pending_cycles = group.pending_cycles;
+      split.pending_instructions = group.pending_instructions;
+      split.budget = group.budget;
+      children.emplace_back(lane_pc, child);
+    }
+    group.mask[lane] = 0;
+    group.count--;
+    this->add_lane(this->groups[child], lane);
+  }
+
+  this->place(index, lead_pc);
+  for (const std::pair<uint16_t, std::size_t> &entry : children) {
+    this->place(entry.second, entry.first);
+  }
+}
+
+uint16_t LockstepEngine::step_lane(std::size_t lane, uint16_t pc) {
+  uint8_t &a = this->register_a[lane];
+  uint8_t &x = this->register_x[lane];
+  uint8_t &y = this->register_y[lane];
+  uint8_t &p = this->status[lane];
+  uint8_t &sp = this->stack_pointer[lane];
+  auto read = [&](uint16_t addr) { return this->row(addr)[lane]; };
+  auto write = [&](uint16_t addr, uint8_t value) {
+    this->row(addr)[lane] = value;
+    this->page_written[addr >> 8] = true;
+  };
+  auto push = [&](uint8_t value) {
+    write(STACK + sp, value);
+    sp = static_cast<uint8_t>(sp - 1);
+  };
+  auto pull = [&]() {
+    sp = static_cast<uint8_t>(sp + 1);
+    return read(STACK + sp);
+  };
+
+  uint8_t code = read(pc);
+  if (code == 0x00) {
+    this->halt[lane] = 1;
+    return static_cast<uint16_t>(pc + 1);
+  }
+  const OpCode &op = OPCODES_TABLE[code];
+  const Instruction ins = op.instruction;
+  if (ins == Instruction::Illegal) {
+    throw std::runtime_error("opcode no soportado");
+  }
+
+  uint16_t operand = static_cast<uint16_t>(pc + 1);
+  uint8_t lo = read(operand);
+  uint8_t hi = read(static_cast<uint16_t>(operand + 1));
+  uint16_t addr = 0;
+  bool page_crossed = false;
+  switch (op.mode) {
+  case AddressingMode::Immediate:
+    addr = operand;
+    break;
+  case AddressingMode::ZeroPage:
+    addr = lo;
+    break;
+  case AddressingMode::Absolute:
+    addr = static_cast<uint16_t>(hi << 8 | lo);
+    break;
+  case AddressingMode::ZeroPage_X:
+    addr = static_cast<uint8_t>(lo + x);
+    break;
+  case AddressingMode::ZeroPage_Y:
+    addr = static_cast<uint8_t>(lo + y);
+    break;
+  case AddressingMode::Absolute_X:
+    addr = static_cast<uint16_t>((hi << 8 | lo) + x);
+    page_crossed = (addr & 0xFF) < x;
+    break;
+  case AddressingMode::Absolute_Y:
+    addr = static_cast<uint16_t>((hi << 8 | lo) + y);
+    page_crossed = (addr & 0xFF) < y;
+    break;
+  case AddressingMode::Indirect_X: {
+    uint8_t ptr = static_cast<uint8_t>(lo + x);
+    addr = static_cast<uint16_t>(read(static_cast<uint8_t>(ptr + 1)) << 8 |
+                                 read(ptr));
+    break;
+  }
+  case AddressingMode::Indirect_Y:
+    addr = static_cast<uint16_t>(
+        (read(static_cast<uint8_t>(lo + 1)) << 8 | read(lo)) + y);
+    page_crossed = (addr & 0xFF) < y;
+    break;
+  default:
+    break;
+  }
+
+  uint16_t next = static_cast<uint16_t>(pc + op.len);
+  uint64_t cost = op.cycles;
+  if (page_crossed && reads_with_penalty(ins)) {
+    cost++;
+  }
+
+  auto add_to_a = [&](uint8_t value) {
+    uint16_t sum = a + value + (p & CpuFlags::CARRY ? 1 : 0);
+    uint8_t result = static_cast<uint8_t>(sum);
+    set_carry(p, sum > 0xFF);
+    p = (p & ~CpuFlags::OVERFLOW) |
+        (((value ^ result) & (result ^ a) & 0x80) ? CpuFlags::OVERFLOW : 0);
+    a = result;
+    set_flags_nz(p, a);
+  };
+  auto compare = [&](uint8_t reg) {
+    uint8_t value = read(addr);
+    set_carry(p, value <= reg);
+    set_flags_nz(p, static_cast<uint8_t>(reg - value));
+  };
+  // Shifts and rotates work on A when there is no operand address.
+  auto modify = [&](auto &&change) {
+    uint8_t value = op.mode == AddressingMode::NoneAddressing ? a : read(addr);
+    uint8_t result = change(value);
+    set_flags_nz(p, result);
+    if (op.mode == AddressingMode::NoneAddressing) {
+      a = result;
+    } else {
+      write(addr, result);
+    }
+  };
+
+  uint8_t flag;
+  bool when_set;
+  switch (ins) {
+  case Instruction::LDA:
+    a = read(addr);
+    set_flags_nz(p, a);
+    break;
+  case Instruction::LDX:
+    x = read(addr);
+    set_flags_nz(p, x);
+    break;
+  case Instruction::LDY:
+    y = read(addr);
+    set_flags_nz(p, y);
+    break;
+  case Instruction::STA:
+    write(addr, a);
+    break;
+  case Instruction::STX:
+    write(addr, x);
+    break;
+  case Instruction::STY:
+    write(addr, y);
+    break;
+  case Instruction::ADC:
+    add_to_a(read(addr));
+    break;
+  case Instruction::SBC:
+    add_to_a(static_cast<uint8_t>(~read(addr)));
+    break;
+  case Instruction::AND:
+    a &= read(addr);
+    set_flags_nz(p, a);
+    break;
+  case Instruction::ORA:
+    a |= read(addr);
+    set_flags_nz(p, a);
+    break;
+  case Instruction::EOR:
+    a ^= read(addr);
+    set_flags_nz(p, a);
+    break;
+  case Instruction::CMP:
+    compare(a);
+    break;
+  case Instruction::CPX:
+    compare(x);
+    break;
+  case Instruction::CPY:
+    compare(y);
+    break;
+  case Instruction::BIT: {
+    uint8_t value = read(addr);
+    p = (p & ~(CpuFlags::ZERO | CpuFlags::NEGATIV | CpuFlags::OVERFLOW)) |
+        (value & (CpuFlags::NEGATIV | CpuFlags::OVERFLOW)) |
+        ((a & value) == 0 ? CpuFlags::ZERO : 0);
+    break;
+  }
+  case Instruction::ASL:
+    modify([&](uint8_t value) {
+      set_carry(p, value & 0x80);
+      return static_cast<uint8_t>(value << 1);
+    });
+    break;
+  case Instruction::LSR:
+    modify([&](uint8_t value) {
+      set_carry(p, value & 0x01);
+      return static_cast<uint8_t>(value >> 1);
+    });
+    break;
+  case Instruction::ROL:
+    modify([&](uint8_t value) {
+      uint8_t carry = p & CpuFlags::CARRY ? 0x01 : 0x00;
+      set_carry(p, value & 0x80);
+      return static_cast<uint8_t>(value << 1 | carry);
+    });
+    break;
+  case Instruction::ROR:
+    modify([&](uint8_t value) {
+      uint8_t carry = p & CpuFlags::CARRY ? 0x80 : 0x00;
+      set_carry(p, value & 0x01);
+      return static_cast<uint8_t>(value >> 1 | carry);
+    });
+    break;
+  case Instruction::INC:
+    modify([](uint8_t value) { return static_cast<uint8_t>(value + 1); });
+    break;
+  case Instruction::DEC:
+    modify([](uint8_t value) { return static_cast<uint8_t>(value - 1); });
+    break;
+  case Instruction::INX:
+    x++;
+    set_flags_nz(p, x);
+    break;
+  case Instruction::INY:
+    y++;
+    set_flags_nz(p, y);
+    break;
+  case Instruction::DEX:
+    x--;
+    set_flags_nz(p, x);
+    break;
+  case Instruction::DEY:
+    y--;
+    set_flags_nz(p, y);
+    break;
+  case Instruction::TAX:
+    x = a;
+    set_flags_nz(p, x);
+    break;
+  case Instruction::TAY:
+    y = a;
+    set_flags_nz(p, y);
+    break;
+  case Instruction::TXA:
+    a = x;
+    set_flags_nz(p, a);
+    break;
+  case Instruction::TYA:
+    a = y;
+    set_flags_nz(p, a);
+    break;
+  case Instruction::TSX:
+    x = sp;
+    set_flags_nz(p, x);
+    break;
+  case Instruction::TXS:
+    sp = x;
+    break;
+  case Instruction::CLC:
+    p &= ~CpuFlags::CARRY;
+    break;
+  case Instruction::SEC:
+    p |= CpuFlags::CARRY;
+    break;
+  case Instruction::CLD:
+    p &= ~CpuFlags::DECIMAL_MODE;
+    break;
+  case Instruction::SED:
+    p |= CpuFlags::DECIMAL_MODE;
+    break;
+  case Instruction::CLI:
+    p &= ~CpuFlags::INTERRUPT_DISABLE;
+    break;
+  case Instruction::SEI:
+    p |= CpuFlags::INTERRUPT_DISABLE;
+    break;
+  case Instruction::CLV:
+    p &= ~CpuFlags::OVERFLOW;
+    break;
+  case Instruction::NOP:
+    break;
+  case Instruction::PHA:
+    push(a);
+    break;
+  case Instruction::PHP:
+    push(p | CpuFlags::BREAK | CpuFlags::BREAK2);
+    break;
+  case Instruction::PLA:
+    a = pull();
+    set_flags_nz(p, a);
+    break;
+  case Instruction::PLP:
+    p = (pull() & ~CpuFlags::BREAK) | CpuFlags::BREAK2;
+    break;
+  case Instruction::JMP: {
+    uint16_t target = static_cast<uint16_t>(hi << 8 | lo);
+    if (op.code == 0x6c) {
+      // The indirect vector never crosses a page, like the NMOS 6502.
+      uint16_t hi_addr = (target & 0xFF) == 0xFF
+                             ? static_cast<uint16_t>(target & 0xFF00)
+                             : static_cast<uint16_t>(target + 1);
+      target = static_cast<uint16_t>(read(hi_addr) << 8 | read(target));
+    }
+    next = jump_target(pc, target, op.len);
+    break;
+  }
+  case Instruction::JSR: {
+    uint16_t ret = static_cast<uint16_t>(pc + 2);
+    push(ret >> 8);
+    push(ret & 0xFF);
+    next = jump_target(pc, static_cast<uint16_t>(hi << 8 | lo), op.len);
+    break;
+  }
+  case Instruction::RTS: {
+    uint8_t ret_lo = pull();
+    uint8_t ret_hi = pull();
+    next = jump_target(pc, static_cast<uint16_t>((ret_hi << 8 | ret_lo) + 1),
+                       op.len);
+    break;
+  }
+  case Instruction::RTI: {
+    p = (pull() & ~CpuFlags::BREAK) | CpuFlags::BREAK2;
+    uint8_t ret_lo = pull();
+    uint8_t ret_hi = pull();
+    next = jump_target(pc, static_cast<uint16_t>(ret_hi << 8 | ret_lo),
+                       op.len);
+    break;
+  }
+  default:
+    if (branch_condition(ins, flag, when_set) &&
+        static_cast<bool>(p & flag) == when_set) {
+      uint16_t jump = static_cast<uint16_t>(next + static_cast<int8_t>(lo));
+      cost += 1 + ((next & 0xFF00) != (jump & 0xFF00));
+      next = jump_target(pc, jump, op.len);
+    }
+    break;
+  }
+
+  this->cycles[lane] += cost;
+  return next;
+}
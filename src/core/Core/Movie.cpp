@@ -0,0 +1,266 @@
+#include "Core/Movie.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+static void put_u16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(value & 0xFF);
+  out.push_back(value >> 8);
+}
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value) {
+  put_u16(out, value & 0xFFFF);
+  put_u16(out, value >> 16);
+}
+
+static void put_u64(std::vector<uint8_t> &out, uint64_t value) {
+  put_u32(out, value & 0xFFFFFFFF);
+  put_u32(out, value >> 32);
+}
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+// Bounds-checked little-endian reader over a movie file.
+class MovieReader {
+public:
+  explicit MovieReader(const std::vector<uint8_t> &data) : data(data) {
+    this->pos = 0;
+  }
+
+  const uint8_t *take(std::size_t count) {
+    if (this->data.size() - this->pos < count) {
+      throw std::runtime_error("pelicula truncada");
+    }
+    const uint8_t *bytes = this->data.data() + this->pos;
+    this->pos += count;
+    return bytes;
+  }
+
+  uint8_t u8() { return *this->take(1); }
+
+  uint16_t u16() {
+    const uint8_t *bytes = this->take(2);
+    return bytes[0] | (bytes[1] << 8);
+  }
+
+  uint32_t u32() {
+    uint32_t lo = this->u16();
+    uint32_t hi = this->u16();
+    return lo | (hi << 16);
+  }
+
+  uint64_t u64() {
+    uint64_t lo = this->u32();
+    uint64_t hi = this->u32();
+    return lo | (hi << 32);
+  }
+
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = this->u8();
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    throw std::runtime_error("pelicula invalida");
+  }
+
+private:
+  const std::vector<uint8_t> &data;
+  std::size_t pos;
+};
+
+std::vector<uint8_t> serialize_movie(const Movie &movie) {
+  std::vector<uint8_t> out;
+  out.reserve(32 + movie.start_state.size() + movie.events.size() * 3 +
+              movie.checkpoints.size() * 12);
+  put_u32(out, MOVIE_MAGIC);
+  put_u16(out, MOVIE_VERSION);
+  put_u64(out, movie.start_cycle);
+  put_varint(out, movie.start_state.size());
+  out.insert(out.end(), movie.start_state.begin(), movie.start_state.end());
+
+  put_varint(out, movie.events.size());
+  uint64_t cycle = movie.start_cycle;
+  // No event has written yet, so the first one always stores its address.
+  int32_t address = -1;
+  for (const MovieEvent &event : movie.events) {
+    bool new_address = event.address != address;
+    put_varint(out, (event.cycle - cycle) << 1 | new_address);
+    if (new_address) {
+      put_u16(out, event.address);
+    }
+    out.push_back(event.value);
+    cycle = event.cycle;
+    address = event.address;
+  }
+
+  put_varint(out, movie.checkpoints.size());
+  cycle = movie.start_cycle;
+  for (const MovieCheckpoint &checkpoint : movie.checkpoints) {
+    put_varint(out, checkpoint.cycle - cycle);
+    put_u64(out, checkpoint.hash);
+    cycle = checkpoint.cycle;
+  }
+
+  put_varint(out, (movie.end_cycle - movie.start_cycle) << 1 |
+                     movie.break_at_end);
+  return out;
+}
+
+Movie deserialize_movie(const std::vector<uint8_t> &data) {
+  MovieReader reader(data);
+  if (reader.u32() != MOVIE_MAGIC) {
+    throw std::runtime_error("pelicula invalida");
+  }
+  if (reader.u16() != MOVIE_VERSION) {
+    throw std::runtime_error("version de pelicula no soportada");
+  }
+
+  Movie movie;
+  movie.start_cycle = reader.u64();
+  uint64_t state_size = reader.varint();
+  const uint8_t *state = reader.take(state_size);
+  movie.start_state.assign(state, state + state_size);
+
+  uint64_t count = reader.varint();
+  uint64_t cycle = movie.start_cycle;
+  uint16_t address = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t delta = reader.varint();
+    if (delta & 1) {
+      address = reader.u16();
+    } else if (i == 0) {
+      throw std::runtime_error("pelicula invalida");
+    }
+    cycle += delta >> 1;
+    movie.events.push_back({cycle, address, reader.u8()});
+  }
+
+  count = reader.varint();
+  cycle = movie.start_cycle;
+  for (uint64_t i = 0; i < count; i++) {
+    cycle += reader.varint();
+    movie.checkpoints.push_back({cycle, reader.u64()});
+  }
+
+  uint64_t end = reader.varint();
+  movie.end_cycle = movie.start_cycle + (end >> 1);
+  movie.break_at_end = end & 1;
+  return movie;
+}
+
+MovieRecorder::MovieRecorder(NesCpu &cpu, uint64_t checkpoint_cycles)
+    : cpu(cpu) {
+  this->movie.start_state = cpu.save_state();
+  this->movie.start_cycle = cpu.cycles;
+  this->movie.end_cycle = cpu.cycles;
+  this->movie.break_at_end = false;
+  this->checkpoint_cycles = std::max<uint64_t>(checkpoint_cycles, 1);
+  this->next_checkpoint = cpu.cycles + this->checkpoint_cycles;
+}
+
+void MovieRecorder::write(uint16_t address, uint8_t value) {
+  this->movie.events.push_back({this->cpu.cycles, address, value});
+  this->cpu.mem_write(address, value);
+}
+
+RunResult MovieRecorder::run_until(const RunLimits &limits) {
+  RunResult result = this->cpu.run_until(limits);
+  this->movie.break_at_end = result.reason == StopReason::Break;
+  if (this->cpu.cycles >= this->next_checkpoint) {
+    this->movie.checkpoints.push_back(
+        {this->cpu.cycles, this->cpu.state_hash()});
+    this->next_checkpoint = this->cpu.cycles + this->checkpoint_cycles;
+  }
+  return result;
+}
+
+Movie MovieRecorder::finish() {
+  if (this->movie.checkpoints.empty() ||
+      this->movie.checkpoints.back().cycle != this->cpu.cycles) {
+    this->movie.checkpoints.push_back(
+        {this->cpu.cycles, this->cpu.state_hash()});
+  }
+  this->movie.end_cycle = this->cpu.cycles;
+  return this->movie;
+}
+
+ReplayResult replay_movie(NesCpu &cpu, const Movie &movie) {
+  cpu.load_state(movie.start_state);
+  ReplayResult result = {0, 0, 0, StopReason::CycleLimit};
+  std::size_t next_event = 0;
+  bool break_pending = movie.break_at_end;
+
+  while (true) {
+    uint64_t now = cpu.cycles;
+    if (now == movie.end_cycle && break_pending) {
+      // Step onto the BRK the recording stopped at before the checkpoints
+      // it took afterwards.
+      RunLimits limits;
+      limits.max_cycles = 1;
+      RunResult run = cpu.run_until(limits);
+      result.instructions += run.instructions;
+      result.cycles += run.cycles;
+      result.reason = run.reason;
+      if (run.reason != StopReason::Break) {
+        throw std::runtime_error("la repeticion diverge en el ciclo " +
+                                 std::to_string(now));
+      }
+      break_pending = false;
+    }
+    while (result.checkpoints < movie.checkpoints.size() &&
+           movie.checkpoints[result.checkpoints].cycle == now) {
+      if (cpu.state_hash() != movie.checkpoints[result.checkpoints].hash) {
+        throw std::runtime_error("la repeticion diverge en el ciclo " +
+                                 std::to_string(now));
+      }
+      result.checkpoints++;
+    }
+    while (next_event < movie.events.size() &&
+           movie.events[next_event].cycle == now) {
+      const MovieEvent &event = movie.events[next_event++];
+      cpu.mem_write(event.address, event.value);
+    }
+    if (now >= movie.end_cycle) {
+      break;
+    }
+
+    // Run up to the next cycle the movie has something at; it is an
+    // instruction boundary whenever the re-run follows the recording.
+    uint64_t target = movie.end_cycle;
+    if (next_event < movie.events.size()) {
+      target = std::min(target, movie.events[next_event].cycle);
+    }
+    if (result.checkpoints < movie.checkpoints.size()) {
+      target = std::min(target, movie.checkpoints[result.checkpoints].cycle);
+    }
+    RunLimits limits;
+    limits.max_cycles = target - now;
+    RunResult run = cpu.run_until(limits);
+    result.instructions += run.instructions;
+    result.cycles += run.cycles;
+    result.reason = run.reason;
+    if (run.reason == StopReason::Break) {
+      throw std::runtime_error("la repeticion llego a BRK en el ciclo " +
+                               std::to_string(cpu.cycles));
+    }
+    if (cpu.cycles != target) {
+      throw std::runtime_error("la repeticion no paso por el ciclo " +
+                               std::to_string(target));
+    }
+  }
+  if (next_event < movie.events.size() ||
+      result.checkpoints < movie.checkpoints.size()) {
+    throw std::runtime_error("pelicula invalida");
+  }
+  return result;
+}
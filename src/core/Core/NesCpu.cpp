@@ -1,4 +1,5 @@
 #include "Core/NesCpu.hpp"
+#include "Core/Cartridge.hpp"
 #include <cstddef>
 #include <cstring>
 #include <iostream>
@@ -35,32 +36,23 @@ CpuFlags cpuflags_from_bits(uint8_t bits) {
 
 NesCpu::NesCpu() {
   this->register_a = 0;
-  this->status = cpuflags_from_bits(0b100100);
+  this->set_status(cpuflags_from_bits(0b100100));
   this->program_counter = 0;
   this->register_x = 0;
   this->register_y = 0;
-}
-
-void NesCpu::lda(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t value = this->mem_read(addr);
-  this->set_register_a(value);
-}
-
-void NesCpu::ldy(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t value = this->mem_read(addr);
-
-  this->register_y = value;
-  this->update_zero_and_negative_flags(register_y);
-}
-
-void NesCpu::ldx(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t value = this->mem_read(addr);
-
-  this->register_x = value;
-  this->update_zero_and_negative_flags(register_x);
+  this->stack_pointer = STACK_RESET;
+  this->cycles = 0;
+  this->bus.map_memory(0x00, BUS_PAGE_COUNT, BUS_MEMORY_SIZE);
+  this->mark_all_lines_dirty();
+  this->write_watch = NO_WRITE_WATCH;
+  this->write_watch_hit = false;
+  this->core = DEFAULT_CPU_CORE;
+  this->break_mode = BreakMode::Interrupt;
+  this->interrupt_lines = 0;
+  this->decoded_operand = 0;
+#ifdef EIZNESS_TRACE
+  this->tracer = nullptr;
+#endif
 }
 
 void NesCpu::tax() {
@@ -68,361 +60,216 @@ void NesCpu::tax() {
   this->update_zero_and_negative_flags(this->register_x);
 }
 
-void NesCpu::inx() {
-  this->register_x = static_cast<uint8_t>(this->register_x + 1);
-  update_zero_and_negative_flags(this->register_x);
-}
-
-void NesCpu::iny() {
-  this->register_y = static_cast<uint8_t>(this->register_y + 1);
-  update_zero_and_negative_flags(this->register_y);
+void NesCpu::tay() {
+  this->register_y = this->register_a;
+  this->update_zero_and_negative_flags(this->register_y);
 }
 
-void NesCpu::sta(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  this->mem_write(addr, this->register_a);
+void NesCpu::tsx() {
+  this->register_x = this->stack_pointer;
+  this->update_zero_and_negative_flags(this->register_x);
 }
 
-void NesCpu::set_register_a(uint8_t value) {
-  this->register_a = value;
+void NesCpu::txa() {
+  this->register_a = this->register_x;
   this->update_zero_and_negative_flags(this->register_a);
 }
 
-void NesCpu::andd(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-  this->set_register_a(data & this->register_a);
-}
-
-void NesCpu::eor(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-  this->set_register_a(data ^ this->register_a);
-}
-
-void NesCpu::ora(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-  this->set_register_a(data | this->register_a);
-}
+void NesCpu::txs() { this->stack_pointer = this->register_x; }
 
-void NesCpu::update_zero_and_negative_flags(uint8_t result) {
-  if (result == 0) {
-    this->status |= CpuFlags::ZERO;
-  } else {
-    this->status &= ~CpuFlags::ZERO;
-  }
-
-  if ((result >> 7) == 1) {
-    this->status |= CpuFlags::NEGATIV;
-  } else {
-    this->status &= ~CpuFlags::NEGATIV;
-  }
+void NesCpu::tya() {
+  this->register_a = this->register_y;
+  this->update_zero_and_negative_flags(this->register_a);
 }
 
 void NesCpu::update_negative_flags(uint8_t result) {
-  if ((result >> 7) == 1) {
-    this->status = this->status | CpuFlags::NEGATIV;
-  } else {
-    this->status = this->status & ~CpuFlags::NEGATIV;
-  }
-}
-
-// Memory Management
-
-uint8_t NesCpu::mem_read(uint16_t addr) {
-  return this->memory[static_cast<std::size_t>(addr)];
+  this->set_flag(CpuFlags::NEGATIV, (result >> 7) == 1);
 }
 
-uint16_t NesCpu::mem_read_u16(uint16_t pos) {
-  uint8_t lo = this->mem_read(pos);
-  uint8_t hi = this->mem_read(pos + 1);
-  return (hi << 8) | lo;
+CpuFlags NesCpu::get_status() const {
+#ifdef EIZNESS_LAZY_FLAGS
+  uint8_t bits = this->status_bits & (INTERRUPT_DISABLE | DECIMAL_MODE |
+                                      BREAK | BREAK2);
+  bits |= this->flag_carry ? CARRY : 0;
+  bits |= this->flag(CpuFlags::ZERO) ? ZERO : 0;
+  bits |= this->flag_overflow ? OVERFLOW : 0;
+  bits |= this->flag(CpuFlags::NEGATIV) ? NEGATIV : 0;
+  return static_cast<CpuFlags>(bits);
+#else
+  return this->status_bits;
+#endif
 }
 
-void NesCpu::mem_write(uint16_t addr, uint8_t data) {
-  this->memory[static_cast<std::size_t>(addr)] = data;
+void NesCpu::set_status(CpuFlags status) {
+  this->status_bits = status;
+#ifdef EIZNESS_LAZY_FLAGS
+  this->flag_carry = (status & CpuFlags::CARRY) != 0;
+  this->flag_overflow = (status & CpuFlags::OVERFLOW) != 0;
+  this->flag_result = ((status & CpuFlags::ZERO) ? 0 : 1) |
+                      ((status & CpuFlags::NEGATIV) ? 0x8000 : 0);
+#endif
 }
 
-void NesCpu::mem_write_u16(uint16_t pos, uint16_t data) {
-  uint8_t hi = (data >> 8) & 0xff;
-  uint8_t lo = data & 0xff;
-  this->mem_write(pos, lo);
-  this->mem_write(pos + 1, hi);
+void NesCpu::mark_all_lines_dirty() {
+  this->dirty_lines.fill(~static_cast<uint64_t>(0));
 }
 
-void NesCpu::load(std::vector<uint8_t> program) {
-  std::memcpy(&this->memory[0x0600], program.data(), program.size());
-  this->mem_write_u16(0xFFFC, 0x0600);
-}
+void NesCpu::clear_dirty_lines() { this->dirty_lines.fill(0); }
 
-void NesCpu::reset() {
-  this->register_a = 0;
-  this->register_x = 0;
-  this->status = cpuflags_from_bits(0b100100);
-  this->program_counter = this->mem_read_u16(0xFFFC);
+void NesCpu::invalidate_blocks() {
+  this->bus.rehash();
+  this->blocks.clear();
+  this->jit.clear();
+  this->bus.disarm_code_traps();
 }
 
-void NesCpu::set_carry_flag() { this->status = this->status | CpuFlags::CARRY; }
-
-void NesCpu::clear_carry_flag() {
-  this->status = this->status & ~CpuFlags::CARRY;
+void NesCpu::drop_written_blocks() {
+  this->bus.drain_code_writes(
+      [this](uint8_t page) { this->blocks.invalidate_page(page); });
 }
 
-void NesCpu::add_to_register_a(uint8_t data) {
-  uint16_t sum =
-      this->register_a + data + (this->status & CpuFlags::CARRY ? 1 : 0);
-  bool carry = sum > 0xFF;
-
-  if (carry) {
-    this->status |= CpuFlags::CARRY;
-  } else {
-    this->status &= ~CpuFlags::CARRY;
-  }
-
-  uint8_t result = static_cast<uint8_t>(sum & 0xFF);
-
-  if (((data ^ result) & (result ^ this->register_a) & 0x80) != 0) {
-    this->status |= CpuFlags::OVERFLOW;
-  } else {
-    this->status &= ~CpuFlags::OVERFLOW;
+void NesCpu::load(const std::vector<uint8_t> &program) {
+  for (std::size_t i = 0; i < program.size(); i++) {
+    this->mem_write(static_cast<uint16_t>(0x0600 + i), program[i]);
   }
-
-  this->register_a = result;
+  this->mem_write_u16(RESET_VECTOR, 0x0600);
 }
 
-void NesCpu::sbc(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-
-  int8_t data_signed = static_cast<int8_t>(data);
-  int8_t carry = this->status & CpuFlags::CARRY ? 1 : 0;
-  int16_t result_signed = this->register_a - data_signed - carry;
-
-  uint8_t result = static_cast<uint8_t>(result_signed);
-  this->set_register_a(result);
-
-  this->status &= ~CpuFlags::CARRY;
-
-  if (result_signed >= 0 && result_signed < 128) {
-    this->status |= CpuFlags::NEGATIV;
-  } else {
-    this->status &= ~CpuFlags::NEGATIV;
-  }
-
-  if (result == 0) {
-    this->status |= CpuFlags::ZERO;
-  } else {
-    this->status &= ~CpuFlags::ZERO;
-  }
-
-  if ((this->register_a ^ result) & (this->register_a ^ data) & 0x80) {
-    this->status |= CpuFlags::OVERFLOW;
-  } else {
-    this->status &= ~CpuFlags::OVERFLOW;
-  }
-}
-
-void NesCpu::adc(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t value = this->mem_read(addr);
-  this->add_to_register_a(value);
-}
-
-uint8_t NesCpu::stack_pop() {
-  this->stack_pointer = uint8_t(stack_pointer + 1);
-  return this->mem_read(static_cast<uint16_t>(STACK) +
-                        static_cast<uint16_t>(this->stack_pointer));
-}
-
-void NesCpu::stack_push(uint8_t data) {
-  this->mem_write(static_cast<uint16_t>(STACK) +
-                      static_cast<uint16_t>(this->stack_pointer),
-                  data);
-  this->stack_pointer = uint8_t(stack_pointer - 1);
-}
-
-uint16_t NesCpu::stack_pop_u16() {
-  uint16_t lo = static_cast<uint16_t>(this->stack_pop());
-  uint16_t hi = static_cast<uint16_t>(this->stack_pop());
-
-  return hi << 8 | lo;
+void NesCpu::insert_cartridge(const Cartridge &cartridge) {
+  // PPU and APU registers stay unmapped until their devices attach.
+  this->bus.unmap(0x00, BUS_PAGE_COUNT);
+  this->bus.map_memory(0x00, 0x20, 0x800);
+  cartridge.attach(this->bus);
+  this->mark_all_lines_dirty();
+  this->reset();
 }
 
-void NesCpu::stack_push_u16(uint16_t data) {
-  uint8_t hi = (data >> 8) & 0xFF;
-  uint8_t lo = data & 0xFF;
-  this->stack_push(hi);
-  this->stack_push(lo);
+void NesCpu::reset() {
+  this->register_a = 0;
+  this->register_x = 0;
+  this->register_y = 0;
+  this->stack_pointer = STACK_RESET;
+  this->set_status(cpuflags_from_bits(0b100100));
+  this->program_counter = this->mem_read_u16(RESET_VECTOR);
+  this->interrupt_lines &= ~NMI_LINE;
+  this->cycles += 7;
+}
+
+CpuSnapshot NesCpu::snapshot() {
+  for (std::size_t i = 0; i < BUS_PAGE_COUNT; i++) {
+    if (this->bus.page_dirty(i) || this->snapshot_pages[i] == nullptr) {
+      std::shared_ptr<MemoryPage> page = std::make_shared<MemoryPage>();
+      std::memcpy(page->data(), &this->bus.memory[i * BUS_PAGE_SIZE],
+                  BUS_PAGE_SIZE);
+      this->snapshot_pages[i] = page;
+    }
+  }
+  this->bus.clear_dirty_pages();
+
+  CpuSnapshot snapshot;
+  snapshot.register_a = this->register_a;
+  snapshot.register_x = this->register_x;
+  snapshot.register_y = this->register_y;
+  snapshot.status = this->get_status();
+  snapshot.stack_pointer = this->stack_pointer;
+  snapshot.interrupt_lines = this->interrupt_lines;
+  snapshot.program_counter = this->program_counter;
+  snapshot.cycles = this->cycles;
+  snapshot.pages = this->snapshot_pages;
+  return snapshot;
+}
+
+void NesCpu::restore(const CpuSnapshot &snapshot) {
+  for (std::size_t i = 0; i < BUS_PAGE_COUNT; i++) {
+    if (this->bus.page_dirty(i) ||
+        this->snapshot_pages[i] != snapshot.pages[i]) {
+      this->bus.store_image(static_cast<uint16_t>(i * BUS_PAGE_SIZE),
+                            snapshot.pages[i]->data(), BUS_PAGE_SIZE);
+      this->snapshot_pages[i] = snapshot.pages[i];
+      this->blocks.invalidate_page(i);
+      // A page is four lines.
+      this->dirty_lines[i / 16] |= static_cast<uint64_t>(0xF) << (i % 16 * 4);
+    }
+  }
+  this->bus.clear_dirty_pages();
+
+  this->register_a = snapshot.register_a;
+  this->register_x = snapshot.register_x;
+  this->register_y = snapshot.register_y;
+  this->set_status(cpuflags_from_bits(snapshot.status));
+  this->stack_pointer = snapshot.stack_pointer;
+  this->interrupt_lines = snapshot.interrupt_lines;
+  this->program_counter = snapshot.program_counter;
+  this->cycles = snapshot.cycles;
+}
+
+std::vector<uint8_t> NesCpu::save_state() {
+  return serialize_snapshot(this->snapshot());
+}
+
+void NesCpu::load_state(const std::vector<uint8_t> &data) {
+  this->restore(deserialize_snapshot(data));
+}
+
+// FNV-1a over the registers, the interrupt lines and the cycle count, then
+// over the 64-bit image hash.
+static uint64_t combine_state_hash(const NesCpu &cpu, uint64_t memory_hash) {
+  const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325;
+  const uint64_t FNV_PRIME = 0x100000001b3;
+  uint64_t hash = FNV_OFFSET_BASIS;
+  auto mix = [&hash](uint8_t byte) {
+    hash ^= byte;
+    hash *= FNV_PRIME;
+  };
+
+  mix(cpu.register_a);
+  mix(cpu.register_x);
+  mix(cpu.register_y);
+  mix(cpu.get_status());
+  mix(cpu.stack_pointer);
+  mix(cpu.interrupt_lines);
+  mix(cpu.program_counter & 0xFF);
+  mix(cpu.program_counter >> 8);
+  for (int shift = 0; shift < 64; shift += 8) {
+    mix((cpu.cycles >> shift) & 0xFF);
+  }
+  for (int shift = 0; shift < 64; shift += 8) {
+    mix((memory_hash >> shift) & 0xFF);
+  }
+  return hash;
+}
+
+uint64_t NesCpu::state_hash() const {
+  uint64_t hash = combine_state_hash(*this, this->bus.memory_hash());
+#if defined(EIZNESS_INCREMENTAL_HASH) && !defined(NDEBUG)
+  if (hash != this->full_state_hash()) {
+    throw std::logic_error("hash incremental de memoria desincronizado");
+  }
+#endif
+  return hash;
+}
+
+uint64_t NesCpu::full_state_hash() const {
+  return combine_state_hash(*this, this->bus.compute_memory_hash());
 }
 
 void NesCpu::asl_accumulator() {
-  uint8_t data = this->register_a;
-  if ((data >> 7) == 1) {
-    this->set_carry_flag();
-  } else {
-    this->clear_carry_flag();
-  }
-
-  data = data << 1;
-  this->set_register_a(data);
-}
-
-uint8_t NesCpu::asl(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-  if ((data >> 7) == 1) {
-    this->set_carry_flag();
-  } else {
-    this->clear_carry_flag();
-  }
-  data = data << 1;
-  this->mem_write(addr, data);
-  this->update_zero_and_negative_flags(data);
-
-  return data;
+  this->set_register_a(this->shift_left(this->register_a));
 }
 
 void NesCpu::lsr_accumulator() {
-  uint8_t data = this->register_a;
-  if ((data & 1) == 1) {
-    this->set_carry_flag();
-  } else {
-    this->clear_carry_flag();
-  }
-
-  data = data >> 1;
-  this->set_register_a(data);
-}
-
-uint8_t NesCpu::lsr(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-  if ((data & 1) == 1) {
-    this->set_carry_flag();
-  } else {
-    this->clear_carry_flag();
-  }
-  data = data >> 1;
-  this->mem_write(addr, data);
-  this->update_zero_and_negative_flags(data);
-
-  return data;
+  this->set_register_a(this->shift_right(this->register_a));
 }
 
 void NesCpu::rol_accumulator() {
-  uint8_t data = this->register_a;
-  bool old_carry =
-      static_cast<bool>(status & static_cast<uint8_t>(CpuFlags::CARRY));
-
-  if ((data >> 7) == 1) {
-    this->set_carry_flag();
-  } else {
-    this->clear_carry_flag();
-  }
-
-  data = data << 1;
-  if (old_carry) {
-    data = data | 1;
-  }
-  this->set_register_a(data);
-}
-
-uint8_t NesCpu::rol(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-  bool old_carry =
-      static_cast<bool>(status & static_cast<uint8_t>(CpuFlags::CARRY));
-
-  if ((data >> 7) == 1) {
-    this->set_carry_flag();
-  } else {
-    this->clear_carry_flag();
-  }
-
-  data = data << 1;
-  if (old_carry) {
-    data = data | 1;
-  }
-  this->mem_write(addr, data);
-  this->update_negative_flags(data);
-
-  return data;
+  this->set_register_a(this->rotate_left(this->register_a));
 }
 
 void NesCpu::ror_accumulator() {
-  uint8_t data = this->register_a;
-  bool old_carry =
-      static_cast<bool>(status & static_cast<uint8_t>(CpuFlags::CARRY));
-
-  if ((data & 7) == 1) {
-    this->set_carry_flag();
-  } else {
-    this->clear_carry_flag();
-  }
-
-  data = data >> 1;
-  if (old_carry) {
-    data = data | 0b10000000;
-  }
-  this->set_register_a(data);
-}
-
-uint8_t NesCpu::ror(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-  bool old_carry =
-      static_cast<bool>(status & static_cast<uint8_t>(CpuFlags::CARRY));
-
-  if ((data & 7) == 1) {
-    this->set_carry_flag();
-  } else {
-    this->clear_carry_flag();
-  }
-
-  data = data >> 1;
-  if (old_carry) {
-    data = data | 0b10000000;
-  }
-  this->mem_write(addr, data);
-  this->update_negative_flags(data);
-
-  return data;
-}
-
-uint8_t NesCpu::inc(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-
-  data = uint8_t(data + 1);
-
-  this->mem_write(addr, data);
-  this->update_zero_and_negative_flags(data);
-
-  return data;
-}
-
-void NesCpu::dey() {
-  this->register_y = uint8_t(this->register_y - 1);
-  this->update_zero_and_negative_flags(this->register_y);
-}
-
-void NesCpu::dex() {
-  this->register_x = uint8_t(this->register_x + 1);
-  this->update_zero_and_negative_flags(this->register_x);
+  this->set_register_a(this->rotate_right(this->register_a));
 }
 
-uint8_t NesCpu::dec(AddressingMode mode) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-
-  data = uint8_t(data - 1);
-
-  this->mem_write(addr, data);
-  this->update_zero_and_negative_flags(data);
-
-  return data;
-}
+void NesCpu::pha() { this->stack_push(this->register_a); }
 
 void NesCpu::pla() {
   uint8_t data = this->stack_pop();
@@ -430,130 +277,216 @@ void NesCpu::pla() {
 }
 
 void NesCpu::plp() {
-  this->status = static_cast<CpuFlags>(this->stack_pop());
-  this->status &= ~CpuFlags::BREAK;
-  this->status |= CpuFlags::BREAK2;
+  CpuFlags flags = static_cast<CpuFlags>(this->stack_pop());
+  flags &= ~CpuFlags::BREAK;
+  flags |= CpuFlags::BREAK2;
+  this->set_status(flags);
 }
 
 void NesCpu::php() {
-  CpuFlags flags = this->status;
+  CpuFlags flags = this->get_status();
   flags |= CpuFlags::BREAK;
   flags |= CpuFlags::BREAK2;
   this->stack_push(flags);
 }
 
-// Culpable de los errores
-void NesCpu::bit(AddressingMode mode) {
-  uint16_t addr = get_operand_address(mode);
-  uint8_t data = mem_read(addr);
-  uint8_t andd = register_a & data;
+void NesCpu::brk() {
+  // The byte after BRK is padding; RTI returns past it.
+  this->stack_push_u16(this->program_counter + 1);
+  this->php();
+  this->set_flag(CpuFlags::INTERRUPT_DISABLE, true);
+  this->program_counter = this->mem_read_u16(IRQ_VECTOR);
+}
 
-  if (andd == 0) {
-    this->status |= CpuFlags::ZERO;
-  } else {
-    this->status &= ~CpuFlags::ZERO;
-  }
+void NesCpu::nmi() { this->interrupt_lines |= NMI_LINE; }
 
-  if ((data & 0b10000000) > 0) {
-    this->status |= CpuFlags::NEGATIV;
+void NesCpu::set_irq(bool asserted) {
+  if (asserted) {
+    this->interrupt_lines |= IRQ_LINE;
   } else {
-    this->status &= ~CpuFlags::NEGATIV;
+    this->interrupt_lines &= ~IRQ_LINE;
   }
+}
 
-  if ((data & 0b01000000) > 0) {
-    this->status |= CpuFlags::OVERFLOW;
-  } else {
-    this->status &= ~CpuFlags::OVERFLOW;
+bool NesCpu::poll_interrupts() {
+  if (this->interrupt_lines & NMI_LINE) {
+    this->interrupt_lines &= ~NMI_LINE;
+    this->interrupt(NMI_VECTOR);
+    return true;
+  }
+  if ((this->interrupt_lines & IRQ_LINE) &&
+      !this->flag(CpuFlags::INTERRUPT_DISABLE)) {
+    this->interrupt(IRQ_VECTOR);
+    return true;
   }
+  return false;
+}
+
+void NesCpu::interrupt(uint16_t vector) {
+  this->stack_push_u16(this->program_counter);
+  CpuFlags flags = this->get_status();
+  flags &= ~CpuFlags::BREAK;
+  flags |= CpuFlags::BREAK2;
+  this->stack_push(flags);
+  this->set_flag(CpuFlags::INTERRUPT_DISABLE, true);
+  this->program_counter = this->mem_read_u16(vector);
+  this->cycles += 7;
+}
+
+void NesCpu::jmp_absolute() {
+  uint16_t mem_address = this->mem_read_u16(this->program_counter);
+  this->program_counter = mem_address;
 }
 
-void NesCpu::compare(AddressingMode mode, uint8_t compare_with) {
-  uint16_t addr = this->get_operand_address(mode);
-  uint8_t data = this->mem_read(addr);
-  if (data <= compare_with) {
-    this->status |= CpuFlags::CARRY;
+void NesCpu::jmp_indirect() {
+  uint16_t mem_address = this->mem_read_u16(this->program_counter);
+  uint16_t indirect_ref;
+  if ((mem_address & 0x00FF) == 0x00FF) {
+    uint8_t lo = this->mem_read(mem_address);
+    uint8_t hi = this->mem_read(mem_address & 0xFF00);
+    indirect_ref = (static_cast<uint16_t>(hi) << 8) | lo;
   } else {
-    this->status &= ~CpuFlags::CARRY;
+    indirect_ref = this->mem_read_u16(mem_address);
   }
-  this->update_zero_and_negative_flags(compare_with - data);
+  this->program_counter = indirect_ref;
 }
 
-void NesCpu::branch(bool condition) {
-  if (condition) {
-    int8_t jump = static_cast<int8_t>(this->mem_read(this->program_counter));
-    uint16_t jump_addr = uint16_t(this->program_counter + 1 + jump);
-    this->program_counter = jump_addr;
-  }
+void NesCpu::jsr() {
+  this->stack_push_u16(this->program_counter + 2 - 1);
+  uint16_t target_address = this->mem_read_u16(this->program_counter);
+  this->program_counter = target_address;
 }
 
-void NesCpu::run() {
-  this->run_with_callback([](auto) {});
+void NesCpu::jsr_to(uint16_t target_address) {
+  this->stack_push_u16(this->program_counter + 2 - 1);
+  this->program_counter = target_address;
 }
 
-void NesCpu::load_and_run(std::vector<uint8_t> program) {
+void NesCpu::rts() { this->program_counter = this->stack_pop_u16() + 1; }
+
+void NesCpu::rti() {
+  this->plp();
+
+  this->program_counter = stack_pop_u16();
+}
+
+void NesCpu::run() {
+  if (this->core == CpuCore::Jit) {
+    this->run_until(RunLimits());
+    return;
+  }
+  this->run_with_callback([](NesCpu &) {});
+}
+
+uint64_t NesCpu::run_for_cycles(uint64_t budget) {
+  uint64_t start = this->cycles;
+  uint64_t target = start + budget;
+  if (budget > 0 && this->core == CpuCore::Jit) {
+    RunLimits limits;
+    limits.max_cycles = budget;
+    this->run_until(limits);
+  } else if (budget > 0) {
+    this->run_while([target](NesCpu &cpu) { return cpu.cycles < target; });
+  }
+  return this->cycles - start;
+}
+
+RunResult NesCpu::run_until(const RunLimits &limits) {
+  return this->run_until(limits, NeverStop());
+}
+
+uint32_t NesCpu::run_native(const JitBlock &native, uint64_t loop_budget,
+                            uint64_t cycle_limit, uint64_t &instructions) {
+  JitState state;
+  state.memory = this->bus.memory.data();
+  state.devices = this->bus.device_table();
+  state.write_flags = this->bus.write_flag_table();
+  state.mirrors = this->bus.mirror_table();
+  state.dirty_lines = this->dirty_lines.data();
+  state.cycles = this->cycles;
+  state.cycle_limit = cycle_limit;
+  state.loop_budget = loop_budget;
+  state.passes = 0;
+#ifdef EIZNESS_INCREMENTAL_HASH
+  state.memory_hash = this->bus.image_hash;
+#endif
+  state.write_watch = this->write_watch;
+  state.program_counter = this->program_counter;
+  state.register_a = this->register_a;
+  state.register_x = this->register_x;
+  state.register_y = this->register_y;
+  state.stack_pointer = this->stack_pointer;
+  // Compiled code keeps the flags the way the lazy interpreter does.
+#ifdef EIZNESS_LAZY_FLAGS
+  state.status = this->status_bits;
+  state.zero_negative = this->flag_result;
+  state.carry = this->flag_carry;
+  state.overflow = this->flag_overflow;
+#else
+  CpuFlags status = this->get_status();
+  state.status = status;
+  state.zero_negative = ((status & CpuFlags::ZERO) ? 0 : 1) |
+                        ((status & CpuFlags::NEGATIV) ? 0x8000 : 0);
+  state.carry = (status & CpuFlags::CARRY) != 0;
+  state.overflow = (status & CpuFlags::OVERFLOW) != 0;
+#endif
+
+  uint32_t done = native.code(&state);
+
+#ifdef EIZNESS_LAZY_FLAGS
+  this->status_bits = static_cast<CpuFlags>(state.status);
+  this->flag_result = state.zero_negative;
+  this->flag_carry = state.carry;
+  this->flag_overflow = state.overflow;
+#else
+  uint8_t bits = state.status & (INTERRUPT_DISABLE | DECIMAL_MODE | BREAK |
+                                 BREAK2);
+  bits |= state.carry ? CARRY : 0;
+  bits |= state.overflow ? OVERFLOW : 0;
+  bits |= (state.zero_negative & 0xFF) == 0 ? ZERO : 0;
+  bits |= (state.zero_negative & 0x8080) ? NEGATIV : 0;
+  this->status_bits = static_cast<CpuFlags>(bits);
+#endif
+  this->register_a = state.register_a;
+  this->register_x = state.register_x;
+  this->register_y = state.register_y;
+  this->stack_pointer = state.stack_pointer;
+  this->program_counter = state.program_counter;
+  this->cycles = state.cycles;
+#ifdef EIZNESS_INCREMENTAL_HASH
+  this->bus.image_hash = state.memory_hash;
+#endif
+  instructions += state.passes * native.length;
+  return done;
+}
+
+void NesCpu::load_and_run(const std::vector<uint8_t> &program) {
   this->load(program);
   /* this->reset(); */
-  this->program_counter = this->mem_read_u16(0xFFFC);
+  this->program_counter = this->mem_read_u16(RESET_VECTOR);
   this->run();
 }
 
 uint16_t NesCpu::get_operand_address(AddressingMode mode) {
   switch (mode) {
   case AddressingMode::Immediate:
-    return program_counter;
-
-  case AddressingMode::ZeroPage: {
-    uint8_t pos = mem_read(program_counter);
-    return static_cast<uint16_t>(pos);
-  }
-
+    return this->operand_address<AddressingMode::Immediate>();
+  case AddressingMode::ZeroPage:
+    return this->operand_address<AddressingMode::ZeroPage>();
   case AddressingMode::Absolute:
-    return mem_read_u16(program_counter);
-
-  case AddressingMode::ZeroPage_X: {
-    uint8_t pos = mem_read(program_counter);
-    uint16_t addr = static_cast<uint16_t>(pos) + register_x;
-    return addr;
-  }
-
-  case AddressingMode::ZeroPage_Y: {
-    uint8_t pos = mem_read(program_counter);
-    uint16_t addr = static_cast<uint16_t>(pos) + register_y;
-    return addr;
-  }
-
-  case AddressingMode::Absolute_X: {
-    uint16_t base = mem_read_u16(program_counter);
-    uint16_t addr = base + register_x;
-    return addr;
-  }
-
-  case AddressingMode::Absolute_Y: {
-    uint16_t base = mem_read_u16(program_counter);
-    uint16_t addr = base + register_y;
-    return addr;
-  }
-
-  case AddressingMode::Indirect_X: {
-    uint8_t base = mem_read(program_counter);
-    uint8_t ptr =
-        static_cast<uint8_t>(static_cast<uint16_t>(base) + register_x);
-    uint8_t lo = mem_read(ptr);
-    uint8_t hi = mem_read(ptr + 1);
-    uint16_t deref_base =
-        (static_cast<uint16_t>(hi) << 8) | static_cast<uint16_t>(lo);
-    return deref_base;
-  }
-
-  case AddressingMode::Indirect_Y: {
-    uint8_t base = mem_read(program_counter);
-    uint8_t lo = mem_read(static_cast<uint16_t>(base));
-    uint8_t hi = mem_read(static_cast<uint16_t>(base) + 1);
-    uint16_t deref_base =
-        (static_cast<uint16_t>(hi) << 8) | static_cast<uint16_t>(lo);
-    uint16_t deref = deref_base + register_y;
-    return deref;
-  }
+    return this->operand_address<AddressingMode::Absolute>();
+  case AddressingMode::ZeroPage_X:
+    return this->operand_address<AddressingMode::ZeroPage_X>();
+  case AddressingMode::ZeroPage_Y:
+    return this->operand_address<AddressingMode::ZeroPage_Y>();
+  case AddressingMode::Absolute_X:
+    return this->operand_address<AddressingMode::Absolute_X>();
+  case AddressingMode::Absolute_Y:
+    return this->operand_address<AddressingMode::Absolute_Y>();
+  case AddressingMode::Indirect_X:
+    return this->operand_address<AddressingMode::Indirect_X>();
+  case AddressingMode::Indirect_Y:
+    return this->operand_address<AddressingMode::Indirect_Y>();
 
   case AddressingMode::NoneAddressing:
     throw std::runtime_error("modo no soportado, dirección nula");
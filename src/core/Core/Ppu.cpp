@@ -0,0 +1,708 @@
+#include "Core/Ppu.hpp"
+#include "Core/NesCpu.hpp"
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t PPU_COLORS[64] = {
+    0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600,
+    0x561D00, 0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000,
+    0x000000, 0x000000, 0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC,
+    0xB71E7B, 0xB53120, 0x994E00, 0x6B6D00, 0x388700, 0x0C9300, 0x008F32,
+    0x007C8D, 0x000000, 0x000000, 0x000000, 0xFFFEFF, 0x64B0FF, 0x9290FF,
+    0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22, 0xBCBE00, 0x88D800,
+    0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000, 0xFFFEFF,
+    0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+    0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000,
+    0x000000};
+
+// PPUCTRL, PPUMASK and PPUSTATUS bits.
+static const uint8_t CTRL_INCREMENT_32 = 0x04;
+static const uint8_t CTRL_SPRITE_TABLE = 0x08;
+static const uint8_t CTRL_BACKGROUND_TABLE = 0x10;
+static const uint8_t CTRL_TALL_SPRITES = 0x20;
+static const uint8_t CTRL_NMI = 0x80;
+static const uint8_t MASK_GREYSCALE = 0x01;
+static const uint8_t MASK_BACKGROUND_LEFT = 0x02;
+static const uint8_t MASK_SPRITES_LEFT = 0x04;
+static const uint8_t MASK_BACKGROUND = 0x08;
+static const uint8_t MASK_SPRITES = 0x10;
+static const uint8_t STATUS_OVERFLOW = 0x20;
+static const uint8_t STATUS_SPRITE_ZERO = 0x40;
+static const uint8_t STATUS_VBLANK = 0x80;
+
+static const std::size_t CHR_SIZE = 0x2000;
+
+// Flags of render_line's sprite buffer, above a colour index.
+static const uint8_t SPRITE_BEHIND = 0x20;
+static const uint8_t SPRITE_ZERO = 0x40;
+
+uint32_t ppu_color_rgb(uint8_t color) { return PPU_COLORS[color & 0x3F]; }
+
+static uint8_t reverse_bits(uint8_t value) {
+  value = (value & 0xF0) >> 4 | (value & 0x0F) << 4;
+  value = (value & 0xCC) >> 2 | (value & 0x33) << 2;
+  return (value & 0xAA) >> 1 | (value & 0x55) << 1;
+}
+
+// $3F10/$3F14/$3F18/$3F1C are the backdrop entries of the background
+// palettes.
+static std::size_t palette_index(uint16_t addr) {
+  std::size_t index = addr & 0x1F;
+  return (index & 0x13) == 0x10 ? index & 0x0F : index;
+}
+
+static std::size_t attribute_address(uint16_t v) {
+  return 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+}
+
+// Palette (0-3) of the tile at `v` out of its attribute byte.
+static uint8_t attribute_palette(uint16_t v, uint8_t attribute) {
+  return (attribute >> (((v >> 4) & 4) | (v & 2))) & 3;
+}
+
+NesPpu::NesPpu() {
+  this->mode = PpuMode::Scanline;
+  this->cpu = nullptr;
+  this->chr_ram.assign(CHR_SIZE, 0);
+  this->chr = this->chr_ram.data();
+  this->mirroring = Mirroring::Horizontal;
+  this->vram.fill(0);
+  this->palette.fill(0);
+  this->oam.fill(0);
+  this->tile_rows.fill(0);
+  this->ctrl = 0;
+  this->mask = 0;
+  this->status = 0;
+  this->oam_addr = 0;
+  this->read_buffer = 0;
+  this->io_latch = 0;
+  this->v = 0;
+  this->t = 0;
+  this->fine_x = 0;
+  this->w = false;
+  this->line = 0;
+  this->line_dot = 0;
+  this->clock = 0;
+  this->frames = 0;
+  this->odd_frame = false;
+  this->nmi = false;
+  this->sprite_count = 0;
+  this->sprite_zero_dot = PPU_DOTS_PER_SCANLINE;
+  this->pattern_low = 0;
+  this->pattern_high = 0;
+  this->attribute_low = 0;
+  this->attribute_high = 0;
+  this->next_tile = 0;
+  this->next_attribute = 0;
+  this->next_low = 0;
+  this->next_high = 0;
+  this->pixels.fill(0);
+}
+
+void NesPpu::insert_cartridge(const Cartridge &cartridge) {
+  this->mirroring = cartridge.header().mirroring;
+  if (cartridge.header().chr_rom_size >= CHR_SIZE) {
+    this->chr = cartridge.chr_rom();
+    this->chr_ram.clear();
+  } else {
+    this->chr_ram.assign(CHR_SIZE, 0);
+    this->chr = this->chr_ram.data();
+  }
+  for (std::size_t tile = 0; tile < 512; tile++) {
+    for (std::size_t row = 0; row < 8; row++) {
+      this->decode_tile_row(tile, row);
+    }
+  }
+}
+
+void NesPpu::attach(NesCpu &cpu) {
+  this->cpu = &cpu;
+  this->clock = cpu.cycles * PPU_DOTS_PER_CPU_CYCLE;
+  cpu.bus.map_device(0x20, 0x20, this);
+  cpu.bus.map_device(0x40, 1, this);
+}
+
+void NesPpu::catch_up() {
+  if (this->cpu != nullptr) {
+    this->run_to(this->cpu->cycles * PPU_DOTS_PER_CPU_CYCLE);
+  }
+}
+
+uint64_t NesPpu::next_vblank_cycle() const {
+  // Dots before the PPU runs dot 1 of the vblank scanline.
+  uint64_t dots;
+  if (this->line < PPU_VBLANK_SCANLINE ||
+      (this->line == PPU_VBLANK_SCANLINE && this->line_dot <= 1)) {
+    dots = (PPU_VBLANK_SCANLINE - this->line) * PPU_DOTS_PER_SCANLINE + 1 -
+           this->line_dot;
+  } else {
+    bool skip = this->odd_frame && this->rendering();
+    dots = (PPU_SCANLINES_PER_FRAME - this->line) * PPU_DOTS_PER_SCANLINE -
+           this->line_dot - skip +
+           PPU_VBLANK_SCANLINE * PPU_DOTS_PER_SCANLINE + 1;
+  }
+  return (this->clock + dots + PPU_DOTS_PER_CPU_CYCLE) /
+         PPU_DOTS_PER_CPU_CYCLE;
+}
+
+bool NesPpu::take_nmi() {
+  bool raised = this->nmi;
+  this->nmi = false;
+  return raised;
+}
+
+uint8_t NesPpu::read(uint16_t addr) {
+  if (addr >= 0x4000) {
+    return 0;
+  }
+  this->catch_up();
+  switch (addr & 7) {
+  case 2: {
+    uint8_t value = (this->status & 0xE0) | (this->io_latch & 0x1F);
+    this->status &= ~STATUS_VBLANK;
+    this->w = false;
+    this->io_latch = value;
+    return value;
+  }
+  case 4:
+    this->io_latch = this->oam[this->oam_addr];
+    return this->io_latch;
+  case 7: {
+    uint16_t addr = this->v & 0x3FFF;
+    uint8_t value = this->read_buffer;
+    if (addr >= 0x3F00) {
+      // Palette reads are not buffered; the buffer takes the nametable
+      // byte underneath.
+      value = (this->palette[palette_index(addr)] & 0x3F) |
+              (this->io_latch & 0xC0);
+      this->read_buffer = this->ppu_read(addr - 0x1000);
+    } else {
+      this->read_buffer = this->ppu_read(addr);
+    }
+    this->v += (this->ctrl & CTRL_INCREMENT_32) ? 32 : 1;
+    this->io_latch = value;
+    return value;
+  }
+  default:
+    return this->io_latch;
+  }
+}
+
+void NesPpu::write(uint16_t addr, uint8_t data) {
+  this->catch_up();
+  if (addr >= 0x4000) {
+    if (addr == 0x4014 && this->cpu != nullptr) {
+      uint16_t page = static_cast<uint16_t>(data << 8);
+      for (uint16_t i = 0; i < 0x100; i++) {
+        this->oam[static_cast<uint8_t>(this->oam_addr + i)] =
+            this->cpu->mem_read(page | i);
+      }
+      // The CPU is halted while the bytes are copied.
+      this->cpu->cycles += OAM_DMA_CYCLES + (this->cpu->cycles & 1);
+    }
+    return;
+  }
+  this->io_latch = data;
+  switch (addr & 7) {
+  case 0:
+    if (!(this->ctrl & CTRL_NMI) && (data & CTRL_NMI) &&
+        (this->status & STATUS_VBLANK)) {
+      this->raise_nmi();
+    }
+    this->ctrl = data;
+    this->t = (this->t & ~0x0C00) | ((data & 3) << 10);
+    break;
+  case 1:
+    this->mask = data;
+    break;
+  case 3:
+    this->oam_addr = data;
+    break;
+  case 4:
+    this->oam[this->oam_addr++] = data;
+    break;
+  case 5:
+    if (!this->w) {
+      this->t = (this->t & ~0x001F) | (data >> 3);
+      this->fine_x = data & 7;
+    } else {
+      this->t = (this->t & ~0x73E0) | ((data & 0x07) << 12) |
+                ((data & 0xF8) << 2);
+    }
+    this->w = !this->w;
+    break;
+  case 6:
+    if (!this->w) {
+      this->t = (this->t & 0x00FF) | ((data & 0x3F) << 8);
+    } else {
+      this->t = (this->t & 0xFF00) | data;
+      this->v = this->t;
+    }
+    this->w = !this->w;
+    break;
+  case 7:
+    this->ppu_write(this->v & 0x3FFF, data);
+    this->v += (this->ctrl & CTRL_INCREMENT_32) ? 32 : 1;
+    break;
+  default:
+    break;
+  }
+}
+
+uint8_t NesPpu::peek(uint16_t addr) {
+  if (addr >= 0x4000) {
+    return 0;
+  }
+  switch (addr & 7) {
+  case 2:
+    return (this->status & 0xE0) | (this->io_latch & 0x1F);
+  case 4:
+    return this->oam[this->oam_addr];
+  case 7:
+    return this->read_buffer;
+  default:
+    return this->io_latch;
+  }
+}
+
+std::size_t NesPpu::nametable_index(uint16_t addr) const {
+  std::size_t table = (addr >> 10) & 3;
+  switch (this->mirroring) {
+  case Mirroring::Vertical:
+    table &= 1;
+    break;
+  case Mirroring::Horizontal:
+    table >>= 1;
+    break;
+  case Mirroring::FourScreen:
+    break;
+  }
+  return table * 0x400 + (addr & 0x3FF);
+}
+
+uint8_t NesPpu::ppu_read(uint16_t addr) const {
+  addr &= 0x3FFF;
+  if (addr < 0x2000) {
+    return this->chr[addr];
+  }
+  if (addr < 0x3F00) {
+    return this->vram[this->nametable_index(addr)];
+  }
+  return this->palette[palette_index(addr)];
+}
+
+void NesPpu::ppu_write(uint16_t addr, uint8_t data) {
+  addr &= 0x3FFF;
+  if (addr < 0x2000) {
+    if (!this->chr_ram.empty()) {
+      this->chr_ram[addr] = data;
+      this->decode_tile_row(addr >> 4, addr & 7);
+    }
+  } else if (addr < 0x3F00) {
+    this->vram[this->nametable_index(addr)] = data;
+  } else {
+    this->palette[palette_index(addr)] = data;
+  }
+}
+
+void NesPpu::decode_tile_row(std::size_t tile, std::size_t row) {
+  uint8_t low = this->chr[tile * 16 + row];
+  uint8_t high = this->chr[tile * 16 + 8 + row];
+  std::array<uint8_t, 8> pixels;
+  for (int i = 0; i < 8; i++) {
+    pixels[i] = ((low >> (7 - i)) & 1) | (((high >> (7 - i)) & 1) << 1);
+  }
+  std::memcpy(&this->tile_rows[tile * 8 + row], pixels.data(), 8);
+}
+
+uint32_t NesPpu::line_length() const {
+  // Odd frames drop the last dot of the pre-render scanline while
+  // rendering is on.
+  if (this->line == PPU_PRERENDER_SCANLINE && this->odd_frame &&
+      this->rendering()) {
+    return PPU_DOTS_PER_SCANLINE - 1;
+  }
+  return PPU_DOTS_PER_SCANLINE;
+}
+
+void NesPpu::advance(uint32_t dots) {
+  this->line_dot += dots;
+  this->clock += dots;
+  if (this->line_dot >= this->line_length()) {
+    this->line_dot = 0;
+    this->line++;
+    if (this->line == PPU_SCANLINES_PER_FRAME) {
+      this->line = 0;
+      this->odd_frame = !this->odd_frame;
+    }
+  }
+}
+
+void NesPpu::run_to(uint64_t target) {
+  if (this->mode == PpuMode::Dot) {
+    while (this->clock < target) {
+      this->step_dot();
+      this->advance(1);
+    }
+    return;
+  }
+  // Skip straight to the next dot that does something.
+  while (this->clock < target) {
+    uint32_t event = this->next_event();
+    if (event == this->line_dot) {
+      this->scanline_event();
+      this->advance(1);
+    } else {
+      this->advance(static_cast<uint32_t>(
+          std::min<uint64_t>(event - this->line_dot, target - this->clock)));
+    }
+  }
+}
+
+void NesPpu::start_vblank() {
+  this->status |= STATUS_VBLANK;
+  this->frames++;
+  if (this->ctrl & CTRL_NMI) {
+    this->raise_nmi();
+  }
+}
+
+void NesPpu::raise_nmi() {
+  this->nmi = true;
+  if (this->cpu != nullptr) {
+    this->cpu->nmi();
+  }
+}
+
+uint32_t NesPpu::next_event() const {
+  uint32_t dot = this->line_dot;
+  uint32_t next = this->line_length();
+  auto consider = [&](uint32_t event) {
+    if (event >= dot && event < next) {
+      next = event;
+    }
+  };
+  consider(1);
+  if (this->line < PPU_SCREEN_HEIGHT ||
+      this->line == PPU_PRERENDER_SCANLINE) {
+    consider(256);
+    consider(257);
+    consider(this->sprite_zero_dot);
+  }
+  if (this->line == PPU_PRERENDER_SCANLINE) {
+    consider(280);
+  }
+  return next;
+}
+
+void NesPpu::scanline_event() {
+  uint32_t dot = this->line_dot;
+  if (dot == 1) {
+    if (this->line < PPU_SCREEN_HEIGHT) {
+      this->render_line(this->line);
+    } else if (this->line == PPU_VBLANK_SCANLINE) {
+      this->start_vblank();
+    } else if (this->line == PPU_PRERENDER_SCANLINE) {
+      this->status &= ~(STATUS_VBLANK | STATUS_SPRITE_ZERO | STATUS_OVERFLOW);
+    }
+  }
+  if (this->rendering() && (this->line < PPU_SCREEN_HEIGHT ||
+                            this->line == PPU_PRERENDER_SCANLINE)) {
+    if (dot == 256) {
+      this->increment_y();
+    } else if (dot == 257) {
+      this->copy_x();
+    } else if (dot == 280 && this->line == PPU_PRERENDER_SCANLINE) {
+      this->copy_y();
+    }
+  }
+  if (dot == this->sprite_zero_dot) {
+    this->status |= STATUS_SPRITE_ZERO;
+    this->sprite_zero_dot = PPU_DOTS_PER_SCANLINE;
+  }
+}
+
+void NesPpu::render_line(uint32_t line) {
+  uint8_t *out = &this->pixels[line * PPU_SCREEN_WIDTH];
+  this->sprite_zero_dot = PPU_DOTS_PER_SCANLINE;
+  if (!this->rendering()) {
+    std::fill(out, out + PPU_SCREEN_WIDTH, this->backdrop());
+    return;
+  }
+
+  // 33 tiles cover the 256 pixels at any fine X. A tile row is eight
+  // pixel bytes; the palette bits go into the non-zero ones.
+  std::array<uint8_t, 33 * 8> background = {};
+  if (this->mask & MASK_BACKGROUND) {
+    const uint64_t ones = 0x0101010101010101;
+    uint16_t addr = this->v;
+    std::size_t table = (this->ctrl & CTRL_BACKGROUND_TABLE) ? 256 : 0;
+    std::size_t fine_y = (addr >> 12) & 7;
+    for (std::size_t tile = 0; tile < 33; tile++) {
+      uint8_t name = this->vram[this->nametable_index(addr)];
+      uint8_t palette = attribute_palette(
+          addr, this->vram[this->nametable_index(attribute_address(addr))]);
+      uint64_t row = this->tile_rows[(table + name) * 8 + fine_y];
+      uint64_t opaque = ((row | row >> 1) & ones) * 0xFF;
+      row |= (palette * 4 * ones) & opaque;
+      std::memcpy(&background[tile * 8], &row, sizeof(row));
+      if ((addr & 0x001F) == 31) {
+        addr = (addr & ~0x001F) ^ 0x0400;
+      } else {
+        addr++;
+      }
+    }
+  }
+
+  // The sprites of the line, front-most last so it overwrites the others:
+  // 0x10 | palette << 2 | pixel, plus SPRITE_BEHIND and SPRITE_ZERO.
+  std::array<uint8_t, PPU_SCREEN_WIDTH + 8> front = {};
+  this->evaluate_sprites(line);
+  if (this->mask & MASK_SPRITES) {
+    for (int i = this->sprite_count - 1; i >= 0; i--) {
+      const LineSprite &sprite = this->sprites[i];
+      uint8_t flags = 0x10 | ((sprite.attributes & 3) << 2) |
+                      ((sprite.attributes & 0x20) ? SPRITE_BEHIND : 0) |
+                      (sprite.zero ? SPRITE_ZERO : 0);
+      for (uint32_t column = 0; column < 8; column++) {
+        uint8_t pixel = ((sprite.low >> (7 - column)) & 1) |
+                        (((sprite.high >> (7 - column)) & 1) << 1);
+        if (pixel != 0) {
+          front[sprite.x + column] = flags | pixel;
+        }
+      }
+    }
+  }
+  if (!(this->mask & MASK_BACKGROUND_LEFT)) {
+    std::fill(background.begin() + this->fine_x,
+              background.begin() + this->fine_x + 8, 0);
+  }
+  if (!(this->mask & MASK_SPRITES_LEFT)) {
+    std::fill(front.begin(), front.begin() + 8, 0);
+  }
+
+  std::array<uint8_t, 0x20> colors;
+  uint8_t color_mask = (this->mask & MASK_GREYSCALE) ? 0x30 : 0x3F;
+  for (std::size_t i = 0; i < colors.size(); i++) {
+    colors[i] = this->palette[palette_index(i)] & color_mask;
+  }
+  const uint8_t *back = background.data() + this->fine_x;
+  if (this->sprite_count == 0 || !(this->mask & MASK_SPRITES)) {
+    for (uint32_t x = 0; x < PPU_SCREEN_WIDTH; x++) {
+      out[x] = colors[back[x]];
+    }
+    return;
+  }
+  for (uint32_t x = 0; x < PPU_SCREEN_WIDTH; x++) {
+    uint8_t sprite = front[x];
+    uint8_t index = back[x];
+    if ((sprite & 3) != 0) {
+      if (index == 0 || !(sprite & SPRITE_BEHIND)) {
+        index = sprite & 0x1F;
+      }
+      if ((sprite & SPRITE_ZERO) && back[x] != 0 && x != 255 &&
+          this->sprite_zero_dot == PPU_DOTS_PER_SCANLINE) {
+        this->sprite_zero_dot = x + 1;
+      }
+    }
+    out[x] = colors[index];
+  }
+}
+
+void NesPpu::step_dot() {
+  uint32_t dot = this->line_dot;
+  bool visible = this->line < PPU_SCREEN_HEIGHT;
+  bool prerender = this->line == PPU_PRERENDER_SCANLINE;
+
+  if (dot == 1 && this->line == PPU_VBLANK_SCANLINE) {
+    this->start_vblank();
+  } else if (dot == 1 && prerender) {
+    this->status &= ~(STATUS_VBLANK | STATUS_SPRITE_ZERO | STATUS_OVERFLOW);
+  }
+
+  if ((visible || prerender) && this->rendering()) {
+    if ((dot >= 2 && dot <= 257) || (dot >= 322 && dot <= 337)) {
+      this->pattern_low <<= 1;
+      this->pattern_high <<= 1;
+      this->attribute_low <<= 1;
+      this->attribute_high <<= 1;
+    }
+    if ((dot >= 1 && dot <= 256) || (dot >= 321 && dot <= 336)) {
+      uint16_t table = (this->ctrl & CTRL_BACKGROUND_TABLE) ? 0x1000 : 0;
+      uint16_t fine_y = (this->v >> 12) & 7;
+      switch ((dot - 1) % 8) {
+      case 0:
+        this->load_shifters();
+        this->next_tile = this->ppu_read(0x2000 | (this->v & 0x0FFF));
+        break;
+      case 2:
+        this->next_attribute = attribute_palette(
+            this->v, this->ppu_read(attribute_address(this->v)));
+        break;
+      case 4:
+        this->next_low = this->ppu_read(table + this->next_tile * 16 + fine_y);
+        break;
+      case 6:
+        this->next_high =
+            this->ppu_read(table + this->next_tile * 16 + 8 + fine_y);
+        break;
+      case 7:
+        this->increment_x();
+        break;
+      }
+    }
+    if (dot == 256) {
+      this->increment_y();
+    } else if (dot == 257) {
+      this->load_shifters();
+      this->copy_x();
+      // Sprites for the next scanline; none ever show on scanline 0.
+      this->evaluate_sprites(visible ? this->line + 1 : 0);
+    } else if (prerender && dot >= 280 && dot <= 304) {
+      this->copy_y();
+    }
+  }
+
+  if (visible && dot >= 1 && dot <= PPU_SCREEN_WIDTH) {
+    uint32_t x = dot - 1;
+    uint8_t *out = &this->pixels[this->line * PPU_SCREEN_WIDTH + x];
+    if (!this->rendering()) {
+      *out = this->backdrop();
+      return;
+    }
+    uint8_t background = 0;
+    if (this->mask & MASK_BACKGROUND) {
+      uint16_t bit = 0x8000 >> this->fine_x;
+      uint8_t pixel = ((this->pattern_low & bit) ? 1 : 0) |
+                      ((this->pattern_high & bit) ? 2 : 0);
+      uint8_t palette = ((this->attribute_low & bit) ? 1 : 0) |
+                        ((this->attribute_high & bit) ? 2 : 0);
+      background = pixel ? (palette << 2) | pixel : 0;
+    }
+    bool hit = false;
+    *out = this->compose(x, background, hit);
+    if (hit) {
+      this->status |= STATUS_SPRITE_ZERO;
+    }
+  }
+}
+
+void NesPpu::load_shifters() {
+  this->pattern_low = (this->pattern_low & 0xFF00) | this->next_low;
+  this->pattern_high = (this->pattern_high & 0xFF00) | this->next_high;
+  this->attribute_low = (this->attribute_low & 0xFF00) |
+                        ((this->next_attribute & 1) ? 0xFF : 0x00);
+  this->attribute_high = (this->attribute_high & 0xFF00) |
+                         ((this->next_attribute & 2) ? 0xFF : 0x00);
+}
+
+void NesPpu::evaluate_sprites(uint32_t line) {
+  this->sprite_count = 0;
+  uint32_t height = (this->ctrl & CTRL_TALL_SPRITES) ? 16 : 8;
+  for (std::size_t i = 0; i < 64; i++) {
+    const uint8_t *entry = &this->oam[i * 4];
+    // Sprites show one scanline below their Y.
+    int32_t row = static_cast<int32_t>(line) - 1 - entry[0];
+    if (row < 0 || row >= static_cast<int32_t>(height)) {
+      continue;
+    }
+    if (this->sprite_count == this->sprites.size()) {
+      this->status |= STATUS_OVERFLOW;
+      break;
+    }
+    uint8_t attributes = entry[2];
+    if (attributes & 0x80) {
+      row = height - 1 - row;
+    }
+    uint16_t addr;
+    if (height == 16) {
+      addr = ((entry[1] & 1) ? 0x1000 : 0) + (entry[1] & 0xFE) * 16 +
+             (row >= 8 ? 16 : 0) + (row & 7);
+    } else {
+      addr = ((this->ctrl & CTRL_SPRITE_TABLE) ? 0x1000 : 0) +
+             entry[1] * 16 + row;
+    }
+    LineSprite &sprite = this->sprites[this->sprite_count++];
+    sprite.x = entry[3];
+    sprite.attributes = attributes;
+    sprite.low = this->ppu_read(addr);
+    sprite.high = this->ppu_read(addr + 8);
+    if (attributes & 0x40) {
+      sprite.low = reverse_bits(sprite.low);
+      sprite.high = reverse_bits(sprite.high);
+    }
+    sprite.zero = i == 0;
+  }
+}
+
+uint8_t NesPpu::compose(uint32_t x, uint8_t background, bool &hit) const {
+  if (x < 8 && !(this->mask & MASK_BACKGROUND_LEFT)) {
+    background = 0;
+  }
+  uint8_t sprite = 0;
+  bool behind = false;
+  if ((this->mask & MASK_SPRITES) &&
+      (x >= 8 || (this->mask & MASK_SPRITES_LEFT))) {
+    for (uint8_t i = 0; i < this->sprite_count; i++) {
+      const LineSprite &candidate = this->sprites[i];
+      uint32_t column = x - candidate.x;
+      if (column >= 8) {
+        continue;
+      }
+      uint8_t pixel = ((candidate.low >> (7 - column)) & 1) |
+                      (((candidate.high >> (7 - column)) & 1) << 1);
+      if (pixel == 0) {
+        continue;
+      }
+      if (candidate.zero && background != 0 && x != 255) {
+        hit = true;
+      }
+      sprite = 0x10 | ((candidate.attributes & 3) << 2) | pixel;
+      behind = (candidate.attributes & 0x20) != 0;
+      break;
+    }
+  }
+
+  uint8_t index = 0;
+  if (sprite != 0 && (background == 0 || !behind)) {
+    index = sprite;
+  } else if (background != 0) {
+    index = background;
+  }
+  uint8_t color = this->palette[palette_index(index)];
+  return color & ((this->mask & MASK_GREYSCALE) ? 0x30 : 0x3F);
+}
+
+uint8_t NesPpu::backdrop() const {
+  return this->palette[0] & ((this->mask & MASK_GREYSCALE) ? 0x30 : 0x3F);
+}
+
+void NesPpu::increment_x() {
+  if ((this->v & 0x001F) == 31) {
+    this->v = (this->v & ~0x001F) ^ 0x0400;
+  } else {
+    this->v++;
+  }
+}
+
+void NesPpu::increment_y() {
+  if ((this->v & 0x7000) != 0x7000) {
+    this->v += 0x1000;
+    return;
+  }
+  this->v &= ~0x7000;
+  uint16_t coarse_y = (this->v & 0x03E0) >> 5;
+  if (coarse_y == 29) {
+    coarse_y = 0;
+    this->v ^= 0x0800;
+  } else if (coarse_y == 31) {
+    coarse_y = 0;
+  } else {
+    coarse_y++;
+  }
+  this->v = (this->v & ~0x03E0) | (coarse_y << 5);
+}
+
+void NesPpu::copy_x() { this->v = (this->v & ~0x041F) | (this->t & 0x041F); }
+
+void NesPpu::copy_y() { this->v = (this->v & ~0x7BE0) | (this->t & 0x7BE0); }
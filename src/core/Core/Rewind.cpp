@@ -0,0 +1,211 @@
+#include "Core/Rewind.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static const MemoryPage ZERO_PAGE = {};
+
+// Appends `page` XOR `base` as run tokens; returns false, appending
+// nothing, when they are equal.
+static bool encode_page(std::vector<uint8_t> &out, uint8_t index,
+                        const MemoryPage &page, const MemoryPage &base) {
+  std::array<uint8_t, BUS_PAGE_SIZE> diff;
+  bool changed = false;
+  for (std::size_t i = 0; i < BUS_PAGE_SIZE; i++) {
+    diff[i] = page[i] ^ base[i];
+    changed |= diff[i] != 0;
+  }
+  if (!changed) {
+    return false;
+  }
+  out.push_back(index);
+  std::size_t pos = 0;
+  while (pos < BUS_PAGE_SIZE) {
+    std::size_t end = pos;
+    if (diff[pos] == 0) {
+      while (end < BUS_PAGE_SIZE && end - pos < 0x80 && diff[end] == 0) {
+        end++;
+      }
+      out.push_back(static_cast<uint8_t>(end - pos - 1));
+    } else {
+      // A literal run ends at the first pair of unchanged bytes; a single
+      // one costs as much inside the literal as a token of its own.
+      while (end < BUS_PAGE_SIZE && end - pos < 0x80 &&
+             (diff[end] != 0 ||
+              (end + 1 < BUS_PAGE_SIZE && diff[end + 1] != 0))) {
+        end++;
+      }
+      out.push_back(static_cast<uint8_t>(0x7F + end - pos));
+      out.insert(out.end(), diff.begin() + pos, diff.begin() + end);
+    }
+    pos = end;
+  }
+  return true;
+}
+
+// XORs every page in `data` onto `image`.
+static void apply_frame(const std::vector<uint8_t> &data,
+                        std::array<MemoryPage, BUS_PAGE_COUNT> &image) {
+  std::size_t at = 0;
+  while (at < data.size()) {
+    MemoryPage &page = image[data[at++]];
+    std::size_t pos = 0;
+    while (pos < BUS_PAGE_SIZE) {
+      uint8_t token = data[at++];
+      if (token < 0x80) {
+        pos += token + 1;
+        continue;
+      }
+      for (std::size_t count = token - 0x7F; count > 0; count--) {
+        page[pos++] ^= data[at++];
+      }
+    }
+  }
+}
+
+RewindBuffer::RewindBuffer(std::size_t capacity, uint32_t keyframe_interval) {
+  this->bytes = 0;
+  this->capacity = capacity;
+  this->keyframe_interval = std::max<uint32_t>(keyframe_interval, 1);
+  this->since_keyframe = 0;
+  this->has_last = false;
+}
+
+void RewindBuffer::capture(NesCpu &cpu) {
+  if (!this->frames.empty() && cpu.cycles <= this->frames.back().cycles) {
+    this->drop_after(cpu.cycles);
+  }
+  CpuSnapshot snapshot = cpu.snapshot();
+
+  RewindFrame frame;
+  frame.cycles = snapshot.cycles;
+  frame.register_a = snapshot.register_a;
+  frame.register_x = snapshot.register_x;
+  frame.register_y = snapshot.register_y;
+  frame.status = snapshot.status;
+  frame.stack_pointer = snapshot.stack_pointer;
+  frame.interrupt_lines = snapshot.interrupt_lines;
+  frame.program_counter = snapshot.program_counter;
+  frame.keyframe =
+      !this->has_last || this->since_keyframe >= this->keyframe_interval;
+  for (std::size_t i = 0; i < BUS_PAGE_COUNT; i++) {
+    if (frame.keyframe) {
+      encode_page(frame.data, static_cast<uint8_t>(i), *snapshot.pages[i],
+                  ZERO_PAGE);
+    } else if (snapshot.pages[i] != this->last_pages[i]) {
+      encode_page(frame.data, static_cast<uint8_t>(i), *snapshot.pages[i],
+                  *this->last_pages[i]);
+    }
+  }
+  frame.data.shrink_to_fit();
+
+  this->since_keyframe = frame.keyframe ? 1 : this->since_keyframe + 1;
+  this->last_pages = snapshot.pages;
+  this->has_last = true;
+  this->bytes += sizeof(RewindFrame) + frame.data.size();
+  this->frames.push_back(std::move(frame));
+  this->evict();
+}
+
+void RewindBuffer::decode(std::size_t index, CpuSnapshot &snapshot) const {
+  if (index >= this->frames.size()) {
+    throw std::out_of_range("captura de rebobinado inexistente");
+  }
+  std::size_t key = index;
+  while (!this->frames[key].keyframe) {
+    key--;
+  }
+  std::array<MemoryPage, BUS_PAGE_COUNT> image = {};
+  for (std::size_t i = key; i <= index; i++) {
+    apply_frame(this->frames[i].data, image);
+  }
+
+  const RewindFrame &frame = this->frames[index];
+  snapshot.register_a = frame.register_a;
+  snapshot.register_x = frame.register_x;
+  snapshot.register_y = frame.register_y;
+  snapshot.status = frame.status;
+  snapshot.stack_pointer = frame.stack_pointer;
+  snapshot.interrupt_lines = frame.interrupt_lines;
+  snapshot.program_counter = frame.program_counter;
+  snapshot.cycles = frame.cycles;
+  // Pages already holding the same bytes are kept, so that restoring the
+  // result only rewrites the ones that differ.
+  for (std::size_t i = 0; i < BUS_PAGE_COUNT; i++) {
+    if (snapshot.pages[i] == nullptr || *snapshot.pages[i] != image[i]) {
+      snapshot.pages[i] = std::make_shared<const MemoryPage>(image[i]);
+    }
+  }
+}
+
+CpuSnapshot RewindBuffer::frame(std::size_t index) const {
+  CpuSnapshot snapshot = {};
+  this->decode(index, snapshot);
+  return snapshot;
+}
+
+bool RewindBuffer::seek(NesCpu &cpu, uint64_t cycle) {
+  if (this->frames.empty() || cycle < this->frames.front().cycles) {
+    return false;
+  }
+  auto after = std::upper_bound(
+      this->frames.begin(), this->frames.end(), cycle,
+      [](uint64_t target, const RewindFrame &frame) {
+        return target < frame.cycles;
+      });
+  const RewindFrame &frame = *(after - 1);
+  CpuSnapshot snapshot = cpu.snapshot();
+  this->decode(after - 1 - this->frames.begin(), snapshot);
+  cpu.restore(snapshot);
+  if (cycle > frame.cycles) {
+    RunLimits limits;
+    limits.max_cycles = cycle - frame.cycles;
+    cpu.run_until(limits);
+  }
+  return true;
+}
+
+RewindStats RewindBuffer::stats() const {
+  RewindStats stats = {this->frames.size(), 0, this->bytes, 0, 0};
+  for (const RewindFrame &frame : this->frames) {
+    stats.keyframes += frame.keyframe;
+  }
+  if (!this->frames.empty()) {
+    stats.first_cycle = this->frames.front().cycles;
+    stats.last_cycle = this->frames.back().cycles;
+  }
+  return stats;
+}
+
+void RewindBuffer::clear() {
+  this->frames.clear();
+  this->bytes = 0;
+  this->since_keyframe = 0;
+  this->has_last = false;
+}
+
+void RewindBuffer::drop_after(uint64_t cycle) {
+  while (!this->frames.empty() && this->frames.back().cycles >= cycle) {
+    this->bytes -= sizeof(RewindFrame) + this->frames.back().data.size();
+    this->frames.pop_back();
+  }
+  // The delta base is gone; the next capture starts a new keyframe.
+  this->has_last = false;
+}
+
+void RewindBuffer::evict() {
+  while (this->bytes > this->capacity) {
+    auto next_key = std::find_if(
+        this->frames.begin() + 1, this->frames.end(),
+        [](const RewindFrame &frame) { return frame.keyframe; });
+    if (next_key == this->frames.end()) {
+      // Only the newest keyframe is left; end its run early so the next
+      // capture can let it go.
+      this->since_keyframe = this->keyframe_interval;
+      return;
+    }
+    for (auto it = this->frames.begin(); it != next_key; ++it) {
+      this->bytes -= sizeof(RewindFrame) + it->data.size();
+    }
+    this->frames.erase(this->frames.begin(), next_key);
+  }
+}
@@ -0,0 +1,100 @@
+#include "Core/Scheduler.hpp"
+
+EventScheduler::EventScheduler()
+    : positions(static_cast<std::size_t>(SystemEvent::Count), -1) {
+  this->heap.reserve(this->positions.size());
+}
+
+void EventScheduler::schedule(SystemEvent event, uint64_t cycle) {
+  int32_t position = this->positions[static_cast<std::size_t>(event)];
+  if (position < 0) {
+    this->heap.push_back({cycle, event});
+    this->positions[static_cast<std::size_t>(event)] =
+        static_cast<int32_t>(this->heap.size() - 1);
+    this->sift_up(this->heap.size() - 1);
+    return;
+  }
+  uint64_t old = this->heap[position].cycle;
+  this->heap[position].cycle = cycle;
+  if (cycle < old) {
+    this->sift_up(position);
+  } else {
+    this->sift_down(position);
+  }
+}
+
+void EventScheduler::cancel(SystemEvent event) {
+  int32_t position = this->positions[static_cast<std::size_t>(event)];
+  if (position >= 0) {
+    this->remove_at(position);
+  }
+}
+
+bool EventScheduler::pending(SystemEvent event) const {
+  return this->positions[static_cast<std::size_t>(event)] >= 0;
+}
+
+uint64_t EventScheduler::next_cycle() const {
+  return this->heap.empty() ? NO_EVENT : this->heap[0].cycle;
+}
+
+bool EventScheduler::pop_due(uint64_t cycle, SystemEvent &event) {
+  if (this->heap.empty() || this->heap[0].cycle > cycle) {
+    return false;
+  }
+  event = this->heap[0].event;
+  this->remove_at(0);
+  return true;
+}
+
+void EventScheduler::place(std::size_t index, const Entry &entry) {
+  this->heap[index] = entry;
+  this->positions[static_cast<std::size_t>(entry.event)] =
+      static_cast<int32_t>(index);
+}
+
+void EventScheduler::sift_up(std::size_t index) {
+  Entry entry = this->heap[index];
+  while (index > 0) {
+    std::size_t parent = (index - 1) / 2;
+    if (this->heap[parent].cycle <= entry.cycle) {
+      break;
+    }
+    this->place(index, this->heap[parent]);
+    index = parent;
+  }
+  this->place(index, entry);
+}
+
+void EventScheduler::sift_down(std::size_t index) {
+  Entry entry = this->heap[index];
+  std::size_t size = this->heap.size();
+  while (true) {
+    std::size_t child = index * 2 + 1;
+    if (child >= size) {
+      break;
+    }
+    if (child + 1 < size &&
+        this->heap[child + 1].cycle < this->heap[child].cycle) {
+      child++;
+    }
+    if (entry.cycle <= this->heap[child].cycle) {
+      break;
+    }
+    this->place(index, this->heap[child]);
+    index = child;
+  }
+  this->place(index, entry);
+}
+
+void EventScheduler::remove_at(std::size_t index) {
+  this->positions[static_cast<std::size_t>(this->heap[index].event)] = -1;
+  Entry last = this->heap.back();
+  this->heap.pop_back();
+  if (index == this->heap.size()) {
+    return;
+  }
+  this->place(index, last);
+  this->sift_up(index);
+  this->sift_down(this->positions[static_cast<std::size_t>(last.event)]);
+}
@@ -0,0 +1,125 @@
+#include "Core/Snapshot.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static const uint8_t PAGE_ZERO = 0;
+static const uint8_t PAGE_RAW = 1;
+
+static void put_u16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(value & 0xFF);
+  out.push_back(value >> 8);
+}
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value) {
+  put_u16(out, value & 0xFFFF);
+  put_u16(out, value >> 16);
+}
+
+static void put_u64(std::vector<uint8_t> &out, uint64_t value) {
+  put_u32(out, value & 0xFFFFFFFF);
+  put_u32(out, value >> 32);
+}
+
+// Bounds-checked little-endian reader over a save-state buffer.
+class SnapshotReader {
+public:
+  explicit SnapshotReader(const std::vector<uint8_t> &data) : data(data) {
+    this->pos = 0;
+  }
+
+  const uint8_t *take(std::size_t count) {
+    if (this->data.size() - this->pos < count) {
+      throw std::runtime_error("estado guardado truncado");
+    }
+    const uint8_t *bytes = this->data.data() + this->pos;
+    this->pos += count;
+    return bytes;
+  }
+
+  uint8_t u8() { return *this->take(1); }
+
+  uint16_t u16() {
+    const uint8_t *bytes = this->take(2);
+    return bytes[0] | (bytes[1] << 8);
+  }
+
+  uint32_t u32() {
+    uint32_t lo = this->u16();
+    uint32_t hi = this->u16();
+    return lo | (hi << 16);
+  }
+
+  uint64_t u64() {
+    uint64_t lo = this->u32();
+    uint64_t hi = this->u32();
+    return lo | (hi << 32);
+  }
+
+private:
+  const std::vector<uint8_t> &data;
+  std::size_t pos;
+};
+
+std::vector<uint8_t> serialize_snapshot(const CpuSnapshot &snapshot) {
+  std::vector<uint8_t> out;
+  out.reserve(32 + BUS_PAGE_COUNT);
+  put_u32(out, SNAPSHOT_MAGIC);
+  put_u16(out, SNAPSHOT_VERSION);
+  out.push_back(snapshot.register_a);
+  out.push_back(snapshot.register_x);
+  out.push_back(snapshot.register_y);
+  out.push_back(snapshot.status);
+  out.push_back(snapshot.stack_pointer);
+  out.push_back(snapshot.interrupt_lines);
+  put_u16(out, snapshot.program_counter);
+  put_u64(out, snapshot.cycles);
+
+  for (const std::shared_ptr<const MemoryPage> &page : snapshot.pages) {
+    bool zero = std::all_of(page->begin(), page->end(),
+                            [](uint8_t byte) { return byte == 0; });
+    if (zero) {
+      out.push_back(PAGE_ZERO);
+    } else {
+      out.push_back(PAGE_RAW);
+      out.insert(out.end(), page->begin(), page->end());
+    }
+  }
+  return out;
+}
+
+CpuSnapshot deserialize_snapshot(const std::vector<uint8_t> &data) {
+  SnapshotReader reader(data);
+  if (reader.u32() != SNAPSHOT_MAGIC) {
+    throw std::runtime_error("estado guardado invalido");
+  }
+  if (reader.u16() != SNAPSHOT_VERSION) {
+    throw std::runtime_error("version de estado guardado no soportada");
+  }
+
+  CpuSnapshot snapshot;
+  snapshot.register_a = reader.u8();
+  snapshot.register_x = reader.u8();
+  snapshot.register_y = reader.u8();
+  snapshot.status = reader.u8();
+  snapshot.stack_pointer = reader.u8();
+  snapshot.interrupt_lines = reader.u8();
+  snapshot.program_counter = reader.u16();
+  snapshot.cycles = reader.u64();
+
+  // All-zero pages share one allocation.
+  std::shared_ptr<const MemoryPage> zero = std::make_shared<MemoryPage>();
+  for (std::shared_ptr<const MemoryPage> &page : snapshot.pages) {
+    uint8_t tag = reader.u8();
+    if (tag == PAGE_ZERO) {
+      page = zero;
+    } else if (tag == PAGE_RAW) {
+      std::shared_ptr<MemoryPage> raw = std::make_shared<MemoryPage>();
+      const uint8_t *bytes = reader.take(BUS_PAGE_SIZE);
+      std::copy(bytes, bytes + BUS_PAGE_SIZE, raw->begin());
+      page = raw;
+    } else {
+      throw std::runtime_error("estado guardado invalido");
+    }
+  }
+  return snapshot;
+}
@@ -0,0 +1,115 @@
+#include "Core/System.hpp"
+#include <algorithm>
+
+void NesSystem::insert_cartridge(const Cartridge &cartridge) {
+  this->cpu.insert_cartridge(cartridge);
+  this->ppu.insert_cartridge(cartridge);
+  this->ppu.attach(this->cpu);
+  this->apu.attach(this->cpu);
+}
+
+void NesSystem::load(const std::vector<uint8_t> &program) {
+  this->cpu.load(program);
+  this->cpu.reset();
+  this->ppu.attach(this->cpu);
+  this->apu.attach(this->cpu);
+}
+
+void NesSystem::schedule_devices() {
+  this->events.schedule(SystemEvent::PpuVblank, this->ppu.next_vblank_cycle());
+  uint64_t irq = this->apu.next_irq_cycle();
+  if (irq == NO_EVENT) {
+    this->events.cancel(SystemEvent::ApuIrq);
+  } else {
+    this->events.schedule(SystemEvent::ApuIrq, irq);
+  }
+}
+
+void NesSystem::dispatch() {
+  SystemEvent event;
+  while (this->events.pop_due(this->cpu.cycles, event)) {
+    switch (event) {
+    case SystemEvent::PpuVblank:
+      // Latches the NMI, which the CPU takes before its next instruction.
+      this->ppu.catch_up();
+      break;
+    case SystemEvent::ApuIrq:
+      // Raises the line, which the CPU polls before its next instruction.
+      this->apu.catch_up();
+      break;
+    case SystemEvent::Count:
+      break;
+    }
+  }
+}
+
+RunResult NesSystem::run(const RunLimits &limits) {
+  RunResult total = {StopReason::CycleLimit, 0, 0};
+  uint64_t start = this->cpu.cycles;
+  uint64_t end = limits.max_cycles > UINT64_MAX - start
+                     ? UINT64_MAX
+                     : start + limits.max_cycles;
+  while (true) {
+    this->schedule_devices();
+    // The CPU runs to the next event; any other limit ends the whole run.
+    uint64_t stop = std::min(end, this->events.next_cycle());
+    RunLimits slice = limits;
+    slice.max_instructions = limits.max_instructions - total.instructions;
+    slice.max_cycles =
+        std::max(stop, this->cpu.cycles + 1) - this->cpu.cycles;
+    RunResult run = this->cpu.run_until(slice);
+    total.instructions += run.instructions;
+    total.reason = run.reason;
+    this->dispatch();
+    if (run.reason != StopReason::CycleLimit || this->cpu.cycles >= end) {
+      break;
+    }
+  }
+  // The run's audio goes out as one block.
+  this->apu.catch_up();
+  total.cycles = this->cpu.cycles - start;
+  return total;
+}
+
+RunResult NesSystem::run_until_cycle(uint64_t cycle) {
+  if (this->cpu.cycles >= cycle) {
+    return RunResult{StopReason::CycleLimit, 0, 0};
+  }
+  RunLimits limits;
+  limits.max_cycles = cycle - this->cpu.cycles;
+  return this->run(limits);
+}
+
+RunResult NesSystem::run_frame() {
+  RunResult total = {StopReason::CycleLimit, 0, 0};
+  uint64_t frame = this->ppu.frame_count();
+  while (this->ppu.frame_count() == frame) {
+    RunResult run = this->run_until_cycle(this->ppu.next_vblank_cycle());
+    total.instructions += run.instructions;
+    total.cycles += run.cycles;
+    if (run.reason == StopReason::Break) {
+      total.reason = StopReason::Break;
+      break;
+    }
+  }
+  return total;
+}
+
+RunResult NesSystem::run_frame_lockstep() {
+  RunResult total = {StopReason::CycleLimit, 0, 0};
+  uint64_t frame = this->ppu.frame_count();
+  RunLimits limits;
+  limits.max_instructions = 1;
+  while (this->ppu.frame_count() == frame) {
+    RunResult run = this->cpu.run_until(limits);
+    total.instructions += run.instructions;
+    total.cycles += run.cycles;
+    if (run.reason == StopReason::Break) {
+      total.reason = StopReason::Break;
+      break;
+    }
+    this->ppu.catch_up();
+    this->apu.catch_up();
+  }
+  return total;
+}
@@ -0,0 +1,127 @@
+#include "Core/Trace.hpp"
+#include "Core/OpCodes.hpp"
+#include <cstdio>
+#include <stdexcept>
+
+static std::string format_operand(const TraceRecord &record,
+                                  const OpCode &opcode) {
+  char buffer[32];
+  uint8_t lo = record.operand[0];
+  uint16_t word = (static_cast<uint16_t>(record.operand[1]) << 8) | lo;
+
+  switch (opcode.mode) {
+  case AddressingMode::Immediate:
+    std::snprintf(buffer, sizeof(buffer), "#$%02X", lo);
+    break;
+  case AddressingMode::ZeroPage:
+    std::snprintf(buffer, sizeof(buffer), "$%02X", lo);
+    break;
+  case AddressingMode::ZeroPage_X:
+    std::snprintf(buffer, sizeof(buffer), "$%02X,X", lo);
+    break;
+  case AddressingMode::ZeroPage_Y:
+    std::snprintf(buffer, sizeof(buffer), "$%02X,Y", lo);
+    break;
+  case AddressingMode::Absolute:
+    std::snprintf(buffer, sizeof(buffer), "$%04X", word);
+    break;
+  case AddressingMode::Absolute_X:
+    std::snprintf(buffer, sizeof(buffer), "$%04X,X", word);
+    break;
+  case AddressingMode::Absolute_Y:
+    std::snprintf(buffer, sizeof(buffer), "$%04X,Y", word);
+    break;
+  case AddressingMode::Indirect_X:
+    std::snprintf(buffer, sizeof(buffer), "($%02X,X)", lo);
+    break;
+  case AddressingMode::Indirect_Y:
+    std::snprintf(buffer, sizeof(buffer), "($%02X),Y", lo);
+    break;
+  case AddressingMode::NoneAddressing:
+    if (opcode.code == 0x6c) {
+      std::snprintf(buffer, sizeof(buffer), "($%04X)", word);
+    } else if (opcode.len == 3) {
+      std::snprintf(buffer, sizeof(buffer), "$%04X", word);
+    } else if (opcode.len == 2) {
+      // Relative branch, shown as its absolute target.
+      uint16_t target = static_cast<uint16_t>(record.program_counter + 2 +
+                                              static_cast<int8_t>(lo));
+      std::snprintf(buffer, sizeof(buffer), "$%04X", target);
+    } else if (opcode.instruction == Instruction::ASL ||
+               opcode.instruction == Instruction::LSR ||
+               opcode.instruction == Instruction::ROL ||
+               opcode.instruction == Instruction::ROR) {
+      return "A";
+    } else {
+      return "";
+    }
+    break;
+  }
+  return buffer;
+}
+
+std::string format_trace_record(const TraceRecord &record) {
+  const OpCode &opcode = OPCODES_TABLE[record.opcode];
+
+  char bytes[16];
+  if (opcode.len == 3) {
+    std::snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record.opcode,
+                  record.operand[0], record.operand[1]);
+  } else if (opcode.len == 2) {
+    std::snprintf(bytes, sizeof(bytes), "%02X %02X", record.opcode,
+                  record.operand[0]);
+  } else {
+    std::snprintf(bytes, sizeof(bytes), "%02X", record.opcode);
+  }
+
+  std::string disassembly = opcode.mnemonic;
+  std::string operand = format_operand(record, opcode);
+  if (!operand.empty()) {
+    disassembly += " " + operand;
+  }
+
+  char line[128];
+  std::snprintf(line, sizeof(line),
+                "%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X "
+                "CYC:%llu",
+                record.program_counter, bytes, disassembly.c_str(),
+                record.register_a, record.register_x, record.register_y,
+                record.status, record.stack_pointer,
+                static_cast<unsigned long long>(record.cycle));
+  return line;
+}
+
+TraceBuffer::TraceBuffer(std::size_t capacity) {
+  std::size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  this->records.resize(size);
+  this->mask = size - 1;
+  this->next = 0;
+}
+
+std::size_t TraceBuffer::capacity() const { return this->records.size(); }
+
+std::size_t TraceBuffer::size() const {
+  if (this->next < this->records.size()) {
+    return static_cast<std::size_t>(this->next);
+  }
+  return this->records.size();
+}
+
+void TraceBuffer::clear() { this->next = 0; }
+
+const TraceRecord &TraceBuffer::at(std::size_t index) const {
+  if (index >= this->size()) {
+    throw std::out_of_range("registro de traza fuera de rango");
+  }
+  uint64_t first = this->next - this->size();
+  return this->records[(first + index) & this->mask];
+}
+
+void TraceBuffer::dump(std::ostream &out) const {
+  for (std::size_t i = 0; i < this->size(); i++) {
+    out << format_trace_record(this->at(i)) << '\n';
+  }
+}
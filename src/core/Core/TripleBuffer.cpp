@@ -0,0 +1,29 @@
+#include "Core/TripleBuffer.hpp"
+
+static const uint8_t INDEX_MASK = 0x03;
+static const uint8_t FRESH = 0x04;
+
+TripleBuffer::TripleBuffer(std::size_t frame_size)
+    : middle(1), back_index(0), front_index(2) {
+  for (std::vector<uint8_t> &frame : this->frames) {
+    frame.assign(frame_size, 0);
+  }
+}
+
+void TripleBuffer::publish() {
+  // Release: the frame's bytes are visible before the consumer can take
+  // it; acquire: the buffer coming back is one the consumer is done with.
+  uint8_t old = this->middle.exchange(this->back_index | FRESH,
+                                      std::memory_order_acq_rel);
+  this->back_index = old & INDEX_MASK;
+}
+
+bool TripleBuffer::acquire() {
+  if ((this->middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+    return false;
+  }
+  uint8_t old =
+      this->middle.exchange(this->front_index, std::memory_order_acq_rel);
+  this->front_index = old & INDEX_MASK;
+  return true;
+}
@@ -0,0 +1,376 @@
+#include "App/SnakeGame.hpp"
+#include "Core/Cartridge.hpp"
+#include "Core/Movie.hpp"
+#include "Core/NesCpu.hpp"
+#include "Core/System.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// NTSC CPU cycles per video frame, rounded up.
+const uint64_t CYCLES_PER_FRAME = 29781;
+
+// Writes `value` to `address` once `instruction` instructions have run.
+struct InputEvent {
+  uint64_t instruction;
+  uint16_t address;
+  uint8_t value;
+};
+
+struct Options {
+  uint64_t max_instructions = UINT64_MAX;
+  uint64_t max_cycles = UINT64_MAX;
+  uint64_t batch = 1000;
+  // Receives a fixed-seed pseudo-random byte before every batch when set.
+  int32_t random_address = -1;
+  CpuCore core = DEFAULT_CPU_CORE;
+  std::vector<InputEvent> input;
+  // Movie file written after the run, or replayed instead of running.
+  std::string record;
+  std::string replay;
+  std::vector<std::string> images;
+};
+
+struct Report {
+  uint64_t instructions;
+  uint64_t cycles;
+  StopReason reason;
+  uint64_t hash;
+  double seconds;
+  // Checkpoints verified by a replay.
+  std::size_t checkpoints;
+  // Frames the PPU finished, for cartridges.
+  uint64_t frames;
+};
+
+static void print_usage() {
+  std::fprintf(
+      stderr,
+      "uso: eizness_headless [opciones] imagen...\n"
+      "  imagen               programa crudo cargado en $0600, ROM .nes o\n"
+      "                       'snake' para el juego incluido\n"
+      "  --instructions N     detiene cada imagen tras N instrucciones\n"
+      "  --cycles N           detiene cada imagen tras N ciclos\n"
+      "  --frames N           detiene cada imagen tras N cuadros NTSC;\n"
+      "                       no se combina con --cycles\n"
+      "  --input ARCHIVO      lineas 'instruccion direccion valor'\n"
+      "  --random DIRECCION   escribe un byte aleatorio antes de cada lote\n"
+      "  --batch N            instrucciones por lote (1000)\n"
+      "  --record ARCHIVO     graba la sesion de un programa crudo como\n"
+      "                       pelicula\n"
+      "  --replay ARCHIVO     repite una pelicula sobre el programa y\n"
+      "                       verifica sus hashes\n"
+      "  --core switch|threaded|cached|jit\n");
+}
+
+static uint64_t parse_number(const std::string &text) {
+  std::size_t end = 0;
+  uint64_t value = 0;
+  try {
+    value = std::stoull(text, &end, 0);
+  } catch (const std::exception &) {
+    end = 0;
+  }
+  if (end == 0 || end != text.size()) {
+    throw std::runtime_error("numero invalido: " + text);
+  }
+  return value;
+}
+
+static std::vector<uint8_t> read_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("no se pudo abrir " + path);
+  }
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(file),
+                              std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string &path,
+                       const std::vector<uint8_t> &data) {
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(data.data()), data.size());
+  if (!file) {
+    throw std::runtime_error("no se pudo escribir " + path);
+  }
+}
+
+static std::vector<InputEvent> read_input_script(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("no se pudo abrir " + path);
+  }
+  std::vector<InputEvent> events;
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string instruction, address, value;
+    if (!(fields >> instruction)) {
+      continue;
+    }
+    if (!(fields >> address >> value)) {
+      throw std::runtime_error("linea de entrada invalida: " + line);
+    }
+    events.push_back({parse_number(instruction),
+                      static_cast<uint16_t>(parse_number(address)),
+                      static_cast<uint8_t>(parse_number(value))});
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const InputEvent &lhs, const InputEvent &rhs) {
+                     return lhs.instruction < rhs.instruction;
+                   });
+  return events;
+}
+
+static bool is_cartridge(const std::string &image) {
+  const std::string nes_suffix = ".nes";
+  return image.size() > nes_suffix.size() &&
+         image.compare(image.size() - nes_suffix.size(), nes_suffix.size(),
+                       nes_suffix) == 0;
+}
+
+static Options parse_options(int argc, char *argv[]) {
+  Options options;
+  // Both set max_cycles, so only one of them may be given.
+  bool cycles = false;
+  bool frames = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      options.images.push_back(arg);
+      continue;
+    }
+    if (i + 1 >= argc) {
+      throw std::runtime_error("falta el valor de " + arg);
+    }
+    std::string value = argv[++i];
+    if (arg == "--instructions") {
+      options.max_instructions = parse_number(value);
+    } else if (arg == "--cycles") {
+      options.max_cycles = parse_number(value);
+      cycles = true;
+    } else if (arg == "--frames") {
+      options.max_cycles = parse_number(value) * CYCLES_PER_FRAME;
+      frames = true;
+    } else if (arg == "--input") {
+      options.input = read_input_script(value);
+    } else if (arg == "--random") {
+      options.random_address = parse_number(value) & 0xFFFF;
+    } else if (arg == "--record") {
+      options.record = value;
+    } else if (arg == "--replay") {
+      options.replay = value;
+    } else if (arg == "--batch") {
+      options.batch = std::max<uint64_t>(parse_number(value), 1);
+    } else if (arg == "--core") {
+      if (value == "switch") {
+        options.core = CpuCore::Switch;
+      } else if (value == "threaded") {
+        options.core = CpuCore::Threaded;
+      } else if (value == "cached") {
+        options.core = CpuCore::Cached;
+      } else if (value == "jit") {
+        options.core = CpuCore::Jit;
+      } else {
+        throw std::runtime_error("core desconocido: " + value);
+      }
+    } else {
+      throw std::runtime_error("opcion desconocida: " + arg);
+    }
+  }
+  if ((!options.record.empty() || !options.replay.empty()) &&
+      options.images.size() > 1) {
+    throw std::runtime_error("--record y --replay admiten una sola imagen");
+  }
+  if (!options.record.empty() && !options.replay.empty()) {
+    throw std::runtime_error("--record y --replay son excluyentes");
+  }
+  if (cycles && frames) {
+    throw std::runtime_error("--cycles y --frames son excluyentes");
+  }
+  // Movies hold neither PPU nor APU state, and replays drive the CPU alone.
+  if (!options.record.empty() || !options.replay.empty()) {
+    for (const std::string &image : options.images) {
+      if (is_cartridge(image)) {
+        throw std::runtime_error("--record y --replay no admiten cartuchos");
+      }
+    }
+  }
+  return options;
+}
+
+// Returns the cartridge for .nes images, which go into the system with
+// the PPU and APU attached. Raw programs run on the bare CPU over flat RAM
+// without vectors and stop on BRK.
+static std::unique_ptr<Cartridge> load_image(NesSystem &system,
+                                             const std::string &image) {
+  NesCpu &cpu = system.cpu;
+  if (!is_cartridge(image)) {
+    cpu.break_mode = BreakMode::Exit;
+  }
+  if (image == "snake") {
+    cpu.load(SNAKE_GAME_CODE);
+    cpu.reset();
+  } else if (is_cartridge(image)) {
+    auto cartridge = std::make_unique<Cartridge>(image);
+    system.insert_cartridge(*cartridge);
+    return cartridge;
+  } else {
+    cpu.load(read_file(image));
+    cpu.reset();
+  }
+  return nullptr;
+}
+
+// Re-runs the movie in options.replay on the loaded image at full speed.
+static Report replay_image(const Options &options, NesCpu &cpu) {
+  Movie movie = deserialize_movie(read_file(options.replay));
+  auto start = std::chrono::steady_clock::now();
+  ReplayResult result = replay_movie(cpu, movie);
+  Report report = {result.instructions, result.cycles, result.reason,
+                   cpu.state_hash(), 0.0, result.checkpoints, 0};
+  report.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return report;
+}
+
+// Runs one image in batches, applying scripted input between them, until
+// BRK or until the instruction or cycle budget is spent. Cartridges run
+// through the system's scheduler, so the PPU and APU keep up with the CPU
+// and raise their interrupts on time.
+static Report run_image(const Options &options, const std::string &image) {
+  auto system = std::make_unique<NesSystem>();
+  NesCpu &cpu = system->cpu;
+  cpu.core = options.core;
+  std::unique_ptr<Cartridge> cartridge = load_image(*system, image);
+  if (!options.replay.empty()) {
+    return replay_image(options, cpu);
+  }
+
+  // Every write from here on goes through the recorder when recording.
+  std::optional<MovieRecorder> recorder;
+  if (!options.record.empty()) {
+    recorder.emplace(cpu);
+  }
+  auto write = [&](uint16_t address, uint8_t value) {
+    if (recorder) {
+      recorder->write(address, value);
+    } else {
+      cpu.mem_write(address, value);
+    }
+  };
+
+  uint32_t seed = 1;
+  std::size_t next_event = 0;
+  Report report = {0, 0, StopReason::InstructionLimit, 0, 0.0, 0, 0};
+  auto start = std::chrono::steady_clock::now();
+
+  while (report.instructions < options.max_instructions &&
+         report.cycles < options.max_cycles) {
+    while (next_event < options.input.size() &&
+           options.input[next_event].instruction <= report.instructions) {
+      const InputEvent &event = options.input[next_event++];
+      write(event.address, event.value);
+    }
+    if (options.random_address >= 0) {
+      seed = seed * 1103515245 + 12345;
+      write(options.random_address, seed >> 16);
+    }
+
+    RunLimits limits;
+    limits.max_instructions = std::min(
+        options.batch, options.max_instructions - report.instructions);
+    if (next_event < options.input.size()) {
+      limits.max_instructions =
+          std::min(limits.max_instructions,
+                   options.input[next_event].instruction - report.instructions);
+    }
+    if (options.max_cycles != UINT64_MAX) {
+      limits.max_cycles = options.max_cycles - report.cycles;
+    }
+
+    RunResult result;
+    if (cartridge) {
+      result = system->run(limits);
+    } else if (recorder) {
+      result = recorder->run_until(limits);
+    } else {
+      result = cpu.run_until(limits);
+    }
+    report.instructions += result.instructions;
+    report.cycles += result.cycles;
+    report.reason = result.reason;
+    if (result.reason == StopReason::Break) {
+      break;
+    }
+  }
+
+  report.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  report.hash = cpu.state_hash();
+  report.frames = system->ppu.frame_count();
+  if (recorder) {
+    write_file(options.record, serialize_movie(recorder->finish()));
+  }
+  return report;
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    print_usage();
+    return 2;
+  }
+  if (options.images.empty()) {
+    print_usage();
+    return 2;
+  }
+
+  int status = 0;
+  uint64_t total_instructions = 0;
+  double total_seconds = 0.0;
+  for (const std::string &image : options.images) {
+    try {
+      Report report = run_image(options, image);
+      double mips = report.seconds > 0.0
+                        ? report.instructions / report.seconds / 1e6
+                        : 0.0;
+      std::printf("%s instructions=%" PRIu64 " cycles=%" PRIu64
+                  " stop=%s hash=%016" PRIx64 " mips=%.1f\n",
+                  image.c_str(), report.instructions, report.cycles,
+                  report.reason == StopReason::Break ? "brk" : "budget",
+                  report.hash, mips);
+      if (is_cartridge(image)) {
+        std::printf("ppu frames=%" PRIu64 "\n", report.frames);
+      }
+      if (!options.replay.empty()) {
+        std::printf("replay checkpoints=%zu ok\n", report.checkpoints);
+      }
+      total_instructions += report.instructions;
+      total_seconds += report.seconds;
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "%s: %s\n", image.c_str(), e.what());
+      status = 1;
+    }
+  }
+  if (options.images.size() > 1 && total_seconds > 0.0) {
+    std::printf("total instructions=%" PRIu64 " mips=%.1f\n",
+                total_instructions, total_instructions / total_seconds / 1e6);
+  }
+  return status;
+}
@@ -0,0 +1,200 @@
+#include "Core/Apu.hpp"
+#include "Core/AudioRing.hpp"
+#include "Core/NesCpu.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+// loop: JMP loop
+static const std::vector<uint8_t> IDLE = {0x4c, 0x00, 0x06};
+
+static void start(NesCpu &cpu, NesApu &apu) {
+    cpu.load(IDLE);
+    cpu.reset();
+    apu.attach(cpu);
+}
+
+static void run_cycles(NesCpu &cpu, NesApu &apu, uint64_t cycles) {
+    RunLimits limits;
+    limits.max_cycles = cycles;
+    cpu.run_until(limits);
+    apu.catch_up();
+}
+
+TEST(ApuTest, test_ring_wraps_and_drops) {
+    AudioRing ring(5);
+    EXPECT_EQ(ring.capacity(), 8u);
+    float in[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    float out[8];
+    EXPECT_EQ(ring.push(in, 6), 6u);
+    EXPECT_EQ(ring.pop(out, 4), 4u);
+    EXPECT_EQ(out[3], 3.0f);
+    // Crosses the end of the buffer, then runs out of room.
+    EXPECT_EQ(ring.push(in, 6), 6u);
+    EXPECT_EQ(ring.push(in, 1), 0u);
+    EXPECT_EQ(ring.size(), 8u);
+    EXPECT_EQ(ring.pop(out, 8), 8u);
+    const float expected[8] = {4, 5, 0, 1, 2, 3, 4, 5};
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(out[i], expected[i]);
+    }
+    EXPECT_EQ(ring.pop(out, 1), 0u);
+}
+
+TEST(ApuTest, test_ring_keeps_order_across_threads) {
+    const std::size_t total = 50000;
+    AudioRing ring(256);
+    std::thread producer([&ring, total]() {
+        std::vector<float> block(37);
+        std::size_t sent = 0;
+        while (sent < total) {
+            std::size_t count = std::min(block.size(), total - sent);
+            for (std::size_t i = 0; i < count; i++) {
+                block[i] = static_cast<float>(sent + i);
+            }
+            std::size_t pushed = ring.push(block.data(), count);
+            if (pushed == 0) {
+                std::this_thread::yield();
+            }
+            sent += pushed;
+        }
+    });
+    std::vector<float> block(64);
+    std::size_t received = 0;
+    bool ordered = true;
+    while (received < total) {
+        std::size_t count = ring.pop(block.data(), block.size());
+        if (count == 0) {
+            std::this_thread::yield();
+        }
+        for (std::size_t i = 0; i < count; i++) {
+            ordered &= block[i] == static_cast<float>(received + i);
+        }
+        received += count;
+    }
+    producer.join();
+    EXPECT_TRUE(ordered);
+}
+
+TEST(ApuTest, test_frame_irq) {
+    NesCpu cpu;
+    NesApu apu;
+    start(cpu, apu);
+    uint64_t irq = apu.next_irq_cycle();
+    EXPECT_EQ(irq, cpu.cycles + APU_FOUR_STEP_CYCLES[3]);
+
+    cpu.cycles = irq - 1;
+    apu.catch_up();
+    EXPECT_EQ(cpu.interrupt_lines, 0);
+    cpu.cycles = irq;
+    apu.catch_up();
+    EXPECT_EQ(cpu.interrupt_lines, IRQ_LINE);
+    EXPECT_EQ(apu.next_irq_cycle(), UINT64_MAX);
+
+    // Reading $4015 reports and acknowledges it.
+    EXPECT_EQ(cpu.mem_read(0x4015) & 0x40, 0x40);
+    EXPECT_EQ(cpu.interrupt_lines, 0);
+    EXPECT_EQ(cpu.mem_read(0x4015) & 0x40, 0);
+    EXPECT_EQ(apu.next_irq_cycle(), irq + APU_FOUR_STEP_PERIOD);
+
+    cpu.mem_write(0x4017, 0x40);
+    EXPECT_EQ(apu.next_irq_cycle(), UINT64_MAX);
+    cpu.cycles += 4 * APU_FOUR_STEP_PERIOD;
+    apu.catch_up();
+    EXPECT_EQ(cpu.interrupt_lines, 0);
+}
+
+TEST(ApuTest, test_dmc_irq_lands_on_predicted_cycle) {
+    NesCpu cpu;
+    NesApu apu;
+    start(cpu, apu);
+    cpu.mem_write(0x4017, 0x40);
+    // IRQ on, fastest rate, 17 bytes from $C000.
+    cpu.mem_write(0x4010, 0x8F);
+    cpu.mem_write(0x4012, 0x00);
+    cpu.mem_write(0x4013, 0x01);
+    cpu.mem_write(0x4015, 0x10);
+    EXPECT_EQ(cpu.mem_read(0x4015) & 0x10, 0x10);
+    uint64_t irq = apu.next_irq_cycle();
+    ASSERT_NE(irq, UINT64_MAX);
+
+    cpu.cycles = irq - 1;
+    apu.catch_up();
+    EXPECT_EQ(cpu.interrupt_lines, 0);
+    cpu.cycles = irq;
+    apu.catch_up();
+    EXPECT_EQ(cpu.interrupt_lines, IRQ_LINE);
+    EXPECT_EQ(cpu.mem_read(0x4015) & 0x90, 0x80);
+    // Writing $4015 acknowledges it.
+    cpu.mem_write(0x4015, 0x00);
+    EXPECT_EQ(cpu.interrupt_lines, 0);
+}
+
+TEST(ApuTest, test_pulse_tone_fills_ring) {
+    NesCpu cpu;
+    NesApu apu;
+    AudioRing ring(8192);
+    apu.output = &ring;
+    start(cpu, apu);
+    cpu.mem_write(0x4017, 0x40);
+    // 50% duty, halted length, constant volume 15, period 253: 440Hz.
+    cpu.mem_write(0x4015, 0x01);
+    cpu.mem_write(0x4000, 0xBF);
+    cpu.mem_write(0x4002, 0xFD);
+    cpu.mem_write(0x4003, 0x08);
+    EXPECT_EQ(cpu.mem_read(0x4015) & 0x01, 0x01);
+
+    std::vector<float> samples(8192);
+    const uint64_t frame_cycles = 29781;
+    std::size_t popped = 0;
+    for (int frame = 0; frame < 4; frame++) {
+        run_cycles(cpu, apu, frame_cycles);
+        popped += ring.pop(samples.data(), samples.size());
+    }
+    run_cycles(cpu, apu, frame_cycles);
+    // 48000 / 60.1 samples a frame.
+    std::size_t count = ring.pop(samples.data(), samples.size());
+    EXPECT_GE(count, 797u);
+    EXPECT_LE(count, 801u);
+    EXPECT_EQ(apu.samples_written(), popped + count);
+    EXPECT_EQ(apu.samples_dropped(), 0u);
+
+    // Two crossings per period, about 7.3 periods a frame.
+    int crossings = 0;
+    for (std::size_t i = 1; i < count; i++) {
+        crossings += (samples[i - 1] < 0.0f) != (samples[i] < 0.0f);
+    }
+    EXPECT_GE(crossings, 13);
+    EXPECT_LE(crossings, 16);
+}
+
+TEST(ApuTest, test_slow_host_clock_keeps_sample_rate) {
+    // The SDL frontend runs 35000 cycles a second, not the console's rate.
+    const uint32_t host_clock = 35000;
+    NesCpu cpu;
+    NesApu apu;
+    AudioRing ring(65536);
+    apu.output = &ring;
+    cpu.load(IDLE);
+    cpu.reset();
+    apu.attach(cpu, host_clock);
+    cpu.mem_write(0x4017, 0x40);
+    uint64_t start_cycle = cpu.cycles;
+    for (int frame = 0; frame < 60; frame++) {
+        run_cycles(cpu, apu, host_clock / 60);
+    }
+    // A second of host time is 48000 samples, give or take the rounding
+    // at both ends.
+    uint64_t expected =
+        (cpu.cycles - start_cycle) * APU_SAMPLE_RATE / host_clock;
+    EXPECT_GE(apu.samples_written() + 1, expected);
+    EXPECT_LE(apu.samples_written(), expected + 1);
+    EXPECT_GT(expected, 47900u);
+    EXPECT_EQ(apu.samples_dropped(), 0u);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,117 @@
+#include "App/SnakeGame.hpp"
+#include "Core/NesCpu.hpp"
+#include <gtest/gtest.h>
+
+static NesCpu make_cached(const std::vector<uint8_t> &program) {
+    NesCpu cpu;
+    cpu.core = CpuCore::Cached;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(program);
+    cpu.program_counter = 0x0600;
+    return cpu;
+}
+
+TEST(BlockCacheTest, test_write_into_running_block) {
+    // LDA #$e8; STA $0607; LDX #5; NOP (patched to INX); BRK
+    NesCpu cpu = make_cached(
+        {0xa9, 0xe8, 0x8d, 0x07, 0x06, 0xa2, 0x05, 0xea, 0x00});
+    cpu.run();
+    EXPECT_EQ(cpu.register_x, 6);
+    EXPECT_EQ(cpu.program_counter, 0x0609);
+}
+
+TEST(BlockCacheTest, test_patched_operand_in_loop) {
+    // loop: LDA #0; STA $0200,X; INC $0601; INX; CPX #$10; BNE loop; BRK
+    std::vector<uint8_t> program = {0xa9, 0x00, 0x9d, 0x00, 0x02, 0xee,
+                                    0x01, 0x06, 0xe8, 0xe0, 0x10, 0xd0,
+                                    0xf3, 0x00};
+    NesCpu cpu = make_cached(program);
+    NesCpu reference = make_cached(program);
+    reference.core = CpuCore::Switch;
+    cpu.run();
+    reference.run();
+    EXPECT_EQ(cpu.state_hash(), reference.state_hash());
+    EXPECT_EQ(cpu.mem_read(0x020f), 0x0f);
+}
+
+TEST(BlockCacheTest, test_write_through_mirror) {
+    NesCpu cpu;
+    cpu.core = CpuCore::Cached;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.bus.map_memory(0x00, 0x20, 0x800);
+    // INX; BRK at $0600, then the same code is run again after $0600 is
+    // rewritten to INY through its mirror at $0e00.
+    cpu.mem_write(0x0600, 0xe8);
+    cpu.mem_write(0x0601, 0x00);
+    cpu.program_counter = 0x0600;
+    cpu.run();
+    EXPECT_EQ(cpu.register_x, 1);
+
+    cpu.mem_write(0x0e00, 0xc8);
+    cpu.program_counter = 0x0600;
+    cpu.run();
+    EXPECT_EQ(cpu.register_x, 1);
+    EXPECT_EQ(cpu.register_y, 1);
+}
+
+TEST(BlockCacheTest, test_restore_drops_blocks) {
+    NesCpu cpu = make_cached({0xe8, 0x00});
+    CpuSnapshot inx = cpu.snapshot();
+    cpu.mem_write(0x0600, 0xc8);
+    cpu.run();
+    EXPECT_EQ(cpu.register_y, 1);
+
+    cpu.restore(inx);
+    cpu.run();
+    EXPECT_EQ(cpu.register_x, 1);
+    EXPECT_EQ(cpu.register_y, 0);
+}
+
+TEST(BlockCacheTest, test_invalidate_blocks_after_direct_write) {
+    NesCpu cpu = make_cached({0xe8, 0x00});
+    cpu.run();
+    EXPECT_GT(cpu.blocks.size(), 0u);
+
+    cpu.bus.memory[0x0600] = 0xc8;
+    cpu.invalidate_blocks();
+    EXPECT_EQ(cpu.blocks.size(), 0u);
+    cpu.program_counter = 0x0600;
+    cpu.run();
+    EXPECT_EQ(cpu.register_x, 1);
+    EXPECT_EQ(cpu.register_y, 1);
+}
+
+TEST(BlockCacheTest, test_snake_matches_switch_core) {
+    NesCpu cpu;
+    cpu.core = CpuCore::Cached;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(SNAKE_GAME_CODE);
+    cpu.reset();
+    NesCpu reference = cpu;
+    reference.core = CpuCore::Switch;
+
+    RunLimits limits;
+    limits.max_instructions = 997;
+    uint32_t seed = 7;
+    for (int round = 0; round < 200; round++) {
+        seed = seed * 1103515245 + 12345;
+        for (NesCpu *target : {&cpu, &reference}) {
+            target->mem_write(0xfe, (seed >> 16) % 15 + 1);
+            target->mem_write(0xff, "wdsa"[(round / 16) % 4]);
+        }
+        RunResult result = cpu.run_until(limits);
+        RunResult expected = reference.run_until(limits);
+        ASSERT_EQ(result.instructions, expected.instructions) << round;
+        ASSERT_EQ(cpu.state_hash(), reference.state_hash()) << round;
+        if (expected.reason == StopReason::Break) {
+            break;
+        }
+    }
+    // The game's code is decoded once; only data pages are written.
+    EXPECT_EQ(cpu.blocks.decoded(), cpu.blocks.size());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,128 @@
+#include "Core/Bus.hpp"
+#include "Core/NesCpu.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <vector>
+
+class RecordingDevice : public BusDevice {
+public:
+    uint8_t read(uint16_t addr) override {
+        reads.push_back(addr);
+        return 0x42;
+    }
+
+    void write(uint16_t addr, uint8_t data) override {
+        writes.push_back({addr, data});
+    }
+
+    std::vector<uint16_t> reads;
+    std::vector<std::pair<uint16_t, uint8_t>> writes;
+};
+
+TEST(BusTest, test_ram_mirrors) {
+    // NES layout: 2KB of internal RAM repeated across $0000-$1FFF.
+    Bus bus;
+    bus.map_memory(0x00, 0x20, 0x800);
+
+    bus.write(0x0801, 0x55);
+    EXPECT_EQ(bus.read(0x0001), 0x55);
+    EXPECT_EQ(bus.read(0x1801), 0x55);
+    EXPECT_EQ(bus.page_kind(0x1801), PageKind::Mirrored);
+}
+
+TEST(BusTest, test_mirror_writes_keep_hash_and_traps) {
+    Bus bus;
+    bus.map_memory(0x00, 0x20, 0x800);
+    bus.write(0x1234, 0x99);
+    for (uint16_t addr : {0x0234, 0x0a34, 0x1234, 0x1a34}) {
+        EXPECT_EQ(bus.read(addr), 0x99);
+    }
+    EXPECT_EQ(bus.memory_hash(), bus.compute_memory_hash());
+
+    // A trap on one copy is a trap on all of them.
+    bus.clear_dirty_pages();
+    bus.arm_code_trap(0x07);
+    bus.write(0x1f10, 0x4c);
+    EXPECT_EQ(bus.read(0x0710), 0x4c);
+    EXPECT_TRUE(bus.code_written());
+    std::vector<uint8_t> pages;
+    bus.drain_code_writes([&pages](uint8_t page) { pages.push_back(page); });
+    EXPECT_NE(std::find(pages.begin(), pages.end(), 0x07), pages.end());
+    for (uint8_t page : {0x07, 0x0f, 0x17, 0x1f}) {
+        EXPECT_TRUE(bus.page_dirty(page));
+    }
+    EXPECT_FALSE(bus.page_dirty(0x06));
+    EXPECT_EQ(bus.memory_hash(), bus.compute_memory_hash());
+
+    // Mapping over part of the range leaves the rest as plain RAM, with
+    // its bytes back in the hash.
+    bus.map_memory(0x18, 0x08, 0x800);
+    bus.write(0x1a34, 0x11);
+    bus.write(0x0234, 0x22);
+    EXPECT_EQ(bus.read(0x0a34), 0x99);
+    EXPECT_EQ(bus.read(0x1a34), 0x11);
+    EXPECT_EQ(bus.page_kind(0x0a34), PageKind::Ram);
+    EXPECT_EQ(bus.memory_hash(), bus.compute_memory_hash());
+}
+
+TEST(BusTest, test_rom_ignores_writes) {
+    std::vector<uint8_t> rom(0x4000, 0xea);
+    Bus bus;
+    bus.map_rom(0x80, 0x80, rom.data(), rom.size());
+
+    bus.write(0x8000, 0x00);
+    EXPECT_EQ(bus.read(0x8000), 0xea);
+    EXPECT_EQ(bus.read(0xc000), 0xea);
+    EXPECT_EQ(rom[0], 0xea);
+}
+
+TEST(BusTest, test_device_receives_full_address) {
+    RecordingDevice device;
+    Bus bus;
+    bus.map_device(0x20, 0x20, &device);
+
+    EXPECT_EQ(bus.read(0x2002), 0x42);
+    bus.write(0x3ff8, 0x10);
+    EXPECT_EQ(bus.peek(0x2002), 0x00);
+    ASSERT_EQ(device.reads.size(), 1);
+    EXPECT_EQ(device.reads[0], 0x2002);
+    ASSERT_EQ(device.writes.size(), 1);
+    EXPECT_EQ(device.writes[0].first, 0x3ff8);
+    EXPECT_EQ(device.writes[0].second, 0x10);
+}
+
+TEST(BusTest, test_unmapped_reads_zero) {
+    Bus bus;
+    bus.map_memory(0x40, 1, 0x100);
+    bus.write(0x4000, 0x12);
+    bus.unmap(0x40, 1);
+    bus.write(0x4001, 0x12);
+    EXPECT_EQ(bus.read(0x4000), 0x00);
+    EXPECT_EQ(bus.read(0x4001), 0x00);
+    EXPECT_THROW(bus.map_device(0xff, 2, nullptr), std::out_of_range);
+}
+
+TEST(BusTest, test_cpu_runs_through_device_page) {
+    // LDA $2000; STA $2001; BRK
+    RecordingDevice device;
+    NesCpu cpu;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.bus.map_device(0x20, 1, &device);
+    cpu.load_and_run({0xad, 0x00, 0x20, 0x8d, 0x01, 0x20, 0x00});
+
+    EXPECT_EQ(cpu.register_a, 0x42);
+    ASSERT_EQ(device.writes.size(), 1);
+    EXPECT_EQ(device.writes[0].first, 0x2001);
+    EXPECT_EQ(device.writes[0].second, 0x42);
+}
+
+TEST(BusTest, test_cpu_reads_last_byte) {
+    NesCpu cpu;
+    cpu.mem_write(0xffff, 0x7f);
+    EXPECT_EQ(cpu.mem_read(0xffff), 0x7f);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
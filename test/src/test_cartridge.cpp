@@ -0,0 +1,132 @@
+#include "Core/Cartridge.hpp"
+#include "Core/NesCpu.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+static std::vector<uint8_t> make_header(uint8_t prg_banks, uint8_t chr_banks,
+                                        uint8_t flags6, uint8_t flags7) {
+    std::vector<uint8_t> image = {'N', 'E', 'S', 0x1a, prg_banks, chr_banks,
+                                  flags6, flags7};
+    image.resize(INES_HEADER_SIZE, 0);
+    return image;
+}
+
+// One 16KB NROM bank holding `program` at $8000 with the reset vector
+// pointing at it.
+static std::vector<uint8_t> make_nrom(const std::vector<uint8_t> &program) {
+    std::vector<uint8_t> image = make_header(1, 1, 0x01, 0x00);
+    std::vector<uint8_t> prg(PRG_ROM_BANK_SIZE, 0xea);
+    std::copy(program.begin(), program.end(), prg.begin());
+    prg[0x3ffc] = 0x00;
+    prg[0x3ffd] = 0x80;
+    image.insert(image.end(), prg.begin(), prg.end());
+    image.resize(image.size() + CHR_ROM_BANK_SIZE, 0);
+    return image;
+}
+
+TEST(CartridgeTest, test_parse_ines_header) {
+    std::vector<uint8_t> image = make_header(2, 1, 0x43, 0x10);
+    image.resize(INES_HEADER_SIZE + 2 * PRG_ROM_BANK_SIZE + CHR_ROM_BANK_SIZE);
+    CartridgeHeader header = parse_ines_header(image.data(), image.size());
+
+    EXPECT_FALSE(header.nes2);
+    EXPECT_EQ(header.mapper, 0x14);
+    EXPECT_EQ(header.prg_rom_size, 2 * PRG_ROM_BANK_SIZE);
+    EXPECT_EQ(header.chr_rom_size, CHR_ROM_BANK_SIZE);
+    EXPECT_EQ(header.prg_ram_size, 0x2000);
+    EXPECT_EQ(header.mirroring, Mirroring::Vertical);
+    EXPECT_TRUE(header.battery);
+    EXPECT_FALSE(header.trainer);
+}
+
+TEST(CartridgeTest, test_parse_nes2_header) {
+    // Mapper $123, submapper 5, PRG in exponent form: 2^10 * 3 bytes.
+    std::vector<uint8_t> image = make_header((10 << 2) | 1, 0, 0x30, 0x28);
+    image[8] = 0x51;
+    image[9] = 0x0f;
+    image[10] = 0x07;
+    image.resize(INES_HEADER_SIZE + 3072);
+    CartridgeHeader header = parse_ines_header(image.data(), image.size());
+
+    EXPECT_TRUE(header.nes2);
+    EXPECT_EQ(header.mapper, 0x123);
+    EXPECT_EQ(header.submapper, 5);
+    EXPECT_EQ(header.prg_rom_size, 3072);
+    EXPECT_EQ(header.chr_rom_size, 0);
+    EXPECT_EQ(header.prg_ram_size, 0x2000);
+}
+
+TEST(CartridgeTest, test_rejects_bad_images) {
+    std::vector<uint8_t> image = make_nrom({});
+    image[0] = 'X';
+    EXPECT_THROW(Cartridge{image}, std::runtime_error);
+
+    image = make_nrom({});
+    image.resize(INES_HEADER_SIZE + 100);
+    EXPECT_THROW(Cartridge{image}, std::runtime_error);
+
+    image = make_nrom({});
+    image[6] |= 0x10;
+    EXPECT_THROW(Cartridge{image}, std::runtime_error);
+}
+
+TEST(CartridgeTest, test_nrom_runs_from_mapped_file) {
+    // LDA #$42; STA $0801; LDX $C001; STA $8000; BRK
+    std::vector<uint8_t> image = make_nrom(
+        {0xa9, 0x42, 0x8d, 0x01, 0x08, 0xae, 0x01, 0xc0, 0x8d, 0x00, 0x80,
+         0x00});
+
+    char path[] = "/tmp/eizness_romXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, image.data(), image.size()),
+              static_cast<ssize_t>(image.size()));
+    close(fd);
+
+    Cartridge cartridge(path);
+    unlink(path);
+
+    NesCpu cpu;
+    cpu.insert_cartridge(cartridge);
+    EXPECT_EQ(cpu.program_counter, 0x8000);
+    EXPECT_EQ(cpu.stack_pointer, STACK_RESET);
+    cpu.break_mode = BreakMode::Exit;
+    cpu.run();
+
+    // $0801 is a mirror of $0001; $C000 mirrors the single 16KB bank.
+    EXPECT_EQ(cpu.mem_read(0x0001), 0x42);
+    EXPECT_EQ(cpu.mem_read(0x1801), 0x42);
+    EXPECT_EQ(cpu.register_x, 0x42);
+    EXPECT_EQ(cpu.mem_read(0x8000), 0xa9);
+}
+
+TEST(CartridgeTest, test_trainer_is_loaded_at_7000) {
+    // LDA $7000; LDX $71FF; BRK
+    std::vector<uint8_t> image =
+        make_nrom({0xad, 0x00, 0x70, 0xae, 0xff, 0x71, 0x00});
+    image[6] |= 0x04;
+    std::vector<uint8_t> trainer(INES_TRAINER_SIZE, 0x00);
+    trainer.front() = 0x11;
+    trainer.back() = 0x22;
+    image.insert(image.begin() + INES_HEADER_SIZE, trainer.begin(),
+                 trainer.end());
+    Cartridge cartridge(image);
+
+    NesCpu cpu;
+    cpu.insert_cartridge(cartridge);
+    cpu.break_mode = BreakMode::Exit;
+    cpu.run();
+    EXPECT_EQ(cpu.register_a, 0x11);
+    EXPECT_EQ(cpu.register_x, 0x22);
+    // The rest of PRG-RAM is still writable.
+    cpu.mem_write(0x6000, 0x33);
+    EXPECT_EQ(cpu.mem_read(0x6000), 0x33);
+    EXPECT_EQ(cpu.mem_read(0x7000), 0x11);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,10 +1,12 @@
 #include "Core/NesCpu.hpp"
 #include <gtest/gtest.h>
 
-class CPUTest : public ::testing::Test {
+class CPUTest : public ::testing::TestWithParam<CpuCore> {
 protected:
     void SetUp() override {
         cpu = NesCpu();
+        cpu.core = GetParam();
+        cpu.break_mode = BreakMode::Exit;
     }
 
     void TearDown() override {
@@ -14,36 +16,336 @@ protected:
     NesCpu cpu;
 };
 
-TEST_F(CPUTest, test_lda_immediate_load_data) {
+TEST_P(CPUTest, test_lda_immediate_load_data) {
     cpu.load_and_run({0xa9, 0x05, 0x00});
     EXPECT_EQ(cpu.register_a, 5);
-    EXPECT_FALSE(cpu.status == CpuFlags::ZERO);
-    EXPECT_FALSE(cpu.status == CpuFlags::NEGATIV);
+    EXPECT_FALSE(cpu.get_status() == CpuFlags::ZERO);
+    EXPECT_FALSE(cpu.get_status() == CpuFlags::NEGATIV);
 }
 
-TEST_F(CPUTest, test_tax_move_a_to_x) {
+TEST_P(CPUTest, test_tax_move_a_to_x) {
     cpu.register_a = 10;
     cpu.load_and_run({0xaa, 0x00});
     EXPECT_EQ(cpu.register_x, 10);
 }
 
-TEST_F(CPUTest, test_5_ops_working_together) {
+TEST_P(CPUTest, test_5_ops_working_together) {
     cpu.load_and_run({0xa9, 0xc0, 0xaa, 0xe8, 0x00});
     EXPECT_EQ(cpu.register_x, 0xc1);
 }
 
-TEST_F(CPUTest, test_inx_overflow) {
+TEST_P(CPUTest, test_inx_overflow) {
     cpu.register_x = 0xff;
     cpu.load_and_run({0xe8, 0xe8, 0x00});
     EXPECT_EQ(cpu.register_x, 1);
 }
 
-TEST_F(CPUTest, test_lda_from_memory) {
+TEST_P(CPUTest, test_lda_from_memory) {
     cpu.mem_write(0x10, 0x55);
     cpu.load_and_run({0xa5, 0x10, 0x00});
     EXPECT_EQ(cpu.register_a, 0x55);
 }
 
+TEST_P(CPUTest, test_opcodes_table_is_dense) {
+    for (std::size_t i = 0; i < OPCODES_TABLE.size(); i++) {
+        EXPECT_EQ(OPCODES_TABLE[i].code, i);
+    }
+    for (const OpCode &op : CPU_OPS_CODES) {
+        EXPECT_NE(op.instruction, Instruction::Illegal) << op.mnemonic;
+        EXPECT_EQ(OPCODES_TABLE[op.code].mnemonic, op.mnemonic);
+    }
+    EXPECT_EQ(OPCODES_TABLE[0xff].instruction, Instruction::Illegal);
+}
+
+TEST_P(CPUTest, test_illegal_opcode_throws) {
+    EXPECT_THROW(cpu.load_and_run({0x02}), std::runtime_error);
+}
+TEST_P(CPUTest, test_dex_decrements) {
+    cpu.load_and_run({0xa2, 0x05, 0xca, 0x00});
+    EXPECT_EQ(cpu.register_x, 4);
+}
+
+TEST_P(CPUTest, test_sbc_with_borrow) {
+    // SEC; LDA #$10; SBC #$20
+    cpu.load_and_run({0x38, 0xa9, 0x10, 0xe9, 0x20, 0x00});
+    EXPECT_EQ(cpu.register_a, 0xf0);
+    EXPECT_FALSE(cpu.get_status() & CpuFlags::CARRY);
+    EXPECT_TRUE(cpu.get_status() & CpuFlags::NEGATIV);
+}
+
+TEST_P(CPUTest, test_adc_sets_zero_flag) {
+    // CLC; LDA #$ff; ADC #$01
+    cpu.load_and_run({0x18, 0xa9, 0xff, 0x69, 0x01, 0x00});
+    EXPECT_EQ(cpu.register_a, 0);
+    EXPECT_TRUE(cpu.get_status() & CpuFlags::CARRY);
+    EXPECT_TRUE(cpu.get_status() & CpuFlags::ZERO);
+}
+
+TEST_P(CPUTest, test_bit_flags_survive_php_and_plp) {
+    cpu.mem_write(0x10, 0xc0);
+    // LDA #$01; BIT $10; PHP; LDA #$01; PLP
+    cpu.load_and_run({0xa9, 0x01, 0x24, 0x10, 0x08, 0xa9, 0x01, 0x28, 0x00});
+    EXPECT_EQ(cpu.mem_read(0x01fd), 0xf6);
+    EXPECT_EQ(cpu.get_status(), cpuflags_from_bits(0xe6));
+
+    cpu.set_status(cpuflags_from_bits(0x81));
+    EXPECT_EQ(cpu.get_status(), cpuflags_from_bits(0x81));
+    cpu.set_flag(CpuFlags::ZERO, true);
+    EXPECT_EQ(cpu.get_status(), cpuflags_from_bits(0x83));
+}
+
+TEST_P(CPUTest, test_zero_page_x_wraps) {
+    cpu.mem_write(0x08, 0x42);
+    // LDX #$10; LDA $f8,X
+    cpu.load_and_run({0xa2, 0x10, 0xb5, 0xf8, 0x00});
+    EXPECT_EQ(cpu.register_a, 0x42);
+}
+
+TEST_P(CPUTest, test_ror_accumulator_moves_bit_zero_to_carry) {
+    // CLC; LDA #$01; ROR A
+    cpu.load_and_run({0x18, 0xa9, 0x01, 0x6a, 0x00});
+    EXPECT_EQ(cpu.register_a, 0);
+    EXPECT_TRUE(cpu.get_status() & CpuFlags::CARRY);
+}
+
+TEST_P(CPUTest, test_cycles_include_page_cross_penalty) {
+    // LDX #$01 (2); LDA $01ff,X (4 + 1); LDA $0200,X (4)
+    cpu.load_and_run({0xa2, 0x01, 0xbd, 0xff, 0x01, 0xbd, 0x00, 0x02, 0x00});
+    EXPECT_EQ(cpu.cycles, 11);
+}
+
+TEST_P(CPUTest, test_store_has_no_page_cross_penalty) {
+    // LDX #$01 (2); STA $01ff,X (5)
+    cpu.load_and_run({0xa2, 0x01, 0x9d, 0xff, 0x01, 0x00});
+    EXPECT_EQ(cpu.cycles, 7);
+}
+
+TEST_P(CPUTest, test_branch_cycles) {
+    // LDX #$00 (2); BNE +0 not taken (2); BEQ +0 taken (3)
+    cpu.load_and_run({0xa2, 0x00, 0xd0, 0x00, 0xf0, 0x00, 0x00});
+    EXPECT_EQ(cpu.cycles, 7);
+
+    // Taken BEQ at $06fc lands on $0701, a new page (4).
+    cpu = NesCpu();
+    cpu.core = GetParam();
+    cpu.break_mode = BreakMode::Exit;
+    cpu.mem_write(0x06fa, 0xa2);
+    cpu.mem_write(0x06fb, 0x00);
+    cpu.mem_write(0x06fc, 0xf0);
+    cpu.mem_write(0x06fd, 0x03);
+    cpu.mem_write(0x0701, 0x00);
+    cpu.program_counter = 0x06fa;
+    cpu.run();
+    EXPECT_EQ(cpu.cycles, 6);
+}
+
+TEST_P(CPUTest, test_run_for_cycles_stops_after_budget) {
+    // loop: JMP loop (3 cycles each)
+    cpu.load({0x4c, 0x00, 0x06});
+    cpu.program_counter = 0x0600;
+    EXPECT_EQ(cpu.run_for_cycles(10), 12);
+    EXPECT_EQ(cpu.run_for_cycles(3), 3);
+    EXPECT_EQ(cpu.cycles, 15);
+}
+
+TEST_P(CPUTest, test_run_until_reports_stop_reason) {
+    // loop: INX; STX $10; JMP loop
+    cpu.load({0xe8, 0x86, 0x10, 0x4c, 0x00, 0x06});
+    cpu.program_counter = 0x0600;
+
+    RunLimits limits;
+    limits.max_instructions = 5;
+    RunResult result = cpu.run_until(limits);
+    EXPECT_EQ(result.reason, StopReason::InstructionLimit);
+    EXPECT_EQ(result.instructions, 5);
+    EXPECT_EQ(result.cycles, 2 + 3 + 3 + 2 + 3);
+
+    limits = RunLimits();
+    limits.max_cycles = 4;
+    EXPECT_EQ(cpu.run_until(limits).reason, StopReason::CycleLimit);
+
+    limits = RunLimits();
+    limits.break_at = 0x0603;
+    result = cpu.run_until(limits);
+    EXPECT_EQ(result.reason, StopReason::Breakpoint);
+    EXPECT_EQ(cpu.program_counter, 0x0603);
+
+    cpu.register_x = 0;
+    limits = RunLimits();
+    limits.watch_write = 0x10;
+    result = cpu.run_until(limits);
+    EXPECT_EQ(result.reason, StopReason::WriteWatch);
+    EXPECT_EQ(cpu.mem_read(0x10), 1);
+
+    result = cpu.run_until(RunLimits(), [](NesCpu &c) {
+        return c.register_x == 3;
+    });
+    EXPECT_EQ(result.reason, StopReason::Predicate);
+    EXPECT_EQ(cpu.register_x, 3);
+}
+
+TEST_P(CPUTest, test_run_until_stops_on_brk) {
+    cpu.load({0xe8, 0xe8, 0x00});
+    cpu.program_counter = 0x0600;
+    RunResult result = cpu.run_until(RunLimits());
+    EXPECT_EQ(result.reason, StopReason::Break);
+    EXPECT_EQ(result.instructions, 2);
+}
+
+TEST_P(CPUTest, test_callback_stride) {
+    int calls = 0;
+    cpu.register_x = 0;
+    cpu.load({0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0x00});
+    cpu.program_counter = 0x0600;
+    cpu.run_with_callback([&calls](NesCpu &) { calls++; }, 3);
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(cpu.register_x, 7);
+}
+
+TEST_P(CPUTest, test_cores_agree_on_store_loop) {
+    // LDX #0; LDA #3; loop: STA $0200,X; ADC #7; INX; CPX #$40; BNE loop
+    std::vector<uint8_t> program = {0xa2, 0x00, 0xa9, 0x03, 0x9d, 0x00,
+                                    0x02, 0x69, 0x07, 0xe8, 0xe0, 0x40,
+                                    0xd0, 0xf6, 0x00};
+    NesCpu reference;
+    reference.core = CpuCore::Switch;
+    reference.break_mode = BreakMode::Exit;
+    reference.set_status(cpu.get_status());
+    reference.load_and_run(program);
+    cpu.load_and_run(program);
+
+    EXPECT_EQ(cpu.register_a, reference.register_a);
+    EXPECT_EQ(cpu.register_x, 0x40);
+    EXPECT_EQ(cpu.get_status(), reference.get_status());
+    EXPECT_EQ(cpu.program_counter, reference.program_counter);
+    EXPECT_EQ(cpu.cycles, reference.cycles);
+    for (uint16_t addr = 0x0200; addr < 0x0240; addr++) {
+        EXPECT_EQ(cpu.mem_read(addr), reference.mem_read(addr)) << addr;
+    }
+}
+
+TEST_P(CPUTest, test_dirty_lines_follow_writes) {
+    // LDA #1; STA $0241; STA $05ff; BRK
+    cpu.load({0xa9, 0x01, 0x8d, 0x41, 0x02, 0x8d, 0xff, 0x05, 0x00});
+    cpu.clear_dirty_lines();
+    cpu.program_counter = 0x0600;
+    cpu.run();
+
+    EXPECT_TRUE(cpu.line_dirty(0x0240));
+    EXPECT_TRUE(cpu.line_dirty(0x05c0));
+    EXPECT_FALSE(cpu.line_dirty(0x0200));
+
+    std::vector<uint16_t> lines;
+    cpu.drain_dirty_lines(0x0200, 0x05ff,
+                          [&](uint16_t line) { lines.push_back(line); });
+    EXPECT_EQ(lines, (std::vector<uint16_t>{0x0240, 0x05c0}));
+    EXPECT_FALSE(cpu.line_dirty(0x0240));
+}
+
+TEST_P(CPUTest, test_drain_dirty_lines_stays_in_range) {
+    cpu.clear_dirty_lines();
+    cpu.mem_write(0x01ff, 1);
+    cpu.mem_write(0x0200, 1);
+    cpu.mem_write(0x0600, 1);
+
+    std::vector<uint16_t> lines;
+    cpu.drain_dirty_lines(0x0200, 0x05ff,
+                          [&](uint16_t line) { lines.push_back(line); });
+    EXPECT_EQ(lines, (std::vector<uint16_t>{0x0200}));
+    EXPECT_TRUE(cpu.line_dirty(0x01ff));
+    EXPECT_TRUE(cpu.line_dirty(0x0600));
+}
+
+TEST_P(CPUTest, test_state_hash_tracks_registers_and_memory) {
+    std::vector<uint8_t> program = {0xa9, 0x07, 0x85, 0x10, 0x00};
+    NesCpu other;
+    other.core = GetParam();
+    other.break_mode = BreakMode::Exit;
+    cpu.load_and_run(program);
+    other.load_and_run(program);
+    EXPECT_EQ(cpu.state_hash(), other.state_hash());
+
+    uint64_t hash = cpu.state_hash();
+    cpu.mem_write(0x8000, 1);
+    EXPECT_NE(cpu.state_hash(), hash);
+    cpu.mem_write(0x8000, 0);
+    EXPECT_EQ(cpu.state_hash(), hash);
+    cpu.register_y++;
+    EXPECT_NE(cpu.state_hash(), hash);
+}
+
+TEST_P(CPUTest, test_brk_traps_through_irq_vector) {
+    // LDA #5; BRK; (padding); LDX #7; done: JMP done
+    cpu.break_mode = BreakMode::Interrupt;
+    cpu.load({0xa9, 0x05, 0x00, 0xea, 0xa2, 0x07, 0x4c, 0x06, 0x06});
+    // PLA; PHA; STA $10; INY; RTI
+    std::vector<uint8_t> handler = {0x68, 0x48, 0x85, 0x10, 0xc8, 0x40};
+    for (std::size_t i = 0; i < handler.size(); i++) {
+        cpu.mem_write(0x0700 + i, handler[i]);
+    }
+    cpu.mem_write_u16(IRQ_VECTOR, 0x0700);
+    cpu.program_counter = 0x0600;
+
+    RunLimits limits;
+    limits.break_at = 0x0606;
+    RunResult result = cpu.run_until(limits);
+    EXPECT_EQ(result.reason, StopReason::Breakpoint);
+    EXPECT_EQ(result.instructions, 8);
+    EXPECT_EQ(result.cycles, 2 + 7 + 4 + 3 + 3 + 2 + 6 + 2);
+    // RTI came back past the padding byte, with the status BRK pushed.
+    EXPECT_EQ(cpu.register_x, 7);
+    EXPECT_EQ(cpu.register_y, 1);
+    EXPECT_EQ(cpu.mem_read(0x10) & (BREAK | BREAK2), BREAK | BREAK2);
+    EXPECT_EQ(cpu.stack_pointer, STACK_RESET);
+}
+
+TEST_P(CPUTest, test_nmi_and_irq_lines) {
+    // CLI; loop: INX; JMP loop
+    cpu.load({0x58, 0xe8, 0x4c, 0x01, 0x06});
+    // nmi: INC $10; RTI    irq: INC $11; RTI
+    cpu.mem_write(0x0700, 0xe6);
+    cpu.mem_write(0x0701, 0x10);
+    cpu.mem_write(0x0702, 0x40);
+    cpu.mem_write(0x0710, 0xe6);
+    cpu.mem_write(0x0711, 0x11);
+    cpu.mem_write(0x0712, 0x40);
+    cpu.mem_write_u16(NMI_VECTOR, 0x0700);
+    cpu.mem_write_u16(IRQ_VECTOR, 0x0710);
+    cpu.program_counter = 0x0600;
+
+    RunLimits one;
+    one.max_instructions = 1;
+    RunLimits two;
+    two.max_instructions = 2;
+
+    // The IRQ waits for CLI, then runs its handler.
+    cpu.set_irq(true);
+    cpu.run_until(one);
+    EXPECT_EQ(cpu.mem_read(0x11), 0);
+    RunResult result = cpu.run_until(two);
+    EXPECT_EQ(result.cycles, 7 + 5 + 6);
+    EXPECT_EQ(cpu.mem_read(0x11), 1);
+    EXPECT_EQ(cpu.program_counter, 0x0601);
+    EXPECT_FALSE(cpu.flag(CpuFlags::INTERRUPT_DISABLE));
+    cpu.set_irq(false);
+
+    // An NMI is taken once.
+    cpu.nmi();
+    result = cpu.run_until(two);
+    EXPECT_EQ(result.cycles, 7 + 5 + 6);
+    EXPECT_EQ(cpu.mem_read(0x10), 1);
+    EXPECT_EQ(cpu.program_counter, 0x0601);
+    cpu.run_until(two);
+    EXPECT_EQ(cpu.register_x, 1);
+    EXPECT_EQ(cpu.mem_read(0x10), 1);
+    EXPECT_EQ(cpu.stack_pointer, STACK_RESET);
+}
+
+INSTANTIATE_TEST_SUITE_P(Cores, CPUTest,
+                         ::testing::Values(CpuCore::Switch,
+                                           CpuCore::Threaded,
+                                           CpuCore::Cached,
+                                           CpuCore::Jit));
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,227 @@
+#include "App/SnakeGame.hpp"
+#include "Core/NesCpu.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+class CountingDevice : public BusDevice {
+public:
+    uint8_t read(uint16_t addr) override {
+        reads++;
+        return static_cast<uint8_t>(addr + reads);
+    }
+
+    void write(uint16_t, uint8_t data) override { written.push_back(data); }
+
+    int reads = 0;
+    std::vector<uint8_t> written;
+};
+
+// A jit CPU that compiles every block the first time it runs, and the same
+// machine on the switch core.
+static std::pair<NesCpu, NesCpu> make_pair(const std::vector<uint8_t> &program) {
+    NesCpu cpu;
+    cpu.core = CpuCore::Jit;
+    cpu.jit.hot_runs = 1;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(program);
+    cpu.program_counter = 0x0600;
+    NesCpu reference = cpu;
+    reference.core = CpuCore::Switch;
+    return {cpu, reference};
+}
+
+static void expect_same(const NesCpu &cpu, const NesCpu &reference) {
+    EXPECT_EQ(cpu.register_a, reference.register_a);
+    EXPECT_EQ(cpu.register_x, reference.register_x);
+    EXPECT_EQ(cpu.register_y, reference.register_y);
+    EXPECT_EQ(cpu.get_status(), reference.get_status());
+    EXPECT_EQ(cpu.stack_pointer, reference.stack_pointer);
+    EXPECT_EQ(cpu.program_counter, reference.program_counter);
+    EXPECT_EQ(cpu.cycles, reference.cycles);
+    EXPECT_EQ(cpu.state_hash(), reference.state_hash());
+}
+
+TEST(JitTest, test_every_opcode_matches_interpreter) {
+    if (!Jit::available()) {
+        GTEST_SKIP();
+    }
+    for (int code = 0; code < 256; code++) {
+        if (OPCODES_TABLE[code].instruction == Instruction::Illegal) {
+            continue;
+        }
+        for (int variant = 0; variant < 6; variant++) {
+            auto [cpu, reference] = make_pair(
+                {static_cast<uint8_t>(code), 0x10, 0x02, 0xea, 0xe8, 0x00});
+            for (NesCpu *target : {&cpu, &reference}) {
+                for (int addr = 0; addr < 0x300; addr++) {
+                    target->mem_write(addr,
+                                      static_cast<uint8_t>(addr * 7 + variant));
+                }
+                target->register_a = static_cast<uint8_t>(variant * 91);
+                target->register_x = static_cast<uint8_t>(variant * 37 + 1);
+                target->register_y = static_cast<uint8_t>(0xf0 + variant * 5);
+                target->stack_pointer = static_cast<uint8_t>(variant * 51);
+                target->set_status(
+                    cpuflags_from_bits(static_cast<uint8_t>(variant * 0x47)));
+            }
+            // Jumps land in the pattern, which may hold illegal opcodes.
+            RunLimits limits;
+            limits.max_instructions = 40;
+            auto run = [&limits](NesCpu &target) {
+                try {
+                    return target.run_until(limits).instructions;
+                } catch (const std::runtime_error &) {
+                    return UINT64_MAX;
+                }
+            };
+            SCOPED_TRACE(OPCODES_TABLE[code].mnemonic);
+            SCOPED_TRACE(variant);
+            EXPECT_EQ(run(cpu), run(reference));
+            expect_same(cpu, reference);
+        }
+    }
+}
+
+TEST(JitTest, test_hot_loop_is_compiled) {
+    // LDX #0; loop: TXA; STA $0300,X; ADC $10; STA $10; INX; BNE loop; BRK
+    auto [cpu, reference] = make_pair({0xa2, 0x00, 0x8a, 0x9d, 0x00, 0x03,
+                                       0x65, 0x10, 0x85, 0x10, 0xe8, 0xd0,
+                                       0xf5, 0x00});
+    cpu.jit.hot_runs = JIT_HOT_RUNS;
+    cpu.run();
+    reference.run();
+    expect_same(cpu, reference);
+    if (Jit::available()) {
+        EXPECT_GT(cpu.jit.compiled(), 0u);
+    }
+}
+
+TEST(JitTest, test_device_reads_fall_back_to_interpreter) {
+    // loop: LDA $4000; STA $4001; STA $0200,X; INX; BNE loop; BRK
+    auto [cpu, reference] = make_pair({0xad, 0x00, 0x40, 0x8d, 0x01, 0x40,
+                                       0x9d, 0x00, 0x02, 0xe8, 0xd0, 0xf4,
+                                       0x00});
+    CountingDevice device;
+    CountingDevice reference_device;
+    cpu.bus.map_device(0x40, 1, &device);
+    reference.bus.map_device(0x40, 1, &reference_device);
+    cpu.run();
+    reference.run();
+    expect_same(cpu, reference);
+    EXPECT_EQ(device.reads, 256);
+    EXPECT_EQ(device.written, reference_device.written);
+}
+
+TEST(JitTest, test_self_modifying_loop) {
+    // loop: LDA #0; STA $0200,X; INC $0601; INX; CPX #$40; BNE loop; BRK
+    // The loop rewrites its own immediate operand on every pass.
+    auto [cpu, reference] = make_pair({0xa9, 0x00, 0x9d, 0x00, 0x02, 0xee,
+                                       0x01, 0x06, 0xe8, 0xe0, 0x40, 0xd0,
+                                       0xf3, 0x00});
+    cpu.run();
+    reference.run();
+    expect_same(cpu, reference);
+    EXPECT_EQ(cpu.mem_read(0x023f), 0x3f);
+}
+
+TEST(JitTest, test_cartridge_ram_mirrors) {
+    // RAM as a cartridge maps it, 2KB repeated across $0000-$1FFF.
+    // loop: TXA; STA $1200,X; STA $0810; PHA; INX; BNE loop
+    // loop2: LDA #0; STA $1300,X; INC $0E0E; INX; BNE loop2; BRK
+    // The second loop rewrites its immediate operand through a mirror.
+    NesCpu cpu;
+    cpu.bus.map_memory(0x00, 0x20, 0x800);
+    cpu.core = CpuCore::Jit;
+    cpu.jit.hot_runs = 1;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load({0xa2, 0x00, 0x8a, 0x9d, 0x00, 0x12, 0x8d, 0x10, 0x08,
+              0x48, 0xe8, 0xd0, 0xf5, 0xa9, 0x00, 0x9d, 0x00, 0x13,
+              0xee, 0x0e, 0x0e, 0xe8, 0xd0, 0xf5, 0x00});
+    cpu.program_counter = 0x0600;
+    NesCpu reference = cpu;
+    reference.core = CpuCore::Switch;
+    cpu.run();
+    reference.run();
+    expect_same(cpu, reference);
+    for (uint16_t mirror = 0; mirror < 0x2000; mirror += 0x800) {
+        EXPECT_EQ(cpu.mem_read(mirror + 0x0010), 0xff);
+        EXPECT_EQ(cpu.mem_read(mirror + 0x0180), 0x7d);
+        EXPECT_EQ(cpu.mem_read(mirror + 0x0245), 0x45);
+        EXPECT_EQ(cpu.mem_read(mirror + 0x03a7), 0xa7);
+    }
+    EXPECT_EQ(cpu.bus.memory_hash(), cpu.bus.compute_memory_hash());
+    if (Jit::available()) {
+        EXPECT_GT(cpu.jit.compiled(), 0u);
+    }
+}
+
+TEST(JitTest, test_limits_inside_compiled_blocks) {
+    // loop: INX; STX $10; INY; STY $0200,X; JMP loop
+    std::vector<uint8_t> program = {0xe8, 0x86, 0x10, 0xc8, 0x99,
+                                    0x00, 0x02, 0x4c, 0x00, 0x06};
+    auto [cpu, reference] = make_pair(program);
+    for (int round = 0; round < 30; round++) {
+        RunLimits limits;
+        if (round % 3 == 0) {
+            limits.max_instructions = 7 + round;
+        } else if (round % 3 == 1) {
+            limits.max_cycles = 11 + round;
+        } else {
+            limits.break_at = 0x0604;
+            limits.watch_write = round % 2 ? 0x10 : 0x0200 + round;
+        }
+        RunResult result = cpu.run_until(limits);
+        RunResult expected = reference.run_until(limits);
+        ASSERT_EQ(result.reason, expected.reason) << round;
+        ASSERT_EQ(result.instructions, expected.instructions) << round;
+        ASSERT_EQ(result.cycles, expected.cycles) << round;
+        expect_same(cpu, reference);
+    }
+}
+
+TEST(JitTest, test_snake_matches_switch_core) {
+    NesCpu cpu;
+    cpu.core = CpuCore::Jit;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(SNAKE_GAME_CODE);
+    cpu.reset();
+    NesCpu reference = cpu;
+    reference.core = CpuCore::Switch;
+
+    RunLimits limits;
+    limits.max_instructions = 997;
+    uint32_t seed = 7;
+    for (int round = 0; round < 200; round++) {
+        seed = seed * 1103515245 + 12345;
+        for (NesCpu *target : {&cpu, &reference}) {
+            target->mem_write(0xfe, (seed >> 16) % 15 + 1);
+            target->mem_write(0xff, "wdsa"[(round / 16) % 4]);
+        }
+        RunResult result = cpu.run_until(limits);
+        RunResult expected = reference.run_until(limits);
+        ASSERT_EQ(result.instructions, expected.instructions) << round;
+        ASSERT_EQ(cpu.state_hash(), reference.state_hash()) << round;
+        if (expected.reason == StopReason::Break) {
+            break;
+        }
+    }
+    if (Jit::available()) {
+        EXPECT_GT(cpu.jit.compiled(), 0u);
+    }
+}
+
+TEST(JitTest, test_copies_start_without_code) {
+    auto [cpu, reference] = make_pair({0xe8, 0xd0, 0xfd, 0x00});
+    cpu.run();
+    NesCpu copy = cpu;
+    EXPECT_EQ(copy.jit.compiled(), 0u);
+    EXPECT_EQ(copy.jit.hot_runs, 1u);
+    copy.program_counter = 0x0600;
+    copy.run();
+    EXPECT_EQ(copy.register_x, 0);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,177 @@
+#include "Core/Lockstep.hpp"
+#include <gtest/gtest.h>
+
+// Seeds a shift register from $10, stores 64 of its values at $0200,X and
+// folds them into $12 and $13 from a subroutine, then stops on BRK. The
+// branches depend on the seed, so lanes diverge and converge again.
+static const std::vector<uint8_t> MIXED_PROGRAM = {
+    0xa5, 0x10, 0x85, 0x11, 0xa2, 0x00, 0xa5, 0x11, 0x0a, 0x90, 0x02,
+    0x49, 0x1d, 0x85, 0x11, 0x9d, 0x00, 0x02, 0x20, 0x30, 0x06, 0xe8,
+    0xe0, 0x40, 0xd0, 0xec, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x48, 0x29, 0x07, 0xa8, 0xb9, 0x00, 0x02,
+    0x6d, 0x12, 0x00, 0x8d, 0x12, 0x00, 0x68, 0x6a, 0x26, 0x13, 0x38,
+    0xe5, 0x13, 0x24, 0x11, 0x60};
+
+static NesCpu make_prototype(const std::vector<uint8_t> &program) {
+    NesCpu cpu;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(program);
+    cpu.program_counter = 0x0600;
+    return cpu;
+}
+
+static void expect_lane_matches(const LockstepEngine &engine,
+                                std::size_t lane, const NesCpu &reference) {
+    EXPECT_EQ(engine.register_a[lane], reference.register_a) << lane;
+    EXPECT_EQ(engine.register_x[lane], reference.register_x) << lane;
+    EXPECT_EQ(engine.register_y[lane], reference.register_y) << lane;
+    EXPECT_EQ(engine.status[lane], reference.get_status()) << lane;
+    EXPECT_EQ(engine.stack_pointer[lane], reference.stack_pointer) << lane;
+    EXPECT_EQ(engine.program_counter[lane], reference.program_counter)
+        << lane;
+    EXPECT_EQ(engine.cycles[lane], reference.cycles) << lane;
+    std::size_t differences = 0;
+    for (std::size_t addr = 0; addr < BUS_MEMORY_SIZE; addr++) {
+        differences += engine.read(lane, addr) != reference.bus.memory[addr];
+    }
+    EXPECT_EQ(differences, 0u) << lane;
+}
+
+TEST(LockstepTest, test_diverging_lanes_match_independent_cpus) {
+    const std::size_t lanes = 45;
+    NesCpu prototype = make_prototype(MIXED_PROGRAM);
+    LockstepEngine engine(prototype, lanes);
+    EXPECT_EQ(engine.stride(), 64u);
+
+    std::vector<NesCpu> references(lanes, prototype);
+    for (std::size_t lane = 0; lane < lanes; lane++) {
+        uint8_t seed = static_cast<uint8_t>(lane * 29 + 1);
+        engine.write(lane, 0x10, seed);
+        references[lane].mem_write(0x10, seed);
+    }
+
+    // Uneven budgets stop lanes in the middle of the loop and the
+    // subroutine. A NesCpu has no halted state, so each reference stops
+    // being run once it reaches BRK.
+    std::vector<bool> stopped(lanes, false);
+    RunLimits limits;
+    limits.max_instructions = 37;
+    for (int round = 0; round < 40; round++) {
+        engine.run(limits.max_instructions);
+        for (std::size_t lane = 0; lane < lanes; lane++) {
+            if (!stopped[lane]) {
+                stopped[lane] = references[lane].run_until(limits).reason ==
+                                StopReason::Break;
+            }
+            EXPECT_EQ(engine.halted(lane), stopped[lane]) << lane;
+            expect_lane_matches(engine, lane, references[lane]);
+        }
+    }
+    for (std::size_t lane = 0; lane < lanes; lane++) {
+        EXPECT_TRUE(engine.halted(lane)) << lane;
+    }
+}
+
+TEST(LockstepTest, test_every_opcode_matches) {
+    const std::size_t lanes = 20;
+    for (int code = 0; code < 256; code++) {
+        if (OPCODES_TABLE[code].instruction == Instruction::Illegal) {
+            continue;
+        }
+        // Uniform index registers and pointers exercise the vector kernels,
+        // per-lane ones the one-lane path.
+        for (int varied = 0; varied < 2; varied++) {
+            NesCpu prototype = make_prototype(
+                {static_cast<uint8_t>(code), 0x10, 0x02, 0xea, 0xea});
+            for (int addr = 0; addr < 0x100; addr++) {
+                prototype.mem_write(addr, static_cast<uint8_t>(addr * 7 + 3));
+                prototype.mem_write(0x0100 + addr,
+                                    static_cast<uint8_t>(addr * 5 + 1));
+                prototype.mem_write(0x0200 + addr,
+                                    static_cast<uint8_t>(addr * 3 + 9));
+            }
+            LockstepEngine engine(prototype, lanes);
+            std::vector<NesCpu> references(lanes, prototype);
+            for (std::size_t lane = 0; lane < lanes; lane++) {
+                NesCpu &reference = references[lane];
+                reference.register_a = static_cast<uint8_t>(lane * 37 + 5);
+                reference.set_status(
+                    cpuflags_from_bits(static_cast<uint8_t>(lane * 0x53)));
+                if (varied) {
+                    reference.register_x = static_cast<uint8_t>(lane * 11);
+                    reference.register_y = static_cast<uint8_t>(lane * 13);
+                    reference.stack_pointer =
+                        static_cast<uint8_t>(0xfd - lane);
+                    uint8_t value = static_cast<uint8_t>(lane * 17);
+                    reference.mem_write(0x10, value);
+                    reference.mem_write(0x0100 + reference.stack_pointer + 1,
+                                        value);
+                    engine.write(lane, 0x10, value);
+                    engine.write(lane, 0x0100 + reference.stack_pointer + 1,
+                                 value);
+                } else {
+                    reference.register_x = 0x22;
+                    reference.register_y = 0xf1;
+                }
+                engine.register_a[lane] = reference.register_a;
+                engine.register_x[lane] = reference.register_x;
+                engine.register_y[lane] = reference.register_y;
+                engine.status[lane] = reference.get_status();
+                engine.stack_pointer[lane] = reference.stack_pointer;
+            }
+
+            engine.run(1);
+            RunLimits limits;
+            limits.max_instructions = 1;
+            for (std::size_t lane = 0; lane < lanes; lane++) {
+                references[lane].run_until(limits);
+                SCOPED_TRACE(OPCODES_TABLE[code].mnemonic);
+                expect_lane_matches(engine, lane, references[lane]);
+            }
+        }
+    }
+}
+
+TEST(LockstepTest, test_converged_lanes_use_vector_steps) {
+    const std::size_t lanes = 100;
+    // LDX #0; loop: TXA; STA $0300,X; ADC $10; STA $10; INX; BNE loop
+    NesCpu prototype = make_prototype({0xa2, 0x00, 0x8a, 0x9d, 0x00, 0x03,
+                                       0x65, 0x10, 0x85, 0x10, 0xe8, 0xd0,
+                                       0xf5});
+    LockstepEngine engine(prototype, lanes);
+    LockstepStats stats = engine.run(1000);
+    EXPECT_EQ(stats.instructions, lanes * 1000);
+    EXPECT_EQ(stats.scalar_instructions, 0u);
+    EXPECT_EQ(stats.vector_steps, stats.steps);
+
+    NesCpu reference = prototype;
+    RunLimits limits;
+    limits.max_instructions = 1000;
+    reference.run_until(limits);
+    for (std::size_t lane = 0; lane < lanes; lane += 33) {
+        NesCpu actual = prototype;
+        engine.extract(lane, actual);
+        EXPECT_EQ(actual.state_hash(), reference.state_hash()) << lane;
+    }
+}
+
+TEST(LockstepTest, test_rejects_non_ram_bus) {
+    NesCpu prototype = make_prototype({0x00});
+    EXPECT_THROW(LockstepEngine(prototype, 0), std::invalid_argument);
+    prototype.break_mode = BreakMode::Interrupt;
+    EXPECT_THROW(LockstepEngine(prototype, 4), std::invalid_argument);
+    prototype.break_mode = BreakMode::Exit;
+    prototype.bus.map_memory(0x00, 0x20, 0x800);
+    EXPECT_THROW(LockstepEngine(prototype, 4), std::invalid_argument);
+}
+
+TEST(LockstepTest, test_illegal_opcode_throws) {
+    LockstepEngine engine(make_prototype({0xe8, 0x02}), 8);
+    EXPECT_THROW(engine.run(10), std::runtime_error);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
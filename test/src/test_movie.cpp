@@ -0,0 +1,138 @@
+#include "App/SnakeGame.hpp"
+#include "Core/Movie.hpp"
+#include "Core/NesCpu.hpp"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+// Records a few hundred batches of snake with scripted keys and random
+// bytes, checkpointing every `checkpoint_cycles`.
+static Movie record_snake(CpuCore core, uint64_t checkpoint_cycles,
+                          uint64_t *hash) {
+    NesCpu cpu;
+    cpu.core = core;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(SNAKE_GAME_CODE);
+    cpu.reset();
+    MovieRecorder recorder(cpu, checkpoint_cycles);
+
+    RunLimits limits;
+    limits.max_instructions = 240;
+    uint32_t seed = 3;
+    for (int round = 0; round < 400; round++) {
+        seed = seed * 1103515245 + 12345;
+        recorder.write(0xfe, (seed >> 16) % 15 + 1);
+        if (round % 16 == 0) {
+            recorder.write(0xff, "wdsa"[(round / 16) % 4]);
+        }
+        if (recorder.run_until(limits).reason == StopReason::Break) {
+            break;
+        }
+    }
+    *hash = cpu.state_hash();
+    return recorder.finish();
+}
+
+TEST(MovieTest, test_serialize_round_trip) {
+    uint64_t hash = 0;
+    Movie movie = record_snake(CpuCore::Switch, 5000, &hash);
+    Movie copy = deserialize_movie(serialize_movie(movie));
+
+    EXPECT_EQ(copy.start_state, movie.start_state);
+    EXPECT_EQ(copy.start_cycle, movie.start_cycle);
+    EXPECT_EQ(copy.end_cycle, movie.end_cycle);
+    ASSERT_EQ(copy.events.size(), movie.events.size());
+    for (std::size_t i = 0; i < movie.events.size(); i++) {
+        EXPECT_EQ(copy.events[i].cycle, movie.events[i].cycle);
+        EXPECT_EQ(copy.events[i].address, movie.events[i].address);
+        EXPECT_EQ(copy.events[i].value, movie.events[i].value);
+    }
+    ASSERT_EQ(copy.checkpoints.size(), movie.checkpoints.size());
+    for (std::size_t i = 0; i < movie.checkpoints.size(); i++) {
+        EXPECT_EQ(copy.checkpoints[i].cycle, movie.checkpoints[i].cycle);
+        EXPECT_EQ(copy.checkpoints[i].hash, movie.checkpoints[i].hash);
+    }
+}
+
+TEST(MovieTest, test_rejects_bad_files) {
+    uint64_t hash = 0;
+    std::vector<uint8_t> data =
+        serialize_movie(record_snake(CpuCore::Switch, 5000, &hash));
+    for (std::size_t size : {std::size_t(0), std::size_t(5), data.size() / 2,
+                             data.size() - 1}) {
+        std::vector<uint8_t> truncated(data.begin(), data.begin() + size);
+        EXPECT_THROW(deserialize_movie(truncated), std::runtime_error) << size;
+    }
+    data[0] ^= 0xFF;
+    EXPECT_THROW(deserialize_movie(data), std::runtime_error);
+}
+
+TEST(MovieTest, test_replay_on_every_core) {
+    uint64_t hash = 0;
+    Movie movie = deserialize_movie(
+        serialize_movie(record_snake(CpuCore::Threaded, 5000, &hash)));
+    ASSERT_GT(movie.checkpoints.size(), 10u);
+
+    for (CpuCore core : {CpuCore::Switch, CpuCore::Threaded, CpuCore::Cached,
+                         CpuCore::Jit}) {
+        NesCpu cpu;
+        cpu.core = core;
+        cpu.break_mode = BreakMode::Exit;
+        cpu.load(SNAKE_GAME_CODE);
+        ReplayResult result = replay_movie(cpu, movie);
+        EXPECT_EQ(result.checkpoints, movie.checkpoints.size());
+        EXPECT_EQ(cpu.cycles, movie.end_cycle);
+        EXPECT_EQ(cpu.state_hash(), hash);
+    }
+}
+
+TEST(MovieTest, test_replay_ends_on_brk) {
+    // loop: LDA $FE; STA $0200,X; INX; BNE loop; BRK
+    std::vector<uint8_t> program = {0xa5, 0xfe, 0x9d, 0x00, 0x02,
+                                    0xe8, 0xd0, 0xf8, 0x00};
+    NesCpu cpu;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(program);
+    cpu.program_counter = 0x0600;
+    MovieRecorder recorder(cpu, 100);
+    RunLimits limits;
+    limits.max_instructions = 50;
+    for (int round = 0; round < 100; round++) {
+        recorder.write(0xfe, round * 3);
+        if (recorder.run_until(limits).reason == StopReason::Break) {
+            break;
+        }
+    }
+    Movie movie = deserialize_movie(serialize_movie(recorder.finish()));
+    ASSERT_TRUE(movie.break_at_end);
+
+    NesCpu replay;
+    replay.break_mode = BreakMode::Exit;
+    replay.load(program);
+    ReplayResult result = replay_movie(replay, movie);
+    EXPECT_EQ(result.reason, StopReason::Break);
+    EXPECT_EQ(result.checkpoints, movie.checkpoints.size());
+    EXPECT_EQ(replay.program_counter, cpu.program_counter);
+    EXPECT_EQ(replay.state_hash(), cpu.state_hash());
+}
+
+TEST(MovieTest, test_tampered_event_diverges) {
+    uint64_t hash = 0;
+    Movie movie = record_snake(CpuCore::Switch, 5000, &hash);
+    // A different first direction changes where the snake goes.
+    for (MovieEvent &event : movie.events) {
+        if (event.address == 0xff) {
+            event.value = 'a';
+            break;
+        }
+    }
+    NesCpu cpu;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(SNAKE_GAME_CODE);
+    EXPECT_THROW(replay_movie(cpu, movie), std::runtime_error);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
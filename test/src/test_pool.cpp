@@ -0,0 +1,143 @@
+#include "Core/EmulatorPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+// LDX #seed; loop: INX; STX $10; TXA; STA $0300,X; JMP loop
+static NesCpu make_counter(uint8_t seed) {
+    NesCpu cpu;
+    cpu.load({0xa2, seed, 0xe8, 0x86, 0x10, 0x8a, 0x9d, 0x00, 0x03, 0x4c,
+              0x02, 0x06});
+    cpu.program_counter = 0x0600;
+    return cpu;
+}
+
+TEST(EmulatorPoolTest, test_instances_match_serial_runs) {
+    const uint64_t slice = 1000;
+    EmulatorPool pool(4);
+    for (int i = 0; i < 12; i++) {
+        pool.add(make_counter(i * 7), 20000 + i * 3000);
+    }
+    pool.run(slice);
+
+    for (int i = 0; i < 12; i++) {
+        NesCpu reference = make_counter(i * 7);
+        RunLimits limits;
+        uint64_t budget = 20000 + i * 3000;
+        uint64_t cycles = 0;
+        while (cycles < budget) {
+            limits.max_cycles = std::min(slice, budget - cycles);
+            cycles += reference.run_until(limits).cycles;
+        }
+        EXPECT_EQ(pool.result(i).cycles, cycles) << i;
+        EXPECT_EQ(pool.cpu(i).state_hash(), reference.state_hash()) << i;
+    }
+
+    PoolStats stats = pool.stats();
+    EXPECT_EQ(stats.completed, 12u);
+    EXPECT_GE(stats.slices, 12u * 20);
+}
+
+TEST(EmulatorPoolTest, test_completion_callbacks) {
+    std::atomic<int> calls(0);
+    std::atomic<int> breaks(0);
+    EmulatorPool pool(3);
+    PoolCompletion on_complete = [&](std::size_t, NesCpu &,
+                                     const RunResult &total) {
+        calls++;
+        if (total.reason == StopReason::Break) {
+            breaks++;
+        }
+    };
+    for (int i = 0; i < 5; i++) {
+        pool.add(make_counter(i), 5000, on_complete);
+    }
+    NesCpu short_program;
+    short_program.break_mode = BreakMode::Exit;
+    short_program.load({0xe8, 0xe8, 0x00});
+    short_program.program_counter = 0x0600;
+    std::size_t index = pool.add(short_program, UINT64_MAX, on_complete);
+
+    pool.run(700);
+    EXPECT_EQ(calls, 6);
+    EXPECT_EQ(breaks, 1);
+    EXPECT_EQ(pool.result(index).instructions, 2u);
+    EXPECT_EQ(pool.cpu(index).register_x, 2);
+
+    // Finished instances are not run again.
+    pool.run(700);
+    EXPECT_EQ(calls, 6);
+    EXPECT_EQ(pool.stats().slices, 0u);
+}
+
+TEST(EmulatorPoolTest, test_errors_are_rethrown) {
+    EmulatorPool pool(2);
+    pool.add(make_counter(1), 4000);
+    NesCpu illegal;
+    illegal.load({0x02});
+    illegal.program_counter = 0x0600;
+    pool.add(illegal);
+    EXPECT_THROW(pool.run(500), std::runtime_error);
+    EXPECT_GE(pool.result(0).cycles, 4000u);
+}
+
+TEST(EmulatorPoolTest, test_slices_take_turns) {
+    const uint64_t budget = 5000;
+    const uint64_t slice = 500;
+    EmulatorPool pool(1);
+    uint64_t others_least = UINT64_MAX;
+    bool first = true;
+    PoolCompletion on_complete = [&](std::size_t index, NesCpu &,
+                                     const RunResult &) {
+        if (!first) {
+            return;
+        }
+        first = false;
+        for (std::size_t i = 0; i < pool.size(); i++) {
+            if (i != index) {
+                others_least = std::min(others_least, pool.result(i).cycles);
+            }
+        }
+    };
+    for (int i = 0; i < 3; i++) {
+        pool.add(make_counter(i), budget, on_complete);
+    }
+    pool.run(slice);
+    // When the first instance finished, the others were a slice behind at
+    // most.
+    EXPECT_GE(others_least, budget - slice);
+}
+
+TEST(EmulatorPoolTest, test_completion_errors_are_rethrown) {
+    EmulatorPool pool(2);
+    std::atomic<int> calls(0);
+    for (int i = 0; i < 4; i++) {
+        pool.add(make_counter(i), 3000,
+                 [&](std::size_t index, NesCpu &, const RunResult &) {
+                     calls++;
+                     if (index == 1) {
+                         throw std::runtime_error("callback");
+                     }
+                 });
+    }
+    EXPECT_THROW(pool.run(500), std::runtime_error);
+    EXPECT_EQ(calls, 4);
+}
+
+TEST(EmulatorPoolTest, test_instances_are_cache_line_aligned) {
+    EmulatorPool pool(1);
+    for (int i = 0; i < 3; i++) {
+        pool.add(NesCpu());
+    }
+    EXPECT_EQ(sizeof(PoolInstance) % CACHE_LINE_SIZE, 0u);
+    for (int i = 0; i < 3; i++) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(&pool.cpu(i));
+        EXPECT_EQ(addr % CACHE_LINE_SIZE, 0u);
+    }
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
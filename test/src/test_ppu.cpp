@@ -0,0 +1,195 @@
+#include "Core/NesCpu.hpp"
+#include "Core/Ppu.hpp"
+#include <gtest/gtest.h>
+#include <set>
+#include <vector>
+
+// loop: JMP loop, also the NMI handler
+static const std::vector<uint8_t> IDLE = {0x4c, 0x00, 0x06};
+
+static void start(NesCpu &cpu, NesPpu &ppu, PpuMode mode) {
+    cpu.load(IDLE);
+    cpu.mem_write_u16(NMI_VECTOR, 0x0600);
+    cpu.reset();
+    ppu.mode = mode;
+    ppu.attach(cpu);
+}
+
+static void set_address(NesPpu &ppu, uint16_t addr) {
+    ppu.write(0x2006, addr >> 8);
+    ppu.write(0x2006, addr & 0xFF);
+}
+
+// Runs the CPU until the PPU has entered the next vblank.
+static void run_frame(NesCpu &cpu, NesPpu &ppu) {
+    uint64_t frame = ppu.frame_count();
+    while (ppu.frame_count() == frame) {
+        RunLimits limits;
+        uint64_t vblank = ppu.next_vblank_cycle();
+        limits.max_cycles = vblank > cpu.cycles ? vblank - cpu.cycles : 1;
+        cpu.run_until(limits);
+        ppu.catch_up();
+    }
+}
+
+// Tiles in CHR-RAM, a scrolled background over both nametables, all 64
+// sprites (sprite 0 over the background) and a frame with rendering on.
+static void build_scene(NesCpu &cpu, NesPpu &ppu) {
+    set_address(ppu, 0x0000);
+    for (int tile = 0; tile < 8; tile++) {
+        for (int plane = 0; plane < 2; plane++) {
+            for (int row = 0; row < 8; row++) {
+                ppu.write(0x2007, (tile * 37 + row * 11 + plane * 90) & 0xFF);
+            }
+        }
+    }
+    set_address(ppu, 0x2000);
+    for (int i = 0; i < 0x800; i++) {
+        ppu.write(0x2007, (i * 7 + i / 29) % 8);
+    }
+    set_address(ppu, 0x3F00);
+    for (int i = 0; i < 32; i++) {
+        ppu.write(0x2007, (i * 5 + 1) & 0x3F);
+    }
+    for (int i = 0; i < 64; i++) {
+        // Sprites 1-9 share a row to overflow it.
+        uint8_t y = i == 0 ? 60 : i < 10 ? 120 : (i * 29) % 230;
+        cpu.mem_write(0x0300 + i * 4, y);
+        cpu.mem_write(0x0301 + i * 4, i % 8);
+        cpu.mem_write(0x0302 + i * 4, (i * 0x45) & 0xE3);
+        cpu.mem_write(0x0303 + i * 4, i == 0 ? 100 : (i * 53) % 256);
+    }
+    ppu.write(0x2003, 0);
+    ppu.write(0x4014, 0x03);
+    ppu.write(0x2005, 13);
+    ppu.write(0x2005, 21);
+    ppu.write(0x2000, 0x81);
+    ppu.write(0x2001, 0x1E);
+}
+
+TEST(PpuTest, test_vram_access) {
+    NesCpu cpu;
+    NesPpu ppu;
+    start(cpu, ppu, PpuMode::Scanline);
+
+    set_address(ppu, 0x2105);
+    ppu.write(0x2007, 0x42);
+    ppu.write(0x2007, 0x43);
+    set_address(ppu, 0x2105);
+    ppu.read(0x2007);
+    EXPECT_EQ(ppu.read(0x2007), 0x42);
+    EXPECT_EQ(ppu.read(0x2007), 0x43);
+    // Horizontal mirroring: $2400 is $2000.
+    EXPECT_EQ(ppu.ppu_read(0x2505), 0x42);
+
+    set_address(ppu, 0x3F10);
+    ppu.write(0x2007, 0x2C);
+    set_address(ppu, 0x3F00);
+    EXPECT_EQ(ppu.read(0x2007), 0x2C);
+
+    // The registers repeat every eight bytes.
+    ppu.write(0x3FF3, 0x10);
+    ppu.write(0x2C04, 0x99);
+    ppu.write(0x2003, 0x10);
+    EXPECT_EQ(ppu.read(0x2004), 0x99);
+}
+
+TEST(PpuTest, test_vblank_and_nmi) {
+    NesCpu cpu;
+    NesPpu ppu;
+    start(cpu, ppu, PpuMode::Scanline);
+    ppu.write(0x2000, 0x80);
+
+    uint64_t vblank = ppu.next_vblank_cycle();
+    cpu.cycles = vblank - 1;
+    EXPECT_EQ(ppu.read(0x2002) & 0x80, 0);
+    EXPECT_FALSE(ppu.take_nmi());
+    cpu.cycles = vblank;
+    EXPECT_EQ(ppu.read(0x2002) & 0x80, 0x80);
+    EXPECT_EQ(ppu.scanline(), PPU_VBLANK_SCANLINE);
+    EXPECT_EQ(cpu.interrupt_lines, NMI_LINE);
+    EXPECT_TRUE(ppu.take_nmi());
+    EXPECT_FALSE(ppu.take_nmi());
+    // Reading the status cleared the flag.
+    EXPECT_EQ(ppu.read(0x2002) & 0x80, 0);
+
+    run_frame(cpu, ppu);
+    EXPECT_EQ(ppu.frame_count(), 2u);
+    EXPECT_TRUE(ppu.take_nmi());
+    // One frame is 341 * 262 dots without rendering.
+    EXPECT_NEAR(ppu.next_vblank_cycle() - vblank,
+                2 * 341 * 262 / double(PPU_DOTS_PER_CPU_CYCLE), 1.0);
+}
+
+TEST(PpuTest, test_oam_dma) {
+    NesCpu cpu;
+    NesPpu ppu;
+    start(cpu, ppu, PpuMode::Scanline);
+    for (int i = 0; i < 256; i++) {
+        cpu.mem_write(0x0700 + i, i ^ 0x5A);
+    }
+    cpu.cycles = 1000;
+    ppu.write(0x2003, 0x04);
+    ppu.write(0x4014, 0x07);
+    EXPECT_EQ(cpu.cycles, 1000 + OAM_DMA_CYCLES);
+    cpu.cycles = 1001;
+    ppu.write(0x4014, 0x07);
+    EXPECT_EQ(cpu.cycles, 1001 + OAM_DMA_CYCLES + 1);
+
+    ppu.write(0x2003, 0x04);
+    EXPECT_EQ(ppu.read(0x2004), 0x00 ^ 0x5A);
+    ppu.write(0x2003, 0x03);
+    EXPECT_EQ(ppu.read(0x2004), 0xFF ^ 0x5A);
+}
+
+TEST(PpuTest, test_scanline_mode_matches_dot_mode) {
+    NesCpu scanline_cpu;
+    NesPpu scanline;
+    start(scanline_cpu, scanline, PpuMode::Scanline);
+    NesCpu dot_cpu;
+    NesPpu dot;
+    start(dot_cpu, dot, PpuMode::Dot);
+    build_scene(scanline_cpu, scanline);
+    build_scene(dot_cpu, dot);
+    // Rendering came on in the middle of this one.
+    run_frame(scanline_cpu, scanline);
+    run_frame(dot_cpu, dot);
+
+    for (int frame = 0; frame < 3; frame++) {
+        run_frame(scanline_cpu, scanline);
+        run_frame(dot_cpu, dot);
+        ASSERT_EQ(scanline.frame(), dot.frame()) << "frame " << frame;
+        std::set<uint8_t> colors(dot.frame().begin(), dot.frame().end());
+        EXPECT_GT(colors.size(), 16u);
+        EXPECT_EQ(scanline_cpu.cycles, dot_cpu.cycles);
+        EXPECT_EQ(scanline.read(0x2002) & 0xE0, 0xC0 | 0x20);
+        EXPECT_EQ(dot.read(0x2002) & 0xE0, 0xC0 | 0x20);
+        // Scroll a little further every frame.
+        for (NesPpu *ppu : {&scanline, &dot}) {
+            ppu->write(0x2005, 13 + frame * 31);
+            ppu->write(0x2005, 21 + frame * 17);
+        }
+    }
+
+    // Sprite 0 hits on the same CPU cycle in both modes.
+    uint64_t hit_cycle[2] = {0, 0};
+    NesCpu *cpus[2] = {&scanline_cpu, &dot_cpu};
+    NesPpu *ppus[2] = {&scanline, &dot};
+    for (int i = 0; i < 2; i++) {
+        RunLimits limits;
+        limits.max_instructions = 1;
+        while (ppus[i]->read(0x2002) & 0x40) {
+            cpus[i]->run_until(limits);
+        }
+        while (!(ppus[i]->read(0x2002) & 0x40)) {
+            cpus[i]->run_until(limits);
+        }
+        hit_cycle[i] = cpus[i]->cycles;
+    }
+    EXPECT_EQ(hit_cycle[0], hit_cycle[1]);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
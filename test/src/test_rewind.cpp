@@ -0,0 +1,136 @@
+#include "App/SnakeGame.hpp"
+#include "Core/NesCpu.hpp"
+#include "Core/Rewind.hpp"
+#include <gtest/gtest.h>
+#include <utility>
+#include <vector>
+
+const uint64_t FRAME_CYCLES = 2000;
+
+// Plays `frames` frames of snake, writing the keys of each frame before
+// capturing it. `probes` gets the cycle and state hash halfway through
+// every frame.
+static void play_snake(NesCpu &cpu, RewindBuffer &rewind, int frames,
+                       std::vector<std::pair<uint64_t, uint64_t>> *probes) {
+    uint32_t seed = 7;
+    for (int frame = 0; frame < frames; frame++) {
+        seed = seed * 1103515245 + 12345;
+        cpu.mem_write(0xfe, (seed >> 16) % 15 + 1);
+        cpu.mem_write(0xff, "wdsa"[(frame / 8) % 4]);
+        rewind.capture(cpu);
+
+        RunLimits limits;
+        limits.max_cycles = FRAME_CYCLES / 2;
+        if (cpu.run_until(limits).reason == StopReason::Break) {
+            return;
+        }
+        if (probes != nullptr) {
+            probes->push_back({cpu.cycles, cpu.state_hash()});
+        }
+        if (cpu.run_until(limits).reason == StopReason::Break) {
+            return;
+        }
+    }
+}
+
+static void start(NesCpu &cpu, CpuCore core) {
+    cpu.core = core;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load(SNAKE_GAME_CODE);
+    cpu.reset();
+}
+
+TEST(RewindTest, test_seek_matches_recording) {
+    for (CpuCore core : {CpuCore::Switch, CpuCore::Threaded, CpuCore::Cached,
+                         CpuCore::Jit}) {
+        NesCpu cpu;
+        start(cpu, core);
+        RewindBuffer rewind(REWIND_DEFAULT_CAPACITY, 8);
+        std::vector<std::pair<uint64_t, uint64_t>> probes;
+        play_snake(cpu, rewind, 100, &probes);
+        ASSERT_GT(probes.size(), 20u);
+
+        RewindStats stats = rewind.stats();
+        EXPECT_EQ(stats.keyframes, (stats.frames + 7) / 8);
+        // Jump around, backwards and forwards.
+        for (std::size_t i : {probes.size() - 1, std::size_t(0),
+                              probes.size() / 2, std::size_t(9),
+                              probes.size() - 3}) {
+            ASSERT_TRUE(rewind.seek(cpu, probes[i].first));
+            EXPECT_EQ(cpu.cycles, probes[i].first);
+            EXPECT_EQ(cpu.state_hash(), probes[i].second);
+        }
+    }
+}
+
+TEST(RewindTest, test_capacity_evicts_oldest) {
+    NesCpu cpu;
+    start(cpu, CpuCore::Switch);
+    RewindBuffer unbounded(REWIND_DEFAULT_CAPACITY, 8);
+    play_snake(cpu, unbounded, 100, nullptr);
+    RewindStats full = unbounded.stats();
+
+    NesCpu bounded;
+    start(bounded, CpuCore::Switch);
+    RewindBuffer rewind(full.bytes / 3, 8);
+    play_snake(bounded, rewind, 100, nullptr);
+    RewindStats stats = rewind.stats();
+    EXPECT_LE(stats.bytes, full.bytes / 3);
+    EXPECT_LT(stats.frames, full.frames);
+    EXPECT_EQ(stats.last_cycle, full.last_cycle);
+    EXPECT_GT(stats.first_cycle, full.first_cycle);
+    EXPECT_FALSE(rewind.seek(bounded, full.first_cycle));
+    EXPECT_TRUE(rewind.seek(bounded, stats.first_cycle));
+    EXPECT_EQ(bounded.cycles, stats.first_cycle);
+}
+
+TEST(RewindTest, test_capture_after_seek_drops_future) {
+    NesCpu cpu;
+    start(cpu, CpuCore::Switch);
+    RewindBuffer rewind(REWIND_DEFAULT_CAPACITY, 8);
+    play_snake(cpu, rewind, 40, nullptr);
+    RewindStats before = rewind.stats();
+
+    uint64_t target = (before.first_cycle + before.last_cycle) / 2;
+    ASSERT_TRUE(rewind.seek(cpu, target));
+    rewind.capture(cpu);
+    RewindStats after = rewind.stats();
+    EXPECT_LT(after.frames, before.frames);
+    EXPECT_EQ(after.last_cycle, cpu.cycles);
+
+    // The branch taken from here is recorded like the original one.
+    RunLimits limits;
+    limits.max_cycles = FRAME_CYCLES;
+    cpu.run_until(limits);
+    uint64_t cycle = cpu.cycles;
+    uint64_t hash = cpu.state_hash();
+    rewind.capture(cpu);
+    ASSERT_TRUE(rewind.seek(cpu, after.last_cycle));
+    ASSERT_TRUE(rewind.seek(cpu, cycle));
+    EXPECT_EQ(cpu.state_hash(), hash);
+}
+
+TEST(RewindTest, test_seek_keeps_interrupt_lines) {
+    NesCpu cpu;
+    start(cpu, CpuCore::Switch);
+    RewindBuffer rewind(REWIND_DEFAULT_CAPACITY, 8);
+    // An IRQ held while the game has them masked.
+    cpu.set_irq(true);
+    uint64_t cycle = cpu.cycles;
+    uint64_t hash = cpu.state_hash();
+    rewind.capture(cpu);
+    EXPECT_EQ(rewind.frame(0).interrupt_lines, IRQ_LINE);
+
+    RunLimits limits;
+    limits.max_cycles = FRAME_CYCLES;
+    cpu.run_until(limits);
+    cpu.set_irq(false);
+    ASSERT_TRUE(rewind.seek(cpu, cycle));
+    EXPECT_EQ(cpu.interrupt_lines, IRQ_LINE);
+    EXPECT_EQ(cpu.state_hash(), hash);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
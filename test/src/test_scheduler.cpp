@@ -0,0 +1,141 @@
+#include "Core/Cartridge.hpp"
+#include "Core/Scheduler.hpp"
+#include "Core/System.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <vector>
+
+TEST(SchedulerTest, test_reschedule_and_cancel) {
+    EventScheduler events;
+    SystemEvent event;
+    EXPECT_EQ(events.next_cycle(), NO_EVENT);
+    EXPECT_FALSE(events.pop_due(UINT64_MAX - 1, event));
+
+    events.schedule(SystemEvent::PpuVblank, 500);
+    EXPECT_TRUE(events.pending(SystemEvent::PpuVblank));
+    EXPECT_EQ(events.next_cycle(), 500u);
+    // Scheduling again moves the one pending entry.
+    events.schedule(SystemEvent::PpuVblank, 200);
+    EXPECT_EQ(events.next_cycle(), 200u);
+    events.schedule(SystemEvent::PpuVblank, 900);
+    EXPECT_EQ(events.next_cycle(), 900u);
+
+    EXPECT_FALSE(events.pop_due(899, event));
+    EXPECT_TRUE(events.pop_due(900, event));
+    EXPECT_EQ(event, SystemEvent::PpuVblank);
+    EXPECT_FALSE(events.pending(SystemEvent::PpuVblank));
+    EXPECT_FALSE(events.pop_due(900, event));
+
+    events.schedule(SystemEvent::PpuVblank, 10);
+    events.cancel(SystemEvent::PpuVblank);
+    EXPECT_EQ(events.next_cycle(), NO_EVENT);
+}
+
+// LDA #$80; STA $2000; LDA #$1E; STA $2001;
+// loop: INX; STX $00; BIT $2002; BPL loop; STX $2005; STX $2005; JMP loop
+static const std::vector<uint8_t> POLL_VBLANK = {
+    0xa9, 0x80, 0x8d, 0x00, 0x20, 0xa9, 0x1e, 0x8d, 0x01, 0x20, 0xe8,
+    0x86, 0x00, 0x2c, 0x02, 0x20, 0x10, 0xf8, 0x8e, 0x05, 0x20, 0x8e,
+    0x05, 0x20, 0x4c, 0x0a, 0x06};
+
+// nmi: INC $20; RTI
+static void load_poll_vblank(NesSystem &system) {
+    system.load(POLL_VBLANK);
+    system.cpu.mem_write(0x0700, 0xe6);
+    system.cpu.mem_write(0x0701, 0x20);
+    system.cpu.mem_write(0x0702, 0x40);
+    system.cpu.mem_write_u16(NMI_VECTOR, 0x0700);
+}
+
+TEST(SchedulerTest, test_scheduled_frames_match_lockstep) {
+    NesSystem scheduled;
+    load_poll_vblank(scheduled);
+    NesSystem lockstep;
+    load_poll_vblank(lockstep);
+
+    for (int frame = 0; frame < 5; frame++) {
+        RunResult fast = scheduled.run_frame();
+        RunResult slow = lockstep.run_frame_lockstep();
+        EXPECT_EQ(fast.instructions, slow.instructions);
+        EXPECT_EQ(fast.cycles, slow.cycles);
+        EXPECT_EQ(scheduled.cpu.state_hash(), lockstep.cpu.state_hash());
+        EXPECT_EQ(scheduled.ppu.frame(), lockstep.ppu.frame());
+    }
+    EXPECT_EQ(scheduled.ppu.frame_count(), 5u);
+    // Both took the NMIs of the first four vblanks; the fifth is pending.
+    EXPECT_EQ(scheduled.cpu.mem_read(0x20), 4);
+    EXPECT_EQ(lockstep.cpu.mem_read(0x20), 4);
+    // The APU frame IRQ is raised too, but I stays set from reset.
+    EXPECT_EQ(scheduled.cpu.interrupt_lines, NMI_LINE | IRQ_LINE);
+    EXPECT_EQ(lockstep.cpu.interrupt_lines, NMI_LINE | IRQ_LINE);
+    // The program saw every vblank through $2002 and scrolled.
+    EXPECT_GT(scheduled.cpu.register_x, 0);
+}
+
+TEST(SchedulerTest, test_run_bounds_the_whole_run) {
+    NesSystem system;
+    load_poll_vblank(system);
+    RunLimits limits;
+    limits.max_instructions = 20000;
+    RunResult run = system.run(limits);
+    EXPECT_EQ(run.reason, StopReason::InstructionLimit);
+    EXPECT_EQ(run.instructions, 20000u);
+
+    // Spans several vblanks, which the scheduler stops for and handles.
+    uint64_t frames = system.ppu.frame_count();
+    limits = RunLimits();
+    limits.max_cycles = 100000;
+    run = system.run(limits);
+    EXPECT_EQ(run.reason, StopReason::CycleLimit);
+    EXPECT_GE(run.cycles, 100000u);
+    EXPECT_LT(run.cycles, 100000u + 8);
+    EXPECT_EQ(system.ppu.frame_count(), frames + 3);
+}
+
+// An NROM cartridge: reset enables the vblank NMI with LDA #$80; STA $2000
+// and spins on JMP; the NMI handler at $8100 is INC $10; RTI.
+static std::vector<uint8_t> make_nmi_cartridge() {
+    std::vector<uint8_t> image = {'N', 'E', 'S', 0x1a, 1, 1, 0, 0};
+    image.resize(INES_HEADER_SIZE, 0);
+    std::vector<uint8_t> prg(PRG_ROM_BANK_SIZE, 0xea);
+    const uint8_t reset[] = {0xa9, 0x80, 0x8d, 0x00, 0x20, 0x4c, 0x05, 0x80};
+    std::copy(std::begin(reset), std::end(reset), prg.begin());
+    const uint8_t nmi[] = {0xe6, 0x10, 0x40};
+    std::copy(std::begin(nmi), std::end(nmi), prg.begin() + 0x100);
+    prg[0x3ffa] = 0x00;
+    prg[0x3ffb] = 0x81;
+    prg[0x3ffc] = 0x00;
+    prg[0x3ffd] = 0x80;
+    image.insert(image.end(), prg.begin(), prg.end());
+    image.resize(image.size() + CHR_ROM_BANK_SIZE, 0);
+    return image;
+}
+
+TEST(SchedulerTest, test_cartridge_takes_vblank_nmis) {
+    Cartridge cartridge(make_nmi_cartridge());
+    NesSystem system;
+    system.insert_cartridge(cartridge);
+    EXPECT_EQ(system.cpu.break_mode, BreakMode::Interrupt);
+    // The program never reads a PPU register after enabling NMIs, so only
+    // the scheduled vblank events can raise them.
+    for (int frame = 0; frame < 10; frame++) {
+        system.run_frame();
+    }
+    EXPECT_EQ(system.ppu.frame_count(), 10u);
+    EXPECT_EQ(system.cpu.mem_read(0x10), 9);
+
+    // Batches bounded by cycles alone, as the headless runner runs them.
+    RunLimits limits;
+    limits.max_cycles = 1000;
+    for (int batch = 0; batch < 10 * 30; batch++) {
+        system.run(limits);
+    }
+    EXPECT_GE(system.cpu.mem_read(0x10), 18);
+    EXPECT_LE(system.cpu.mem_read(0x10), 20);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+#include "Core/NesCpu.hpp"
+#include "Core/Snapshot.hpp"
+#include <gtest/gtest.h>
+
+// loop: INX; STX $10; TXA; STA $0300,X; JMP loop
+static const std::vector<uint8_t> STORE_LOOP = {
+    0xe8, 0x86, 0x10, 0x8a, 0x9d, 0x00, 0x03, 0x4c, 0x00, 0x06};
+
+static void run_instructions(NesCpu &cpu, uint64_t count) {
+    RunLimits limits;
+    limits.max_instructions = count;
+    cpu.run_until(limits);
+}
+
+TEST(SnapshotTest, test_restore_rewinds_registers_and_memory) {
+    NesCpu cpu;
+    cpu.load(STORE_LOOP);
+    cpu.program_counter = 0x0600;
+    run_instructions(cpu, 40);
+    CpuSnapshot snapshot = cpu.snapshot();
+    uint8_t x = cpu.register_x;
+    uint64_t cycles = cpu.cycles;
+
+    for (int i = 0; i < 3; i++) {
+        run_instructions(cpu, 400);
+        EXPECT_NE(cpu.register_x, x);
+        cpu.restore(snapshot);
+        EXPECT_EQ(cpu.register_x, x);
+        EXPECT_EQ(cpu.cycles, cycles);
+        EXPECT_EQ(cpu.program_counter, snapshot.program_counter);
+        EXPECT_EQ(cpu.mem_read(0x10), x);
+        EXPECT_EQ(cpu.mem_read(0x0300 + x), x);
+        EXPECT_EQ(cpu.mem_read(0x0300 + x + 1), 0x00);
+    }
+}
+
+TEST(SnapshotTest, test_snapshots_share_clean_pages) {
+    NesCpu cpu;
+    cpu.mem_write(0x0200, 0x01);
+    CpuSnapshot first = cpu.snapshot();
+    cpu.mem_write(0x0200, 0x02);
+    CpuSnapshot second = cpu.snapshot();
+
+    EXPECT_NE(first.pages[0x02], second.pages[0x02]);
+    EXPECT_EQ(first.pages[0x03], second.pages[0x03]);
+    EXPECT_EQ((*first.pages[0x02])[0], 0x01);
+    EXPECT_EQ((*second.pages[0x02])[0], 0x02);
+
+    // Restoring the older snapshot brings back the page that differs even
+    // though it was not written since the last snapshot.
+    cpu.restore(first);
+    EXPECT_EQ(cpu.mem_read(0x0200), 0x01);
+}
+
+TEST(SnapshotTest, test_restore_covers_mirrors) {
+    NesCpu cpu;
+    cpu.bus.map_memory(0x00, 0x20, 0x800);
+    CpuSnapshot snapshot = cpu.snapshot();
+    cpu.mem_write(0x0042, 0x99);
+    EXPECT_TRUE(cpu.bus.page_dirty(0x18));
+    cpu.restore(snapshot);
+    EXPECT_EQ(cpu.mem_read(0x1842), 0x00);
+}
+
+TEST(SnapshotTest, test_save_state_round_trip) {
+    NesCpu cpu;
+    cpu.load(STORE_LOOP);
+    cpu.program_counter = 0x0600;
+    run_instructions(cpu, 25);
+    std::vector<uint8_t> state = cpu.save_state();
+    // Only the non-zero pages ($00, $03, $06, $FF) carry bytes.
+    EXPECT_EQ(state.size(), 22 + BUS_PAGE_COUNT + 4 * BUS_PAGE_SIZE);
+
+    NesCpu other;
+    other.load_state(state);
+    EXPECT_EQ(other.register_x, cpu.register_x);
+    EXPECT_EQ(other.program_counter, cpu.program_counter);
+    EXPECT_EQ(other.cycles, cpu.cycles);
+    EXPECT_EQ(other.bus.memory, cpu.bus.memory);
+}
+
+TEST(SnapshotTest, test_keeps_interrupt_lines) {
+    // A latched NMI and a held IRQ are state like the registers.
+    NesCpu cpu;
+    cpu.nmi();
+    cpu.set_irq(true);
+    CpuSnapshot snapshot = cpu.snapshot();
+    std::vector<uint8_t> state = cpu.save_state();
+    uint64_t hash = cpu.state_hash();
+
+    cpu.interrupt_lines = 0;
+    EXPECT_NE(cpu.state_hash(), hash);
+    cpu.restore(snapshot);
+    EXPECT_EQ(cpu.interrupt_lines, NMI_LINE | IRQ_LINE);
+    EXPECT_EQ(cpu.state_hash(), hash);
+
+    NesCpu other;
+    other.load_state(state);
+    EXPECT_EQ(other.interrupt_lines, NMI_LINE | IRQ_LINE);
+    EXPECT_EQ(other.state_hash(), hash);
+}
+
+TEST(SnapshotTest, test_rejects_bad_states) {
+    NesCpu cpu;
+    std::vector<uint8_t> state = cpu.save_state();
+
+    std::vector<uint8_t> truncated(state.begin(), state.end() - 1);
+    EXPECT_THROW(cpu.load_state(truncated), std::runtime_error);
+
+    std::vector<uint8_t> future = state;
+    future[4] = SNAPSHOT_VERSION + 1;
+    EXPECT_THROW(cpu.load_state(future), std::runtime_error);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,72 @@
+#include "App/SnakeGame.hpp"
+#include "Core/NesCpu.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+TEST(StateHashTest, test_matches_full_hash_on_every_core) {
+    for (CpuCore core : {CpuCore::Switch, CpuCore::Threaded, CpuCore::Cached,
+                         CpuCore::Jit}) {
+        NesCpu cpu;
+        cpu.core = core;
+        cpu.jit.hot_runs = 1;
+        cpu.break_mode = BreakMode::Exit;
+        cpu.load(SNAKE_GAME_CODE);
+        cpu.reset();
+        RunLimits limits;
+        limits.max_instructions = 500;
+        uint32_t seed = 11;
+        for (int round = 0; round < 100; round++) {
+            seed = seed * 1103515245 + 12345;
+            cpu.mem_write(0xfe, (seed >> 16) % 15 + 1);
+            cpu.mem_write(0xff, "wdsa"[(round / 8) % 4]);
+            cpu.run_until(limits);
+            ASSERT_EQ(cpu.state_hash(), cpu.full_state_hash()) << round;
+        }
+    }
+}
+
+TEST(StateHashTest, test_follows_mirrors_rom_and_restore) {
+    NesCpu cpu;
+    cpu.bus.map_memory(0x00, 0x20, 0x800);
+    std::vector<uint8_t> rom(0x4000, 0x5a);
+    cpu.bus.map_rom(0x80, 0x80, rom.data(), rom.size());
+    EXPECT_EQ(cpu.state_hash(), cpu.full_state_hash());
+
+    CpuSnapshot before = cpu.snapshot();
+    uint64_t hash = cpu.state_hash();
+    cpu.mem_write(0x0812, 0x34);
+    cpu.mem_write(0x8000, 0x01);
+    EXPECT_EQ(cpu.bus.memory[0x1812], 0x34);
+    EXPECT_NE(cpu.state_hash(), hash);
+    EXPECT_EQ(cpu.state_hash(), cpu.full_state_hash());
+
+    cpu.restore(before);
+    EXPECT_EQ(cpu.state_hash(), hash);
+
+    cpu.bus.unmap(0x80, 0x80);
+    EXPECT_EQ(cpu.state_hash(), cpu.full_state_hash());
+
+    cpu.bus.memory[0x0300] = 0x77;
+    cpu.invalidate_blocks();
+    EXPECT_EQ(cpu.state_hash(), cpu.full_state_hash());
+}
+
+TEST(StateHashTest, test_write_and_undo) {
+    NesCpu cpu;
+    uint64_t hash = cpu.state_hash();
+    cpu.mem_write(0x1234, 0x01);
+    EXPECT_NE(cpu.state_hash(), hash);
+    cpu.mem_write(0x1234, 0x00);
+    EXPECT_EQ(cpu.state_hash(), hash);
+    // The same byte at another address is a different image.
+    cpu.mem_write(0x1235, 0x01);
+    uint64_t other = cpu.state_hash();
+    cpu.mem_write(0x1235, 0x00);
+    cpu.mem_write(0x1234, 0x01);
+    EXPECT_NE(cpu.state_hash(), other);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
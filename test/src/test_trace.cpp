@@ -0,0 +1,65 @@
+#include "Core/NesCpu.hpp"
+#include "Core/Trace.hpp"
+#include <gtest/gtest.h>
+#include <sstream>
+
+static TraceRecord make_record(uint16_t pc, uint8_t opcode, uint8_t lo,
+                               uint8_t hi) {
+    TraceRecord record = {};
+    record.cycle = 7;
+    record.program_counter = pc;
+    record.opcode = opcode;
+    record.operand[0] = lo;
+    record.operand[1] = hi;
+    record.status = 0x24;
+    record.stack_pointer = 0xfd;
+    return record;
+}
+
+TEST(TraceTest, test_format_matches_nestest_layout) {
+    EXPECT_EQ(format_trace_record(make_record(0xc000, 0x4c, 0xf5, 0xc5)),
+              "C000  4C F5 C5  JMP $C5F5                       "
+              "A:00 X:00 Y:00 P:24 SP:FD CYC:7");
+    EXPECT_EQ(format_trace_record(make_record(0xc72d, 0xb0, 0x04, 0x00)),
+              "C72D  B0 04     BCS $C733                       "
+              "A:00 X:00 Y:00 P:24 SP:FD CYC:7");
+    EXPECT_EQ(format_trace_record(make_record(0xc5f5, 0xa2, 0x00, 0x86)),
+              "C5F5  A2 00     LDX #$00                        "
+              "A:00 X:00 Y:00 P:24 SP:FD CYC:7");
+}
+
+TEST(TraceTest, test_ring_buffer_keeps_newest_records) {
+    TraceBuffer buffer(3);
+    EXPECT_EQ(buffer.capacity(), 4);
+
+    for (uint16_t pc = 0; pc < 6; pc++) {
+        buffer.record(make_record(pc, 0xea, 0, 0));
+    }
+    ASSERT_EQ(buffer.size(), 4);
+    EXPECT_EQ(buffer.at(0).program_counter, 2);
+    EXPECT_EQ(buffer.at(3).program_counter, 5);
+
+    std::ostringstream out;
+    buffer.dump(out);
+    EXPECT_EQ(out.str().find("0002  EA        NOP"), 0);
+}
+
+#ifdef EIZNESS_TRACE
+TEST(TraceTest, test_cpu_records_executed_instructions) {
+    TraceBuffer buffer(16);
+    NesCpu cpu;
+    cpu.tracer = &buffer;
+    cpu.break_mode = BreakMode::Exit;
+    cpu.load_and_run({0xa9, 0x05, 0xaa, 0x00});
+
+    ASSERT_EQ(buffer.size(), 3);
+    EXPECT_EQ(buffer.at(0).opcode, 0xa9);
+    EXPECT_EQ(buffer.at(1).register_a, 0x05);
+    EXPECT_EQ(buffer.at(2).register_x, 0x05);
+}
+#endif
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+#include "Core/InputQueue.hpp"
+#include "Core/TripleBuffer.hpp"
+#include <gtest/gtest.h>
+#include <thread>
+
+TEST(TripleBufferTest, test_acquire_takes_latest_frame) {
+    TripleBuffer frames(4);
+    EXPECT_FALSE(frames.acquire());
+    frames.back()[0] = 1;
+    frames.publish();
+    frames.back()[0] = 2;
+    frames.publish();
+    // Frame 1 was never taken and is skipped.
+    EXPECT_TRUE(frames.acquire());
+    EXPECT_EQ(frames.front()[0], 2);
+    EXPECT_FALSE(frames.acquire());
+    EXPECT_EQ(frames.front()[0], 2);
+    // The producer never gets the consumer's buffer back.
+    EXPECT_NE(frames.back(), frames.front());
+}
+
+TEST(TripleBufferTest, test_frames_arrive_whole_and_in_order) {
+    const int total = 20000;
+    TripleBuffer frames(1024);
+    std::thread producer([&frames, total]() {
+        for (int n = 1; n <= total; n++) {
+            uint8_t *frame = frames.back();
+            for (std::size_t i = 0; i < frames.frame_size(); i++) {
+                frame[i] = static_cast<uint8_t>(n);
+            }
+            frames.back()[0] = static_cast<uint8_t>(n >> 8);
+            frames.publish();
+        }
+    });
+    int last = 0;
+    bool whole = true;
+    bool ordered = true;
+    while (last < total) {
+        if (!frames.acquire()) {
+            std::this_thread::yield();
+            continue;
+        }
+        const uint8_t *frame = frames.front();
+        int n = frame[0] << 8 | frame[1];
+        for (std::size_t i = 1; i < frames.frame_size(); i++) {
+            whole &= frame[i] == static_cast<uint8_t>(n);
+        }
+        ordered &= n > last;
+        last = n;
+    }
+    producer.join();
+    EXPECT_TRUE(whole);
+    EXPECT_TRUE(ordered);
+}
+
+TEST(TripleBufferTest, test_input_queue_keeps_order_and_drops_when_full) {
+    InputQueue keys;
+    uint8_t key;
+    EXPECT_FALSE(keys.pop(key));
+    for (std::size_t i = 0; i < InputQueue::CAPACITY; i++) {
+        EXPECT_TRUE(keys.push(static_cast<uint8_t>(i)));
+    }
+    EXPECT_FALSE(keys.push(0xFF));
+    for (std::size_t i = 0; i < InputQueue::CAPACITY; i++) {
+        ASSERT_TRUE(keys.pop(key));
+        EXPECT_EQ(key, static_cast<uint8_t>(i));
+    }
+    EXPECT_FALSE(keys.pop(key));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}